@@ -1,10 +1,58 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <dirent.h>
+#include <termios.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define PPMS_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#include <stdatomic.h>
+
+#ifdef PPMS_TRACE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 #define INITIAL_TX_CAPACITY 50
 #define PUMP_COUNT 6
+#define MAX_PUMPS 32
 
 #define PRICE_PETROL 102.50
 #define PRICE_DIESEL 88.75
@@ -16,6 +64,11 @@
 
 #define LOW_STOCK_THRESHOLD 5000.0
 
+#define STATION_NAME "ABC Fuel Station"
+#define STATION_ADDRESS "123 Main Road"
+#define TAX_RATE 0.18
+#define LOYALTY_POINTS_PER_100 1
+
 typedef enum { FUEL_PETROL = 0, FUEL_DIESEL = 1, FUEL_CNG = 2 } FuelType;
 typedef enum { PUMP_ACTIVE = 0, PUMP_INACTIVE = 1, PUMP_MAINT = 2 } PumpStatus;
 typedef enum { VEH_2W = 0, VEH_4W = 1, VEH_COMM = 2 } VehicleType;
@@ -23,7 +76,6 @@ typedef enum { PAY_CASH = 0, PAY_CARD = 1, PAY_WALLET = 2 } PaymentMode;
 
 typedef struct {
     FuelType type;
-    double price;
     double opening_stock;
     double current_stock;
     double closing_stock;
@@ -31,32 +83,116 @@ typedef struct {
 
 typedef struct {
     int pump_id;
-    FuelType fuel_type;
     PumpStatus status;
     double transactions_count;
     double total_quantity;
     double total_amount;
 } Pump;
 
+typedef enum {
+    SALE_OK = 0,
+    SALE_ERR_PUMP = 1,
+    SALE_ERR_PUMP_STATUS = 2,
+    SALE_ERR_VEHICLE = 3,
+    SALE_ERR_QUANTITY = 4,
+    SALE_ERR_PAYMENT = 5,
+    SALE_ERR_STOCK = 6,
+    SALE_PENDING_AUTH = 7,
+    SALE_ERR_AUTH_BUSY = 8,
+    SALE_OFFLINE_APPROVED = 9,
+    SALE_ERR_OFFLINE_LIMIT = 10,
+    SALE_ERR_OVERLOAD = 11
+} SaleStatus;
+
+typedef enum { ADMIT_DISPENSE = 0, ADMIT_NEW_AUTH = 1, ADMIT_CLASSES = 2 } AdmissionClass;
+
+typedef enum {
+    ADMIT_OK = 0,
+    ADMIT_REJECT_QUEUE_FULL = 1,
+    ADMIT_REJECT_SHED = 2,
+    ADMIT_REJECT_EXPIRED = 3,
+    ADMIT_REJECT_STOPPED = 4
+} AdmissionResult;
+
+typedef struct {
+    int pump_id;
+    VehicleType vehicle_type;
+    int by_amount;
+    double value;
+    PaymentMode payment_mode;
+    time_t timestamp;
+    uint64_t vehicle_hash;      /* identity_hash() of the registration number, 0 if not given */
+    uint64_t customer_hash;     /* identity_hash() of the card/wallet token, 0 if not given */
+} SaleRequest;
+
 typedef struct {
     char txn_id[32];
     time_t timestamp;
     int pump_id;
     FuelType fuel_type;
     VehicleType vehicle_type;
+    unsigned char settle_state; /* SettleState once put in a settlement batch, else 0 */
     double quantity;
     double amount;
     PaymentMode payment_mode;
+    int processor_id;
+    unsigned int auth_code;
+    uint64_t vehicle_hash;
+    uint64_t customer_hash;
 } Transaction;
 
 Fuel fuels[3];
 
-Pump pumps[PUMP_COUNT];
+/*
+ * Pump slots are append-only: a pump id keeps its slot (status and running
+ * totals) for the life of the process even if a later configuration drops it.
+ * Which pumps exist, and what fuel they dispense, comes from StationConfig.
+ */
+Pump pumps[MAX_PUMPS];
+static atomic_int pump_slots = 0;
+static pthread_mutex_t pump_slot_lock = PTHREAD_MUTEX_INITIALIZER;
 
 Transaction *transactions = NULL;
 size_t tx_capacity = 0;
 size_t tx_count = 0;
 
+/* One bit per TX_SEGMENT_RECORDS slice of transactions[] written since the last backup. */
+#define TX_SEGMENT_RECORDS 4096
+static uint64_t *tx_dirty = NULL;
+static size_t tx_dirty_words = 0;
+static int tx_dirty_overflow = 0;
+
+/* Block index for ad-hoc queries: time and amount range of each TX_SEGMENT_RECORDS slice. */
+typedef struct {
+    time_t min_time;
+    time_t max_time;
+    double min_amount;
+    double max_amount;
+} TxZone;
+
+static TxZone *tx_zones = NULL;
+static size_t tx_zone_cap = 0;
+static int tx_zone_overflow = 0;
+
+/* Growth history of the transaction store, kept by ensure_tx_capacity() under station_lock. */
+#define TX_GROWTH_HISTORY 16
+
+typedef struct {
+    time_t when;
+    size_t from_capacity;
+    size_t to_capacity;
+    size_t bytes_moved;
+    double ms;
+} TxGrowthEvent;
+
+static struct {
+    unsigned long growths;
+    unsigned long moves;
+    unsigned long long bytes_moved;
+    double total_ms;
+    TxGrowthEvent recent[TX_GROWTH_HISTORY];
+} tx_growth;
+
 double fuel_wise_quantity[3] = {0.0, 0.0, 0.0};
 double fuel_wise_amount[3] = {0.0, 0.0, 0.0};
 
@@ -65,8 +201,501 @@ double payment_mode_amount[3] = {0.0, 0.0, 0.0};
 double hour_quantity[24] = {0};
 double hour_amount[24] = {0};
 
+/*
+ * Per-pump, per-minute-of-day totals: one contiguous row of MINUTES_PER_DAY
+ * cells per pump slot, integer units so a cell stays 16 bytes. The matrix
+ * holds a single day, pump_minutes_date (YYYYMMDD); the first sale of a later
+ * day clears it and sales of earlier days are left out.
+ */
+#define MINUTES_PER_DAY 1440
+
+typedef struct {
+    uint32_t sales;
+    uint32_t centiunits;        /* quantity x 100 (litres or kg) */
+    uint64_t paise;
+} MinuteCell;
+
+static MinuteCell pump_minutes[MAX_PUMPS * MINUTES_PER_DAY];
+static int32_t pump_minutes_date;
+
+/*
+ * Distinct vehicles and card holders are counted with HyperLogLog sketches of
+ * identity hashes: 2^HLL_PRECISION one-byte registers, about 1.6% standard
+ * error, and any two sketches merge by taking the register-wise maximum.
+ * Registration numbers and payment tokens themselves are never stored.
+ */
+#define HLL_PRECISION 12
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+typedef struct {
+    uint8_t reg[HLL_REGISTERS];
+} HyperLogLog;
+
+/* Unkeyed 64-bit hash of a string, for spreading values rather than hiding them. */
+static uint64_t name_hash(const char *s) {
+    uint64_t h = 1469598103934665603ull;
+    for (; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+/*
+ * Identity hashes are SipHash-2-4 under a per-station secret key, so a stored
+ * hash cannot be confirmed against a guessed registration number or token
+ * without the key. The key lives in identity_key_path (0600) and is created
+ * from /dev/urandom on first start; stations whose sketches are merged in
+ * menu 29 must share it.
+ */
+#define IDENTITY_KEY_FILE "identity.key"
+
+static uint64_t identity_key[2];
+static char identity_key_path[256] = IDENTITY_KEY_FILE;
+
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND(v0, v1, v2, v3) do { \
+        v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+        v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+    } while (0)
+
+/* Keyed 64-bit hash of an identifier, ignoring case, spaces and punctuation; 0 for an empty one. */
+uint64_t identity_hash(const char *s) {
+    uint64_t v0 = identity_key[0] ^ 0x736f6d6570736575ull;
+    uint64_t v1 = identity_key[1] ^ 0x646f72616e646f6dull;
+    uint64_t v2 = identity_key[0] ^ 0x6c7967656e657261ull;
+    uint64_t v3 = identity_key[1] ^ 0x7465646279746573ull;
+    uint64_t m = 0;
+    size_t len = 0;
+    for (; *s; ++s) {
+        if (!isalnum((unsigned char)*s)) continue;
+        m |= (uint64_t)(unsigned char)toupper((unsigned char)*s) << (8 * (len & 7));
+        if ((++len & 7) == 0) {
+            v3 ^= m;
+            SIP_ROUND(v0, v1, v2, v3);
+            SIP_ROUND(v0, v1, v2, v3);
+            v0 ^= m;
+            m = 0;
+        }
+    }
+    if (len == 0) return 0;
+    m |= (uint64_t)len << 56;
+    v3 ^= m;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i) SIP_ROUND(v0, v1, v2, v3);
+    uint64_t h = v0 ^ v1 ^ v2 ^ v3;
+    return h ? h : 1;
+}
+
+/* Loads the identity key, creating it on first start; returns -1 if it can be neither read nor made. */
+int identity_key_load(void) {
+    struct stat sb;
+    if (stat(identity_key_path, &sb) == 0) {
+        int fd = open(identity_key_path, O_RDONLY);
+        int ok = fd >= 0 && read(fd, identity_key, sizeof(identity_key)) == (ssize_t)sizeof(identity_key);
+        if (fd >= 0) close(fd);
+        if (ok) return 0;
+        fprintf(stderr, "Cannot read identity key %s.\n", identity_key_path);
+        return -1;
+    }
+    int rnd = open("/dev/urandom", O_RDONLY);
+    int ok = rnd >= 0 && read(rnd, identity_key, sizeof(identity_key)) == (ssize_t)sizeof(identity_key);
+    if (rnd >= 0) close(rnd);
+    char tmp[270];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", identity_key_path);
+    int fd = ok ? open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600) : -1;
+    ok = fd >= 0 && write(fd, identity_key, sizeof(identity_key)) == (ssize_t)sizeof(identity_key) && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    if (ok && rename(tmp, identity_key_path) == 0) {
+        printf("Created identity key %s; keep it with the station's data and back it up.\n", identity_key_path);
+        return 0;
+    }
+    if (fd >= 0) unlink(tmp);
+    fprintf(stderr, "Cannot create identity key %s.\n", identity_key_path);
+    return -1;
+}
+
+static void hll_add(HyperLogLog *h, uint64_t hash) {
+    uint32_t idx = (uint32_t)(hash >> (64 - HLL_PRECISION));
+    /* The sentinel bit caps the rank at 64 - HLL_PRECISION + 1. */
+    uint64_t rest = (hash << HLL_PRECISION) | (1ull << (HLL_PRECISION - 1));
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+    if (rank > h->reg[idx]) h->reg[idx] = rank;
+}
+
+/*
+ * Daily rollups: the report aggregates broken down per local calendar day.
+ * The most recent ROLLUP_LIVE_DAYS days are kept in memory (and in
+ * checkpoints); older days live only in the rollup directory, one file per
+ * day, so comparison reports never touch the transaction store.
+ */
+#define ROLLUP_LIVE_DAYS 16
+
+/*
+ * Each day also keeps a uniform random sample of its sales (Algorithm R
+ * reservoir, SAMPLE_PER_DAY rows), so approximate queries over long ranges
+ * read a thousand rows per day instead of the sales themselves. Days are the
+ * strata: the rollup holds each day's exact sale count.
+ */
+#define SAMPLE_PER_DAY 1024
+
+typedef struct {
+    uint32_t paise;
+    uint32_t milliunits;        /* quantity x 1000 */
+    uint16_t minute;            /* local minute of the day */
+    uint16_t pump_id;
+    uint8_t fuel_type;
+    uint8_t vehicle_type;
+    uint8_t payment_mode;
+    uint8_t reserved;
+} SampleRow;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t date;               /* YYYYMMDD, local time */
+    uint64_t sales;
+    double fuel_quantity[3];
+    double fuel_amount[3];
+    uint64_t fuel_sales[3];
+    double payment_amount[3];
+    uint64_t payment_sales[3];
+    double hour_quantity[24];
+    double hour_amount[24];
+    int32_t pump_count;
+    int32_t pump_id[MAX_PUMPS];
+    double pump_quantity[MAX_PUMPS];
+    double pump_amount[MAX_PUMPS];
+    uint64_t pump_sales[MAX_PUMPS];
+    HyperLogLog vehicles;
+    HyperLogLog customers;
+    SampleRow sample[SAMPLE_PER_DAY];   /* first min(sales, SAMPLE_PER_DAY) rows are used */
+    uint32_t reserved;
+    uint32_t crc;               /* CRC32C of everything above */
+} DayRollup;
+
+typedef struct {
+    unsigned long seq;
+    DayRollup day;
+} ClosedDay;
+
+static struct {
+    DayRollup live[ROLLUP_LIVE_DAYS];   /* guarded by station_lock */
+    uint8_t dirty[ROLLUP_LIVE_DAYS];
+    int count;
+    int hot;                    /* index of the day the last sale landed in */
+    int32_t closed_through;     /* newest day ever moved out of live[] */
+    ClosedDay *closed;          /* days moved out of live[] and not yet written */
+    size_t closed_count;
+    size_t closed_cap;
+    unsigned long closed_seq;
+    int journaled;              /* state comes from a journal, so files are not merged into new days */
+    int read_only;              /* replay and batch modes neither write nor merge rollup files */
+    int archive_load;           /* an archive holds whole days, so its days replace their files */
+    char dir[256];
+    unsigned long written;
+    unsigned long write_failures;
+} rollups = { .dir = "rollups" };
+
 static unsigned long txn_sequence = 0;
 
+/* Per-second sale counts for sliding-window rates, ring-indexed by wall-clock second. */
+#define RATE_WINDOW_SECS 300
+
+static struct {
+    time_t sec[RATE_WINDOW_SECS];
+    unsigned long count[RATE_WINDOW_SECS];
+    double amount[RATE_WINDOW_SECS];
+} sale_rate;   /* guarded by station_lock */
+
+pthread_mutex_t station_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define PROCESSOR_NONE 0
+#define PROCESSOR_CARD 1
+#define PROCESSOR_WALLET 2
+#define PROCESSOR_COUNT 3
+
+static const char *processor_names[PROCESSOR_COUNT] = { "None", "CardNet Acquirer", "UPI Wallet Switch" };
+
+/*
+ * Sale-path latency instrumentation. Built only with -DPPMS_PROFILE; otherwise
+ * the PROF_* macros expand to nothing and none of the code below is compiled.
+ * Each stage records into a log-linear histogram (16 linear sub-buckets per
+ * power of two, ~6% relative error) whose counters are updated with relaxed
+ * atomics, so recording never takes a lock.
+ */
+#ifdef PPMS_PROFILE
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef enum {
+    PROF_VALIDATE = 0,
+    PROF_STOCK_CHECK,
+    PROF_TXN_ID,
+    PROF_RECORD,
+    PROF_RECEIPT,
+    PROF_ALERTS,
+    PROF_SALE_TOTAL,
+    PROF_STAGE_COUNT
+} ProfStage;
+
+typedef struct {
+    _Atomic uint64_t counts[HIST_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} LatencyHistogram;
+
+static LatencyHistogram prof_hist[PROF_STAGE_COUNT];
+
+static const char *prof_stage_names[PROF_STAGE_COUNT] = {
+    "validation", "stock check", "txn id", "record", "receipt", "alerts", "sale total"
+};
+
+static uint64_t prof_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int hist_bucket_index(uint64_t v) {
+    if (v < HIST_SUB_COUNT) return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int sub = (int)((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + sub;
+}
+
+static uint64_t hist_bucket_upper(int idx) {
+    if (idx < HIST_SUB_COUNT) return (uint64_t)idx;
+    int magnitude = idx / HIST_SUB_COUNT;
+    int sub = idx % HIST_SUB_COUNT;
+    int shift = magnitude - 1;
+    uint64_t low = (uint64_t)(HIST_SUB_COUNT + sub) << shift;
+    return low + (((uint64_t)1 << shift) - 1);
+}
+
+static void hist_record(LatencyHistogram *h, uint64_t v) {
+    atomic_fetch_add_explicit(&h->counts[hist_bucket_index(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+    uint64_t cur = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (v > cur && !atomic_compare_exchange_weak_explicit(&h->max, &cur, v,
+                                                             memory_order_relaxed,
+                                                             memory_order_relaxed)) {
+    }
+}
+
+static uint64_t hist_percentile(LatencyHistogram *h, uint64_t total, double pct) {
+    uint64_t rank = (uint64_t)(pct / 100.0 * (double)total + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        seen += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t upper = hist_bucket_upper(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+/* Formatting helpers below avoid stdio so the dump can run inside a signal handler. */
+static size_t prof_put_str(char *buf, size_t pos, size_t cap, const char *s) {
+    while (*s && pos + 1 < cap) buf[pos++] = *s++;
+    return pos;
+}
+
+static size_t prof_put_u64(char *buf, size_t pos, size_t cap, uint64_t v, int width) {
+    char tmp[24];
+    int n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v > 0);
+    while (width-- > n && pos + 1 < cap) buf[pos++] = ' ';
+    while (n > 0 && pos + 1 < cap) buf[pos++] = tmp[--n];
+    return pos;
+}
+
+static void prof_dump_fd(int fd) {
+    char line[256];
+    size_t n = 0;
+    n = prof_put_str(line, n, sizeof(line), "\n----- Sale Latency (ns) -----\n");
+    n = prof_put_str(line, n, sizeof(line), "stage               count        mean         p50         p90         p99       p99.9         max\n");
+    if (write(fd, line, n) < 0) return;
+    for (int s = 0; s < PROF_STAGE_COUNT; ++s) {
+        LatencyHistogram *h = &prof_hist[s];
+        uint64_t total = atomic_load_explicit(&h->total, memory_order_relaxed);
+        uint64_t sum = atomic_load_explicit(&h->sum, memory_order_relaxed);
+        n = 0;
+        n = prof_put_str(line, n, sizeof(line), prof_stage_names[s]);
+        while (n < 14) line[n++] = ' ';
+        n = prof_put_u64(line, n, sizeof(line), total, 11);
+        n = prof_put_u64(line, n, sizeof(line), total ? sum / total : 0, 12);
+        n = prof_put_u64(line, n, sizeof(line), total ? hist_percentile(h, total, 50.0) : 0, 12);
+        n = prof_put_u64(line, n, sizeof(line), total ? hist_percentile(h, total, 90.0) : 0, 12);
+        n = prof_put_u64(line, n, sizeof(line), total ? hist_percentile(h, total, 99.0) : 0, 12);
+        n = prof_put_u64(line, n, sizeof(line), total ? hist_percentile(h, total, 99.9) : 0, 12);
+        n = prof_put_u64(line, n, sizeof(line), atomic_load_explicit(&h->max, memory_order_relaxed), 12);
+        n = prof_put_str(line, n, sizeof(line), "\n");
+        if (write(fd, line, n) < 0) return;
+    }
+}
+
+static void prof_signal_handler(int sig) {
+    (void)sig;
+    prof_dump_fd(STDERR_FILENO);
+}
+
+#define PROF_START(var) uint64_t var = prof_now_ns()
+#define PROF_STOP(stage, var) hist_record(&prof_hist[(stage)], prof_now_ns() - (var))
+
+#else
+
+#define PROF_START(var) ((void)0)
+#define PROF_STOP(stage, var) ((void)0)
+
+#endif
+
+/*
+ * Timeline tracing in Chrome trace-event format. Built only with -DPPMS_TRACE.
+ * Every thread appends begin/end events stamped with the raw cycle counter
+ * into its own buffer; buffers are converted to microseconds and written as
+ * JSON only when a dump is requested.
+ */
+#ifdef PPMS_TRACE
+
+#define TRACE_BUFFER_EVENTS 65536
+#define TRACE_MAX_THREADS 64
+#define TRACE_OUTPUT_FILE "ppms_trace.json"
+
+typedef struct {
+    const char *name;
+    uint64_t ticks;
+    char phase;
+} TraceEvent;
+
+typedef struct {
+    int tid;
+    size_t count;
+    size_t dropped;
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+} TraceBuffer;
+
+static TraceBuffer *trace_buffers[TRACE_MAX_THREADS];
+static int trace_thread_count = 0;
+static pthread_mutex_t trace_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local TraceBuffer *trace_local = NULL;
+static uint64_t trace_base_ticks = 0;
+static uint64_t trace_base_ns = 0;
+
+static uint64_t trace_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return trace_clock_ns();
+#endif
+}
+
+static void trace_init(void) {
+    trace_base_ns = trace_clock_ns();
+    trace_base_ticks = trace_ticks();
+}
+
+static TraceBuffer *trace_thread_buffer(void) {
+    if (trace_local) return trace_local;
+    TraceBuffer *buf = (TraceBuffer*) calloc(1, sizeof(TraceBuffer));
+    if (!buf) return NULL;
+    pthread_mutex_lock(&trace_registry_lock);
+    if (trace_thread_count < TRACE_MAX_THREADS) {
+        buf->tid = trace_thread_count + 1;
+        trace_buffers[trace_thread_count++] = buf;
+    } else {
+        free(buf);
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&trace_registry_lock);
+    trace_local = buf;
+    return buf;
+}
+
+static inline void trace_event(const char *name, char phase) {
+    TraceBuffer *buf = trace_local ? trace_local : trace_thread_buffer();
+    if (!buf) return;
+    if (buf->count == TRACE_BUFFER_EVENTS) { buf->dropped++; return; }
+    TraceEvent *ev = &buf->events[buf->count];
+    ev->name = name;
+    ev->phase = phase;
+    ev->ticks = trace_ticks();
+    buf->count++;
+}
+
+static int trace_dump(const char *path) {
+    uint64_t end_ns = trace_clock_ns();
+    uint64_t end_ticks = trace_ticks();
+    double elapsed_us = (double)(end_ns - trace_base_ns) / 1000.0;
+    double ticks_per_us = elapsed_us > 0.0 ? (double)(end_ticks - trace_base_ticks) / elapsed_us : 1.0;
+    if (ticks_per_us <= 0.0) ticks_per_us = 1.0;
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    fprintf(fp, "{\"traceEvents\":[\n");
+    int first = 1;
+    size_t total = 0, dropped = 0;
+    pthread_mutex_lock(&trace_registry_lock);
+    for (int t = 0; t < trace_thread_count; ++t) {
+        TraceBuffer *buf = trace_buffers[t];
+        for (size_t i = 0; i < buf->count; ++i) {
+            const TraceEvent *ev = &buf->events[i];
+            fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"ppms\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                    first ? "" : ",\n", ev->name, ev->phase,
+                    (double)(ev->ticks - trace_base_ticks) / ticks_per_us, buf->tid);
+            first = 0;
+        }
+        total += buf->count;
+        dropped += buf->dropped;
+    }
+    pthread_mutex_unlock(&trace_registry_lock);
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"events\":%zu,\"dropped\":%zu}}\n",
+            total, dropped);
+    fclose(fp);
+    return 0;
+}
+
+#define TRACE_BEGIN(name) trace_event((name), 'B')
+#define TRACE_END(name) trace_event((name), 'E')
+
+#else
+
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+
+#endif
+
+static double elapsed_seconds(const struct timespec *a, const struct timespec *b) {
+    return (double)(b->tv_sec - a->tv_sec) + (double)(b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
 const char* fuel_name(FuelType f) {
     switch (f) {
         case FUEL_PETROL: return "Petrol";
@@ -91,6 +720,14 @@ const char* vehicle_name(VehicleType v) {
     }
 }
 
+int payment_processor_for(PaymentMode p) {
+    switch (p) {
+        case PAY_CARD: return PROCESSOR_CARD;
+        case PAY_WALLET: return PROCESSOR_WALLET;
+        default: return PROCESSOR_NONE;
+    }
+}
+
 const char* payment_name(PaymentMode p) {
     switch (p) {
         case PAY_CASH: return "Cash";
@@ -100,7 +737,8 @@ const char* payment_name(PaymentMode p) {
 }
 
 void format_time_local(time_t t, char *buf, size_t bufsz) {
-    struct tm *lt = localtime(&t);
+    struct tm tm;
+    struct tm *lt = localtime_r(&t, &tm);
     if (lt != NULL) {
         strftime(buf, bufsz, "%Y-%m-%d %H:%M:%S", lt);
     } else {
@@ -108,9 +746,9 @@ void format_time_local(time_t t, char *buf, size_t bufsz) {
     }
 }
 
-void generate_txn_id(char *out, size_t outsz) {
-    time_t now = time(NULL);
-    struct tm *lt = localtime(&now);
+void generate_txn_id(time_t now, char *out, size_t outsz) {
+    struct tm tm;
+    struct tm *lt = localtime_r(&now, &tm);
     txn_sequence++;
     if (lt != NULL) {
         snprintf(out, outsz, "TXN%04u%02d%02d%02d%05lu",
@@ -124,35 +762,130 @@ void generate_txn_id(char *out, size_t outsz) {
     }
 }
 
+/* Keeps txn_sequence past the suffix of an id loaded from elsewhere so live ids cannot repeat it. */
+void txn_sequence_cover(const char *txn_id) {
+    if (strncmp(txn_id, "TXN", 3) != 0 || strlen(txn_id) <= 13) return;
+    unsigned long seq = strtoul(txn_id + 13, NULL, 10);
+    if (seq > txn_sequence) txn_sequence = seq;
+}
+
+/*
+ * Live station configuration. Prices, the low-stock threshold and the pump
+ * list (id -> fuel) live in an immutable StationConfig published through an
+ * atomic pointer. Readers bracket their use with config_acquire/release,
+ * which only bumps a per-epoch reader counter; a reload builds and validates
+ * a new config off to the side, swaps the pointer, flips the epoch and frees
+ * the old config once the readers of the previous epoch have drained. Sales
+ * already pricing against the old config finish on it and nothing waits on
+ * station_lock for a reload.
+ */
+typedef struct {
+    int pump_id;
+    FuelType fuel;
+    int slot;
+} PumpConfig;
+
+typedef struct {
+    unsigned long version;
+    double low_stock_threshold;
+    double price[3];
+    int pump_count;
+    PumpConfig pumps[MAX_PUMPS];
+} StationConfig;
+
+static _Atomic(StationConfig*) station_config = NULL;
+static atomic_uint config_epoch = 0;
+static atomic_uint config_readers[2];
+
+const StationConfig *config_acquire(unsigned *ticket) {
+    for (;;) {
+        unsigned epoch = atomic_load(&config_epoch);
+        atomic_fetch_add(&config_readers[epoch & 1], 1);
+        if (atomic_load(&config_epoch) == epoch) {
+            *ticket = epoch & 1;
+            return atomic_load(&station_config);
+        }
+        atomic_fetch_sub(&config_readers[epoch & 1], 1);
+    }
+}
+
+void config_release(unsigned ticket) {
+    atomic_fetch_sub(&config_readers[ticket], 1);
+}
+
+const PumpConfig *config_pump(const StationConfig *cfg, int pump_id) {
+    for (int i = 0; i < cfg->pump_count; ++i)
+        if (cfg->pumps[i].pump_id == pump_id) return &cfg->pumps[i];
+    return NULL;
+}
+
+int pump_index_by_id(int pump_id) {
+    int n = atomic_load_explicit(&pump_slots, memory_order_acquire);
+    for (int i = 0; i < n; ++i)
+        if (pumps[i].pump_id == pump_id) return i;
+    return -1;
+}
+
+/* Returns the slot for pump_id, claiming a fresh one if it has none yet; -1 when all slots are used. */
+int pump_slot_bind(int pump_id) {
+    pthread_mutex_lock(&pump_slot_lock);
+    int idx = pump_index_by_id(pump_id);
+    int n = atomic_load_explicit(&pump_slots, memory_order_relaxed);
+    if (idx < 0 && n < MAX_PUMPS) {
+        memset(&pumps[n], 0, sizeof(pumps[n]));
+        pumps[n].pump_id = pump_id;
+        pumps[n].status = PUMP_ACTIVE;
+        atomic_store_explicit(&pump_slots, n + 1, memory_order_release);
+        idx = n;
+    }
+    pthread_mutex_unlock(&pump_slot_lock);
+    return idx;
+}
+
+/* Points every configured pump at its slot; fails only if the slot table is full. */
+int config_bind_slots(StationConfig *cfg) {
+    for (int i = 0; i < cfg->pump_count; ++i) {
+        cfg->pumps[i].slot = pump_slot_bind(cfg->pumps[i].pump_id);
+        if (cfg->pumps[i].slot < 0) return -1;
+    }
+    return 0;
+}
+
 void initialize_system() {
     fuels[FUEL_PETROL].type = FUEL_PETROL;
-    fuels[FUEL_PETROL].price = PRICE_PETROL;
     fuels[FUEL_PETROL].opening_stock = OPEN_PETROL;
     fuels[FUEL_PETROL].current_stock = OPEN_PETROL;
     fuels[FUEL_PETROL].closing_stock = OPEN_PETROL;
 
     fuels[FUEL_DIESEL].type = FUEL_DIESEL;
-    fuels[FUEL_DIESEL].price = PRICE_DIESEL;
     fuels[FUEL_DIESEL].opening_stock = OPEN_DIESEL;
     fuels[FUEL_DIESEL].current_stock = OPEN_DIESEL;
     fuels[FUEL_DIESEL].closing_stock = OPEN_DIESEL;
 
     fuels[FUEL_CNG].type = FUEL_CNG;
-    fuels[FUEL_CNG].price = PRICE_CNG;
     fuels[FUEL_CNG].opening_stock = OPEN_CNG;
     fuels[FUEL_CNG].current_stock = OPEN_CNG;
     fuels[FUEL_CNG].closing_stock = OPEN_CNG;
 
+    StationConfig *cfg = (StationConfig*) calloc(1, sizeof(StationConfig));
+    if (!cfg) {
+        fprintf(stderr, "Failed to allocate station configuration.\n");
+        exit(EXIT_FAILURE);
+    }
+    cfg->version = 1;
+    cfg->low_stock_threshold = LOW_STOCK_THRESHOLD;
+    cfg->price[FUEL_PETROL] = PRICE_PETROL;
+    cfg->price[FUEL_DIESEL] = PRICE_DIESEL;
+    cfg->price[FUEL_CNG] = PRICE_CNG;
+    cfg->pump_count = PUMP_COUNT;
     for (int i = 0; i < PUMP_COUNT; ++i) {
-        pumps[i].pump_id = i + 1;
-        pumps[i].transactions_count = 0;
-        pumps[i].total_quantity = 0.0;
-        pumps[i].total_amount = 0.0;
-        pumps[i].status = PUMP_ACTIVE;
-        if (i < 2) pumps[i].fuel_type = FUEL_PETROL;
-        else if (i < 4) pumps[i].fuel_type = FUEL_DIESEL;
-        else pumps[i].fuel_type = FUEL_CNG;
+        cfg->pumps[i].pump_id = i + 1;
+        if (i < 2) cfg->pumps[i].fuel = FUEL_PETROL;
+        else if (i < 4) cfg->pumps[i].fuel = FUEL_DIESEL;
+        else cfg->pumps[i].fuel = FUEL_CNG;
     }
+    config_bind_slots(cfg);
+    atomic_store(&station_config, cfg);
 
     tx_capacity = INITIAL_TX_CAPACITY;
     transactions = (Transaction*) calloc(tx_capacity, sizeof(Transaction));
@@ -162,15 +895,31 @@ void initialize_system() {
     }
 }
 
+void notices_flush(FILE *out);
+
 void shutdown_system() {
+    notices_flush(stdout);
     if (transactions) free(transactions);
     transactions = NULL;
     tx_capacity = 0;
     tx_count = 0;
+    free(tx_dirty);
+    tx_dirty = NULL;
+    tx_dirty_words = 0;
+    free(tx_zones);
+    tx_zones = NULL;
+    tx_zone_cap = 0;
+    free(rollups.closed);
+    rollups.closed = NULL;
+    rollups.closed_count = rollups.closed_cap = 0;
+    free(atomic_exchange(&station_config, NULL));
 }
 
 void ensure_tx_capacity() {
     if (tx_count < tx_capacity) return;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Transaction *old_block = transactions;
     size_t new_capacity = tx_capacity * 2;
     Transaction *new_block = (Transaction*) realloc(transactions, new_capacity * sizeof(Transaction));
     if (!new_block) {
@@ -184,126 +933,3734 @@ void ensure_tx_capacity() {
         }
     }
     memset(new_block + tx_capacity, 0, (new_capacity - tx_capacity) * sizeof(Transaction));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* A moved block may have been remapped rather than copied; bytes_moved is the upper bound. */
+    TxGrowthEvent *ev = &tx_growth.recent[tx_growth.growths % TX_GROWTH_HISTORY];
+    ev->when = time(NULL);
+    ev->from_capacity = tx_capacity;
+    ev->to_capacity = new_capacity;
+    ev->bytes_moved = new_block != old_block ? tx_count * sizeof(Transaction) : 0;
+    ev->ms = (double)(end.tv_sec - start.tv_sec) * 1e3 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+    tx_growth.growths++;
+    if (ev->bytes_moved) tx_growth.moves++;
+    tx_growth.bytes_moved += ev->bytes_moved;
+    tx_growth.total_ms += ev->ms;
+
     transactions = new_block;
     tx_capacity = new_capacity;
 }
 
-int pump_index_by_id(int pump_id) {
-    for (int i = 0; i < PUMP_COUNT; ++i)
-        if (pumps[i].pump_id == pump_id) return i;
-    return -1;
+void mark_tx_dirty(size_t index) {
+    size_t seg = index / TX_SEGMENT_RECORDS;
+    if (seg / 64 >= tx_dirty_words) {
+        size_t words = tx_dirty_words ? tx_dirty_words : 16;
+        while (seg / 64 >= words) words *= 2;
+        uint64_t *grown = (uint64_t*) realloc(tx_dirty, words * sizeof(uint64_t));
+        if (!grown) {
+            tx_dirty_overflow = 1;
+            return;
+        }
+        memset(grown + tx_dirty_words, 0, (words - tx_dirty_words) * sizeof(uint64_t));
+        tx_dirty = grown;
+        tx_dirty_words = words;
+    }
+    tx_dirty[seg / 64] |= 1ull << (seg % 64);
 }
 
-void check_low_stock_alerts() {
-    for (int i = 0; i < 3; ++i) {
-        if (fuels[i].current_stock < LOW_STOCK_THRESHOLD) {
-            printf("WARNING: Low stock for %s: %.2f units left (threshold %.2f)\n",
-                   fuel_name(fuels[i].type), fuels[i].current_stock, LOW_STOCK_THRESHOLD);
+/* Widens the zone of transactions[index]; caller holds station_lock. */
+void note_tx_zone(size_t index) {
+    size_t zone = index / TX_SEGMENT_RECORDS;
+    if (zone >= tx_zone_cap) {
+        size_t cap = tx_zone_cap ? tx_zone_cap : 64;
+        while (zone >= cap) cap *= 2;
+        TxZone *grown = (TxZone*) realloc(tx_zones, cap * sizeof(TxZone));
+        if (!grown) {
+            tx_zone_overflow = 1;
+            return;
         }
+        tx_zones = grown;
+        tx_zone_cap = cap;
+    }
+    const Transaction *t = &transactions[index];
+    TxZone *z = &tx_zones[zone];
+    if (index % TX_SEGMENT_RECORDS == 0) {
+        z->min_time = z->max_time = t->timestamp;
+        z->min_amount = z->max_amount = t->amount;
+        return;
     }
+    if (t->timestamp < z->min_time) z->min_time = t->timestamp;
+    if (t->timestamp > z->max_time) z->max_time = t->timestamp;
+    if (t->amount < z->min_amount) z->min_amount = t->amount;
+    if (t->amount > z->max_amount) z->max_amount = t->amount;
 }
 
-void print_receipt(const Transaction *t) {
-    char timestr[64];
-    format_time_local(t->timestamp, timestr, sizeof(timestr));
-    printf("\n------------------- FUEL RECEIPT -------------------\n");
-    printf("Transaction ID : %s\n", t->txn_id);
-    printf("Date & Time    : %s\n", timestr);
-    printf("Pump ID        : %d\n", t->pump_id);
-    printf("Fuel Type      : %s\n", fuel_name(t->fuel_type));
-    printf("Vehicle Type   : %s\n", vehicle_name(t->vehicle_type));
-    printf("Quantity       : %.3f %s\n", t->quantity, (t->fuel_type == FUEL_CNG ? "kg" : "liters"));
-    printf("Amount (INR)   : %.2f\n", t->amount);
-    printf("Payment Mode   : %s\n", payment_name(t->payment_mode));
-    printf("----------------------------------------------------\n\n");
+/*
+ * Notices from background threads (payment outcomes, timers, reloads). They
+ * are queued instead of printed, so they never land in the middle of a prompt;
+ * the menu loop prints them before showing the menu, and on shutdown whatever
+ * is left is printed. The live dashboard shows the latest one on its event
+ * line and leaves the queue for the menu. When more than NOTICE_SLOTS pile up
+ * the oldest go.
+ */
+#define NOTICE_SLOTS 64
+#define NOTICE_BYTES 192
+
+static struct {
+    pthread_mutex_t lock;
+    unsigned long posted;
+    unsigned long shown;
+    char text[NOTICE_SLOTS][NOTICE_BYTES];
+} notices = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void notice(const char *fmt, ...) {
+    char buf[NOTICE_BYTES];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    pthread_mutex_lock(&notices.lock);
+    memcpy(notices.text[notices.posted % NOTICE_SLOTS], buf, sizeof(buf));
+    notices.posted++;
+    pthread_mutex_unlock(&notices.lock);
 }
 
-void record_transaction(const Transaction *tx) {
-    ensure_tx_capacity();
-    transactions[tx_count] = *tx;
-    tx_count++;
+/* Copies the most recent notice into buf; returns 0 if none was ever posted. */
+int notice_latest(char *buf, size_t cap) {
+    pthread_mutex_lock(&notices.lock);
+    int have = notices.posted > 0;
+    if (have) snprintf(buf, cap, "%s", notices.text[(notices.posted - 1) % NOTICE_SLOTS]);
+    pthread_mutex_unlock(&notices.lock);
+    return have;
+}
 
-    int pidx = pump_index_by_id(tx->pump_id);
-    if (pidx >= 0) {
-        pumps[pidx].transactions_count += 1;
-        pumps[pidx].total_quantity += tx->quantity;
-        pumps[pidx].total_amount += tx->amount;
+void notices_flush(FILE *out) {
+    pthread_mutex_lock(&notices.lock);
+    if (notices.posted - notices.shown > NOTICE_SLOTS) {
+        fprintf(out, "(%lu earlier notices dropped)\n", notices.posted - notices.shown - NOTICE_SLOTS);
+        notices.shown = notices.posted - NOTICE_SLOTS;
     }
+    for (; notices.shown < notices.posted; notices.shown++)
+        fprintf(out, "%s\n", notices.text[notices.shown % NOTICE_SLOTS]);
+    pthread_mutex_unlock(&notices.lock);
+    fflush(out);
+}
 
-    fuel_wise_quantity[tx->fuel_type] += tx->quantity;
-    fuel_wise_amount[tx->fuel_type] += tx->amount;
+/*
+ * Hierarchical timing wheel driving every time-based event (day rollover,
+ * shift ends, scheduled price revisions, payment reservation expiry, alert
+ * re-arming, periodic checkpoints). Four levels of 256 slots at 10 ms per
+ * tick cover 2^32 ticks (~497 days). A timer is filed in the level matching
+ * how far away it is and cascades one level down whenever the level below
+ * wraps, so arming and cancelling are O(1) and a tick touches one slot.
+ * Timers are embedded in their owner, so nothing is allocated per timer.
+ * Callbacks run on the timer thread without the wheel lock and may re-arm.
+ * Between callbacks the thread sleeps until the earliest pending expiry.
+ */
+#define TW_BITS 8
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4
+#define TW_TICK_MS 10
 
-    payment_mode_amount[tx->payment_mode] += tx->amount;
+typedef void (*TimerFn)(void *arg, unsigned long data);
 
-    struct tm *lt = localtime(&tx->timestamp);
-    if (lt != NULL) {
-        int hour = lt->tm_hour;
-        hour_quantity[hour] += tx->quantity;
-        hour_amount[hour] += tx->amount;
-    }
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer **pprev;       /* NULL when not pending */
+    uint64_t expires;           /* tick */
+    TimerFn fn;
+    void *arg;
+    unsigned long data;
+} Timer;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int running;
+    int stopping;
+    uint64_t now;               /* next tick to process */
+    uint64_t wake_at;           /* tick the sleeping thread wakes at; 0 while it runs */
+    struct timespec origin;
+    Timer *slots[TW_LEVELS][TW_SLOTS];
+    Timer *expired;
+    size_t pending;
+    unsigned long armed;
+    unsigned long fired;
+    unsigned long cancelled;
+    unsigned long cascaded;
+} timer_wheel = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static uint64_t timer_current_tick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t ms = (int64_t)(ts.tv_sec - timer_wheel.origin.tv_sec) * 1000 +
+                 (ts.tv_nsec - timer_wheel.origin.tv_nsec) / 1000000;
+    return ms > 0 ? (uint64_t)ms / TW_TICK_MS : 0;
 }
 
-void clear_input_buffer(void) {
-    int ch;
-    while ((ch = getchar()) != '\n' && ch != EOF) {
+static void timer_link(Timer **head, Timer *t) {
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+}
+
+static void timer_unlink(Timer *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/* Caller holds timer_wheel.lock. */
+static void timer_file(Timer *t) {
+    uint64_t now = timer_wheel.now;
+    if (t->expires <= now) {
+        timer_link(&timer_wheel.slots[0][now & TW_MASK], t);
+        return;
     }
+    uint64_t delta = t->expires - now;
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= (1ull << (TW_BITS * (level + 1)))) level++;
+    timer_link(&timer_wheel.slots[level][(t->expires >> (TW_BITS * level)) & TW_MASK], t);
 }
 
-void process_sale() {
-    int pump_id;
-    printf("\nAvailable Pumps:\n");
-    for (int i = 0; i < PUMP_COUNT; ++i) {
-        printf("Pump %d - %s (%s)\n",
-               pumps[i].pump_id,
-               fuel_name(pumps[i].fuel_type),
-               pump_status_name(pumps[i].status));
+/* Caller holds timer_wheel.lock. Moves the timers due at the current tick onto the expired list. */
+static void timer_advance(void) {
+    uint64_t now = timer_wheel.now;
+    if ((now & TW_MASK) == 0) {
+        for (int level = 1; level < TW_LEVELS; ++level) {
+            size_t idx = (now >> (TW_BITS * level)) & TW_MASK;
+            Timer *t = timer_wheel.slots[level][idx];
+            timer_wheel.slots[level][idx] = NULL;
+            while (t) {
+                Timer *next = t->next;
+                timer_file(t);
+                timer_wheel.cascaded++;
+                t = next;
+            }
+            if (idx != 0) break;
+        }
     }
-    printf("Enter Pump ID to use: ");
-    if (scanf("%d", &pump_id) != 1) {
-        clear_input_buffer();
-        printf("Invalid input.\n");
-        return;
+    Timer **slot = &timer_wheel.slots[0][now & TW_MASK];
+    while (*slot) {
+        Timer *t = *slot;
+        timer_unlink(t);
+        timer_link(&timer_wheel.expired, t);
     }
-    int pidx = pump_index_by_id(pump_id);
-    if (pidx < 0) { printf("Invalid pump id.\n"); clear_input_buffer(); return; }
-    if (pumps[pidx].status != PUMP_ACTIVE) { printf("Selected pump is not active.\n"); clear_input_buffer(); return; }
+    timer_wheel.now = now + 1;
+}
 
-    int vchoice;
-    printf("Select vehicle type: 0=2-Wheeler, 1=4-Wheeler, 2=Commercial: ");
-    if (scanf("%d", &vchoice) != 1 || vchoice < 0 || vchoice > 2) {
-        clear_input_buffer();
-        printf("Invalid.\n");
-        return;
+/* (Re)arms t to call fn(arg, data) after delay_ms; returns -1 if the timer thread is not running. */
+int timer_arm(Timer *t, uint64_t delay_ms, TimerFn fn, void *arg, unsigned long data) {
+    pthread_mutex_lock(&timer_wheel.lock);
+    if (!timer_wheel.running) {
+        pthread_mutex_unlock(&timer_wheel.lock);
+        return -1;
+    }
+    if (t->pprev) {
+        timer_unlink(t);
+        timer_wheel.pending--;
     }
+    uint64_t tick = timer_current_tick();
+    if (timer_wheel.pending == 0 && tick > timer_wheel.now) timer_wheel.now = tick;
+    uint64_t delay = (delay_ms + TW_TICK_MS - 1) / TW_TICK_MS;
+    if (delay > 0xFFFFFFFFull) delay = 0xFFFFFFFFull;
+    t->expires = tick + delay;
+    t->fn = fn;
+    t->arg = arg;
+    t->data = data;
+    timer_file(t);
+    timer_wheel.pending++;
+    if (t->expires < timer_wheel.wake_at) pthread_cond_signal(&timer_wheel.wake);
+    timer_wheel.armed++;
+    pthread_mutex_unlock(&timer_wheel.lock);
+    return 0;
+}
 
-    FuelType ftype = pumps[pidx].fuel_type;
-    double unit_price = fuels[ftype].price;
+/* Returns 1 if t was pending; a callback already running is not waited for. */
+int timer_cancel(Timer *t) {
+    pthread_mutex_lock(&timer_wheel.lock);
+    int was_pending = t->pprev != NULL;
+    if (was_pending) {
+        timer_unlink(t);
+        timer_wheel.pending--;
+        timer_wheel.cancelled++;
+    }
+    pthread_mutex_unlock(&timer_wheel.lock);
+    return was_pending;
+}
 
-    int mode;
-    printf("Enter input mode: 0=Quantity, 1=Amount: ");
-    if (scanf("%d", &mode) != 1 || (mode != 0 && mode != 1)) {
-        clear_input_buffer();
-        printf("Invalid.\n");
-        return;
+/*
+ * Caller holds timer_wheel.lock. Earliest tick at which the thread has work:
+ * the first occupied level-0 slot, or the next level-0 wrap when a coarser
+ * level has to cascade first.
+ */
+static uint64_t timer_next_tick(void) {
+    uint64_t now = timer_wheel.now;
+    for (uint64_t i = 0; i < TW_SLOTS; ++i) {
+        if (timer_wheel.slots[0][(now + i) & TW_MASK]) return now + i;
     }
+    return (now | TW_MASK) + 1;
+}
 
-    double qty = 0.0, amt = 0.0;
-    if (mode == 0) {
-        printf("Enter quantity to dispense (%s): ", (ftype == FUEL_CNG ? "kg" : "liters"));
-        if (scanf("%lf", &qty) != 1 || qty <= 0) {
-            clear_input_buffer();
-            printf("Invalid quantity.\n");
-            return;
+static void *timer_thread_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&timer_wheel.lock);
+    while (!timer_wheel.stopping) {
+        uint64_t tick = timer_current_tick();
+        while (timer_wheel.now <= tick) timer_advance();
+        while (timer_wheel.expired) {
+            Timer *t = timer_wheel.expired;
+            timer_unlink(t);
+            timer_wheel.pending--;
+            timer_wheel.fired++;
+            TimerFn fn = t->fn;
+            void *fn_arg = t->arg;
+            unsigned long data = t->data;
+            pthread_mutex_unlock(&timer_wheel.lock);
+            fn(fn_arg, data);
+            pthread_mutex_lock(&timer_wheel.lock);
         }
-        amt = qty * unit_price;
-    } else {
-        printf("Enter amount to spend (INR): ");
-        if (scanf("%lf", &amt) != 1 || amt <= 0) {
-            clear_input_buffer();
-            printf("Invalid amount.\n");
-            return;
+        if (timer_wheel.stopping) break;
+        if (timer_wheel.pending == 0) {
+            timer_wheel.wake_at = UINT64_MAX;
+            pthread_cond_wait(&timer_wheel.wake, &timer_wheel.lock);
+            timer_wheel.wake_at = 0;
+            continue;
         }
-        qty = amt / unit_price;
+        timer_wheel.wake_at = timer_next_tick();
+        uint64_t ticks = timer_wheel.wake_at - timer_current_tick();
+        if ((int64_t)ticks < 1) ticks = 1;
+        long wait_ms = (long)(ticks * TW_TICK_MS);
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += wait_ms / 1000;
+        until.tv_nsec += (wait_ms % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&timer_wheel.wake, &timer_wheel.lock, &until);
+        timer_wheel.wake_at = 0;
+    }
+    pthread_mutex_unlock(&timer_wheel.lock);
+    return NULL;
+}
+
+int timers_start() {
+    clock_gettime(CLOCK_MONOTONIC, &timer_wheel.origin);
+    timer_wheel.now = 0;
+    timer_wheel.stopping = 0;
+    if (pthread_create(&timer_wheel.thread, NULL, timer_thread_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start timer thread; scheduled events are disabled.\n");
+        return -1;
+    }
+    pthread_mutex_lock(&timer_wheel.lock);
+    timer_wheel.running = 1;
+    pthread_mutex_unlock(&timer_wheel.lock);
+    return 0;
+}
+
+/* Pending timers are dropped, not fired. */
+void timers_stop() {
+    pthread_mutex_lock(&timer_wheel.lock);
+    if (!timer_wheel.running) {
+        pthread_mutex_unlock(&timer_wheel.lock);
+        return;
+    }
+    timer_wheel.running = 0;
+    timer_wheel.stopping = 1;
+    pthread_cond_signal(&timer_wheel.wake);
+    pthread_mutex_unlock(&timer_wheel.lock);
+    pthread_join(timer_wheel.thread, NULL);
+}
+
+/*
+ * Low-stock alerts fire once per fuel and are re-armed by a timer after
+ * LOW_STOCK_REALERT_MS, or at once when the stock recovers. Without the timer
+ * thread every check alerts, as before.
+ */
+#define LOW_STOCK_REALERT_MS (15 * 60 * 1000)
+
+static atomic_int low_stock_alerted[3];
+static Timer low_stock_rearm[3];
+
+static void low_stock_rearm_fire(void *arg, unsigned long fuel) {
+    (void)arg;
+    atomic_store(&low_stock_alerted[fuel], 0);
+}
+
+void check_low_stock_alerts() {
+    unsigned ticket;
+    const StationConfig *cfg = config_acquire(&ticket);
+    for (int i = 0; i < 3; ++i) {
+        if (fuels[i].current_stock < cfg->low_stock_threshold) {
+            if (atomic_exchange(&low_stock_alerted[i], 1)) continue;
+            notice("WARNING: Low stock for %s: %.2f units left (threshold %.2f)",
+                   fuel_name(fuels[i].type), fuels[i].current_stock, cfg->low_stock_threshold);
+            if (timer_arm(&low_stock_rearm[i], LOW_STOCK_REALERT_MS, low_stock_rearm_fire, NULL, (unsigned long)i) != 0)
+                atomic_store(&low_stock_alerted[i], 0);
+        } else if (atomic_load(&low_stock_alerted[i])) {
+            timer_cancel(&low_stock_rearm[i]);
+            atomic_store(&low_stock_alerted[i], 0);
+        }
+    }
+    config_release(ticket);
+}
+
+/*
+ * Receipt spooler. The sale path only copies the transaction into a queue
+ * slot; a dedicated thread drains the queue in batches, renders them and
+ * writes them to the configured sink (stdout, a printer device or a text
+ * file with one page per receipt), retrying with backoff if the sink fails.
+ * At shutdown a batch the sink still refuses after RECEIPT_SHUTDOWN_TRIES
+ * attempts is appended to RECEIPT_FALLBACK_FILE instead of being dropped.
+ * If the spooler is not running, or its queue is full, the receipt is
+ * written inline.
+ */
+#define RECEIPT_MAX_BYTES 1024
+#define RECEIPT_QUEUE_SLOTS 256
+#define RECEIPT_BATCH_MAX 32
+#define RECEIPT_RETRY_MAX_MS 2000
+#define RECEIPT_SHUTDOWN_TRIES 5
+#define RECEIPT_FALLBACK_FILE "receipts.undelivered"
+
+typedef enum { RECEIPT_SINK_STDOUT = 0, RECEIPT_SINK_DEVICE = 1, RECEIPT_SINK_FILE = 2 } ReceiptSinkType;
+
+size_t render_receipt(const Transaction *t, char *buf, size_t cap);
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+    pthread_t thread;
+    int running;
+    int stopping;
+    ReceiptSinkType sink;
+    char path[256];
+    int fd;
+    size_t head;
+    size_t count;
+    unsigned long delivered;
+    unsigned long batches;
+    unsigned long retries;
+    unsigned long inline_writes;
+    unsigned long fallback_writes;
+    Timer retry_timer;
+    int retry_due;
+    Transaction slots[RECEIPT_QUEUE_SLOTS];
+} spooler = { .lock = PTHREAD_MUTEX_INITIALIZER, .nonempty = PTHREAD_COND_INITIALIZER, .fd = -1 };
+
+static int receipt_sink_write(const char *data, size_t len) {
+    if (spooler.sink == RECEIPT_SINK_STDOUT) {
+        size_t n = fwrite(data, 1, len, stdout);
+        fflush(stdout);
+        return n == len ? 0 : -1;
+    }
+    if (spooler.fd < 0) {
+        int flags = O_WRONLY | O_CREAT | (spooler.sink == RECEIPT_SINK_FILE ? O_APPEND : 0);
+        spooler.fd = open(spooler.path, flags, 0644);
+        if (spooler.fd < 0) return -1;
+    }
+    while (len > 0) {
+        ssize_t n = write(spooler.fd, data, len);
+        if (n <= 0) {
+            close(spooler.fd);
+            spooler.fd = -1;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Appends a batch the sink would not take to RECEIPT_FALLBACK_FILE. */
+static int receipt_fallback_write(const char *data, size_t len) {
+    int fd = open(RECEIPT_FALLBACK_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return -1;
+    int ok = 1;
+    while (ok && len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) ok = 0;
+        else data += n, len -= (size_t)n;
+    }
+    if (fsync(fd) != 0) ok = 0;
+    if (close(fd) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+static void receipt_retry_fire(void *arg, unsigned long data) {
+    (void)arg;
+    (void)data;
+    pthread_mutex_lock(&spooler.lock);
+    spooler.retry_due = 1;
+    pthread_cond_signal(&spooler.nonempty);
+    pthread_mutex_unlock(&spooler.lock);
+}
+
+/* Waits out one backoff step on the timer wheel, or sleeps if the timer thread is not running. */
+static void receipt_retry_wait(long backoff_ms) {
+    pthread_mutex_lock(&spooler.lock);
+    spooler.retry_due = 0;
+    if (timer_arm(&spooler.retry_timer, (uint64_t)backoff_ms, receipt_retry_fire, NULL, 0) == 0) {
+        while (!spooler.retry_due) pthread_cond_wait(&spooler.nonempty, &spooler.lock);
+        pthread_mutex_unlock(&spooler.lock);
+        return;
+    }
+    pthread_mutex_unlock(&spooler.lock);
+    struct timespec ts = { backoff_ms / 1000, (backoff_ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void *receipt_spooler_main(void *arg) {
+    (void)arg;
+    static char batch[RECEIPT_BATCH_MAX * (RECEIPT_MAX_BYTES + 2)];
+    static Transaction pending[RECEIPT_BATCH_MAX];
+    int sink_dead = 0;          /* shutdown already gave up on the sink once */
+    pthread_mutex_lock(&spooler.lock);
+    for (;;) {
+        while (spooler.count == 0 && !spooler.stopping)
+            pthread_cond_wait(&spooler.nonempty, &spooler.lock);
+        if (spooler.count == 0) break;
+
+        size_t n = spooler.count < RECEIPT_BATCH_MAX ? spooler.count : RECEIPT_BATCH_MAX;
+        for (size_t i = 0; i < n; ++i) pending[i] = spooler.slots[(spooler.head + i) % RECEIPT_QUEUE_SLOTS];
+        spooler.head = (spooler.head + n) % RECEIPT_QUEUE_SLOTS;
+        spooler.count -= n;
+        int stopping = spooler.stopping;
+        pthread_mutex_unlock(&spooler.lock);
+
+        size_t len = 0;
+        for (size_t i = 0; i < n; ++i) {
+            len += render_receipt(&pending[i], batch + len, RECEIPT_MAX_BYTES);
+            if (spooler.sink == RECEIPT_SINK_FILE) batch[len++] = '\f';
+        }
+        long backoff_ms = 50;
+        int tries = 1;
+        int ok = !sink_dead && receipt_sink_write(batch, len) == 0;
+        while (!ok && !sink_dead && (!stopping || tries < RECEIPT_SHUTDOWN_TRIES)) {
+            receipt_retry_wait(backoff_ms);
+            if (backoff_ms < RECEIPT_RETRY_MAX_MS) backoff_ms *= 2;
+            pthread_mutex_lock(&spooler.lock);
+            spooler.retries++;
+            stopping = spooler.stopping;
+            pthread_mutex_unlock(&spooler.lock);
+            ok = receipt_sink_write(batch, len) == 0;
+            if (stopping) tries++;
+        }
+        int saved = 0;
+        if (!ok) {
+            sink_dead = 1;
+            saved = receipt_fallback_write(batch, len) == 0;
+            if (saved) fprintf(stderr, "Receipt spooler: %s unavailable; %zu receipts saved to %s.\n",
+                               spooler.path, n, RECEIPT_FALLBACK_FILE);
+            else fprintf(stderr, "Receipt spooler: %zu receipts could not be delivered to %s or %s.\n",
+                         n, spooler.path, RECEIPT_FALLBACK_FILE);
+        }
+
+        pthread_mutex_lock(&spooler.lock);
+        if (ok) {
+            spooler.delivered += n;
+            spooler.batches++;
+        } else if (saved) {
+            spooler.fallback_writes += n;
+        }
+    }
+    pthread_mutex_unlock(&spooler.lock);
+    return NULL;
+}
+
+int receipt_spooler_start(ReceiptSinkType sink, const char *path) {
+    spooler.sink = sink;
+    spooler.fd = -1;
+    snprintf(spooler.path, sizeof(spooler.path), "%s", path ? path : "stdout");
+    spooler.stopping = 0;
+    if (pthread_create(&spooler.thread, NULL, receipt_spooler_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start receipt spooler; receipts will print inline.\n");
+        return -1;
+    }
+    spooler.running = 1;
+    return 0;
+}
+
+void receipt_spooler_stop() {
+    if (!spooler.running) return;
+    pthread_mutex_lock(&spooler.lock);
+    spooler.stopping = 1;
+    pthread_cond_signal(&spooler.nonempty);
+    pthread_mutex_unlock(&spooler.lock);
+    pthread_join(spooler.thread, NULL);
+    timer_cancel(&spooler.retry_timer);
+    spooler.running = 0;
+    if (spooler.fd >= 0) close(spooler.fd);
+    spooler.fd = -1;
+}
+
+/*
+ * Receipt templates. A template is plain text with {field} or {field:N}
+ * placeholders (N = decimal places, "{{" for a literal brace). It is compiled
+ * once into a flat list of literal spans and field ops; rendering a receipt
+ * then just walks the ops, copying spans and formatting numbers by hand, with
+ * no allocation and no format-string parsing.
+ */
+#define RECEIPT_TEMPLATE_MAX_BYTES 4096
+#define RECEIPT_TEMPLATE_MAX_OPS 128
+
+static const char *default_receipt_template =
+    "\n------------------- FUEL RECEIPT -------------------\n"
+    "{station}\n"
+    "{address}\n"
+    "Transaction ID : {txn_id}\n"
+    "Date & Time    : {datetime}\n"
+    "Pump ID        : {pump}\n"
+    "Fuel Type      : {fuel}\n"
+    "Vehicle Type   : {vehicle}\n"
+    "Quantity       : {quantity:3} {unit}\n"
+    "Rate (INR)     : {rate:2} per unit\n"
+    "Amount (INR)   : {amount:2}\n"
+    "Incl. Tax (INR): {tax:2}\n"
+    "Payment Mode   : {payment}\n"
+    "Loyalty Points : {loyalty}\n"
+    "Thank you!\n"
+    "----------------------------------------------------\n\n";
+
+typedef enum {
+    RF_LITERAL = 0,
+    RF_STATION,
+    RF_ADDRESS,
+    RF_TXN_ID,
+    RF_DATETIME,
+    RF_PUMP,
+    RF_FUEL,
+    RF_VEHICLE,
+    RF_QUANTITY,
+    RF_UNIT,
+    RF_RATE,
+    RF_AMOUNT,
+    RF_TAX,
+    RF_PAYMENT,
+    RF_LOYALTY
+} ReceiptField;
+
+static const struct { const char *name; ReceiptField field; int decimals; } receipt_fields[] = {
+    { "station", RF_STATION, 0 }, { "address", RF_ADDRESS, 0 }, { "txn_id", RF_TXN_ID, 0 },
+    { "datetime", RF_DATETIME, 0 }, { "pump", RF_PUMP, 0 }, { "fuel", RF_FUEL, 0 },
+    { "vehicle", RF_VEHICLE, 0 }, { "quantity", RF_QUANTITY, 3 }, { "unit", RF_UNIT, 0 },
+    { "rate", RF_RATE, 2 }, { "amount", RF_AMOUNT, 2 }, { "tax", RF_TAX, 2 },
+    { "payment", RF_PAYMENT, 0 }, { "loyalty", RF_LOYALTY, 0 }
+};
+
+typedef struct {
+    ReceiptField field;
+    int decimals;
+    unsigned offset;
+    unsigned len;
+} ReceiptOp;
+
+typedef struct {
+    char source[RECEIPT_TEMPLATE_MAX_BYTES];
+    char literals[RECEIPT_TEMPLATE_MAX_BYTES];
+    ReceiptOp ops[RECEIPT_TEMPLATE_MAX_OPS];
+    int op_count;
+} ReceiptTemplate;
+
+static ReceiptTemplate receipt_template;
+
+static int receipt_template_add_op(ReceiptTemplate *tpl, ReceiptField field, int decimals,
+                                   unsigned offset, unsigned len) {
+    if (field == RF_LITERAL && len == 0) return 0;
+    if (tpl->op_count == RECEIPT_TEMPLATE_MAX_OPS) return -1;
+    ReceiptOp *op = &tpl->ops[tpl->op_count++];
+    op->field = field;
+    op->decimals = decimals;
+    op->offset = offset;
+    op->len = len;
+    return 0;
+}
+
+int compile_receipt_template(const char *src, ReceiptTemplate *tpl) {
+    size_t srclen = strlen(src);
+    if (srclen >= RECEIPT_TEMPLATE_MAX_BYTES) {
+        fprintf(stderr, "Receipt template too long (max %d bytes).\n", RECEIPT_TEMPLATE_MAX_BYTES - 1);
+        return -1;
+    }
+    memcpy(tpl->source, src, srclen + 1);
+    tpl->op_count = 0;
+    unsigned lit_len = 0, lit_start = 0;
+    for (size_t i = 0; i < srclen; ++i) {
+        if (src[i] == '{' && src[i + 1] == '{') {
+            tpl->literals[lit_len++] = '{';
+            i++;
+            continue;
+        }
+        if (src[i] != '{') {
+            tpl->literals[lit_len++] = src[i];
+            continue;
+        }
+        const char *close_brace = strchr(src + i, '}');
+        if (!close_brace) {
+            fprintf(stderr, "Receipt template: unterminated placeholder at offset %zu.\n", i);
+            return -1;
+        }
+        char name[32];
+        size_t nlen = (size_t)(close_brace - (src + i + 1));
+        if (nlen == 0 || nlen >= sizeof(name)) {
+            fprintf(stderr, "Receipt template: bad placeholder at offset %zu.\n", i);
+            return -1;
+        }
+        memcpy(name, src + i + 1, nlen);
+        name[nlen] = '\0';
+        int decimals = -1;
+        char *colon = strchr(name, ':');
+        if (colon) {
+            *colon = '\0';
+            decimals = atoi(colon + 1);
+            if (decimals < 0 || decimals > 6) decimals = 2;
+        }
+        int found = -1;
+        for (size_t f = 0; f < sizeof(receipt_fields) / sizeof(receipt_fields[0]); ++f)
+            if (strcmp(receipt_fields[f].name, name) == 0) found = (int)f;
+        if (found < 0) {
+            fprintf(stderr, "Receipt template: unknown field {%s}.\n", name);
+            return -1;
+        }
+        if (receipt_template_add_op(tpl, RF_LITERAL, 0, lit_start, lit_len - lit_start) != 0 ||
+            receipt_template_add_op(tpl, receipt_fields[found].field,
+                                    decimals >= 0 ? decimals : receipt_fields[found].decimals, 0, 0) != 0) {
+            fprintf(stderr, "Receipt template has too many fields (max %d).\n", RECEIPT_TEMPLATE_MAX_OPS);
+            return -1;
+        }
+        lit_start = lit_len;
+        i += nlen + 1;
+    }
+    if (receipt_template_add_op(tpl, RF_LITERAL, 0, lit_start, lit_len - lit_start) != 0) {
+        fprintf(stderr, "Receipt template has too many fields (max %d).\n", RECEIPT_TEMPLATE_MAX_OPS);
+        return -1;
+    }
+    return 0;
+}
+
+int load_receipt_template(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open receipt template %s.\n", path);
+        return -1;
+    }
+    char src[RECEIPT_TEMPLATE_MAX_BYTES];
+    size_t n = fread(src, 1, sizeof(src) - 1, fp);
+    int truncated = !feof(fp);
+    fclose(fp);
+    if (truncated) {
+        fprintf(stderr, "Receipt template %s is too long.\n", path);
+        return -1;
+    }
+    src[n] = '\0';
+    return compile_receipt_template(src, &receipt_template);
+}
+
+static size_t rt_put(char *buf, size_t pos, size_t cap, const char *s, size_t len) {
+    if (pos + len >= cap) len = pos + 1 < cap ? cap - 1 - pos : 0;
+    memcpy(buf + pos, s, len);
+    return pos + len;
+}
+
+static size_t rt_put_uint(char *buf, size_t pos, size_t cap, unsigned long long v, int min_digits) {
+    char tmp[24];
+    int n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v > 0 || n < min_digits);
+    while (n > 0 && pos + 1 < cap) buf[pos++] = tmp[--n];
+    return pos;
+}
+
+static size_t rt_put_fixed(char *buf, size_t pos, size_t cap, double v, int decimals) {
+    static const double scale[] = { 1.0, 10.0, 100.0, 1000.0, 10000.0, 100000.0, 1000000.0 };
+    if (v < 0) {
+        if (pos + 1 < cap) buf[pos++] = '-';
+        v = -v;
+    }
+    unsigned long long scaled = (unsigned long long)(v * scale[decimals] + 0.5);
+    unsigned long long unit = (unsigned long long)scale[decimals];
+    pos = rt_put_uint(buf, pos, cap, scaled / unit, 1);
+    if (decimals > 0) {
+        if (pos + 1 < cap) buf[pos++] = '.';
+        pos = rt_put_uint(buf, pos, cap, scaled % unit, decimals);
+    }
+    return pos;
+}
+
+static size_t rt_put_str(char *buf, size_t pos, size_t cap, const char *s) {
+    return rt_put(buf, pos, cap, s, strlen(s));
+}
+
+size_t render_receipt(const Transaction *t, char *buf, size_t cap) {
+    const ReceiptTemplate *tpl = &receipt_template;
+    size_t pos = 0;
+    struct tm lt;
+    int have_tm = localtime_r(&t->timestamp, &lt) != NULL;
+    for (int i = 0; i < tpl->op_count; ++i) {
+        const ReceiptOp *op = &tpl->ops[i];
+        switch (op->field) {
+            case RF_LITERAL: pos = rt_put(buf, pos, cap, tpl->literals + op->offset, op->len); break;
+            case RF_STATION: pos = rt_put_str(buf, pos, cap, STATION_NAME); break;
+            case RF_ADDRESS: pos = rt_put_str(buf, pos, cap, STATION_ADDRESS); break;
+            case RF_TXN_ID: pos = rt_put_str(buf, pos, cap, t->txn_id); break;
+            case RF_DATETIME:
+                if (!have_tm) { pos = rt_put_str(buf, pos, cap, "unknown-time"); break; }
+                pos = rt_put_uint(buf, pos, cap, (unsigned)(lt.tm_year + 1900), 4);
+                pos = rt_put(buf, pos, cap, "-", 1);
+                pos = rt_put_uint(buf, pos, cap, (unsigned)(lt.tm_mon + 1), 2);
+                pos = rt_put(buf, pos, cap, "-", 1);
+                pos = rt_put_uint(buf, pos, cap, (unsigned)lt.tm_mday, 2);
+                pos = rt_put(buf, pos, cap, " ", 1);
+                pos = rt_put_uint(buf, pos, cap, (unsigned)lt.tm_hour, 2);
+                pos = rt_put(buf, pos, cap, ":", 1);
+                pos = rt_put_uint(buf, pos, cap, (unsigned)lt.tm_min, 2);
+                pos = rt_put(buf, pos, cap, ":", 1);
+                pos = rt_put_uint(buf, pos, cap, (unsigned)lt.tm_sec, 2);
+                break;
+            case RF_PUMP: pos = rt_put_uint(buf, pos, cap, (unsigned)t->pump_id, 1); break;
+            case RF_FUEL: pos = rt_put_str(buf, pos, cap, fuel_name(t->fuel_type)); break;
+            case RF_VEHICLE: pos = rt_put_str(buf, pos, cap, vehicle_name(t->vehicle_type)); break;
+            case RF_QUANTITY: pos = rt_put_fixed(buf, pos, cap, t->quantity, op->decimals); break;
+            case RF_UNIT: pos = rt_put_str(buf, pos, cap, t->fuel_type == FUEL_CNG ? "kg" : "liters"); break;
+            case RF_RATE:
+                pos = rt_put_fixed(buf, pos, cap, t->quantity > 0 ? t->amount / t->quantity : 0.0, op->decimals);
+                break;
+            case RF_AMOUNT: pos = rt_put_fixed(buf, pos, cap, t->amount, op->decimals); break;
+            case RF_TAX: pos = rt_put_fixed(buf, pos, cap, t->amount * TAX_RATE / (1.0 + TAX_RATE), op->decimals); break;
+            case RF_PAYMENT: pos = rt_put_str(buf, pos, cap, payment_name(t->payment_mode)); break;
+            case RF_LOYALTY:
+                pos = rt_put_uint(buf, pos, cap, (unsigned long long)(t->amount / 100.0) * LOYALTY_POINTS_PER_100, 1);
+                break;
+        }
+    }
+    if (cap > 0) buf[pos] = '\0';
+    return pos;
+}
+
+void print_receipt(const Transaction *t) {
+    pthread_mutex_lock(&spooler.lock);
+    if (spooler.running && spooler.count < RECEIPT_QUEUE_SLOTS) {
+        spooler.slots[(spooler.head + spooler.count) % RECEIPT_QUEUE_SLOTS] = *t;
+        spooler.count++;
+        pthread_cond_signal(&spooler.nonempty);
+        pthread_mutex_unlock(&spooler.lock);
+        return;
+    }
+    spooler.inline_writes++;
+    pthread_mutex_unlock(&spooler.lock);
+    char buf[RECEIPT_MAX_BYTES];
+    size_t len = render_receipt(t, buf, sizeof(buf));
+    fwrite(buf, 1, len, stdout);
+}
+
+/*
+ * E-receipts. A sale only enqueues a short text message for the customer's
+ * phone/email; a dispatcher thread delivers queued messages in batches through
+ * an EReceiptGateway. The bundled gateway runs a local command and speaks a
+ * line protocol: one tab-separated "txn_id, contact, message" line per
+ * receipt, answered by one line per receipt starting with "OK" on success.
+ * Undelivered receipts are kept in a retry list that is rewritten to
+ * EReceiptRetryFile on every change and reloaded at startup.
+ */
+#define ERECEIPT_QUEUE_SLOTS 1024
+#define ERECEIPT_BATCH_MAX 64
+#define ERECEIPT_REPLY_TIMEOUT_MS 5000
+#define ERECEIPT_RETRY_BASE_SEC 5
+#define ERECEIPT_RETRY_MAX_SEC 300
+#define ERECEIPT_RETRY_FILE "ereceipt.queue"
+
+typedef struct {
+    char txn_id[32];
+    char contact[64];
+    char message[192];
+    int attempts;
+    time_t next_attempt;
+} EReceipt;
+
+typedef struct {
+    const char *name;
+    void *ctx;
+    int (*send_batch)(void *ctx, const EReceipt *batch, size_t n, int *delivered);
+    void (*close)(void *ctx);
+} EReceiptGateway;
+
+typedef struct {
+    char command[256];
+    pid_t pid;
+    int to_fd;
+    int from_fd;
+    size_t reply_len;           /* bytes buffered in reply[] not yet consumed */
+    char reply[4096];
+} ProcessGateway;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int running;
+    int stopping;
+    EReceiptGateway gateway;
+    size_t head;
+    size_t count;
+    EReceipt *retry;
+    size_t retry_count;
+    size_t retry_cap;
+    unsigned long delivered;
+    unsigned long batches;
+    unsigned long failures;
+    Timer retry_timer;
+    EReceipt slots[ERECEIPT_QUEUE_SLOTS];
+} ereceipts = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static ProcessGateway process_gateway = { .pid = -1, .to_fd = -1, .from_fd = -1 };
+
+static void process_gateway_close(void *ctx) {
+    ProcessGateway *g = (ProcessGateway*) ctx;
+    if (g->to_fd >= 0) close(g->to_fd);
+    if (g->from_fd >= 0) close(g->from_fd);
+    if (g->pid > 0) {
+        kill(g->pid, SIGTERM);
+        waitpid(g->pid, NULL, 0);
+    }
+    g->to_fd = -1;
+    g->from_fd = -1;
+    g->reply_len = 0;
+    g->pid = -1;
+}
+
+static int process_gateway_spawn(ProcessGateway *g) {
+    int to_child[2], from_child[2];
+    if (pipe(to_child) != 0) return -1;
+    if (pipe(from_child) != 0) {
+        close(to_child[0]); close(to_child[1]);
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(to_child[0]); close(to_child[1]);
+        close(from_child[0]); close(from_child[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[0]); close(to_child[1]);
+        close(from_child[0]); close(from_child[1]);
+        execl("/bin/sh", "sh", "-c", g->command, (char*) NULL);
+        _exit(127);
+    }
+    close(to_child[0]);
+    close(from_child[1]);
+    g->pid = pid;
+    g->to_fd = to_child[1];
+    g->from_fd = from_child[0];
+    g->reply_len = 0;
+    return 0;
+}
+
+/*
+ * Reads one reply line. Replies already buffered are returned without
+ * polling, so a gateway that answers a whole batch in one write is not
+ * mistaken for a silent one. Returns -1 on timeout, EOF or error.
+ */
+static int process_gateway_read_line(ProcessGateway *g, char *line, size_t cap) {
+    for (;;) {
+        char *nl = (char*) memchr(g->reply, '\n', g->reply_len);
+        if (nl || g->reply_len == sizeof(g->reply)) {
+            size_t used = nl ? (size_t)(nl - g->reply) + 1 : g->reply_len;
+            size_t n = used < cap ? used : cap - 1;
+            memcpy(line, g->reply, n);
+            line[n] = '\0';
+            memmove(g->reply, g->reply + used, g->reply_len - used);
+            g->reply_len -= used;
+            return 0;
+        }
+        struct pollfd pfd = { g->from_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, ERECEIPT_REPLY_TIMEOUT_MS) <= 0) return -1;
+        ssize_t r = read(g->from_fd, g->reply + g->reply_len, sizeof(g->reply) - g->reply_len);
+        if (r <= 0) return -1;
+        g->reply_len += (size_t)r;
+    }
+}
+
+static int process_gateway_send(void *ctx, const EReceipt *batch, size_t n, int *delivered) {
+    ProcessGateway *g = (ProcessGateway*) ctx;
+    if (g->pid < 0 && process_gateway_spawn(g) != 0) return -1;
+
+    char buf[ERECEIPT_BATCH_MAX * (sizeof(EReceipt) + 4)];
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        int w = snprintf(buf + len, sizeof(buf) - len, "%s\t%s\t%s\n",
+                         batch[i].txn_id, batch[i].contact, batch[i].message);
+        if (w < 0 || (size_t)w >= sizeof(buf) - len) return -1;
+        len += (size_t)w;
+    }
+    for (size_t off = 0; off < len;) {
+        ssize_t w = write(g->to_fd, buf + off, len - off);
+        if (w <= 0) { process_gateway_close(g); return -1; }
+        off += (size_t)w;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        char reply[128];
+        if (process_gateway_read_line(g, reply, sizeof(reply)) != 0) {
+            for (; i < n; ++i) delivered[i] = 0;
+            process_gateway_close(g);
+            return -1;
+        }
+        delivered[i] = strncmp(reply, "OK", 2) == 0;
+    }
+    return 0;
+}
+
+/*
+ * Rewrites the retry file from a snapshot of the retry list. Called by the
+ * dispatcher (the only writer) with ereceipts.lock held; the lock is dropped
+ * while the file is written so sales can keep enqueuing.
+ */
+static void ereceipt_persist_retries(void) {
+    char tmp[] = ERECEIPT_RETRY_FILE ".tmp";
+    size_t count = ereceipts.retry_count;
+    EReceipt *snap = count ? (EReceipt*) malloc(count * sizeof(EReceipt)) : NULL;
+    if (count && !snap) return;
+    if (count) memcpy(snap, ereceipts.retry, count * sizeof(EReceipt));
+    pthread_mutex_unlock(&ereceipts.lock);
+    if (count == 0) {
+        remove(ERECEIPT_RETRY_FILE);
+    } else {
+        FILE *fp = fopen(tmp, "w");
+        if (fp) {
+            for (size_t i = 0; i < count; ++i)
+                fprintf(fp, "%s\t%s\t%d\t%s\n", snap[i].txn_id, snap[i].contact, snap[i].attempts, snap[i].message);
+            int ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+            fclose(fp);
+            if (ok) rename(tmp, ERECEIPT_RETRY_FILE);
+        }
+    }
+    free(snap);
+    pthread_mutex_lock(&ereceipts.lock);
+}
+
+static int ereceipt_add_retry(const EReceipt *r) {
+    if (ereceipts.retry_count == ereceipts.retry_cap) {
+        size_t cap = ereceipts.retry_cap ? ereceipts.retry_cap * 2 : 64;
+        EReceipt *grown = (EReceipt*) realloc(ereceipts.retry, cap * sizeof(EReceipt));
+        if (!grown) return -1;
+        ereceipts.retry = grown;
+        ereceipts.retry_cap = cap;
+    }
+    ereceipts.retry[ereceipts.retry_count++] = *r;
+    return 0;
+}
+
+static void ereceipt_load_retries(void) {
+    FILE *fp = fopen(ERECEIPT_RETRY_FILE, "r");
+    if (!fp) return;
+    char line[sizeof(EReceipt) + 16];
+    while (fgets(line, sizeof(line), fp)) {
+        EReceipt r;
+        memset(&r, 0, sizeof(r));
+        line[strcspn(line, "\n")] = '\0';
+        char *id = strtok(line, "\t");
+        char *contact = strtok(NULL, "\t");
+        char *attempts = strtok(NULL, "\t");
+        char *message = strtok(NULL, "");
+        if (!id || !contact || !attempts || !message) continue;
+        snprintf(r.txn_id, sizeof(r.txn_id), "%s", id);
+        snprintf(r.contact, sizeof(r.contact), "%s", contact);
+        snprintf(r.message, sizeof(r.message), "%s", message);
+        r.attempts = atoi(attempts);
+        ereceipt_add_retry(&r);
+    }
+    fclose(fp);
+}
+
+static void ereceipt_retry_fire(void *arg, unsigned long data) {
+    (void)arg;
+    (void)data;
+    pthread_mutex_lock(&ereceipts.lock);
+    pthread_cond_signal(&ereceipts.wake);
+    pthread_mutex_unlock(&ereceipts.lock);
+}
+
+static void *ereceipt_dispatcher_main(void *arg) {
+    (void)arg;
+    static EReceipt batch[ERECEIPT_BATCH_MAX];
+    int delivered[ERECEIPT_BATCH_MAX];
+    pthread_mutex_lock(&ereceipts.lock);
+    for (;;) {
+        time_t now = time(NULL);
+        time_t next_retry = 0;
+        size_t n = 0;
+        for (size_t i = 0; i < ereceipts.retry_count && n < ERECEIPT_BATCH_MAX;) {
+            if (ereceipts.retry[i].next_attempt <= now) {
+                batch[n++] = ereceipts.retry[i];
+                ereceipts.retry[i] = ereceipts.retry[--ereceipts.retry_count];
+            } else {
+                if (!next_retry || ereceipts.retry[i].next_attempt < next_retry)
+                    next_retry = ereceipts.retry[i].next_attempt;
+                ++i;
+            }
+        }
+        while (n < ERECEIPT_BATCH_MAX && ereceipts.count > 0) {
+            batch[n++] = ereceipts.slots[ereceipts.head];
+            ereceipts.head = (ereceipts.head + 1) % ERECEIPT_QUEUE_SLOTS;
+            ereceipts.count--;
+        }
+        if (n == 0) {
+            if (ereceipts.stopping) break;
+            time_t wait_sec = next_retry - time(NULL);
+            if (next_retry && timer_arm(&ereceipts.retry_timer, wait_sec > 0 ? (uint64_t)wait_sec * 1000 : 0,
+                                        ereceipt_retry_fire, NULL, 0) == 0) {
+                pthread_cond_wait(&ereceipts.wake, &ereceipts.lock);
+            } else if (next_retry) {
+                struct timespec until = { next_retry, 0 };
+                pthread_cond_timedwait(&ereceipts.wake, &ereceipts.lock, &until);
+            } else {
+                pthread_cond_wait(&ereceipts.wake, &ereceipts.lock);
+            }
+            continue;
+        }
+        pthread_mutex_unlock(&ereceipts.lock);
+
+        for (size_t i = 0; i < n; ++i) delivered[i] = 0;
+        int rc = ereceipts.gateway.send_batch(ereceipts.gateway.ctx, batch, n, delivered);
+
+        pthread_mutex_lock(&ereceipts.lock);
+        ereceipts.batches++;
+        int retries_changed = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (delivered[i]) {
+                ereceipts.delivered++;
+                if (batch[i].attempts > 0) retries_changed = 1;
+                continue;
+            }
+            EReceipt *r = &batch[i];
+            r->attempts++;
+            long delay = (long)ERECEIPT_RETRY_BASE_SEC << (r->attempts < 6 ? r->attempts - 1 : 6);
+            r->next_attempt = time(NULL) + (delay < ERECEIPT_RETRY_MAX_SEC ? delay : ERECEIPT_RETRY_MAX_SEC);
+            ereceipts.failures++;
+            ereceipt_add_retry(r);
+            retries_changed = 1;
+        }
+        if (retries_changed) ereceipt_persist_retries();
+        if (rc != 0 && ereceipts.stopping) break;
+    }
+    ereceipt_persist_retries();
+    pthread_mutex_unlock(&ereceipts.lock);
+    return NULL;
+}
+
+int ereceipt_start(const char *command) {
+    snprintf(process_gateway.command, sizeof(process_gateway.command), "%s", command);
+    ereceipts.gateway.name = "process";
+    ereceipts.gateway.ctx = &process_gateway;
+    ereceipts.gateway.send_batch = process_gateway_send;
+    ereceipts.gateway.close = process_gateway_close;
+    signal(SIGPIPE, SIG_IGN);
+    ereceipt_load_retries();
+    if (pthread_create(&ereceipts.thread, NULL, ereceipt_dispatcher_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start e-receipt dispatcher.\n");
+        return -1;
+    }
+    ereceipts.running = 1;
+    if (ereceipts.retry_count > 0)
+        printf("Resending %zu undelivered e-receipts from %s.\n", ereceipts.retry_count, ERECEIPT_RETRY_FILE);
+    return 0;
+}
+
+void ereceipt_stop() {
+    if (!ereceipts.running) return;
+    pthread_mutex_lock(&ereceipts.lock);
+    ereceipts.stopping = 1;
+    pthread_cond_signal(&ereceipts.wake);
+    pthread_mutex_unlock(&ereceipts.lock);
+    pthread_join(ereceipts.thread, NULL);
+    timer_cancel(&ereceipts.retry_timer);
+    ereceipts.gateway.close(ereceipts.gateway.ctx);
+    ereceipts.running = 0;
+    free(ereceipts.retry);
+    ereceipts.retry = NULL;
+    ereceipts.retry_count = ereceipts.retry_cap = 0;
+}
+
+int ereceipt_enabled() {
+    return ereceipts.running;
+}
+
+int ereceipt_enqueue(const Transaction *t, const char *contact) {
+    pthread_mutex_lock(&ereceipts.lock);
+    if (!ereceipts.running || ereceipts.count == ERECEIPT_QUEUE_SLOTS) {
+        pthread_mutex_unlock(&ereceipts.lock);
+        return -1;
+    }
+    EReceipt *r = &ereceipts.slots[(ereceipts.head + ereceipts.count) % ERECEIPT_QUEUE_SLOTS];
+    snprintf(r->txn_id, sizeof(r->txn_id), "%s", t->txn_id);
+    snprintf(r->contact, sizeof(r->contact), "%s", contact);
+    snprintf(r->message, sizeof(r->message), "%s: %s %s %.3f %s INR %.2f via %s",
+             STATION_NAME, t->txn_id, fuel_name(t->fuel_type), t->quantity,
+             t->fuel_type == FUEL_CNG ? "kg" : "L", t->amount, payment_name(t->payment_mode));
+    r->attempts = 0;
+    r->next_attempt = 0;
+    ereceipts.count++;
+    pthread_cond_signal(&ereceipts.wake);
+    pthread_mutex_unlock(&ereceipts.lock);
+    return 0;
+}
+
+void show_ereceipt_status() {
+    if (!ereceipt_enabled()) {
+        printf("\nE-receipts are disabled (start with --ereceipt-gateway CMD).\n");
+        return;
+    }
+    pthread_mutex_lock(&ereceipts.lock);
+    printf("\n----- E-Receipt Delivery -----\n");
+    printf("Gateway: %s (%s)\n", ereceipts.gateway.name, process_gateway.command);
+    printf("Queued: %zu | Awaiting retry: %zu | Delivered: %lu | Failed attempts: %lu | Batches: %lu\n",
+           ereceipts.count, ereceipts.retry_count, ereceipts.delivered, ereceipts.failures, ereceipts.batches);
+    pthread_mutex_unlock(&ereceipts.lock);
+}
+
+static DayRollup *rollup_day(int32_t date);
+static void standing_apply(const Transaction *tx, int hour, int32_t date);
+
+void record_transaction(const Transaction *tx) {
+    ensure_tx_capacity();
+    transactions[tx_count] = *tx;
+    mark_tx_dirty(tx_count);
+    note_tx_zone(tx_count);
+    tx_count++;
+
+    int pidx = pump_index_by_id(tx->pump_id);
+    if (pidx >= 0) {
+        pumps[pidx].transactions_count += 1;
+        pumps[pidx].total_quantity += tx->quantity;
+        pumps[pidx].total_amount += tx->amount;
+    }
+
+    fuel_wise_quantity[tx->fuel_type] += tx->quantity;
+    fuel_wise_amount[tx->fuel_type] += tx->amount;
+
+    payment_mode_amount[tx->payment_mode] += tx->amount;
+
+    struct tm tm;
+    struct tm *lt = localtime_r(&tx->timestamp, &tm);
+    if (lt != NULL) {
+        int hour = lt->tm_hour;
+        hour_quantity[hour] += tx->quantity;
+        hour_amount[hour] += tx->amount;
+        int32_t date = (lt->tm_year + 1900) * 10000 + (lt->tm_mon + 1) * 100 + lt->tm_mday;
+        if (date > pump_minutes_date) {
+            memset(pump_minutes, 0, sizeof(pump_minutes));
+            pump_minutes_date = date;
+        }
+        if (pidx >= 0 && date == pump_minutes_date) {
+            MinuteCell *cell = &pump_minutes[(size_t)pidx * MINUTES_PER_DAY + (size_t)(hour * 60 + lt->tm_min)];
+            cell->sales++;
+            cell->centiunits += (uint32_t)(tx->quantity * 100.0 + 0.5);
+            cell->paise += (uint64_t)(tx->amount * 100.0 + 0.5);
+        }
+        DayRollup *day = rollup_day(date);
+        day->sales++;
+        day->fuel_quantity[tx->fuel_type] += tx->quantity;
+        day->fuel_amount[tx->fuel_type] += tx->amount;
+        day->fuel_sales[tx->fuel_type]++;
+        day->payment_amount[tx->payment_mode] += tx->amount;
+        day->payment_sales[tx->payment_mode]++;
+        day->hour_quantity[hour] += tx->quantity;
+        day->hour_amount[hour] += tx->amount;
+        int slot = 0;
+        while (slot < day->pump_count && day->pump_id[slot] != tx->pump_id) slot++;
+        if (slot == day->pump_count && slot < MAX_PUMPS) day->pump_id[day->pump_count++] = tx->pump_id;
+        if (slot < MAX_PUMPS) {
+            day->pump_quantity[slot] += tx->quantity;
+            day->pump_amount[slot] += tx->amount;
+            day->pump_sales[slot]++;
+        }
+        if (tx->vehicle_hash) hll_add(&day->vehicles, tx->vehicle_hash);
+        if (tx->customer_hash) hll_add(&day->customers, tx->customer_hash);
+        /* Reservoir slot: the k-th sale of the day replaces a random row with probability SAMPLE_PER_DAY/k. */
+        uint64_t pick = day->sales - 1;
+        if (pick >= SAMPLE_PER_DAY) {
+            uint64_t r = name_hash(tx->txn_id) ^ (day->sales * 0x9E3779B97F4A7C15ull);
+            r ^= r >> 31;
+            r *= 0xbf58476d1ce4e5b9ull;
+            r ^= r >> 29;
+            pick = r % day->sales;
+        }
+        if (pick < SAMPLE_PER_DAY) {
+            SampleRow *row = &day->sample[pick];
+            row->paise = (uint32_t)(tx->amount * 100.0 + 0.5);
+            row->milliunits = (uint32_t)(tx->quantity * 1000.0 + 0.5);
+            row->minute = (uint16_t)(hour * 60 + lt->tm_min);
+            row->pump_id = (uint16_t)tx->pump_id;
+            row->fuel_type = (uint8_t)tx->fuel_type;
+            row->vehicle_type = (uint8_t)tx->vehicle_type;
+            row->payment_mode = (uint8_t)tx->payment_mode;
+        }
+        standing_apply(tx, hour, date);
+    }
+}
+
+void clear_input_buffer(void) {
+    int ch;
+    while ((ch = getchar()) != '\n' && ch != EOF) {
+    }
+}
+
+/*
+ * Command capture for deterministic replay. When started with --record FILE
+ * every sale, supply and pump-status command is appended as one text line;
+ * doubles are written as hex floats so replay sees bit-identical inputs. A
+ * digest of the final derived state is appended on clean shutdown. The
+ * recording's time zone is kept too, since hour and day buckets depend on it.
+ * Authorized card/wallet sales are recorded when they commit, as A lines
+ * carrying the fuel, quantity and amount fixed when they were submitted.
+ */
+#define CAPTURE_MAGIC "PPMSREC 1"
+
+static FILE *capture_fp = NULL;
+/*
+ * While recording, held from pricing a sale until its S line is written and
+ * by config_publish around the swap, so every sale lands in the capture after
+ * the config it was priced with. Nests inside station_lock.
+ */
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void capture_hold(void) {
+    if (capture_fp) pthread_mutex_lock(&capture_lock);
+}
+
+static void capture_unhold(void) {
+    if (capture_fp) pthread_mutex_unlock(&capture_lock);
+}
+
+uint64_t state_digest() {
+    uint64_t h = 1469598103934665603ull;
+#define DIGEST_BYTES(ptr, len) do { \
+        const unsigned char *p_ = (const unsigned char*)(ptr); \
+        for (size_t i_ = 0; i_ < (len); ++i_) { h ^= p_[i_]; h *= 1099511628211ull; } \
+    } while (0)
+    for (int i = 0; i < 3; ++i) DIGEST_BYTES(&fuels[i].current_stock, sizeof(double));
+    for (int i = 0; i < pump_slots; ++i) {
+        DIGEST_BYTES(&pumps[i].status, sizeof(pumps[i].status));
+        DIGEST_BYTES(&pumps[i].transactions_count, sizeof(double));
+        DIGEST_BYTES(&pumps[i].total_quantity, sizeof(double));
+        DIGEST_BYTES(&pumps[i].total_amount, sizeof(double));
+    }
+    DIGEST_BYTES(fuel_wise_quantity, sizeof(fuel_wise_quantity));
+    DIGEST_BYTES(fuel_wise_amount, sizeof(fuel_wise_amount));
+    DIGEST_BYTES(payment_mode_amount, sizeof(payment_mode_amount));
+    DIGEST_BYTES(hour_quantity, sizeof(hour_quantity));
+    DIGEST_BYTES(hour_amount, sizeof(hour_amount));
+    DIGEST_BYTES(pump_minutes, (size_t)pump_slots * MINUTES_PER_DAY * sizeof(MinuteCell));
+    DIGEST_BYTES(&pump_minutes_date, sizeof(pump_minutes_date));
+    uint64_t count = (uint64_t)tx_count;
+    DIGEST_BYTES(&count, sizeof(count));
+#undef DIGEST_BYTES
+    return h;
+}
+
+void capture_config(const StationConfig *cfg) {
+    if (!capture_fp) return;
+    fprintf(capture_fp, "C %a %a %a %a %d", cfg->low_stock_threshold,
+            cfg->price[FUEL_PETROL], cfg->price[FUEL_DIESEL], cfg->price[FUEL_CNG], cfg->pump_count);
+    for (int i = 0; i < cfg->pump_count; ++i)
+        fprintf(capture_fp, " %d:%d", cfg->pumps[i].pump_id, (int)cfg->pumps[i].fuel);
+    fputc('\n', capture_fp);
+}
+
+/* The zone as a TZ value: $TZ, else the zoneinfo name /etc/localtime links to, else a fixed offset. */
+static void capture_time_zone(char *out, size_t cap) {
+    const char *env = getenv("TZ");
+    char link[256];
+    ssize_t n;
+    if (env && *env) {
+        snprintf(out, cap, "%s", env);
+    } else if ((n = readlink("/etc/localtime", link, sizeof(link) - 1)) > 0 && (link[n] = '\0', strstr(link, "zoneinfo/"))) {
+        snprintf(out, cap, "%s", strstr(link, "zoneinfo/") + strlen("zoneinfo/"));
+    } else {
+        time_t now = time(NULL);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        long west = -tm.tm_gmtoff;
+        snprintf(out, cap, "UTC%c%02ld:%02ld", west < 0 ? '-' : '+', labs(west) / 3600, labs(west) / 60 % 60);
+    }
+}
+
+int capture_open(const char *path) {
+    capture_fp = fopen(path, "w");
+    if (!capture_fp) return -1;
+    setvbuf(capture_fp, NULL, _IOLBF, 0);
+    fprintf(capture_fp, "%s\n", CAPTURE_MAGIC);
+    char zone[256];
+    capture_time_zone(zone, sizeof(zone));
+    fprintf(capture_fp, "Z %s\n", zone);
+    fprintf(capture_fp, "I %a %a %a\n",
+            fuels[FUEL_PETROL].current_stock,
+            fuels[FUEL_DIESEL].current_stock,
+            fuels[FUEL_CNG].current_stock);
+    unsigned ticket;
+    capture_config(config_acquire(&ticket));
+    config_release(ticket);
+    return 0;
+}
+
+void capture_close() {
+    if (!capture_fp) return;
+    fprintf(capture_fp, "D %016llx\n", (unsigned long long)state_digest());
+    fclose(capture_fp);
+    capture_fp = NULL;
+}
+
+void capture_sale(const SaleRequest *req) {
+    if (!capture_fp) return;
+    fprintf(capture_fp, "S %lld %d %d %d %a %d %llx %llx\n",
+            (long long)req->timestamp, req->pump_id, (int)req->vehicle_type,
+            req->by_amount, req->value, (int)req->payment_mode,
+            (unsigned long long)req->vehicle_hash, (unsigned long long)req->customer_hash);
+}
+
+/* A card/wallet sale committed after authorization, with the price and quantity fixed at submit time. */
+void capture_authorized_sale(const SaleRequest *req, FuelType ftype, double qty, double amt) {
+    if (!capture_fp) return;
+    fprintf(capture_fp, "A %lld %d %d %d %a %d %llx %llx %d %a %a\n",
+            (long long)req->timestamp, req->pump_id, (int)req->vehicle_type,
+            req->by_amount, req->value, (int)req->payment_mode,
+            (unsigned long long)req->vehicle_hash, (unsigned long long)req->customer_hash,
+            (int)ftype, qty, amt);
+}
+
+void capture_supply(int fuel, double qty) {
+    if (!capture_fp) return;
+    fprintf(capture_fp, "U %lld %d %a\n", (long long)time(NULL), fuel, qty);
+}
+
+void capture_pump_status(int pump_id, PumpStatus status) {
+    if (!capture_fp) return;
+    fprintf(capture_fp, "P %lld %d %d\n", (long long)time(NULL), pump_id, (int)status);
+}
+
+/*
+ * Configuration reload (--config FILE, SIGHUP or menu 24). The file holds
+ * "key = value" lines; '#' starts a comment and absent keys keep their
+ * current value:
+ *     low_stock_threshold = 5000
+ *     price.petrol = 102.50          (also price.diesel, price.cng)
+ *     pump = 7 diesel                (if any pump lines are given they
+ *                                     replace the whole pump list)
+ * The new config is fully validated before it is published, so a bad file
+ * leaves the running one untouched.
+ */
+static const char *config_file = NULL;
+static pthread_mutex_t config_update_lock = PTHREAD_MUTEX_INITIALIZER;
+static sigset_t config_signals;
+
+static int fuel_from_name(const char *name) {
+    for (int f = FUEL_PETROL; f <= FUEL_CNG; ++f)
+        if (strcasecmp(name, fuel_name((FuelType)f)) == 0) return f;
+    return -1;
+}
+
+/* Reload messages go to the terminal from the menu, and to the notice queue from background threads. */
+static void config_say(int background, FILE *out, const char *fmt, ...) {
+    char buf[NOTICE_BYTES];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (background) notice("%s", buf);
+    else fprintf(out, "%s\n", buf);
+}
+
+static int config_parse(const char *path, const StationConfig *base, StationConfig *out, int background) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        config_say(background, stderr, "Cannot open configuration file %s.", path);
+        return -1;
+    }
+    *out = *base;
+    const char *error = NULL;
+    int lineno = 0, pumps_given = 0;
+    char line[256];
+    while (!error && fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char key[64], fuel[16], extra;
+        double v;
+        int id;
+        char *eq = strchr(line, '=');
+        if (!eq) {
+            if (sscanf(line, "%63s", key) == 1) error = "expected key = value";
+            continue;
+        }
+        *eq = '\0';
+        if (sscanf(line, "%63s %c", key, &extra) != 1) {
+            error = "expected key = value";
+        } else if (strcmp(key, "low_stock_threshold") == 0) {
+            if (sscanf(eq + 1, "%lf %c", &v, &extra) != 1 || !(v >= 0)) error = "threshold must be a number >= 0";
+            else out->low_stock_threshold = v;
+        } else if (strncmp(key, "price.", 6) == 0) {
+            int f = fuel_from_name(key + 6);
+            if (f < 0) error = "unknown fuel (petrol, diesel or cng)";
+            else if (sscanf(eq + 1, "%lf %c", &v, &extra) != 1 || !(v > 0) || v > 100000) error = "price must be a positive number";
+            else out->price[f] = v;
+        } else if (strcmp(key, "pump") == 0) {
+            if (!pumps_given) {
+                out->pump_count = 0;
+                pumps_given = 1;
+            }
+            int f = -1;
+            if (sscanf(eq + 1, "%d %15s %c", &id, fuel, &extra) != 2) error = "expected pump = ID FUEL";
+            else if (id < 1 || id > 999) error = "pump id must be between 1 and 999";
+            else if ((f = fuel_from_name(fuel)) < 0) error = "unknown fuel (petrol, diesel or cng)";
+            else if (config_pump(out, id)) error = "duplicate pump id";
+            else if (out->pump_count == MAX_PUMPS) error = "too many pumps";
+            else {
+                out->pumps[out->pump_count].pump_id = id;
+                out->pumps[out->pump_count].fuel = (FuelType)f;
+                out->pumps[out->pump_count].slot = -1;
+                out->pump_count++;
+            }
+        } else {
+            error = "unknown key";
+        }
+    }
+    fclose(fp);
+    if (error) {
+        config_say(background, stderr, "%s:%d: %s; configuration not applied.", path, lineno, error);
+        return -1;
+    }
+    if (out->pump_count == 0) {
+        config_say(background, stderr, "%s: no pumps configured; configuration not applied.", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Swaps in cfg (already slot-bound) and frees the previous config once every
+ * reader that could still see it has left. Caller holds config_update_lock.
+ * While recording, the swap happens under capture_lock (not station_lock) so
+ * the capture orders it exactly against the sales priced on either side of it.
+ */
+static void config_publish(StationConfig *cfg) {
+    StationConfig *old = atomic_load(&station_config);
+    cfg->version = old->version + 1;
+    if (capture_fp) {
+        pthread_mutex_lock(&capture_lock);
+        atomic_store(&station_config, cfg);
+        capture_config(cfg);
+        pthread_mutex_unlock(&capture_lock);
+    } else {
+        atomic_store(&station_config, cfg);
+    }
+    unsigned epoch = atomic_fetch_add(&config_epoch, 1);
+    while (atomic_load(&config_readers[epoch & 1]) != 0) {
+        struct timespec ts = { 0, 50000 };
+        nanosleep(&ts, NULL);
+    }
+    free(old);
+}
+
+static void config_report_changes(const StationConfig *old, const StationConfig *cfg, int background) {
+    int changes = 0;
+    if (cfg->low_stock_threshold != old->low_stock_threshold) {
+        config_say(background, stdout, "  Low-stock threshold %.2f -> %.2f",
+                   old->low_stock_threshold, cfg->low_stock_threshold);
+        changes++;
+    }
+    for (int f = FUEL_PETROL; f <= FUEL_CNG; ++f) {
+        if (cfg->price[f] == old->price[f]) continue;
+        config_say(background, stdout, "  %s price %.2f -> %.2f",
+                   fuel_name((FuelType)f), old->price[f], cfg->price[f]);
+        changes++;
+    }
+    for (int i = 0; i < cfg->pump_count; ++i) {
+        const PumpConfig *was = config_pump(old, cfg->pumps[i].pump_id);
+        if (!was) {
+            config_say(background, stdout, "  Pump %d added (%s)",
+                       cfg->pumps[i].pump_id, fuel_name(cfg->pumps[i].fuel));
+            changes++;
+        } else if (was->fuel != cfg->pumps[i].fuel) {
+            config_say(background, stdout, "  Pump %d remapped %s -> %s", cfg->pumps[i].pump_id,
+                       fuel_name(was->fuel), fuel_name(cfg->pumps[i].fuel));
+            changes++;
+        }
+    }
+    for (int i = 0; i < old->pump_count; ++i) {
+        if (config_pump(cfg, old->pumps[i].pump_id)) continue;
+        config_say(background, stdout, "  Pump %d removed", old->pumps[i].pump_id);
+        changes++;
+    }
+    if (!changes) config_say(background, stdout, "  no changes");
+}
+
+int config_reload(const char *path, int background) {
+    if (!path) {
+        config_say(background, stdout, "No configuration file was given (start with --config FILE).");
+        return -1;
+    }
+    StationConfig *cfg = (StationConfig*) malloc(sizeof(StationConfig));
+    if (!cfg) {
+        config_say(background, stderr, "Failed to allocate station configuration.");
+        return -1;
+    }
+    pthread_mutex_lock(&config_update_lock);
+    const StationConfig *cur = atomic_load(&station_config);
+    int rc = config_parse(path, cur, cfg, background);
+    if (rc == 0 && config_bind_slots(cfg) != 0) {
+        config_say(background, stderr, "%s: all %d pump slots are in use; configuration not applied.",
+                   path, MAX_PUMPS);
+        rc = -1;
+    }
+    if (rc == 0) {
+        config_say(background, stdout, "Configuration v%lu loaded from %s:", cur->version + 1, path);
+        config_report_changes(cur, cfg, background);
+        config_publish(cfg);
+    } else {
+        free(cfg);
+    }
+    pthread_mutex_unlock(&config_update_lock);
+    return rc;
+}
+
+/* Publishes the current config with one fuel price changed; used by scheduled price revisions. */
+int config_set_price(FuelType fuel, double price) {
+    const int background = 1;   /* revisions fire on the timer thread */
+    StationConfig *cfg = (StationConfig*) malloc(sizeof(StationConfig));
+    if (!cfg) {
+        config_say(background, stderr, "Failed to allocate station configuration.");
+        return -1;
+    }
+    pthread_mutex_lock(&config_update_lock);
+    const StationConfig *cur = atomic_load(&station_config);
+    *cfg = *cur;
+    cfg->price[fuel] = price;
+    config_say(background, stdout, "Configuration v%lu from scheduled price revision:", cur->version + 1);
+    config_report_changes(cur, cfg, background);
+    config_publish(cfg);
+    pthread_mutex_unlock(&config_update_lock);
+    return 0;
+}
+
+/* Installs a config decoded from a capture; used by replay. */
+int config_install(StationConfig *cfg) {
+    pthread_mutex_lock(&config_update_lock);
+    int rc = config_bind_slots(cfg);
+    if (rc == 0) config_publish(cfg);
+    else free(cfg);
+    pthread_mutex_unlock(&config_update_lock);
+    return rc;
+}
+
+/* Must run before any thread is created so SIGHUP is only ever taken by config_signal_main. */
+void config_block_signals() {
+    sigemptyset(&config_signals);
+    sigaddset(&config_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &config_signals, NULL);
+}
+
+static void *config_signal_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        int sig;
+        if (sigwait(&config_signals, &sig) != 0 || sig != SIGHUP) continue;
+        notice("SIGHUP received, reloading configuration.");
+        config_reload(config_file, 1);
+    }
+    return NULL;
+}
+
+void config_watch_signals() {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, config_signal_main, NULL) == 0) pthread_detach(tid);
+    else fprintf(stderr, "Failed to start configuration reload thread; SIGHUP is ignored.\n");
+}
+
+/*
+ * CRC32C (Castagnoli) guards every journal record and archive block. x86-64
+ * builds use the SSE4.2 crc32 instruction when the CPU has it, ARMv8 builds
+ * with the CRC extension use __crc32cd, and anything else falls back to a
+ * slicing-by-8 table. crc32c_init() must run before the first checksum.
+ */
+static uint32_t crc32c_table[8][256];
+static int crc32c_hw = 0;
+
+void crc32c_init() {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+        crc32c_table[0][i] = c;
+    }
+    for (int t = 1; t < 8; ++t)
+        for (int i = 0; i < 256; ++i)
+            crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[t - 1][i] & 0xFF];
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    crc32c_hw = __builtin_cpu_supports("sse4.2") != 0;
+#elif defined(__ARM_FEATURE_CRC32)
+    crc32c_hw = 1;
+#endif
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw_update(uint32_t c, const unsigned char *p, size_t n) {
+    uint64_t c64 = c;
+    for (; n > 0 && ((uintptr_t)p & 7) != 0; --n) c64 = _mm_crc32_u8((uint32_t)c64, *p++);
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c64 = _mm_crc32_u64(c64, v);
+    }
+    for (; n > 0; --n) c64 = _mm_crc32_u8((uint32_t)c64, *p++);
+    return (uint32_t)c64;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_hw_update(uint32_t c, const unsigned char *p, size_t n) {
+    for (; n > 0 && ((uintptr_t)p & 7) != 0; --n) c = __crc32cb(c, *p++);
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = __crc32cd(c, v);
+    }
+    for (; n > 0; --n) c = __crc32cb(c, *p++);
+    return c;
+}
+#endif
+
+static uint32_t crc32c_sw_update(uint32_t c, const unsigned char *p, size_t n) {
+    for (; n >= 8; n -= 8, p += 8) {
+        uint32_t lo = c ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        c = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+            crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+            crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]] ^ crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+    }
+    for (; n > 0; --n) c = (c >> 8) ^ crc32c_table[0][(c ^ *p++) & 0xFF];
+    return c;
+}
+
+/* Extends crc (0 to start) over n bytes at data. */
+uint32_t crc32c(uint32_t crc, const void *data, size_t n) {
+    const unsigned char *p = (const unsigned char*) data;
+#if (defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))) || defined(__ARM_FEATURE_CRC32)
+    if (crc32c_hw) return ~crc32c_hw_update(~crc, p, n);
+#endif
+    return ~crc32c_sw_update(~crc, p, n);
+}
+
+/*
+ * Write-behind file I/O for the sale journal and exports. Callers append into
+ * a per-file staging buffer with io_file_append() and never enter a write
+ * syscall themselves. One I/O thread swaps the staging buffers out and
+ * submits every pending write through io_uring with a single io_uring_enter(),
+ * each write linked to an fdatasync when the file is durable. Where io_uring
+ * is unavailable (non-Linux, old kernel, seccomp) the same thread falls back
+ * to pwrite + fdatasync.
+ */
+#define IO_STAGING_BYTES (1 << 20)
+#define IO_MAX_FILES 8
+#define IO_RING_ENTRIES (2 * IO_MAX_FILES)
+
+typedef struct {
+    const char *name;
+    int fd;
+    int durable;
+    char *buf[2];
+    int active;
+    size_t fill;
+    int in_flight;
+    int error;
+    uint64_t offset;
+    uint64_t completed;
+} IoFile;
+
+#ifdef PPMS_HAVE_IO_URING
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+} IoUring;
+
+static int io_uring_init(IoUring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return -1;
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) goto fail;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail;
+    r->sq_head = (unsigned*)((char*)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned*)((char*)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned*)((char*)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)((char*)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned*)((char*)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned*)((char*)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned*)((char*)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)((char*)r->cq_ptr + p.cq_off.cqes);
+    return 0;
+fail:
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_len);
+    if (r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+}
+
+static void io_uring_release(IoUring *r) {
+    if (r->fd < 0) return;
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+    r->fd = -1;
+}
+
+static struct io_uring_sqe *io_uring_next_sqe(IoUring *r) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+#endif
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t progress;
+    pthread_t thread;
+    int running;
+    int stopping;
+    IoFile *files[IO_MAX_FILES];
+    int nfiles;
+    int use_uring;
+#ifdef PPMS_HAVE_IO_URING
+    IoUring ring;
+#endif
+    unsigned long batches;
+    unsigned long writes;
+    unsigned long syncs;
+    unsigned long long bytes;
+} io_backend = { .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+                 .progress = PTHREAD_COND_INITIALIZER };
+
+typedef struct {
+    IoFile *file;
+    const char *data;
+    size_t len;
+    uint64_t offset;
+    ssize_t written;
+    int sync_failed;
+} IoRequest;
+
+static ssize_t io_pwrite_all(int fd, const char *data, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd, data + done, len - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return done > 0 ? (ssize_t)done : -1;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+/* Performs one batch of writes; called by the I/O thread without io_backend.lock held. */
+static void io_submit_batch(IoRequest *reqs, int n) {
+    TRACE_BEGIN("journal_flush");
+#ifdef PPMS_HAVE_IO_URING
+    if (io_backend.use_uring) {
+        int sqes = 0;
+        for (int i = 0; i < n; ++i) {
+            struct io_uring_sqe *sqe = io_uring_next_sqe(&io_backend.ring);
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = reqs[i].file->fd;
+            sqe->addr = (uint64_t)(uintptr_t)reqs[i].data;
+            sqe->len = (uint32_t)reqs[i].len;
+            sqe->off = reqs[i].offset;
+            sqe->user_data = (uint64_t)i * 2;
+            sqes++;
+            if (reqs[i].file->durable) {
+                sqe->flags |= IOSQE_IO_LINK;
+                sqe = io_uring_next_sqe(&io_backend.ring);
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = reqs[i].file->fd;
+                sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+                sqe->user_data = (uint64_t)i * 2 + 1;
+                sqes++;
+            }
+        }
+        int reaped = 0;
+        int rc = (int) syscall(__NR_io_uring_enter, io_backend.ring.fd, (unsigned)sqes, (unsigned)sqes,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+        while (rc >= 0 && reaped < sqes) {
+            unsigned head = *io_backend.ring.cq_head;
+            unsigned tail = __atomic_load_n(io_backend.ring.cq_tail, __ATOMIC_ACQUIRE);
+            if (head == tail) {
+                rc = (int) syscall(__NR_io_uring_enter, io_backend.ring.fd, 0u, 1u, IORING_ENTER_GETEVENTS, NULL, 0);
+                continue;
+            }
+            for (; head != tail; ++head, ++reaped) {
+                struct io_uring_cqe *cqe = &io_backend.ring.cqes[head & *io_backend.ring.cq_mask];
+                IoRequest *req = &reqs[cqe->user_data / 2];
+                if (cqe->user_data % 2 == 0) req->written = cqe->res;
+                else if (cqe->res < 0) req->sync_failed = 1;
+            }
+            __atomic_store_n(io_backend.ring.cq_head, head, __ATOMIC_RELEASE);
+        }
+        for (int i = 0; i < n; ++i) {
+            IoRequest *req = &reqs[i];
+            /* Short or failed ring writes (and cancelled linked syncs) are finished synchronously. */
+            if (rc < 0 || req->written < (ssize_t)req->len || req->sync_failed) {
+                size_t done = req->written > 0 ? (size_t)req->written : 0;
+                ssize_t rest = io_pwrite_all(req->file->fd, req->data + done, req->len - done, req->offset + done);
+                req->written = rest < 0 ? -1 : (ssize_t)(done + (size_t)rest);
+                req->sync_failed = req->file->durable && fdatasync(req->file->fd) != 0;
+            }
+        }
+        TRACE_END("journal_flush");
+        return;
+    }
+#endif
+    for (int i = 0; i < n; ++i) {
+        IoRequest *req = &reqs[i];
+        req->written = io_pwrite_all(req->file->fd, req->data, req->len, req->offset);
+        req->sync_failed = req->file->durable && fdatasync(req->file->fd) != 0;
+    }
+    TRACE_END("journal_flush");
+}
+
+static void *io_backend_main(void *arg) {
+    (void)arg;
+    IoRequest reqs[IO_MAX_FILES];
+    pthread_mutex_lock(&io_backend.lock);
+    for (;;) {
+        int n = 0;
+        for (int i = 0; i < io_backend.nfiles; ++i) {
+            IoFile *f = io_backend.files[i];
+            if (f->fill == 0 || f->in_flight) continue;
+            reqs[n].file = f;
+            reqs[n].data = f->buf[f->active];
+            reqs[n].len = f->fill;
+            reqs[n].offset = f->offset - f->fill;
+            reqs[n].written = 0;
+            reqs[n].sync_failed = 0;
+            f->active ^= 1;
+            f->fill = 0;
+            f->in_flight = 1;
+            n++;
+        }
+        if (n == 0) {
+            if (io_backend.stopping) break;
+            pthread_cond_wait(&io_backend.work, &io_backend.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&io_backend.lock);
+        io_submit_batch(reqs, n);
+        pthread_mutex_lock(&io_backend.lock);
+        io_backend.batches++;
+        for (int i = 0; i < n; ++i) {
+            IoFile *f = reqs[i].file;
+            if (reqs[i].written != (ssize_t)reqs[i].len || reqs[i].sync_failed) {
+                if (!f->error) fprintf(stderr, "Write to %s failed; data after offset %llu may be lost.\n",
+                                       f->name, (unsigned long long)reqs[i].offset);
+                f->error = 1;
+            }
+            f->completed = reqs[i].offset + reqs[i].len;
+            f->in_flight = 0;
+            io_backend.writes++;
+            if (f->durable) io_backend.syncs++;
+            io_backend.bytes += reqs[i].len;
+        }
+        pthread_cond_broadcast(&io_backend.progress);
+    }
+    pthread_mutex_unlock(&io_backend.lock);
+    return NULL;
+}
+
+int io_backend_start() {
+#ifdef PPMS_HAVE_IO_URING
+    io_backend.use_uring = io_uring_init(&io_backend.ring, IO_RING_ENTRIES) == 0;
+#endif
+    io_backend.stopping = 0;
+    if (pthread_create(&io_backend.thread, NULL, io_backend_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start I/O thread; journal and exports will write inline.\n");
+        return -1;
+    }
+    io_backend.running = 1;
+    return 0;
+}
+
+void io_backend_stop() {
+    if (!io_backend.running) return;
+    pthread_mutex_lock(&io_backend.lock);
+    io_backend.stopping = 1;
+    pthread_cond_signal(&io_backend.work);
+    pthread_mutex_unlock(&io_backend.lock);
+    pthread_join(io_backend.thread, NULL);
+    io_backend.running = 0;
+#ifdef PPMS_HAVE_IO_URING
+    if (io_backend.use_uring) io_uring_release(&io_backend.ring);
+    io_backend.use_uring = 0;
+#endif
+}
+
+const char *io_backend_name() {
+    if (!io_backend.running) return "inline pwrite";
+    return io_backend.use_uring ? "io_uring" : "pwrite thread";
+}
+
+/* Opens fd for write-behind appends starting at offset. Durable files are fdatasync'ed after every batch. */
+IoFile *io_file_open(const char *name, int fd, uint64_t offset, int durable) {
+    IoFile *f = (IoFile*) calloc(1, sizeof(IoFile));
+    if (!f) return NULL;
+    f->buf[0] = (char*) malloc(IO_STAGING_BYTES);
+    f->buf[1] = (char*) malloc(IO_STAGING_BYTES);
+    if (!f->buf[0] || !f->buf[1]) {
+        free(f->buf[0]); free(f->buf[1]); free(f);
+        return NULL;
+    }
+    f->name = name;
+    f->fd = fd;
+    f->durable = durable;
+    f->offset = offset;
+    f->completed = offset;
+    pthread_mutex_lock(&io_backend.lock);
+    if (io_backend.nfiles == IO_MAX_FILES) {
+        pthread_mutex_unlock(&io_backend.lock);
+        free(f->buf[0]); free(f->buf[1]); free(f);
+        return NULL;
+    }
+    io_backend.files[io_backend.nfiles++] = f;
+    pthread_mutex_unlock(&io_backend.lock);
+    return f;
+}
+
+int io_file_append(IoFile *f, const void *data, size_t len) {
+    if (len > IO_STAGING_BYTES) return -1;
+    pthread_mutex_lock(&io_backend.lock);
+    if (!io_backend.running) {
+        pthread_mutex_unlock(&io_backend.lock);
+        ssize_t n = io_pwrite_all(f->fd, (const char*)data, len, f->offset);
+        if (n != (ssize_t)len || (f->durable && fdatasync(f->fd) != 0)) return -1;
+        f->offset += len;
+        f->completed = f->offset;
+        return 0;
+    }
+    while (f->fill + len > IO_STAGING_BYTES) {
+        pthread_cond_signal(&io_backend.work);
+        pthread_cond_wait(&io_backend.progress, &io_backend.lock);
+    }
+    memcpy(f->buf[f->active] + f->fill, data, len);
+    f->fill += len;
+    f->offset += len;
+    int error = f->error;
+    pthread_cond_signal(&io_backend.work);
+    pthread_mutex_unlock(&io_backend.lock);
+    return error ? -1 : 0;
+}
+
+/* Waits until everything appended so far has reached the file. */
+int io_file_sync(IoFile *f) {
+    pthread_mutex_lock(&io_backend.lock);
+    while (io_backend.running && f->completed < f->offset) {
+        pthread_cond_signal(&io_backend.work);
+        pthread_cond_wait(&io_backend.progress, &io_backend.lock);
+    }
+    int error = f->error;
+    pthread_mutex_unlock(&io_backend.lock);
+    return error ? -1 : 0;
+}
+
+/* Flushes, detaches and closes f; returns -1 if any write to it failed. */
+int io_file_close(IoFile *f) {
+    if (!f) return 0;
+    int rc = io_file_sync(f);
+    pthread_mutex_lock(&io_backend.lock);
+    for (int i = 0; i < io_backend.nfiles; ++i) {
+        if (io_backend.files[i] != f) continue;
+        io_backend.files[i] = io_backend.files[--io_backend.nfiles];
+        break;
+    }
+    pthread_mutex_unlock(&io_backend.lock);
+    if (close(f->fd) != 0) rc = -1;
+    free(f->buf[0]);
+    free(f->buf[1]);
+    free(f);
+    return rc;
+}
+
+/*
+ * Sale journal: every committed sale, fuel supply and pump status change is
+ * appended as a typed binary record through the write-behind backend, and
+ * replayed into the in-memory store by journal_open() at startup. Records
+ * carry a CRC32C; a torn or failing record at the tail (crash mid-write) is
+ * cut off before appending resumes, but a failing record with intact data
+ * after it means media corruption and recovery stops instead.
+ *
+ * The live segment is the --journal path itself. A checkpoint (see
+ * checkpoint_now) starts a new segment with the next generation number, so
+ * recovery only replays segments newer than the last checkpoint.
+ */
+#define JOURNAL_MAGIC "PPMSJNL1"
+#define JOURNAL_VERSION 6
+#define JOURNAL_CHECKPOINT_RECORDS 50000
+
+typedef enum { JREC_SALE = 1, JREC_SUPPLY = 2, JREC_PUMP_STATUS = 3, JREC_SETTLE = 4,
+               JREC_AUTH_CODE = 5 } JournalRecordType;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t generation;
+} JournalHeader;
+
+typedef struct {
+    uint32_t type;
+    uint32_t length;
+    uint32_t crc;
+} JournalRecordHeader;
+
+/* CRC32C over type, length and payload. */
+static uint32_t journal_record_crc(const JournalRecordHeader *h, const void *payload) {
+    uint32_t c = crc32c(0, h, offsetof(JournalRecordHeader, crc));
+    return crc32c(c, payload, h->length);
+}
+
+typedef struct {
+    uint64_t sequence;
+    Transaction tx;
+} JournalSale;
+
+typedef struct {
+    int64_t timestamp;
+    int32_t fuel;
+    int32_t reserved;
+    double quantity;
+} JournalSupply;
+
+typedef struct {
+    int64_t timestamp;
+    int32_t pump_id;
+    int32_t status;
+} JournalPumpStatus;
+
+/* transactions[first, last) moved to state; a SETTLE_SUBMITTED record also advances the settlement cursor to last. */
+typedef struct {
+    uint64_t first;
+    uint64_t last;
+    uint32_t batch_no;
+    uint32_t state;
+} JournalSettle;
+
+/* Auth code returned when an offline authorization was forwarded. */
+typedef struct {
+    uint64_t tx_index;
+    char txn_id[32];
+    uint32_t auth_code;
+    uint32_t reserved;
+} JournalAuthCode;
+
+static IoFile *journal = NULL;
+
+/* Guarded by station_lock, like journal itself. */
+static struct {
+    char path[256];
+    char next_path[272];
+    uint64_t generation;
+    unsigned long since_checkpoint;
+    int keep_segments;
+    int restored;               /* startup found a checkpoint or journal records */
+    /* The rest is owned by checkpoint_now (checkpointer.lock) once the journal is open. */
+    uint64_t checkpointed;      /* generation the installed checkpoint covers */
+    uint64_t pending_from;      /* oldest uncovered segment kept as path.N, 0 if none */
+    int live_next;              /* the live segment is still at next_path */
+} journal_ctl;
+
+static void checkpoint_request(void);
+static int journal_sync(void);
+static int settlement_mark(size_t first, size_t last, unsigned batch_no, int state);
+
+static void journal_append(JournalRecordType type, const void *payload, uint32_t len) {
+    if (!journal) return;
+    char rec[sizeof(JournalRecordHeader) + sizeof(JournalSale)];
+    JournalRecordHeader h = { (uint32_t)type, len, 0 };
+    h.crc = journal_record_crc(&h, payload);
+    memcpy(rec, &h, sizeof(h));
+    memcpy(rec + sizeof(h), payload, len);
+    io_file_append(journal, rec, sizeof(h) + len);
+    if (++journal_ctl.since_checkpoint == JOURNAL_CHECKPOINT_RECORDS) checkpoint_request();
+}
+
+void journal_sale(const Transaction *tx) {
+    JournalSale rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.sequence = txn_sequence;
+    rec.tx = *tx;
+    journal_append(JREC_SALE, &rec, sizeof(rec));
+}
+
+void journal_supply(int fuel, double qty) {
+    JournalSupply rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.timestamp = (int64_t)time(NULL);
+    rec.fuel = fuel;
+    rec.quantity = qty;
+    journal_append(JREC_SUPPLY, &rec, sizeof(rec));
+}
+
+void journal_pump_status(int pump_id, PumpStatus status) {
+    JournalPumpStatus rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.timestamp = (int64_t)time(NULL);
+    rec.pump_id = pump_id;
+    rec.status = (int32_t)status;
+    journal_append(JREC_PUMP_STATUS, &rec, sizeof(rec));
+}
+
+void journal_settle(size_t first, size_t last, unsigned batch_no, int state) {
+    JournalSettle rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.first = first;
+    rec.last = last;
+    rec.batch_no = batch_no;
+    rec.state = (uint32_t)state;
+    journal_append(JREC_SETTLE, &rec, sizeof(rec));
+}
+
+void journal_auth_code(size_t index, const char *txn_id, unsigned int auth_code) {
+    JournalAuthCode rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.tx_index = index;
+    snprintf(rec.txn_id, sizeof(rec.txn_id), "%s", txn_id);
+    rec.auth_code = auth_code;
+    journal_append(JREC_AUTH_CODE, &rec, sizeof(rec));
+}
+
+static int journal_apply(const JournalRecordHeader *h, const char *payload) {
+    switch (h->type) {
+        case JREC_SALE: {
+            JournalSale rec;
+            if (h->length != sizeof(rec)) return -1;
+            memcpy(&rec, payload, sizeof(rec));
+            if (rec.tx.fuel_type < FUEL_PETROL || rec.tx.fuel_type > FUEL_CNG) return -1;
+            fuels[rec.tx.fuel_type].current_stock -= rec.tx.quantity;
+            pump_slot_bind(rec.tx.pump_id);
+            record_transaction(&rec.tx);
+            txn_sequence = (unsigned long)rec.sequence;
+            return 0;
+        }
+        case JREC_SUPPLY: {
+            JournalSupply rec;
+            if (h->length != sizeof(rec)) return -1;
+            memcpy(&rec, payload, sizeof(rec));
+            if (rec.fuel < 0 || rec.fuel > 2) return -1;
+            fuels[rec.fuel].current_stock += rec.quantity;
+            return 0;
+        }
+        case JREC_PUMP_STATUS: {
+            JournalPumpStatus rec;
+            if (h->length != sizeof(rec)) return -1;
+            memcpy(&rec, payload, sizeof(rec));
+            int idx = pump_slot_bind(rec.pump_id);
+            if (idx < 0 || rec.status < PUMP_ACTIVE || rec.status > PUMP_MAINT) return -1;
+            pumps[idx].status = (PumpStatus)rec.status;
+            return 0;
+        }
+        case JREC_SETTLE: {
+            JournalSettle rec;
+            if (h->length != sizeof(rec)) return -1;
+            memcpy(&rec, payload, sizeof(rec));
+            if (rec.first > rec.last || rec.last > tx_count) return -1;
+            return settlement_mark((size_t)rec.first, (size_t)rec.last, rec.batch_no, (int)rec.state);
+        }
+        case JREC_AUTH_CODE: {
+            JournalAuthCode rec;
+            if (h->length != sizeof(rec)) return -1;
+            memcpy(&rec, payload, sizeof(rec));
+            if (rec.tx_index >= tx_count || strncmp(transactions[rec.tx_index].txn_id, rec.txn_id, sizeof(rec.txn_id)) != 0)
+                return -1;
+            transactions[rec.tx_index].auth_code = rec.auth_code;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int sync_parent_dir(const char *path) {
+    char dir[256];
+    const char *slash = strrchr(path, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else if (slash == path) snprintf(dir, sizeof(dir), "/");
+    else snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = (const char*) data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Creates a journal segment holding only its header; returns the fd or -1. */
+static int journal_create(const char *path, uint64_t generation) {
+    struct stat want, live;
+    if (journal && stat(path, &want) == 0 && fstat(journal->fd, &live) == 0 &&
+        want.st_dev == live.st_dev && want.st_ino == live.st_ino) {
+        fprintf(stderr, "Refusing to overwrite the open journal segment %s.\n", path);
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    JournalHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic));
+    hdr.version = JOURNAL_VERSION;
+    hdr.record_size = (uint32_t)sizeof(Transaction);
+    hdr.generation = generation;
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || fdatasync(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int journal_read_header(int fd, const char *path, JournalHeader *hdr) {
+    if (pread(fd, hdr, sizeof(*hdr), 0) != (ssize_t)sizeof(*hdr) ||
+        memcmp(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != JOURNAL_VERSION || hdr->record_size != sizeof(Transaction)) {
+        fprintf(stderr, "%s is not a journal this build can read.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Replays one journal segment into the in-memory store and cuts off a torn
+ * tail. *end receives the offset where appends should resume. Returns the
+ * number of records replayed, or -1 if the segment cannot be trusted.
+ */
+static long journal_replay(int fd, const char *path, uint64_t *end) {
+    struct stat st;
+    uint64_t size = fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    size_t cap = IO_STAGING_BYTES, have = 0;
+    char *buf = (char*) malloc(cap);
+    if (!buf) return -1;
+    uint64_t good = sizeof(JournalHeader);
+    long recovered = 0;
+    int stop = 0;
+    while (!stop) {
+        ssize_t n = pread(fd, buf + have, cap - have, (off_t)(good + have));
+        if (n <= 0) break;
+        have += (size_t)n;
+        size_t pos = 0;
+        while (have - pos >= sizeof(JournalRecordHeader)) {
+            JournalRecordHeader h;
+            memcpy(&h, buf + pos, sizeof(h));
+            uint64_t rec_end = good + pos + sizeof(h) + h.length;
+            /* A bad length is a torn tail only if no complete record could follow it. */
+            uint64_t left = size - (good + pos + sizeof(h));
+            if (h.length > sizeof(JournalSale)) { stop = left < sizeof(JournalSale) ? 1 : -1; break; }
+            if (have - pos < sizeof(h) + h.length) break;
+            const char *payload = buf + pos + sizeof(h);
+            if (journal_record_crc(&h, payload) != h.crc) { stop = rec_end >= size ? 1 : -1; break; }
+            if (journal_apply(&h, payload) != 0) { stop = -1; break; }
+            pos += sizeof(h) + h.length;
+            recovered++;
+        }
+        memmove(buf, buf + pos, have - pos);
+        have -= pos;
+        good += pos;
+    }
+    free(buf);
+    if (stop < 0) {
+        fprintf(stderr, "Journal %s is corrupt at offset %llu with valid data after it; "
+                        "refusing to truncate. Move it aside or restore a backup.\n",
+                path, (unsigned long long)good);
+        return -1;
+    }
+    if (size > good) {
+        fprintf(stderr, "Journal %s: discarding %llu bytes of torn tail.\n", path,
+                (unsigned long long)(size - good));
+        if (ftruncate(fd, (off_t)good) != 0) return -1;
+    }
+    *end = good;
+    return recovered;
+}
+
+
+const char* sale_status_message(SaleStatus st) {
+    switch (st) {
+        case SALE_OK: return "OK";
+        case SALE_ERR_PUMP: return "Invalid pump id.";
+        case SALE_ERR_PUMP_STATUS: return "Selected pump is not active.";
+        case SALE_ERR_VEHICLE: return "Invalid vehicle type.";
+        case SALE_ERR_QUANTITY: return "Invalid quantity.";
+        case SALE_ERR_PAYMENT: return "Invalid payment mode.";
+        case SALE_PENDING_AUTH: return "Payment authorization pending.";
+        case SALE_ERR_AUTH_BUSY: return "Too many payments awaiting authorization; try again.";
+        case SALE_OFFLINE_APPROVED: return "Approved offline; authorization will be forwarded when the link returns.";
+        case SALE_ERR_OFFLINE_LIMIT: return "Payment link is down and the amount exceeds the offline floor limit; use cash.";
+        case SALE_ERR_OVERLOAD: return "Sale engine is overloaded; request was not admitted.";
+        default: return "Insufficient stock.";
+    }
+}
+
+/* Caller holds station_lock. */
+static void sale_rate_record(double amount) {
+    time_t now = time(NULL);
+    size_t i = (size_t)now % RATE_WINDOW_SECS;
+    if (sale_rate.sec[i] != now) {
+        sale_rate.sec[i] = now;
+        sale_rate.count[i] = 0;
+        sale_rate.amount[i] = 0.0;
+    }
+    sale_rate.count[i]++;
+    sale_rate.amount[i] += amount;
+}
+
+/* Caller holds station_lock. Sums the last secs seconds, the current one included. */
+static void sale_rate_window(int secs, unsigned long *count, double *amount) {
+    time_t now = time(NULL);
+    *count = 0;
+    *amount = 0.0;
+    for (int k = 0; k < secs && k < RATE_WINDOW_SECS; ++k) {
+        size_t i = (size_t)(now - k) % RATE_WINDOW_SECS;
+        if (sale_rate.sec[i] != now - k) continue;
+        *count += sale_rate.count[i];
+        *amount += sale_rate.amount[i];
+    }
+}
+
+static SaleStatus validate_sale(const SaleRequest *req, FuelType *ftype_out, double *qty_out, double *amt_out) {
+    if (req->vehicle_type < VEH_2W || req->vehicle_type > VEH_COMM) return SALE_ERR_VEHICLE;
+    if (req->payment_mode < PAY_CASH || req->payment_mode > PAY_WALLET) return SALE_ERR_PAYMENT;
+    if (!(req->value > 0)) return SALE_ERR_QUANTITY;
+    unsigned ticket;
+    const StationConfig *cfg = config_acquire(&ticket);
+    const PumpConfig *pc = config_pump(cfg, req->pump_id);
+    if (!pc) {
+        config_release(ticket);
+        return SALE_ERR_PUMP;
+    }
+    if (pumps[pc->slot].status != PUMP_ACTIVE) {
+        config_release(ticket);
+        return SALE_ERR_PUMP_STATUS;
+    }
+
+    FuelType ftype = pc->fuel;
+    double unit_price = cfg->price[ftype];
+    config_release(ticket);
+    double qty, amt;
+    if (req->by_amount) {
+        amt = req->value;
+        qty = amt / unit_price;
+    } else {
+        qty = req->value;
+        amt = qty * unit_price;
+    }
+    *ftype_out = ftype;
+    *qty_out = qty;
+    *amt_out = amt;
+    return SALE_OK;
+}
+
+/* Both stages are timed on every exit, so rejected sales show up in their histograms too. */
+static SaleStatus price_sale(const SaleRequest *req, FuelType *ftype_out, double *qty_out, double *amt_out) {
+    PROF_START(t_validate);
+    SaleStatus st = validate_sale(req, ftype_out, qty_out, amt_out);
+    PROF_STOP(PROF_VALIDATE, t_validate);
+    if (st != SALE_OK) return st;
+
+    PROF_START(t_stock);
+    if (*qty_out > fuels[*ftype_out].current_stock) st = SALE_ERR_STOCK;
+    PROF_STOP(PROF_STOCK_CHECK, t_stock);
+    return st;
+}
+
+/* Caller holds station_lock; assigns the next txn id. The sale is stored at index tx_count by store_sale. */
+static void prepare_sale(const SaleRequest *req, FuelType ftype, double qty, double amt,
+                         unsigned int auth_code, Transaction *tx) {
+    memset(tx, 0, sizeof(*tx));
+    PROF_START(t_id);
+    generate_txn_id(req->timestamp, tx->txn_id, sizeof(tx->txn_id));
+    PROF_STOP(PROF_TXN_ID, t_id);
+    tx->timestamp = req->timestamp;
+    tx->pump_id = req->pump_id;
+    tx->fuel_type = ftype;
+    tx->vehicle_type = req->vehicle_type;
+    tx->quantity = qty;
+    tx->amount = amt;
+    tx->payment_mode = req->payment_mode;
+    tx->processor_id = payment_processor_for(req->payment_mode);
+    tx->auth_code = auth_code;
+    tx->vehicle_hash = req->vehicle_hash;
+    tx->customer_hash = req->customer_hash;
+}
+
+/* Caller holds station_lock and has already taken the quantity out of current_stock. */
+static void store_sale(const Transaction *tx, Transaction *out) {
+    PROF_START(t_record);
+    record_transaction(tx);
+    PROF_STOP(PROF_RECORD, t_record);
+    journal_sale(tx);
+    sale_rate_record(tx->amount);
+
+    if (out) *out = *tx;
+}
+
+/* Caller holds station_lock and has already taken qty out of current_stock. */
+static void commit_sale(const SaleRequest *req, FuelType ftype, double qty, double amt,
+                        unsigned int auth_code, Transaction *out) {
+    Transaction tx;
+    prepare_sale(req, ftype, qty, amt, auth_code, &tx);
+    store_sale(&tx, out);
+}
+
+static SaleStatus apply_sale(const SaleRequest *req, Transaction *out) {
+    FuelType ftype;
+    double qty, amt;
+    capture_hold();
+    SaleStatus st = price_sale(req, &ftype, &qty, &amt);
+    if (st == SALE_OK) {
+        fuels[ftype].current_stock -= qty;
+        commit_sale(req, ftype, qty, amt, 0, out);
+        capture_sale(req);
+    }
+    capture_unhold();
+    return st;
+}
+
+SaleStatus execute_sale(const SaleRequest *req, Transaction *out) {
+    TRACE_BEGIN("sale");
+    pthread_mutex_lock(&station_lock);
+    SaleStatus st = apply_sale(req, out);
+    pthread_mutex_unlock(&station_lock);
+    TRACE_END("sale");
+    return st;
+}
+
+/*
+ * Asynchronous card/wallet authorization. payment_submit() validates the sale,
+ * reserves its fuel by taking it out of current_stock and hands the amount to
+ * a PaymentProcessor, then returns so the pump can serve the next customer.
+ * The processor reports back through payment_auth_result() from any thread;
+ * the pipeline thread then commits the sale, or puts the reserved fuel back on
+ * a decline or when PAYMENT_AUTH_TIMEOUT_MS passes without an answer. Replay
+ * captures only committed sales, in commit order. The reservation is admitted
+ * like any new sale; the final commit is admitted as a dispense.
+ */
+#define PAYMENT_MAX_PENDING 256
+#define PAYMENT_AUTH_TIMEOUT_MS 3000
+#define OFFLINE_QUEUE_FILE "offline_auth.queue"
+#define OFFLINE_FORWARD_BATCH 2048
+#define OFFLINE_POLL_MS 1000
+#define FLOOR_LIMIT_CARD 2000.0
+#define FLOOR_LIMIT_WALLET 1000.0
+
+typedef enum { AUTH_FREE = 0, AUTH_IN_FLIGHT, AUTH_APPROVED, AUTH_DECLINED, AUTH_EXPIRED } AuthState;
+
+typedef struct {
+    AuthState state;
+    unsigned long id;
+    SaleRequest req;
+    FuelType fuel_type;
+    double quantity;
+    double amount;
+    unsigned int auth_code;
+    struct timespec deadline;
+    Timer expiry;
+    char contact[64];
+} PaymentAuth;
+
+typedef struct {
+    char txn_id[32];
+    int64_t timestamp;
+    int32_t payment_mode;
+    int32_t processor_id;
+    double amount;
+    uint64_t tx_index;
+} OfflineAuth;
+
+typedef struct {
+    const char *name;
+    void *ctx;
+    int (*authorize)(void *ctx, unsigned long auth_id, int processor_id, PaymentMode mode, double amount);
+    int (*authorize_batch)(void *ctx, const OfflineAuth *batch, size_t n, int *approved, unsigned int *codes);
+    int (*link_up)(void *ctx);
+    void (*stop)(void *ctx);
+} PaymentProcessor;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+    int running;
+    int stopping;
+    PaymentProcessor processor;
+    unsigned long next_id;
+    size_t in_flight;
+    unsigned long approved;
+    unsigned long declined;
+    unsigned long timed_out;
+    double reserved_stock[3];   /* guarded by station_lock, not lock */
+    int deadline_scan;          /* no timer thread: the pipeline expires slots itself */
+    Timer offline_poll;
+    PaymentAuth slots[PAYMENT_MAX_PENDING];
+} payments = { .lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER };
+
+/*
+ * Store-and-forward. While the processor link is down, card/wallet sales up to
+ * the floor limit are approved locally: an OfflineAuth record is appended
+ * (and fsync'd) to OFFLINE_QUEUE_FILE, then the sale commits at once. When the
+ * link returns, the pipeline thread forwards the queue in bulk batches; the
+ * returned auth codes are written back into the stored transactions and the
+ * queue is truncated. Offline declines cannot be undone, only reported.
+ */
+static struct {
+    pthread_mutex_t lock;
+    int fd;
+    size_t pending;
+    unsigned long queued;
+    unsigned long forwarded;
+    unsigned long declined;
+    double declined_amount;
+} offline_queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+static int offline_queue_open(void) {
+    offline_queue.fd = open(OFFLINE_QUEUE_FILE, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (offline_queue.fd < 0) return -1;
+    off_t size = lseek(offline_queue.fd, 0, SEEK_END);
+    offline_queue.pending = size > 0 ? (size_t)size / sizeof(OfflineAuth) : 0;
+    if (offline_queue.pending > 0)
+        printf("%zu offline authorizations waiting to be forwarded.\n", offline_queue.pending);
+    return 0;
+}
+
+static int offline_queue_append(const OfflineAuth *rec) {
+    pthread_mutex_lock(&offline_queue.lock);
+    int ok = offline_queue.fd >= 0 &&
+             write(offline_queue.fd, rec, sizeof(*rec)) == (ssize_t)sizeof(*rec) &&
+             fsync(offline_queue.fd) == 0;
+    if (ok) {
+        offline_queue.pending++;
+        offline_queue.queued++;
+    }
+    pthread_mutex_unlock(&offline_queue.lock);
+    return ok ? 0 : -1;
+}
+
+static double floor_limit_for(PaymentMode mode) {
+    return mode == PAY_CARD ? FLOOR_LIMIT_CARD : FLOOR_LIMIT_WALLET;
+}
+
+/*
+ * Rewrites the queue without its first n records through OFFLINE_QUEUE_FILE.tmp
+ * and rename, so a crash leaves either the old queue or the new one. Caller
+ * holds offline_queue.lock.
+ */
+static int offline_queue_drop_head(size_t n) {
+    static OfflineAuth batch[OFFLINE_FORWARD_BATCH];
+    const char *tmp = OFFLINE_QUEUE_FILE ".tmp";
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) return -1;
+    size_t remaining = offline_queue.pending - n;
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < remaining; i += OFFLINE_FORWARD_BATCH) {
+        size_t k = remaining - i < OFFLINE_FORWARD_BATCH ? remaining - i : OFFLINE_FORWARD_BATCH;
+        off_t from = (off_t)((n + i) * sizeof(OfflineAuth));
+        if (pread(offline_queue.fd, batch, k * sizeof(OfflineAuth), from) != (ssize_t)(k * sizeof(OfflineAuth)))
+            rc = -1;
+        else
+            rc = write_all(fd, batch, k * sizeof(OfflineAuth));
+    }
+    if (rc == 0) rc = fsync(fd);
+    if (rc == 0) rc = rename(tmp, OFFLINE_QUEUE_FILE);
+    if (rc != 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    sync_parent_dir(OFFLINE_QUEUE_FILE);
+    close(offline_queue.fd);
+    offline_queue.fd = fd;
+    offline_queue.pending = remaining;
+    return 0;
+}
+
+/*
+ * Forwards the authorizations queued when the call starts; returns the number
+ * forwarded. The queue lock is dropped around the processor call so offline
+ * sales can keep appending. New auth codes are journaled before the queue is
+ * cut, so after a crash a record is forwarded again rather than lost.
+ */
+static size_t offline_forward(const PaymentProcessor *proc) {
+    static OfflineAuth batch[OFFLINE_FORWARD_BATCH];
+    int approved[OFFLINE_FORWARD_BATCH];
+    unsigned int codes[OFFLINE_FORWARD_BATCH];
+    size_t forwarded = 0;
+
+    TRACE_BEGIN("offline_forward");
+    pthread_mutex_lock(&offline_queue.lock);
+    size_t total = offline_queue.pending;
+    pthread_mutex_unlock(&offline_queue.lock);
+    while (forwarded < total) {
+        size_t want = total - forwarded < OFFLINE_FORWARD_BATCH ? total - forwarded : OFFLINE_FORWARD_BATCH;
+        pthread_mutex_lock(&offline_queue.lock);
+        ssize_t got = pread(offline_queue.fd, batch, want * sizeof(OfflineAuth),
+                            (off_t)(forwarded * sizeof(OfflineAuth)));
+        pthread_mutex_unlock(&offline_queue.lock);
+        if (got < (ssize_t)(want * sizeof(OfflineAuth))) break;
+        if (proc->authorize_batch(proc->ctx, batch, want, approved, codes) != 0) break;
+
+        pthread_mutex_lock(&station_lock);
+        for (size_t i = 0; i < want; ++i) {
+            uint64_t idx = batch[i].tx_index;
+            if (idx < tx_count && strcmp(transactions[idx].txn_id, batch[i].txn_id) == 0) {
+                transactions[idx].auth_code = approved[i] ? codes[i] : 0;
+                mark_tx_dirty((size_t)idx);
+                journal_auth_code((size_t)idx, transactions[idx].txn_id, transactions[idx].auth_code);
+            }
+            if (!approved[i]) {
+                offline_queue.declined++;
+                offline_queue.declined_amount += batch[i].amount;
+                notice("[Payment] Offline %s sale %s (INR %.2f) declined by processor; collect payment.",
+                       payment_name((PaymentMode)batch[i].payment_mode), batch[i].txn_id, batch[i].amount);
+            }
+        }
+        pthread_mutex_unlock(&station_lock);
+        forwarded += want;
+    }
+
+    if (forwarded > 0) {
+        journal_sync();
+        pthread_mutex_lock(&offline_queue.lock);
+        if (offline_queue_drop_head(forwarded) != 0)
+            notice("[Payment] Could not rewrite %s; forwarded authorizations will be sent again.",
+                   OFFLINE_QUEUE_FILE);
+        else
+            offline_queue.forwarded += forwarded;
+        size_t remaining = offline_queue.pending;
+        pthread_mutex_unlock(&offline_queue.lock);
+        notice("[Payment] Link restored: forwarded %zu offline authorizations, %zu still queued.",
+               forwarded, remaining);
+    }
+    TRACE_END("offline_forward");
+    return forwarded;
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void timespec_add_ms(struct timespec *ts, long ms) {
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+void payment_auth_result(unsigned long auth_id, int approved, unsigned int auth_code) {
+    pthread_mutex_lock(&payments.lock);
+    PaymentAuth *a = &payments.slots[auth_id % PAYMENT_MAX_PENDING];
+    if (a->state == AUTH_IN_FLIGHT && a->id == auth_id) {
+        a->state = approved ? AUTH_APPROVED : AUTH_DECLINED;
+        a->auth_code = auth_code;
+        pthread_cond_signal(&payments.changed);
+    }
+    pthread_mutex_unlock(&payments.lock);
+}
+
+/* Timer callback: the reservation ran out before the processor answered. */
+static void payment_auth_expire(void *arg, unsigned long auth_id) {
+    PaymentAuth *a = (PaymentAuth*) arg;
+    pthread_mutex_lock(&payments.lock);
+    if (a->state == AUTH_IN_FLIGHT && a->id == auth_id) {
+        a->state = AUTH_EXPIRED;
+        pthread_cond_signal(&payments.changed);
+    }
+    pthread_mutex_unlock(&payments.lock);
+}
+
+SaleStatus admit_step(const SaleRequest *req, AdmissionClass cls, SaleStatus (*step)(void *ctx), void *ctx,
+                      Transaction *out, AdmissionResult *adm);
+
+typedef struct {
+    PaymentAuth *auth;
+    AuthState outcome;
+    int done;
+    Transaction tx;
+} PaymentCommit;
+
+/* Settles a finished authorization: commits the sale or returns its fuel. */
+static SaleStatus payment_commit_step(void *ctx) {
+    PaymentCommit *c = (PaymentCommit*) ctx;
+    PaymentAuth *a = c->auth;
+    pthread_mutex_lock(&station_lock);
+    payments.reserved_stock[a->fuel_type] -= a->quantity;
+    if (c->outcome == AUTH_APPROVED) {
+        commit_sale(&a->req, a->fuel_type, a->quantity, a->amount, a->auth_code, &c->tx);
+        /* Replay must not re-price or re-check the pump: both may have changed since submit. */
+        capture_authorized_sale(&a->req, a->fuel_type, a->quantity, a->amount);
+    } else {
+        fuels[a->fuel_type].current_stock += a->quantity;
+    }
+    pthread_mutex_unlock(&station_lock);
+    c->done = 1;
+    return SALE_OK;
+}
+
+/*
+ * The fuel is already dispensed, so the commit goes through admission as a
+ * dispense; if admission refuses it (or the pump has since been removed) it
+ * runs inline, since it cannot be dropped.
+ */
+static void payment_finish(PaymentAuth *a, AuthState outcome) {
+    PaymentCommit c;
+    memset(&c, 0, sizeof(c));
+    c.auth = a;
+    c.outcome = outcome;
+    admit_step(&a->req, ADMIT_DISPENSE, payment_commit_step, &c, NULL, NULL);
+    if (!c.done) payment_commit_step(&c);
+    Transaction tx = c.tx;
+
+    if (outcome == AUTH_APPROVED) {
+        notice("[Payment] Pump %d: %s INR %.2f approved (auth %06u).",
+               a->req.pump_id, payment_name(a->req.payment_mode), a->amount, a->auth_code);
+        print_receipt(&tx);
+        if (strcmp(a->contact, "-") != 0) ereceipt_enqueue(&tx, a->contact);
+        pthread_mutex_lock(&station_lock);
+        check_low_stock_alerts();
+        pthread_mutex_unlock(&station_lock);
+    } else {
+        notice("[Payment] Pump %d: %s INR %.2f %s; %.3f units returned to stock.",
+               a->req.pump_id, payment_name(a->req.payment_mode), a->amount,
+               outcome == AUTH_DECLINED ? "declined" : "timed out", a->quantity);
+    }
+}
+
+static void payment_offline_poll_fire(void *arg, unsigned long data) {
+    (void)arg;
+    (void)data;
+    pthread_mutex_lock(&payments.lock);
+    pthread_cond_signal(&payments.changed);
+    pthread_mutex_unlock(&payments.lock);
+}
+
+static void *payment_pipeline_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&payments.lock);
+    for (;;) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        struct timespec next = now;
+        int have_next = 0;
+        PaymentAuth *ready = NULL;
+        AuthState outcome = AUTH_FREE;
+        for (int i = 0; i < PAYMENT_MAX_PENDING && !ready; ++i) {
+            PaymentAuth *a = &payments.slots[i];
+            if (a->state == AUTH_APPROVED || a->state == AUTH_DECLINED) {
+                ready = a;
+                outcome = a->state;
+            } else if (a->state == AUTH_EXPIRED) {
+                ready = a;
+                outcome = AUTH_FREE;
+            } else if (a->state == AUTH_IN_FLIGHT && payments.deadline_scan) {
+                if (!timespec_before(&now, &a->deadline)) {
+                    ready = a;
+                    outcome = AUTH_FREE;
+                } else if (!have_next || timespec_before(&a->deadline, &next)) {
+                    next = a->deadline;
+                    have_next = 1;
+                }
+            }
+        }
+        if (ready) {
+            timer_cancel(&ready->expiry);
+            PaymentAuth done = *ready;
+            ready->state = AUTH_FREE;
+            payments.in_flight--;
+            if (outcome == AUTH_APPROVED) payments.approved++;
+            else if (outcome == AUTH_DECLINED) payments.declined++;
+            else payments.timed_out++;
+            pthread_cond_broadcast(&payments.changed);
+            pthread_mutex_unlock(&payments.lock);
+            payment_finish(&done, outcome);
+            pthread_mutex_lock(&payments.lock);
+            continue;
+        }
+        pthread_mutex_lock(&offline_queue.lock);
+        size_t offline_pending = offline_queue.pending;
+        pthread_mutex_unlock(&offline_queue.lock);
+        if (offline_pending > 0 && payments.processor.link_up(payments.processor.ctx)) {
+            pthread_mutex_unlock(&payments.lock);
+            offline_forward(&payments.processor);
+            pthread_mutex_lock(&payments.lock);
+            continue;
+        }
+        if (payments.stopping && payments.in_flight == 0) break;
+        if (offline_pending > 0 &&
+            timer_arm(&payments.offline_poll, OFFLINE_POLL_MS, payment_offline_poll_fire, NULL, 0) != 0) {
+            struct timespec poll_at = now;
+            timespec_add_ms(&poll_at, OFFLINE_POLL_MS);
+            if (!have_next || timespec_before(&poll_at, &next)) next = poll_at;
+            have_next = 1;
+        }
+        if (have_next) pthread_cond_timedwait(&payments.changed, &payments.lock, &next);
+        else pthread_cond_wait(&payments.changed, &payments.lock);
+    }
+    pthread_mutex_unlock(&payments.lock);
+    return NULL;
+}
+
+int payment_pipeline_start(PaymentProcessor processor) {
+    payments.processor = processor;
+    payments.stopping = 0;
+    if (offline_queue_open() != 0)
+        fprintf(stderr, "Cannot open %s; offline approvals are disabled.\n", OFFLINE_QUEUE_FILE);
+    if (pthread_create(&payments.thread, NULL, payment_pipeline_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start payment pipeline; card/wallet sales will be accepted instantly.\n");
+        return -1;
+    }
+    payments.running = 1;
+    return 0;
+}
+
+void payment_pipeline_stop() {
+    if (!payments.running) return;
+    pthread_mutex_lock(&payments.lock);
+    if (payments.in_flight > 0)
+        printf("Waiting for %zu payment authorizations to finish...\n", payments.in_flight);
+    payments.stopping = 1;
+    pthread_cond_broadcast(&payments.changed);
+    pthread_mutex_unlock(&payments.lock);
+    pthread_join(payments.thread, NULL);
+    timer_cancel(&payments.offline_poll);
+    if (payments.processor.stop) payments.processor.stop(payments.processor.ctx);
+    payments.running = 0;
+    if (offline_queue.pending > 0)
+        printf("%zu offline authorizations remain queued in %s.\n", offline_queue.pending, OFFLINE_QUEUE_FILE);
+    if (offline_queue.fd >= 0) close(offline_queue.fd);
+    offline_queue.fd = -1;
+}
+
+void payment_pipeline_wake() {
+    pthread_mutex_lock(&payments.lock);
+    pthread_cond_broadcast(&payments.changed);
+    pthread_mutex_unlock(&payments.lock);
+}
+
+typedef struct {
+    const SaleRequest *req;
+    Transaction *out;
+} OfflineSale;
+
+static SaleStatus payment_offline_step(void *ctx) {
+    OfflineSale *o = (OfflineSale*) ctx;
+    const SaleRequest *req = o->req;
+    OfflineAuth rec;
+    Transaction tx;
+    FuelType ftype;
+    double qty, amt;
+    pthread_mutex_lock(&station_lock);
+    capture_hold();
+    SaleStatus st = price_sale(req, &ftype, &qty, &amt);
+    if (st == SALE_OK && (offline_queue.fd < 0 || amt > floor_limit_for(req->payment_mode)))
+        st = SALE_ERR_OFFLINE_LIMIT;
+    if (st != SALE_OK) {
+        capture_unhold();
+        pthread_mutex_unlock(&station_lock);
+        return st;
+    }
+    prepare_sale(req, ftype, qty, amt, 0, &tx);
+    memset(&rec, 0, sizeof(rec));
+    snprintf(rec.txn_id, sizeof(rec.txn_id), "%s", tx.txn_id);
+    rec.timestamp = (int64_t)tx.timestamp;
+    rec.payment_mode = (int32_t)tx.payment_mode;
+    rec.processor_id = tx.processor_id;
+    rec.amount = tx.amount;
+    rec.tx_index = (uint64_t)tx_count;
+    /* The authorization is on disk before the sale is stored or journaled, so no approved sale goes unforwarded. */
+    if (offline_queue_append(&rec) != 0) {
+        txn_sequence--;
+        capture_unhold();
+        pthread_mutex_unlock(&station_lock);
+        fprintf(stderr, "Cannot persist offline authorization for %s; sale refused.\n", rec.txn_id);
+        return SALE_ERR_OFFLINE_LIMIT;
+    }
+    fuels[ftype].current_stock -= qty;
+    store_sale(&tx, o->out);
+    capture_sale(req);
+    capture_unhold();
+    pthread_mutex_unlock(&station_lock);
+    return SALE_OFFLINE_APPROVED;
+}
+
+static SaleStatus payment_submit_offline(const SaleRequest *req, Transaction *out) {
+    OfflineSale o;
+    memset(&o, 0, sizeof(o));
+    o.req = req;
+    o.out = out;
+    return admit_step(req, ADMIT_NEW_AUTH, payment_offline_step, &o, NULL, NULL);
+}
+
+int payment_pipeline_enabled() {
+    return payments.running;
+}
+
+typedef struct {
+    const SaleRequest *req;
+    const char *contact;
+    unsigned long id;
+    double amount;
+} PaymentReserve;
+
+/* Takes an authorization slot and reserves the sale's fuel; the admitted part of payment_submit. */
+static SaleStatus payment_reserve_step(void *ctx) {
+    PaymentReserve *r = (PaymentReserve*) ctx;
+    const SaleRequest *req = r->req;
+    FuelType ftype;
+    double qty, amt;
+    pthread_mutex_lock(&payments.lock);
+    if (payments.in_flight == PAYMENT_MAX_PENDING) {
+        pthread_mutex_unlock(&payments.lock);
+        return SALE_ERR_AUTH_BUSY;
+    }
+    unsigned long id;
+    do {
+        id = ++payments.next_id;
+    } while (payments.slots[id % PAYMENT_MAX_PENDING].state != AUTH_FREE);
+
+    pthread_mutex_lock(&station_lock);
+    SaleStatus st = price_sale(req, &ftype, &qty, &amt);
+    if (st == SALE_OK) {
+        fuels[ftype].current_stock -= qty;
+        payments.reserved_stock[ftype] += qty;
+    }
+    pthread_mutex_unlock(&station_lock);
+    if (st != SALE_OK) {
+        pthread_mutex_unlock(&payments.lock);
+        return st;
+    }
+
+    PaymentAuth *a = &payments.slots[id % PAYMENT_MAX_PENDING];
+    timer_cancel(&a->expiry);
+    memset(a, 0, sizeof(*a));
+    a->state = AUTH_IN_FLIGHT;
+    a->id = id;
+    a->req = *req;
+    a->fuel_type = ftype;
+    a->quantity = qty;
+    a->amount = amt;
+    snprintf(a->contact, sizeof(a->contact), "%s", r->contact ? r->contact : "-");
+    clock_gettime(CLOCK_REALTIME, &a->deadline);
+    timespec_add_ms(&a->deadline, PAYMENT_AUTH_TIMEOUT_MS);
+    if (timer_arm(&a->expiry, PAYMENT_AUTH_TIMEOUT_MS, payment_auth_expire, a, id) != 0)
+        payments.deadline_scan = 1;
+    payments.in_flight++;
+    pthread_cond_signal(&payments.changed);
+    pthread_mutex_unlock(&payments.lock);
+    r->id = id;
+    r->amount = amt;
+    return SALE_PENDING_AUTH;
+}
+
+SaleStatus payment_submit(const SaleRequest *req, const char *contact, unsigned long *auth_id_out,
+                          Transaction *offline_tx) {
+    if (!payments.processor.link_up(payments.processor.ctx)) return payment_submit_offline(req, offline_tx);
+    TRACE_BEGIN("payment_submit");
+    PaymentReserve r = { req, contact, 0, 0.0 };
+    SaleStatus st = admit_step(req, ADMIT_NEW_AUTH, payment_reserve_step, &r, NULL, NULL);
+    if (st != SALE_PENDING_AUTH) {
+        TRACE_END("payment_submit");
+        return st;
+    }
+    if (payments.processor.authorize(payments.processor.ctx, r.id, payment_processor_for(req->payment_mode),
+                                     req->payment_mode, r.amount) != 0)
+        payment_auth_result(r.id, 0, 0);
+    if (auth_id_out) *auth_id_out = r.id;
+    TRACE_END("payment_submit");
+    return SALE_PENDING_AUTH;
+}
+
+void show_pending_authorizations() {
+    if (!payment_pipeline_enabled()) {
+        printf("\nCard/wallet payments are approved instantly (start with --payment-sim to simulate a processor).\n");
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    pthread_mutex_lock(&payments.lock);
+    printf("\n----- Payment Authorizations (%s, link %s) -----\n", payments.processor.name,
+           payments.processor.link_up(payments.processor.ctx) ? "up" : "DOWN");
+    printf("In flight: %zu | Approved: %lu | Declined: %lu | Timed out: %lu\n",
+           payments.in_flight, payments.approved, payments.declined, payments.timed_out);
+    pthread_mutex_lock(&offline_queue.lock);
+    printf("Offline: queued %zu | forwarded %lu | declined after forwarding %lu (INR %.2f) | floor limits card %.2f, wallet %.2f\n",
+           offline_queue.pending, offline_queue.forwarded, offline_queue.declined,
+           offline_queue.declined_amount, FLOOR_LIMIT_CARD, FLOOR_LIMIT_WALLET);
+    pthread_mutex_unlock(&offline_queue.lock);
+    for (int i = 0; i < PAYMENT_MAX_PENDING; ++i) {
+        const PaymentAuth *a = &payments.slots[i];
+        if (a->state != AUTH_IN_FLIGHT) continue;
+        long left_ms = (long)(a->deadline.tv_sec - now.tv_sec) * 1000 + (a->deadline.tv_nsec - now.tv_nsec) / 1000000;
+        printf("Auth %lu | Pump %d | %s via %s | INR %.2f | %.3f units reserved | timeout in %ld ms\n",
+               a->id, a->req.pump_id, payment_name(a->req.payment_mode),
+               processor_names[payment_processor_for(a->req.payment_mode)],
+               a->amount, a->quantity, left_ms);
+    }
+    pthread_mutex_unlock(&payments.lock);
+}
+
+/*
+ * Local stand-in for a card/wallet processor: answers each request after
+ * latency_ms +/- 50%, declining decline_pct percent of them and silently
+ * dropping timeout_pct percent so the pipeline's timeout path is exercised.
+ * Requests are held in a small table, so many can be outstanding at once.
+ */
+typedef struct {
+    unsigned long auth_id;
+    struct timespec due;
+    int approve;
+    int respond;
+    int used;
+} SimAuthRequest;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int stopping;
+    long latency_ms;
+    int decline_pct;
+    int timeout_pct;
+    int link_down;
+    uint64_t rng;
+    SimAuthRequest pending[PAYMENT_MAX_PENDING];
+} SimProcessor;
+
+static SimProcessor sim_processor = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static uint64_t sim_next(SimProcessor *sp) {
+    sp->rng ^= sp->rng << 13;
+    sp->rng ^= sp->rng >> 7;
+    sp->rng ^= sp->rng << 17;
+    return sp->rng;
+}
+
+static int sim_authorize(void *ctx, unsigned long auth_id, int processor_id, PaymentMode mode, double amount) {
+    SimProcessor *sp = (SimProcessor*) ctx;
+    (void)processor_id; (void)mode; (void)amount;
+    pthread_mutex_lock(&sp->lock);
+    if (sp->link_down) {
+        pthread_mutex_unlock(&sp->lock);
+        return -1;
+    }
+    for (int i = 0; i < PAYMENT_MAX_PENDING; ++i) {
+        SimAuthRequest *r = &sp->pending[i];
+        if (r->used) continue;
+        long latency = sp->latency_ms / 2 + (long)(sim_next(sp) % (uint64_t)(sp->latency_ms + 1));
+        r->used = 1;
+        r->auth_id = auth_id;
+        r->approve = (int)(sim_next(sp) % 100) >= sp->decline_pct;
+        r->respond = (int)(sim_next(sp) % 100) >= sp->timeout_pct;
+        clock_gettime(CLOCK_REALTIME, &r->due);
+        timespec_add_ms(&r->due, latency);
+        pthread_cond_signal(&sp->wake);
+        pthread_mutex_unlock(&sp->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&sp->lock);
+    return -1;
+}
+
+static void *sim_processor_main(void *arg) {
+    SimProcessor *sp = (SimProcessor*) arg;
+    pthread_mutex_lock(&sp->lock);
+    while (!sp->stopping) {
+        struct timespec now, next;
+        clock_gettime(CLOCK_REALTIME, &now);
+        int have_next = 0;
+        for (int i = 0; i < PAYMENT_MAX_PENDING; ++i) {
+            SimAuthRequest *r = &sp->pending[i];
+            if (!r->used) continue;
+            if (!timespec_before(&now, &r->due)) {
+                SimAuthRequest done = *r;
+                r->used = 0;
+                if (!done.respond) continue;
+                unsigned int code = (unsigned int)(sim_next(sp) % 1000000);
+                pthread_mutex_unlock(&sp->lock);
+                payment_auth_result(done.auth_id, done.approve, code);
+                pthread_mutex_lock(&sp->lock);
+            } else if (!have_next || timespec_before(&r->due, &next)) {
+                next = r->due;
+                have_next = 1;
+            }
+        }
+        if (have_next) pthread_cond_timedwait(&sp->wake, &sp->lock, &next);
+        else pthread_cond_wait(&sp->wake, &sp->lock);
+    }
+    pthread_mutex_unlock(&sp->lock);
+    return NULL;
+}
+
+static int sim_authorize_batch(void *ctx, const OfflineAuth *batch, size_t n, int *approved, unsigned int *codes) {
+    SimProcessor *sp = (SimProcessor*) ctx;
+    (void)batch;
+    pthread_mutex_lock(&sp->lock);
+    long latency = sp->latency_ms;
+    int down = sp->link_down;
+    pthread_mutex_unlock(&sp->lock);
+    if (down) return -1;
+    struct timespec ts = { latency / 1000, (latency % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+    pthread_mutex_lock(&sp->lock);
+    for (size_t i = 0; i < n; ++i) {
+        approved[i] = (int)(sim_next(sp) % 100) >= sp->decline_pct;
+        codes[i] = (unsigned int)(sim_next(sp) % 1000000);
+    }
+    pthread_mutex_unlock(&sp->lock);
+    return 0;
+}
+
+static int sim_link_up(void *ctx) {
+    SimProcessor *sp = (SimProcessor*) ctx;
+    pthread_mutex_lock(&sp->lock);
+    int up = !sp->link_down;
+    pthread_mutex_unlock(&sp->lock);
+    return up;
+}
+
+void toggle_payment_link() {
+    if (!payment_pipeline_enabled()) {
+        printf("\nNo payment processor is configured (start with --payment-sim).\n");
+        return;
+    }
+    SimProcessor *sp = &sim_processor;
+    pthread_mutex_lock(&sp->lock);
+    sp->link_down = !sp->link_down;
+    int down = sp->link_down;
+    pthread_mutex_unlock(&sp->lock);
+    printf("Payment link is now %s.\n", down ? "DOWN (offline approvals up to the floor limit)" : "UP");
+    payment_pipeline_wake();
+}
+
+static void sim_processor_stop(void *ctx) {
+    SimProcessor *sp = (SimProcessor*) ctx;
+    pthread_mutex_lock(&sp->lock);
+    sp->stopping = 1;
+    pthread_cond_signal(&sp->wake);
+    pthread_mutex_unlock(&sp->lock);
+    pthread_join(sp->thread, NULL);
+}
+
+int sim_processor_start(const char *spec, PaymentProcessor *out) {
+    SimProcessor *sp = &sim_processor;
+    sp->latency_ms = 300;
+    sp->decline_pct = 5;
+    sp->timeout_pct = 1;
+    if (spec) sscanf(spec, "%ld,%d,%d", &sp->latency_ms, &sp->decline_pct, &sp->timeout_pct);
+    if (sp->latency_ms < 0) sp->latency_ms = 0;
+    sp->rng = (uint64_t)time(NULL) | 1;
+    if (pthread_create(&sp->thread, NULL, sim_processor_main, sp) != 0) return -1;
+    out->name = "simulated processor";
+    out->ctx = sp;
+    out->authorize = sim_authorize;
+    out->authorize_batch = sim_authorize_batch;
+    out->link_up = sim_link_up;
+    out->stop = sim_processor_stop;
+    return 0;
+}
+
+int apply_supply(int fuel, double qty) {
+    if (fuel < 0 || fuel > 2 || !(qty > 0)) return -1;
+    pthread_mutex_lock(&station_lock);
+    fuels[fuel].current_stock += qty;
+    journal_supply(fuel, qty);
+    capture_supply(fuel, qty);
+    pthread_mutex_unlock(&station_lock);
+    return 0;
+}
+
+int apply_pump_status(int pump_id, PumpStatus status) {
+    pthread_mutex_lock(&station_lock);
+    int idx = pump_index_by_id(pump_id);
+    if (idx < 0 || status < PUMP_ACTIVE || status > PUMP_MAINT) {
+        pthread_mutex_unlock(&station_lock);
+        return -1;
+    }
+    pumps[idx].status = status;
+    journal_pump_status(pump_id, status);
+    capture_pump_status(pump_id, status);
+    pthread_mutex_unlock(&station_lock);
+    return 0;
+}
+
+/*
+ * Admission control in front of the sale engine. Controllers hand sale
+ * requests to admission_submit(), which queues them per pump in one of two
+ * bounded rings: dispenses already in progress (high priority) and new
+ * authorizations. A single engine thread serves all high-priority rings
+ * round-robin before any new authorization. Requests are refused outright
+ * when their ring is full, new authorizations are shed once total queued
+ * depth passes ADMISSION_SHED_WATERMARK percent of capacity, and a new
+ * authorization that waited longer than ADMISSION_MAX_WAIT_MS is expired
+ * instead of executed, which keeps tail latency bounded under overload.
+ */
+#define ADMISSION_QUEUE_DEPTH 64
+#define ADMISSION_SHED_WATERMARK 75
+#define ADMISSION_MAX_WAIT_MS 250
+#define ADMISSION_LATENCY_BUCKETS 32
+#define ADMISSION_ENGINE_BATCH 32
+
+typedef struct {
+    SaleRequest req;
+    AdmissionClass cls;
+    SaleStatus (*step)(void *ctx);  /* runs instead of execute_sale(req) when set */
+    void *ctx;
+    struct timespec enqueued;
+    int done;
+    pthread_cond_t done_cond;
+    AdmissionResult admission;
+    SaleStatus status;
+    Transaction tx;
+} SaleTicket;
+
+typedef struct {
+    SaleTicket *ring[ADMISSION_QUEUE_DEPTH];
+    size_t head;
+    size_t count;
+    size_t max_depth;
+} AdmissionQueue;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_t thread;
+    int running;
+    int stopping;
+    AdmissionQueue queues[MAX_PUMPS][ADMIT_CLASSES];
+    size_t queued;
+    size_t next_pump;
+    unsigned long admitted[ADMIT_CLASSES];
+    unsigned long completed[ADMIT_CLASSES];
+    unsigned long rejected_full[ADMIT_CLASSES];
+    unsigned long shed;
+    unsigned long expired;
+    unsigned long latency_buckets[ADMISSION_LATENCY_BUCKETS];
+    uint64_t latency_max_us;
+} admission = { .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER };
+
+static const char *admission_result_names[] = {
+    "admitted", "rejected: pump queue full", "rejected: station overloaded",
+    "rejected: waited too long in queue", "rejected: sale engine stopped"
+};
+
+static uint64_t admission_elapsed_us(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t us = (int64_t)(now.tv_sec - since->tv_sec) * 1000000 + (now.tv_nsec - since->tv_nsec) / 1000;
+    return us > 0 ? (uint64_t)us : 0;
+}
+
+/* Caller holds admission.lock. */
+static void admission_complete(SaleTicket *t) {
+    uint64_t us = admission_elapsed_us(&t->enqueued);
+    int b = 0;
+    while (b < ADMISSION_LATENCY_BUCKETS - 1 && (1ull << (b + 1)) <= us) b++;
+    admission.latency_buckets[b]++;
+    if (us > admission.latency_max_us) admission.latency_max_us = us;
+    t->done = 1;
+    pthread_cond_signal(&t->done_cond);
+}
+
+static SaleTicket *admission_next(void) {
+    for (int cls = 0; cls < ADMIT_CLASSES; ++cls) {
+        int slots = pump_slots;
+        for (int n = 0; n < slots; ++n) {
+            size_t p = (admission.next_pump + (size_t)n) % (size_t)slots;
+            AdmissionQueue *q = &admission.queues[p][cls];
+            if (q->count == 0) continue;
+            SaleTicket *t = q->ring[q->head];
+            q->head = (q->head + 1) % ADMISSION_QUEUE_DEPTH;
+            q->count--;
+            admission.queued--;
+            admission.next_pump = (p + 1) % (size_t)slots;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/* New authorizations are FIFO per pump, so stale ones are always at the head of their ring. */
+static void admission_expire_stale(void) {
+    for (int p = 0; p < pump_slots; ++p) {
+        AdmissionQueue *q = &admission.queues[p][ADMIT_NEW_AUTH];
+        while (q->count > 0 && admission_elapsed_us(&q->ring[q->head]->enqueued) > ADMISSION_MAX_WAIT_MS * 1000ull) {
+            SaleTicket *t = q->ring[q->head];
+            q->head = (q->head + 1) % ADMISSION_QUEUE_DEPTH;
+            q->count--;
+            admission.queued--;
+            t->admission = ADMIT_REJECT_EXPIRED;
+            admission.expired++;
+            admission_complete(t);
+        }
+    }
+}
+
+/* Tickets are drained in batches so the engine takes admission.lock twice per batch, not per sale. */
+static void *admission_engine_main(void *arg) {
+    (void)arg;
+    SaleTicket *batch[ADMISSION_ENGINE_BATCH];
+    pthread_mutex_lock(&admission.lock);
+    for (;;) {
+        int n = 0;
+        SaleTicket *t;
+        admission_expire_stale();
+        while (n < ADMISSION_ENGINE_BATCH && (t = admission_next()) != NULL) batch[n++] = t;
+        if (n == 0) {
+            if (admission.stopping) break;
+            pthread_cond_wait(&admission.work, &admission.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&admission.lock);
+        for (int i = 0; i < n; ++i)
+            batch[i]->status = batch[i]->step ? batch[i]->step(batch[i]->ctx)
+                                              : execute_sale(&batch[i]->req, &batch[i]->tx);
+        pthread_mutex_lock(&admission.lock);
+        for (int i = 0; i < n; ++i) {
+            admission.completed[batch[i]->cls]++;
+            admission_complete(batch[i]);
+        }
+    }
+    pthread_mutex_unlock(&admission.lock);
+    return NULL;
+}
+
+int admission_start() {
+    admission.stopping = 0;
+    if (pthread_create(&admission.thread, NULL, admission_engine_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start sale engine; sales will run inline.\n");
+        return -1;
+    }
+    admission.running = 1;
+    return 0;
+}
+
+void admission_stop() {
+    if (!admission.running) return;
+    pthread_mutex_lock(&admission.lock);
+    admission.stopping = 1;
+    pthread_cond_signal(&admission.work);
+    pthread_mutex_unlock(&admission.lock);
+    pthread_join(admission.thread, NULL);
+    admission.running = 0;
+}
+
+AdmissionResult admission_submit(SaleTicket *t) {
+    int pidx = pump_index_by_id(t->req.pump_id);
+    clock_gettime(CLOCK_MONOTONIC, &t->enqueued);
+    t->done = 0;
+    t->status = SALE_OK;
+    pthread_mutex_lock(&admission.lock);
+    AdmissionResult res = ADMIT_OK;
+    if (!admission.running || admission.stopping) {
+        res = ADMIT_REJECT_STOPPED;
+    } else if (pidx < 0) {
+        t->status = SALE_ERR_PUMP;
+        t->done = 1;
+    } else {
+        AdmissionQueue *q = &admission.queues[pidx][t->cls];
+        size_t capacity = (size_t)pump_slots * ADMIT_CLASSES * ADMISSION_QUEUE_DEPTH;
+        if (t->cls == ADMIT_NEW_AUTH && admission.queued * 100 >= capacity * ADMISSION_SHED_WATERMARK) {
+            res = ADMIT_REJECT_SHED;
+            admission.shed++;
+        } else if (q->count == ADMISSION_QUEUE_DEPTH) {
+            res = ADMIT_REJECT_QUEUE_FULL;
+            admission.rejected_full[t->cls]++;
+        } else {
+            q->ring[(q->head + q->count) % ADMISSION_QUEUE_DEPTH] = t;
+            q->count++;
+            if (q->count > q->max_depth) q->max_depth = q->count;
+            admission.queued++;
+            admission.admitted[t->cls]++;
+            pthread_cond_signal(&admission.work);
+        }
+    }
+    t->admission = res;
+    pthread_mutex_unlock(&admission.lock);
+    return res;
+}
+
+void admission_wait(SaleTicket *t) {
+    pthread_mutex_lock(&admission.lock);
+    while (!t->done) pthread_cond_wait(&t->done_cond, &admission.lock);
+    pthread_mutex_unlock(&admission.lock);
+}
+
+/*
+ * Runs a sale through admission control, or inline if the engine is not
+ * running. With step set, the engine runs step(ctx) in req's pump and class
+ * instead of execute_sale, and out is left alone.
+ */
+SaleStatus admit_step(const SaleRequest *req, AdmissionClass cls, SaleStatus (*step)(void *ctx), void *ctx,
+                      Transaction *out, AdmissionResult *adm) {
+    if (!admission.running) {
+        if (adm) *adm = ADMIT_OK;
+        return step ? step(ctx) : execute_sale(req, out);
+    }
+    SaleTicket ticket;
+    memset(&ticket, 0, sizeof(ticket));
+    ticket.req = *req;
+    ticket.cls = cls;
+    ticket.step = step;
+    ticket.ctx = ctx;
+    pthread_cond_init(&ticket.done_cond, NULL);
+    AdmissionResult res = admission_submit(&ticket);
+    if (res == ADMIT_OK) {
+        admission_wait(&ticket);
+        res = ticket.admission;
+    }
+    pthread_cond_destroy(&ticket.done_cond);
+    if (adm) *adm = res;
+    if (res != ADMIT_OK) return SALE_ERR_OVERLOAD;
+    if (out && !step && ticket.status == SALE_OK) *out = ticket.tx;
+    return ticket.status;
+}
+
+SaleStatus submit_sale(const SaleRequest *req, AdmissionClass cls, Transaction *out, AdmissionResult *adm) {
+    return admit_step(req, cls, NULL, NULL, out, adm);
+}
+
+static uint64_t admission_latency_percentile(double pct, unsigned long total) {
+    unsigned long rank = (unsigned long)(pct / 100.0 * (double)total + 0.5), seen = 0;
+    if (rank == 0) rank = 1;
+    for (int b = 0; b < ADMISSION_LATENCY_BUCKETS; ++b) {
+        seen += admission.latency_buckets[b];
+        if (seen >= rank) {
+            uint64_t upper = (1ull << (b + 1)) - 1;
+            return upper < admission.latency_max_us ? upper : admission.latency_max_us;
+        }
+    }
+    return admission.latency_max_us;
+}
+
+void show_admission_metrics() {
+    int pump_ids[MAX_PUMPS];
+    pthread_mutex_lock(&station_lock);
+    int slots = pump_slots;
+    for (int p = 0; p < slots; ++p) pump_ids[p] = pumps[p].pump_id;
+    pthread_mutex_unlock(&station_lock);
+    pthread_mutex_lock(&admission.lock);
+    unsigned long total = 0;
+    for (int b = 0; b < ADMISSION_LATENCY_BUCKETS; ++b) total += admission.latency_buckets[b];
+    printf("\n----- Sale Admission Control (%s) -----\n", admission.running ? "engine running" : "inline");
+    printf("Queue capacity: %d per pump per class | shed new authorizations above %d%% | max wait %d ms\n",
+           ADMISSION_QUEUE_DEPTH, ADMISSION_SHED_WATERMARK, ADMISSION_MAX_WAIT_MS);
+    for (int p = 0; p < slots; ++p) {
+        const AdmissionQueue *d = &admission.queues[p][ADMIT_DISPENSE];
+        const AdmissionQueue *n = &admission.queues[p][ADMIT_NEW_AUTH];
+        printf("Pump %d | dispense queue %zu (max %zu) | new-auth queue %zu (max %zu)\n",
+               pump_ids[p], d->count, d->max_depth, n->count, n->max_depth);
+    }
+    printf("Dispense: admitted %lu, completed %lu, rejected (full) %lu\n",
+           admission.admitted[ADMIT_DISPENSE], admission.completed[ADMIT_DISPENSE],
+           admission.rejected_full[ADMIT_DISPENSE]);
+    printf("New auth: admitted %lu, completed %lu, rejected (full) %lu, shed %lu, expired %lu\n",
+           admission.admitted[ADMIT_NEW_AUTH], admission.completed[ADMIT_NEW_AUTH],
+           admission.rejected_full[ADMIT_NEW_AUTH], admission.shed, admission.expired);
+    if (total > 0)
+        printf("Queue+execute latency (us): p50 %llu | p99 %llu | p99.9 %llu | max %llu\n",
+               (unsigned long long)admission_latency_percentile(50.0, total),
+               (unsigned long long)admission_latency_percentile(99.0, total),
+               (unsigned long long)admission_latency_percentile(99.9, total),
+               (unsigned long long)admission.latency_max_us);
+    pthread_mutex_unlock(&admission.lock);
+}
+
+typedef struct {
+    int id;
+    double seconds;
+    unsigned long ok;
+    unsigned long rejected;
+} OverloadController;
+
+static void *overload_controller_main(void *arg) {
+    OverloadController *c = (OverloadController*) arg;
+    uint64_t rng = 0x9E3779B97F4A7C15ull * (uint64_t)(c->id + 1);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (admission_elapsed_us(&start) < (uint64_t)(c->seconds * 1e6)) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        SaleRequest req;
+        unsigned ticket;
+        const StationConfig *cfg = config_acquire(&ticket);
+        req.pump_id = cfg->pumps[rng % (uint64_t)cfg->pump_count].pump_id;
+        config_release(ticket);
+        req.vehicle_type = (VehicleType)((rng >> 8) % 3);
+        req.by_amount = 1;
+        req.value = 100.0 + (double)((rng >> 16) % 2000);
+        req.payment_mode = PAY_CASH;
+        req.timestamp = time(NULL);
+        req.vehicle_hash = 0;
+        req.customer_hash = 0;
+        AdmissionResult res;
+        AdmissionClass cls = (rng >> 32) % 5 == 0 ? ADMIT_DISPENSE : ADMIT_NEW_AUTH;
+        submit_sale(&req, cls, NULL, &res);
+        if (res == ADMIT_OK) {
+            c->ok++;
+        } else {
+            struct timespec backoff = { 0, 1000000 };
+            c->rejected++;
+            nanosleep(&backoff, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* Drives the sale engine with many concurrent controllers and reports admission behaviour. */
+int run_overload_test(int controllers, double seconds) {
+    if (controllers <= 0 || seconds <= 0) {
+        fprintf(stderr, "Overload test needs a positive controller count and duration.\n");
+        return -1;
+    }
+    for (int f = 0; f < 3; ++f) apply_supply(f, 1e12);
+    OverloadController *cs = (OverloadController*) calloc((size_t)controllers, sizeof(OverloadController));
+    pthread_t *tids = (pthread_t*) calloc((size_t)controllers, sizeof(pthread_t));
+    if (!cs || !tids || admission_start() != 0) {
+        free(cs); free(tids);
+        return -1;
+    }
+    int started = 0;
+    for (int i = 0; i < controllers; ++i) {
+        cs[i].id = i;
+        cs[i].seconds = seconds;
+        if (pthread_create(&tids[i], NULL, overload_controller_main, &cs[i]) != 0) break;
+        started++;
+    }
+    unsigned long ok = 0, rejected = 0;
+    for (int i = 0; i < started; ++i) {
+        pthread_join(tids[i], NULL);
+        ok += cs[i].ok;
+        rejected += cs[i].rejected;
+    }
+    printf("Overload test: %d controllers for %.1f s -> %lu sales committed (%.0f/s), %lu rejected\n",
+           started, seconds, ok, (double)ok / seconds, rejected);
+    show_admission_metrics();
+    admission_stop();
+    free(cs);
+    free(tids);
+    return 0;
+}
+
+void process_sale() {
+    int pump_id;
+    unsigned ticket;
+    const StationConfig *cfg = config_acquire(&ticket);
+    printf("\nAvailable Pumps:\n");
+    pthread_mutex_lock(&station_lock);
+    for (int i = 0; i < cfg->pump_count; ++i) {
+        printf("Pump %d - %s (%s)\n",
+               cfg->pumps[i].pump_id,
+               fuel_name(cfg->pumps[i].fuel),
+               pump_status_name(pumps[cfg->pumps[i].slot].status));
+    }
+    pthread_mutex_unlock(&station_lock);
+    config_release(ticket);
+    printf("Enter Pump ID to use: ");
+    if (scanf("%d", &pump_id) != 1) {
+        clear_input_buffer();
+        printf("Invalid input.\n");
+        return;
+    }
+    cfg = config_acquire(&ticket);
+    const PumpConfig *pc = config_pump(cfg, pump_id);
+    FuelType ftype = pc ? pc->fuel : FUEL_PETROL;
+    double unit_price = cfg->price[ftype];
+    int pidx = pc ? pc->slot : -1;
+    config_release(ticket);
+    if (pidx < 0) { printf("Invalid pump id.\n"); clear_input_buffer(); return; }
+    if (pumps[pidx].status != PUMP_ACTIVE) { printf("Selected pump is not active.\n"); clear_input_buffer(); return; }
+
+    int vchoice;
+    printf("Select vehicle type: 0=2-Wheeler, 1=4-Wheeler, 2=Commercial: ");
+    if (scanf("%d", &vchoice) != 1 || vchoice < 0 || vchoice > 2) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+
+    char plate[32];
+    printf("Vehicle registration number (- to skip): ");
+    if (scanf("%31s", plate) != 1) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+
+    int mode;
+    printf("Enter input mode: 0=Quantity, 1=Amount: ");
+    if (scanf("%d", &mode) != 1 || (mode != 0 && mode != 1)) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+
+    double value = 0.0, qty = 0.0;
+    if (mode == 0) {
+        printf("Enter quantity to dispense (%s): ", (ftype == FUEL_CNG ? "kg" : "liters"));
+        if (scanf("%lf", &value) != 1 || value <= 0) {
+            clear_input_buffer();
+            printf("Invalid quantity.\n");
+            return;
+        }
+        qty = value;
+    } else {
+        printf("Enter amount to spend (INR): ");
+        if (scanf("%lf", &value) != 1 || value <= 0) {
+            clear_input_buffer();
+            printf("Invalid amount.\n");
+            return;
+        }
+        qty = value / unit_price;
     }
 
     if (qty > fuels[ftype].current_stock) {
@@ -312,196 +4669,4784 @@ void process_sale() {
         return;
     }
 
-    int paychoice;
-    printf("Payment Mode: 0=Cash, 1=Credit Card, 2=Digital Wallet: ");
-    if (scanf("%d", &paychoice) != 1 || paychoice < 0 || paychoice > 2) {
+    int paychoice;
+    printf("Payment Mode: 0=Cash, 1=Credit Card, 2=Digital Wallet: ");
+    if (scanf("%d", &paychoice) != 1 || paychoice < 0 || paychoice > 2) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+
+    char token[64] = "-";
+    if (paychoice != PAY_CASH) {
+        printf("Card/wallet token (- to skip): ");
+        if (scanf("%63s", token) != 1) {
+            clear_input_buffer();
+            printf("Invalid.\n");
+            return;
+        }
+    }
+
+    char contact[64] = "-";
+    if (ereceipt_enabled()) {
+        printf("E-receipt phone/email (- to skip): ");
+        if (scanf("%63s", contact) != 1) {
+            clear_input_buffer();
+            printf("Invalid.\n");
+            return;
+        }
+    }
+
+    SaleRequest req;
+    req.pump_id = pump_id;
+    req.vehicle_type = (VehicleType)vchoice;
+    req.by_amount = mode;
+    req.value = value;
+    req.payment_mode = (PaymentMode)paychoice;
+    req.timestamp = time(NULL);
+    req.vehicle_hash = identity_hash(plate);
+    req.customer_hash = identity_hash(token);
+
+    PROF_START(t_sale);
+    Transaction tx;
+    SaleStatus st;
+    if (req.payment_mode != PAY_CASH && payment_pipeline_enabled()) {
+        unsigned long auth_id = 0;
+        st = payment_submit(&req, contact, &auth_id, &tx);
+        if (st == SALE_PENDING_AUTH) {
+            printf("Authorizing %s payment (auth %lu); pump is free for the next customer.\n",
+                   payment_name(req.payment_mode), auth_id);
+            goto done;
+        }
+        if (st == SALE_OFFLINE_APPROVED) {
+            printf("%s\n", sale_status_message(st));
+            st = SALE_OK;
+        }
+    } else {
+        AdmissionResult adm;
+        st = submit_sale(&req, ADMIT_NEW_AUTH, &tx, &adm);
+        if (adm != ADMIT_OK) {
+            printf("Sale %s.\n", admission_result_names[adm]);
+            goto done;
+        }
+    }
+    if (st != SALE_OK) {
+        printf("%s\n", sale_status_message(st));
+        goto done;
+    }
+
+    PROF_START(t_receipt);
+    print_receipt(&tx);
+    if (strcmp(contact, "-") != 0 && ereceipt_enqueue(&tx, contact) != 0)
+        printf("E-receipt queue full; receipt for %s not sent.\n", tx.txn_id);
+    PROF_STOP(PROF_RECEIPT, t_receipt);
+
+    PROF_START(t_alerts);
+    pthread_mutex_lock(&station_lock);
+    check_low_stock_alerts();
+    pthread_mutex_unlock(&station_lock);
+    PROF_STOP(PROF_ALERTS, t_alerts);
+done:
+    /* Every submitted sale is timed, including rejected ones and those handed to the payment pipeline. */
+    PROF_STOP(PROF_SALE_TOTAL, t_sale);
+
+    clear_input_buffer();
+}
+
+void add_supply() {
+    printf("\nAdd supply to which fuel? 0=Petrol,1=Diesel,2=CNG: ");
+    int f;
+    if (scanf("%d", &f) != 1 || f < 0 || f > 2) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+    double amt;
+    printf("Enter quantity to add (%s): ", (f==FUEL_CNG?"kg":"liters"));
+    if (scanf("%lf", &amt) != 1 || amt <= 0) {
+        clear_input_buffer();
+        printf("Invalid quantity.\n");
+        return;
+    }
+    apply_supply(f, amt);
+    pthread_mutex_lock(&station_lock);
+    printf("Supply added. New stock for %s: %.2f\n", fuel_name(fuels[f].type), fuels[f].current_stock);
+    pthread_mutex_unlock(&station_lock);
+    clear_input_buffer();
+}
+
+void change_pump_status() {
+    int pid;
+    printf("Enter Pump ID to change status: ");
+    if (scanf("%d", &pid) != 1) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+    int idx = pump_index_by_id(pid);
+    if (idx < 0) { printf("Invalid pump id.\n"); clear_input_buffer(); return; }
+    int s;
+    printf("Select status: 0=Active,1=Inactive,2=Maintenance: ");
+    if (scanf("%d", &s) != 1 || s < 0 || s > 2) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+    apply_pump_status(pid, (PumpStatus)s);
+    printf("Pump %d status set to %s\n", pid, pump_status_name(pumps[idx].status));
+    clear_input_buffer();
+}
+
+void show_pump_performance(FILE *out) {
+    TRACE_BEGIN("pump_performance");
+    fprintf(out, "\n----- Pump-wise Performance -----\n");
+    unsigned ticket;
+    const StationConfig *cfg = config_acquire(&ticket);
+    for (int i = 0; i < pump_slots; ++i) {
+        const PumpConfig *pc = config_pump(cfg, pumps[i].pump_id);
+        fprintf(out, "Pump %d | Fuel: %s | Status: %s | Txns: %.0f | Qty: %.3f | Revenue: ₹%.2f\n",
+               pumps[i].pump_id,
+               pc ? fuel_name(pc->fuel) : "Retired",
+               pump_status_name(pumps[i].status),
+               pumps[i].transactions_count,
+               pumps[i].total_quantity,
+               pumps[i].total_amount);
+    }
+    config_release(ticket);
+    TRACE_END("pump_performance");
+}
+
+void show_fuel_summary(FILE *out) {
+    TRACE_BEGIN("fuel_summary");
+    fprintf(out, "\n----- Fuel-wise Summary -----\n");
+    for (int i = 0; i < 3; ++i) {
+        fprintf(out, "%s | Opening Stock: %.2f | Current Stock: %.2f | Sold Qty: %.3f | Revenue: ₹%.2f\n",
+               fuel_name(fuels[i].type),
+               fuels[i].opening_stock,
+               fuels[i].current_stock,
+               fuel_wise_quantity[i],
+               fuel_wise_amount[i]);
+    }
+    TRACE_END("fuel_summary");
+}
+
+void show_hour_wise_analysis(FILE *out) {
+    TRACE_BEGIN("hour_wise_analysis");
+    fprintf(out, "\n----- Hour-wise Sales Analysis -----\n");
+    for (int h = 0; h < 24; ++h) {
+        if (hour_quantity[h] > 0.0 || hour_amount[h] > 0.0)
+            fprintf(out, "Hour %02d:00 - Qty: %.3f | Revenue: ₹%.2f\n", h, hour_quantity[h], hour_amount[h]);
+    }
+    TRACE_END("hour_wise_analysis");
+}
+
+void show_payment_breakdown(FILE *out) {
+    TRACE_BEGIN("payment_breakdown");
+    fprintf(out, "\n----- Payment Mode Breakdown -----\n");
+    fprintf(out, "Cash: ₹%.2f\n", payment_mode_amount[PAY_CASH]);
+    fprintf(out, "Credit Card: ₹%.2f\n", payment_mode_amount[PAY_CARD]);
+    fprintf(out, "Digital Wallet: ₹%.2f\n", payment_mode_amount[PAY_WALLET]);
+    TRACE_END("payment_breakdown");
+}
+
+void generate_daily_report(FILE *out) {
+    TRACE_BEGIN("daily_report");
+    fprintf(out, "\n================= DAILY REPORT =================\n");
+    fprintf(out, "Fuel Opening & Closing Stocks:\n");
+    for (int i = 0; i < 3; ++i) {
+        fuels[i].closing_stock = fuels[i].current_stock;
+        fprintf(out, "%s: Opening: %.2f | Closing: %.2f\n",
+               fuel_name(fuels[i].type),
+               fuels[i].opening_stock,
+               fuels[i].closing_stock);
+    }
+    double total_qty = 0.0, total_amt = 0.0;
+    for (int i = 0; i < 3; ++i) {
+        total_qty += fuel_wise_quantity[i];
+        total_amt += fuel_wise_amount[i];
+    }
+    fprintf(out, "Total Sales Quantity (all fuels): %.3f\n", total_qty);
+    fprintf(out, "Total Revenue (all fuels): ₹%.2f\n", total_amt);
+    show_fuel_summary(out);
+    fprintf(out, "Number of transactions: %zu\n", tx_count);
+    show_payment_breakdown(out);
+    show_pump_performance(out);
+    show_hour_wise_analysis(out);
+    fprintf(out, "================================================\n");
+    TRACE_END("daily_report");
+}
+
+void list_transactions() {
+    if (tx_count == 0) { printf("No transactions yet.\n"); return; }
+    printf("\n---- Transactions (most recent first) ----\n");
+    for (long i = (long)tx_count - 1; i >= 0; --i) {
+        char timestr[64];
+        format_time_local(transactions[i].timestamp, timestr, sizeof(timestr));
+        printf("%s | %s | Pump %d | Qty: %.3f | ₹%.2f | %s\n",
+               transactions[i].txn_id,
+               timestr,
+               transactions[i].pump_id,
+               transactions[i].quantity,
+               transactions[i].amount,
+               payment_name(transactions[i].payment_mode));
+    }
+}
+
+#define EXPORT_CHUNK_RECORDS 4096
+
+/*
+ * Writes all transactions as CSV through the write-behind backend. Rows are
+ * formatted in chunks under station_lock and handed off after unlocking, so
+ * neither sales nor the export wait on the disk.
+ */
+long export_transactions_csv(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create export file %s.\n", path);
+        return -1;
+    }
+    IoFile *out = io_file_open(path, fd, 0, 0);
+    if (!out) {
+        close(fd);
+        return -1;
+    }
+    static const char header[] = "txn_id,timestamp,pump_id,fuel,vehicle,quantity,amount,payment,processor,auth_code\n";
+    io_file_append(out, header, sizeof(header) - 1);
+    char *chunk = (char*) malloc(IO_STAGING_BYTES);
+    size_t next = 0;
+    int rc = chunk ? 0 : -1;
+    TRACE_BEGIN("export_csv");
+    while (rc == 0) {
+        size_t len = 0;
+        pthread_mutex_lock(&station_lock);
+        size_t end = next + EXPORT_CHUNK_RECORDS < tx_count ? next + EXPORT_CHUNK_RECORDS : tx_count;
+        for (; next < end; ++next) {
+            const Transaction *t = &transactions[next];
+            char timestr[64];
+            format_time_local(t->timestamp, timestr, sizeof(timestr));
+            int n = snprintf(chunk + len, IO_STAGING_BYTES - len, "%s,%s,%d,%s,%s,%.3f,%.2f,%s,%s,%06u\n",
+                             t->txn_id, timestr, t->pump_id, fuel_name(t->fuel_type),
+                             vehicle_name(t->vehicle_type), t->quantity, t->amount,
+                             payment_name(t->payment_mode),
+                             processor_names[t->processor_id >= 0 && t->processor_id < PROCESSOR_COUNT ? t->processor_id : 0],
+                             t->auth_code);
+            if (n > 0) len += (size_t)n;
+        }
+        int done = next >= tx_count;
+        pthread_mutex_unlock(&station_lock);
+        if (len > 0) rc = io_file_append(out, chunk, len);
+        if (done) break;
+    }
+    TRACE_END("export_csv");
+    free(chunk);
+    if (io_file_close(out) != 0) rc = -1;
+    if (rc != 0) {
+        fprintf(stderr, "Export to %s failed.\n", path);
+        return -1;
+    }
+    return (long)next;
+}
+
+void export_transactions_menu() {
+    char path[256];
+    printf("CSV file to write: ");
+    if (scanf("%255s", path) != 1) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+    clear_input_buffer();
+    long n = export_transactions_csv(path);
+    if (n >= 0) printf("Exported %ld transactions to %s (%s).\n", n, path, io_backend_name());
+}
+
+/*
+ * Writes the non-empty cells of the pump x minute matrix as CSV, one row per
+ * pump-minute. Each pump row is copied out under station_lock and formatted
+ * after unlocking.
+ */
+long export_heatmap_csv(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create export file %s.\n", path);
+        return -1;
+    }
+    IoFile *out = io_file_open(path, fd, 0, 0);
+    if (!out) {
+        close(fd);
+        return -1;
+    }
+    static const char header[] = "date,pump_id,minute,time,sales,quantity,amount\n";
+    io_file_append(out, header, sizeof(header) - 1);
+    char *chunk = (char*) malloc(IO_STAGING_BYTES);
+    MinuteCell *row = (MinuteCell*) malloc(MINUTES_PER_DAY * sizeof(MinuteCell));
+    long rows = 0;
+    int rc = chunk && row ? 0 : -1;
+    int slots = atomic_load_explicit(&pump_slots, memory_order_acquire);
+    for (int p = 0; rc == 0 && p < slots; ++p) {
+        pthread_mutex_lock(&station_lock);
+        int pump_id = pumps[p].pump_id;
+        int32_t date = pump_minutes_date;
+        memcpy(row, &pump_minutes[(size_t)p * MINUTES_PER_DAY], MINUTES_PER_DAY * sizeof(MinuteCell));
+        pthread_mutex_unlock(&station_lock);
+        size_t len = 0;
+        for (int m = 0; m < MINUTES_PER_DAY; ++m) {
+            const MinuteCell *c = &row[m];
+            if (c->sales == 0) continue;
+            /* A full row is ~70 KB, well inside the staging buffer, but flush defensively. */
+            if (IO_STAGING_BYTES - len < 128) {
+                rc = io_file_append(out, chunk, len);
+                len = 0;
+                if (rc != 0) break;
+            }
+            int n = snprintf(chunk + len, IO_STAGING_BYTES - len, "%04d-%02d-%02d,%d,%d,%02d:%02d,%u,%.2f,%.2f\n",
+                             date / 10000, date / 100 % 100, date % 100, pump_id, m, m / 60, m % 60, c->sales,
+                             c->centiunits / 100.0, (double)c->paise / 100.0);
+            if (n > 0) len += (size_t)n;
+            rows++;
+        }
+        if (rc == 0 && len > 0) rc = io_file_append(out, chunk, len);
+    }
+    free(row);
+    free(chunk);
+    if (io_file_close(out) != 0) rc = -1;
+    if (rc != 0) {
+        fprintf(stderr, "Export to %s failed.\n", path);
+        return -1;
+    }
+    return rows;
+}
+
+#define HEATMAP_MAX_COLUMNS 96
+#define HEATMAP_PEAKS 5
+
+enum { HEAT_VOLUME, HEAT_REVENUE, HEAT_SALES };
+
+static uint64_t heatmap_value(const MinuteCell *c, int metric) {
+    switch (metric) {
+        case HEAT_REVENUE: return c->paise;
+        case HEAT_SALES: return c->sales;
+        default: return c->centiunits;
+    }
+}
+
+static void heatmap_format(char *buf, size_t cap, uint64_t v, int metric) {
+    if (metric == HEAT_REVENUE) snprintf(buf, cap, "INR %.2f", (double)v / 100.0);
+    else if (metric == HEAT_SALES) snprintf(buf, cap, "%llu sales", (unsigned long long)v);
+    else snprintf(buf, cap, "%.2f L/kg", (double)v / 100.0);
+}
+
+/*
+ * Renders one metric of the pump x minute matrix for a window of the day.
+ * Columns cover whole minutes (several per column when the window is wider
+ * than the screen) and the shading is relative to the busiest cell in view,
+ * so a two-minute rush stands out even when its hour looks average.
+ */
+void show_minute_heatmap() {
+    static const char shades[] = " .:-=+*#%@";
+    int metric, hh, mm, span;
+    printf("\nMetric (0=Volume, 1=Revenue, 2=Sales count): ");
+    if (scanf("%d", &metric) != 1 || metric < HEAT_VOLUME || metric > HEAT_SALES) {
+        clear_input_buffer();
+        printf("Invalid metric.\n");
+        return;
+    }
+    printf("Window start (HH:MM): ");
+    if (scanf("%d:%d", &hh, &mm) != 2 || hh < 0 || hh > 23 || mm < 0 || mm > 59) {
+        clear_input_buffer();
+        printf("Invalid time.\n");
+        return;
+    }
+    printf("Window length in minutes (10-1440): ");
+    if (scanf("%d", &span) != 1 || span < 10 || span > MINUTES_PER_DAY) {
+        clear_input_buffer();
+        printf("Invalid length.\n");
+        return;
+    }
+    clear_input_buffer();
+
+    int start = hh * 60 + mm;
+    int per_col = (span + HEATMAP_MAX_COLUMNS - 1) / HEATMAP_MAX_COLUMNS;
+    int cols = (span + per_col - 1) / per_col;
+    int slots = atomic_load_explicit(&pump_slots, memory_order_acquire);
+    uint64_t *grid = (uint64_t*) calloc((size_t)(slots ? slots : 1) * (size_t)cols, sizeof(uint64_t));
+    uint64_t *row_total = (uint64_t*) calloc((size_t)(slots ? slots : 1), sizeof(uint64_t));
+    int *ids = (int*) calloc((size_t)(slots ? slots : 1), sizeof(int));
+    if (!grid || !row_total || !ids) {
+        free(grid);
+        free(row_total);
+        free(ids);
+        printf("Out of memory.\n");
+        return;
+    }
+
+    struct { uint64_t v; int slot; int minute; } peaks[HEATMAP_PEAKS];
+    memset(peaks, 0, sizeof(peaks));
+    uint64_t max = 0;
+    pthread_mutex_lock(&station_lock);
+    int32_t date = pump_minutes_date;
+    for (int p = 0; p < slots; ++p) {
+        ids[p] = pumps[p].pump_id;
+        const MinuteCell *row = &pump_minutes[(size_t)p * MINUTES_PER_DAY];
+        for (int i = 0; i < span; ++i) {
+            int m = (start + i) % MINUTES_PER_DAY;
+            uint64_t v = heatmap_value(&row[m], metric);
+            grid[(size_t)p * cols + i / per_col] += v;
+            row_total[p] += v;
+            if (v > peaks[HEATMAP_PEAKS - 1].v) {
+                int k = HEATMAP_PEAKS - 1;
+                while (k > 0 && peaks[k - 1].v < v) {
+                    peaks[k] = peaks[k - 1];
+                    k--;
+                }
+                peaks[k].v = v;
+                peaks[k].slot = p;
+                peaks[k].minute = m;
+            }
+        }
+    }
+    pthread_mutex_unlock(&station_lock);
+    for (size_t i = 0; i < (size_t)slots * (size_t)cols; ++i)
+        if (grid[i] > max) max = grid[i];
+
+    static const char *metric_names[] = {"Volume", "Revenue", "Sales"};
+    printf("\n--- %s Heatmap %04d-%02d-%02d, %02d:%02d for %d min, %d min per column ---\n",
+           metric_names[metric], date / 10000, date / 100 % 100, date % 100, hh, mm, span, per_col);
+    printf("       ");
+    for (int c = 0; c < cols; c += 12) {
+        int m = (start + c * per_col) % MINUTES_PER_DAY;
+        printf("%02d:%02d", m / 60, m % 60);
+        for (int pad = 5; pad < 12 && c + pad < cols; ++pad) putchar(' ');
+    }
+    putchar('\n');
+    for (int p = 0; p < slots; ++p) {
+        printf("P%-4d |", ids[p]);
+        for (int c = 0; c < cols; ++c) {
+            uint64_t v = grid[(size_t)p * cols + c];
+            /* Any activity gets at least the faintest shade. */
+            int level = v == 0 ? 0 : (int)(1 + (v - 1) * (sizeof(shades) - 2) / max);
+            putchar(shades[level]);
+        }
+        char total[32];
+        heatmap_format(total, sizeof(total), row_total[p], metric);
+        printf("| %s\n", total);
+    }
+    char scale[32];
+    heatmap_format(scale, sizeof(scale), max, metric);
+    printf("Scale: '%s' from nothing to %s per column\n", shades, scale);
+
+    if (peaks[0].v > 0) {
+        printf("\nBusiest pump-minutes:\n");
+        for (int k = 0; k < HEATMAP_PEAKS && peaks[k].v > 0; ++k) {
+            char value[32];
+            heatmap_format(value, sizeof(value), peaks[k].v, metric);
+            printf("  Pump %-3d %02d:%02d  %s\n", ids[peaks[k].slot], peaks[k].minute / 60, peaks[k].minute % 60, value);
+        }
+    }
+    free(grid);
+    free(row_total);
+    free(ids);
+
+    char path[256];
+    printf("\nExport full matrix to CSV (- to skip): ");
+    if (scanf("%255s", path) != 1) {
+        clear_input_buffer();
+        return;
+    }
+    clear_input_buffer();
+    if (strcmp(path, "-") == 0) return;
+    long n = export_heatmap_csv(path);
+    if (n >= 0) printf("Exported %ld pump-minutes to %s (%s).\n", n, path, io_backend_name());
+}
+
+void print_sample_receipt_format() {
+    printf("\n--- Receipt Template ---\n");
+    printf("%s", receipt_template.source);
+    printf("------------------------\n");
+
+    Transaction sample;
+    memset(&sample, 0, sizeof(sample));
+    snprintf(sample.txn_id, sizeof(sample.txn_id), "TXN2025110212%05d", 1);
+    sample.timestamp = time(NULL);
+    sample.pump_id = 3;
+    sample.fuel_type = FUEL_DIESEL;
+    sample.vehicle_type = VEH_4W;
+    sample.quantity = 25.0;
+    unsigned ticket;
+    sample.amount = 25.0 * config_acquire(&ticket)->price[FUEL_DIESEL];
+    config_release(ticket);
+    sample.payment_mode = PAY_CARD;
+    char buf[RECEIPT_MAX_BYTES];
+    render_receipt(&sample, buf, sizeof(buf));
+    printf("\n--- Sample Rendering ---%s", buf);
+}
+
+/*
+ * End-of-day settlement. Each run makes one pass over the transactions added
+ * since the previous run and streams every card/wallet sale into a settlement
+ * file for its processor (header, detail lines, count/total trailer). The
+ * submitted sales are kept in a hash table keyed by txn id. Acquirer response
+ * files ("txn_id,amount,ACCEPTED|REJECTED" per line) are matched against that
+ * table, updating running per-mode totals, and those totals are checked
+ * against payment_mode_amount. Amounts are handled in paise.
+ *
+ * Each transaction carries its own settle_state and every batch and response
+ * is journaled (JREC_SETTLE); the cursor is part of the checkpoint. The
+ * table and totals are rebuilt from the store after recovery, so a restart
+ * neither resubmits settled sales nor counts a response twice.
+ */
+#define SETTLEMENT_IO_BUFFER (1 << 20)
+
+typedef enum { SETTLE_SUBMITTED = 1, SETTLE_ACCEPTED = 2, SETTLE_REJECTED = 3 } SettleState;
+
+typedef struct {
+    char txn_id[32];
+    long long paise;
+    size_t index;
+    unsigned char mode;
+    unsigned char state;
+} SettlementEntry;
+
+static struct {
+    size_t cursor;
+    unsigned batch_no;
+    SettlementEntry *table;
+    size_t table_cap;
+    size_t table_used;
+    long long submitted[3];
+    double submitted_amount[3];
+    long long accepted[3];
+    long long rejected[3];
+} settlement;
+
+static uint64_t settle_hash(const char *id) {
+    uint64_t h = 1469598103934665603ull;
+    while (*id) { h ^= (unsigned char)*id++; h *= 1099511628211ull; }
+    return h;
+}
+
+static SettlementEntry *settle_find_slot(SettlementEntry *table, size_t cap, const char *id) {
+    size_t i = (size_t)settle_hash(id) & (cap - 1);
+    while (table[i].state != 0 && strcmp(table[i].txn_id, id) != 0) i = (i + 1) & (cap - 1);
+    return &table[i];
+}
+
+static int settle_table_reserve(size_t needed) {
+    if (settlement.table_cap && (settlement.table_used + needed) * 2 <= settlement.table_cap) return 0;
+    size_t cap = settlement.table_cap ? settlement.table_cap : 1024;
+    while ((settlement.table_used + needed) * 2 > cap) cap *= 2;
+    SettlementEntry *table = (SettlementEntry*) calloc(cap, sizeof(SettlementEntry));
+    if (!table) return -1;
+    for (size_t i = 0; i < settlement.table_cap; ++i) {
+        if (settlement.table[i].state == 0) continue;
+        *settle_find_slot(table, cap, settlement.table[i].txn_id) = settlement.table[i];
+    }
+    free(settlement.table);
+    settlement.table = table;
+    settlement.table_cap = cap;
+    return 0;
+}
+
+static long long to_paise(double amount) {
+    return (long long)(amount * 100.0 + (amount >= 0 ? 0.5 : -0.5));
+}
+
+void settlement_release() {
+    free(settlement.table);
+    memset(&settlement, 0, sizeof(settlement));
+}
+
+/* Enters transactions[idx] into the table at its settle_state; space must be reserved. */
+static void settle_table_add(size_t idx) {
+    const Transaction *t = &transactions[idx];
+    SettlementEntry *e = settle_find_slot(settlement.table, settlement.table_cap, t->txn_id);
+    if (e->state != 0) return;
+    snprintf(e->txn_id, sizeof(e->txn_id), "%s", t->txn_id);
+    e->paise = to_paise(t->amount);
+    e->index = idx;
+    e->mode = (unsigned char)t->payment_mode;
+    e->state = t->settle_state;
+    settlement.table_used++;
+    settlement.submitted[t->payment_mode] += e->paise;
+    settlement.submitted_amount[t->payment_mode] += t->amount;
+    if (e->state == SETTLE_ACCEPTED) settlement.accepted[e->mode] += e->paise;
+    if (e->state == SETTLE_REJECTED) settlement.rejected[e->mode] += e->paise;
+}
+
+/* Records a response for a submitted entry in the table and in its transaction. */
+static void settle_resolve(SettlementEntry *e, int state) {
+    e->state = (unsigned char)state;
+    transactions[e->index].settle_state = (unsigned char)state;
+    mark_tx_dirty(e->index);
+    if (state == SETTLE_ACCEPTED) settlement.accepted[e->mode] += e->paise;
+    else settlement.rejected[e->mode] += e->paise;
+}
+
+/*
+ * Caller holds station_lock. SETTLE_SUBMITTED puts the unsettled card/wallet
+ * sales in [first, last) into batch batch_no and moves the cursor to last;
+ * ACCEPTED/REJECTED resolves submitted sales in the range.
+ */
+static int settlement_mark(size_t first, size_t last, unsigned batch_no, int state) {
+    if (state == SETTLE_SUBMITTED) {
+        if (settle_table_reserve(last - first) != 0) return -1;
+        for (size_t i = first; i < last; ++i) {
+            Transaction *t = &transactions[i];
+            if (t->processor_id <= PROCESSOR_NONE || t->processor_id >= PROCESSOR_COUNT || t->settle_state != 0) continue;
+            t->settle_state = SETTLE_SUBMITTED;
+            mark_tx_dirty(i);
+            settle_table_add(i);
+        }
+        if (last > settlement.cursor) settlement.cursor = last;
+        if (batch_no > settlement.batch_no) settlement.batch_no = batch_no;
+        return 0;
+    }
+    if (state != SETTLE_ACCEPTED && state != SETTLE_REJECTED) return -1;
+    for (size_t i = first; i < last; ++i) {
+        if (transactions[i].settle_state != SETTLE_SUBMITTED || settlement.table_cap == 0) continue;
+        SettlementEntry *e = settle_find_slot(settlement.table, settlement.table_cap, transactions[i].txn_id);
+        if (e->state == SETTLE_SUBMITTED) settle_resolve(e, state);
+    }
+    return 0;
+}
+
+/* Caller holds station_lock. Rebuilds the table and totals from the store's settle_state. */
+static int settlement_rebuild(void) {
+    size_t cursor = settlement.cursor;
+    unsigned batch_no = settlement.batch_no;
+    settlement_release();
+    settlement.cursor = cursor < tx_count ? cursor : tx_count;
+    settlement.batch_no = batch_no;
+    size_t settled = 0;
+    for (size_t i = 0; i < tx_count; ++i)
+        if (transactions[i].settle_state != 0) settled++;
+    if (settled == 0) return 0;
+    if (settle_table_reserve(settled) != 0) return -1;
+    for (size_t i = 0; i < tx_count; ++i)
+        if (transactions[i].settle_state != 0) settle_table_add(i);
+    return 0;
+}
+
+/* Caller holds station_lock. */
+int run_settlement(const char *dir) {
+    FILE *files[PROCESSOR_COUNT] = { NULL };
+    char *buffers[PROCESSOR_COUNT] = { NULL };
+    size_t counts[PROCESSOR_COUNT] = { 0 };
+    long long totals[PROCESSOR_COUNT] = { 0 };
+    char paths[PROCESSOR_COUNT][512];
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm lt;
+    localtime_r(&now, &lt);
+    strftime(stamp, sizeof(stamp), "%Y%m%d", &lt);
+
+    unsigned batch = settlement.batch_no + 1;
+    size_t first = settlement.cursor;
+    int rc = 0;
+    size_t i;
+    for (i = first; i < tx_count; ++i) {
+        const Transaction *t = &transactions[i];
+        int p = t->processor_id;
+        if (p <= PROCESSOR_NONE || p >= PROCESSOR_COUNT || t->settle_state != 0) continue;
+        if (!files[p]) {
+            snprintf(paths[p], sizeof(paths[p]), "%s/settle_%s_%u_p%d.csv", dir, stamp, batch, p);
+            files[p] = fopen(paths[p], "w");
+            if (!files[p]) {
+                fprintf(stderr, "Settlement: cannot create %s.\n", paths[p]);
+                rc = -1;
+                break;
+            }
+            buffers[p] = (char*) malloc(SETTLEMENT_IO_BUFFER);
+            if (buffers[p]) setvbuf(files[p], buffers[p], _IOFBF, SETTLEMENT_IO_BUFFER);
+            fprintf(files[p], "H,%s,%u,%lld\n", processor_names[p], batch, (long long)now);
+        }
+        long long paise = to_paise(t->amount);
+        fprintf(files[p], "D,%s,%lld,%d,%s,%06u,%lld.%02lld\n", t->txn_id, (long long)t->timestamp,
+                t->pump_id, t->payment_mode == PAY_CARD ? "CARD" : "WALLET", t->auth_code,
+                paise / 100, paise % 100);
+        counts[p]++;
+        totals[p] += paise;
+    }
+    for (int p = 1; p < PROCESSOR_COUNT; ++p)
+        if (files[p] && fflush(files[p]) != 0) rc = -1;
+    if (rc == 0 && settlement_mark(first, i, batch, SETTLE_SUBMITTED) != 0) {
+        fprintf(stderr, "Settlement: out of memory.\n");
+        rc = -1;
+    }
+    if (rc == 0) journal_settle(first, i, batch, SETTLE_SUBMITTED);
+
+    printf("\n----- Settlement Batch %u -----\n", batch);
+    for (int p = 1; p < PROCESSOR_COUNT; ++p) {
+        if (!files[p]) continue;
+        fprintf(files[p], "T,%zu,%lld.%02lld\n", counts[p], totals[p] / 100, totals[p] % 100);
+        if (fclose(files[p]) != 0) rc = -1;
+        free(buffers[p]);
+        printf("%s: %zu sales, INR %lld.%02lld -> %s\n", processor_names[p], counts[p],
+               totals[p] / 100, totals[p] % 100, paths[p]);
+    }
+    if (counts[PROCESSOR_CARD] + counts[PROCESSOR_WALLET] == 0) printf("No new card/wallet sales to settle.\n");
+    return rc;
+}
+
+static void print_settlement_position(void) {
+    static const PaymentMode modes[2] = { PAY_CARD, PAY_WALLET };
+    for (int m = 0; m < 2; ++m) {
+        PaymentMode mode = modes[m];
+        long long outstanding = settlement.submitted[mode] - settlement.accepted[mode] - settlement.rejected[mode];
+        printf("%s: Sold %.2f | Accepted %lld.%02lld | Rejected %lld.%02lld | Awaiting response %lld.%02lld | Not yet submitted %.2f\n",
+               payment_name(mode), payment_mode_amount[mode],
+               settlement.accepted[mode] / 100, settlement.accepted[mode] % 100,
+               settlement.rejected[mode] / 100, settlement.rejected[mode] % 100,
+               outstanding / 100, outstanding % 100,
+               payment_mode_amount[mode] - settlement.submitted_amount[mode]);
+    }
+}
+
+/* Caller holds station_lock. */
+int reconcile_settlement(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open settlement response %s.\n", path);
+        return -1;
+    }
+    char line[256];
+    size_t matched = 0, unknown = 0, mismatched = 0, duplicates = 0, malformed = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        char id[64], status[16];
+        double amount;
+        if (sscanf(line, "%63[^,],%lf,%15s", id, &amount, status) != 3) continue;
+        /* Anything but the two final statuses leaves the sale submitted rather than rejecting it for good. */
+        int state = 0;
+        if (strcmp(status, "ACCEPTED") == 0) state = SETTLE_ACCEPTED;
+        else if (strcmp(status, "REJECTED") == 0) state = SETTLE_REJECTED;
+        if (!state) { malformed++; continue; }
+        if (settlement.table_cap == 0) { unknown++; continue; }
+        SettlementEntry *e = settle_find_slot(settlement.table, settlement.table_cap, id);
+        if (e->state == 0) { unknown++; continue; }
+        if (e->state != SETTLE_SUBMITTED) { duplicates++; continue; }
+        if (to_paise(amount) != e->paise) { mismatched++; continue; }
+        settle_resolve(e, state);
+        journal_settle(e->index, e->index + 1, 0, state);
+        matched++;
+    }
+    fclose(fp);
+    printf("\n----- Settlement Reconciliation -----\n");
+    printf("Matched: %zu | Unknown txn: %zu | Amount mismatch: %zu | Already reconciled: %zu | "
+           "Malformed status: %zu\n", matched, unknown, mismatched, duplicates, malformed);
+    print_settlement_position();
+    return 0;
+}
+
+void settle_payments_menu() {
+    char dir[256];
+    printf("Directory for settlement files: ");
+    if (scanf("%255s", dir) != 1) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+    clear_input_buffer();
+    pthread_mutex_lock(&station_lock);
+    run_settlement(dir);
+    print_settlement_position();
+    pthread_mutex_unlock(&station_lock);
+}
+
+void reconcile_settlement_menu() {
+    char path[256];
+    printf("Acquirer response file: ");
+    if (scanf("%255s", path) != 1) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+    clear_input_buffer();
+    pthread_mutex_lock(&station_lock);
+    reconcile_settlement(path);
+    pthread_mutex_unlock(&station_lock);
+}
+
+/*
+ * Transaction archive: the native on-disk format for historical sales. A
+ * fixed header is followed by raw Transaction records, so record i always
+ * lives at sizeof(ArchiveHeader) + i * sizeof(Transaction) and writers can
+ * fill disjoint ranges in parallel. The records are followed by one CRC32C
+ * per ARCHIVE_BLOCK_RECORDS block, and the header carries its own CRC32C.
+ */
+#define ARCHIVE_MAGIC "PPMSARC1"
+#define ARCHIVE_VERSION 5
+#define ARCHIVE_BLOCK_RECORDS TX_SEGMENT_RECORDS
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    uint32_t block_records;
+    uint32_t header_crc;
+} ArchiveHeader;
+
+static uint64_t archive_block_count(uint64_t record_count) {
+    return (record_count + ARCHIVE_BLOCK_RECORDS - 1) / ARCHIVE_BLOCK_RECORDS;
+}
+
+static off_t archive_crc_table_offset(uint64_t record_count) {
+    return (off_t)sizeof(ArchiveHeader) + (off_t)record_count * (off_t)sizeof(Transaction);
+}
+
+int archive_write_header(int fd, uint64_t record_count) {
+    ArchiveHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, ARCHIVE_MAGIC, sizeof(hdr.magic));
+    hdr.version = ARCHIVE_VERSION;
+    hdr.record_size = (uint32_t)sizeof(Transaction);
+    hdr.record_count = record_count;
+    hdr.block_records = ARCHIVE_BLOCK_RECORDS;
+    hdr.header_crc = crc32c(0, &hdr, offsetof(ArchiveHeader, header_crc));
+    return pwrite(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) ? 0 : -1;
+}
+
+/* Reads block b back from the file and sums it, for blocks no single writer produced whole. */
+static int archive_block_crc(int fd, uint64_t record_count, uint64_t b, uint32_t *crc) {
+    uint64_t first = b * ARCHIVE_BLOCK_RECORDS;
+    size_t n = record_count - first < ARCHIVE_BLOCK_RECORDS ? (size_t)(record_count - first) : ARCHIVE_BLOCK_RECORDS;
+    size_t bytes = n * sizeof(Transaction);
+    Transaction *block = (Transaction*) malloc(bytes);
+    int rc = block ? 0 : -1;
+    off_t off = (off_t)sizeof(ArchiveHeader) + (off_t)first * (off_t)sizeof(Transaction);
+    if (rc == 0 && pread(fd, block, bytes, off) != (ssize_t)bytes) rc = -1;
+    if (rc == 0) *crc = crc32c(0, block, bytes);
+    free(block);
+    return rc;
+}
+
+/* Appends the per-block CRC table once all records are in place. */
+int archive_write_checksums(int fd, uint64_t record_count, const uint32_t *crcs) {
+    size_t table = (size_t)archive_block_count(record_count) * sizeof(uint32_t);
+    return pwrite(fd, crcs, table, archive_crc_table_offset(record_count)) == (ssize_t)table ? 0 : -1;
+}
+
+/* Loads an archive into the in-memory store, rebuilding all aggregates. */
+long load_archive(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open archive %s.\n", path);
+        return -1;
+    }
+    ArchiveHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, ARCHIVE_MAGIC, sizeof(hdr.magic)) != 0) {
+        fprintf(stderr, "%s is not a transaction archive.\n", path);
+        fclose(fp);
+        return -1;
+    }
+    if (hdr.version != ARCHIVE_VERSION || hdr.record_size != sizeof(Transaction) ||
+        hdr.block_records != ARCHIVE_BLOCK_RECORDS) {
+        fprintf(stderr, "%s: unsupported archive version %u (record size %u).\n",
+                path, hdr.version, hdr.record_size);
+        fclose(fp);
+        return -1;
+    }
+    if (crc32c(0, &hdr, offsetof(ArchiveHeader, header_crc)) != hdr.header_crc) {
+        fprintf(stderr, "%s: archive header checksum mismatch.\n", path);
+        fclose(fp);
+        return -1;
+    }
+    uint64_t blocks = archive_block_count(hdr.record_count);
+    size_t table = (size_t)blocks * sizeof(uint32_t);
+    uint32_t *crcs = (uint32_t*) malloc(table ? table : 1);
+    Transaction *block = (Transaction*) malloc(ARCHIVE_BLOCK_RECORDS * sizeof(Transaction));
+    if (!crcs || !block) {
+        free(crcs); free(block);
+        fclose(fp);
+        return -1;
+    }
+    if (pread(fileno(fp), crcs, table, archive_crc_table_offset(hdr.record_count)) != (ssize_t)table) {
+        fprintf(stderr, "%s: archive truncated, block checksums missing.\n", path);
+        free(crcs); free(block);
+        fclose(fp);
+        return -1;
+    }
+    uint64_t loaded = 0;
+    for (uint64_t b = 0; b < blocks; ++b) {
+        size_t want = hdr.record_count - loaded < ARCHIVE_BLOCK_RECORDS ? (size_t)(hdr.record_count - loaded)
+                                                                         : ARCHIVE_BLOCK_RECORDS;
+        if (fread(block, sizeof(Transaction), want, fp) != want) {
+            fprintf(stderr, "%s: archive truncated in block %llu.\n", path, (unsigned long long)b);
+            break;
+        }
+        if (crc32c(0, block, want * sizeof(Transaction)) != crcs[b]) {
+            fprintf(stderr, "%s: block %llu (records %llu-%llu) failed its checksum; stopping load.\n", path,
+                    (unsigned long long)b, (unsigned long long)loaded, (unsigned long long)(loaded + want - 1));
+            break;
+        }
+        for (size_t i = 0; i < want; ++i) {
+            record_transaction(&block[i]);
+            txn_sequence_cover(block[i].txn_id);
+        }
+        loaded += want;
+    }
+    free(crcs);
+    free(block);
+    fclose(fp);
+    if (settlement_rebuild() != 0) fprintf(stderr, "%s: no memory for the settlement table.\n", path);
+    if (loaded < hdr.record_count) return -1;
+    return (long)loaded;
+}
+
+/*
+ * Rollup files hold one DayRollup each, named <dir>/YYYY-MM-DD.day, and are
+ * always rewritten whole by rollup_flush(): at day rollover, after each
+ * checkpoint and on exit. A day pushed out of live[] waits in closed[] until
+ * it has been written, so the sale path never does file I/O beyond reading
+ * a day the first time it is touched. A day that receives sales after it
+ * was written (a journal replay, a restart without a journal) is reopened
+ * from its file, so the file stays the complete total for the day. Days an
+ * archive load creates replace their files instead, so loading the same
+ * archive again does not count it twice. Replay and batch modes keep every
+ * day in memory and leave the directory alone.
+ */
+#define ROLLUP_MAGIC "PPMSDAY1"
+#define ROLLUP_VERSION 3
+
+static void rollup_path(char *out, size_t cap, const char *dir, int32_t date) {
+    snprintf(out, cap, "%s/%04d-%02d-%02d.day", dir, date / 10000, date / 100 % 100, date % 100);
+}
+
+static int rollup_write_file(const char *path, const DayRollup *r) {
+    DayRollup out = *r;
+    out.crc = crc32c(0, &out, offsetof(DayRollup, crc));
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return -1;
+    int ok = fwrite(&out, sizeof(out), 1, fp) == 1 && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) unlink(path);
+    return ok ? 0 : -1;
+}
+
+/* Returns 0 if the rollup file for date exists and is intact. */
+static int rollup_read(const char *dir, int32_t date, DayRollup *out) {
+    char path[300];
+    rollup_path(path, sizeof(path), dir, date);
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+    int ok = fread(out, sizeof(*out), 1, fp) == 1;
+    fclose(fp);
+    if (ok && memcmp(out->magic, ROLLUP_MAGIC, sizeof(out->magic)) == 0 && out->version == ROLLUP_VERSION &&
+        out->date == date && out->pump_count >= 0 && out->pump_count <= MAX_PUMPS &&
+        crc32c(0, out, offsetof(DayRollup, crc)) == out->crc)
+        return 0;
+    fprintf(stderr, "Rollup %s is damaged or from another version; ignoring it.\n", path);
+    return -1;
+}
+
+/* Caller holds station_lock. Queues a day leaving live[] for rollup_flush(). */
+static void rollup_close_out(int slot) {
+    DayRollup *r = &rollups.live[slot];
+    if (r->date > rollups.closed_through) rollups.closed_through = r->date;
+    if (rollups.closed_count == rollups.closed_cap) {
+        size_t cap = rollups.closed_cap ? rollups.closed_cap * 2 : ROLLUP_LIVE_DAYS;
+        ClosedDay *grown = (ClosedDay*) realloc(rollups.closed, cap * sizeof(ClosedDay));
+        if (!grown) {
+            rollups.write_failures++;
+            fprintf(stderr, "Out of memory; the rollup for %d is lost.\n", r->date);
+            return;
+        }
+        rollups.closed = grown;
+        rollups.closed_cap = cap;
+    }
+    ClosedDay *c = &rollups.closed[rollups.closed_count++];
+    c->seq = ++rollups.closed_seq;
+    c->day = *r;
+}
+
+/*
+ * Returns the live rollup for date (YYYYMMDD), marked dirty. A full live[]
+ * gives up its oldest day. A day not in memory starts from its file unless
+ * the journal already holds all of its sales. Caller holds station_lock.
+ */
+static DayRollup *rollup_day(int32_t date) {
+    int slot = rollups.hot;
+    if (rollups.count == 0 || rollups.live[slot].date != date) {
+        slot = -1;
+        for (int i = 0; i < rollups.count && slot < 0; ++i)
+            if (rollups.live[i].date == date) slot = i;
+    }
+    if (slot < 0) {
+        if (rollups.count < ROLLUP_LIVE_DAYS) {
+            slot = rollups.count++;
+        } else {
+            slot = 0;
+            for (int i = 1; i < ROLLUP_LIVE_DAYS; ++i)
+                if (rollups.live[i].date < rollups.live[slot].date) slot = i;
+            rollup_close_out(slot);
+        }
+        DayRollup *r = &rollups.live[slot];
+        int found = 0;
+        for (size_t i = 0; i < rollups.closed_count && !found; ++i) {
+            if (rollups.closed[i].day.date != date) continue;
+            *r = rollups.closed[i].day;
+            rollups.closed[i] = rollups.closed[--rollups.closed_count];
+            found = 1;
+        }
+        int from_file = rollups.journaled ? date <= rollups.closed_through
+                                          : !rollups.read_only && !rollups.archive_load;
+        if (!found && (!from_file || rollup_read(rollups.dir, date, r) != 0)) {
+            memset(r, 0, sizeof(*r));
+            memcpy(r->magic, ROLLUP_MAGIC, sizeof(r->magic));
+            r->version = ROLLUP_VERSION;
+            r->date = date;
+        }
+    }
+    rollups.hot = slot;
+    rollups.dirty[slot] = 1;
+    return &rollups.live[slot];
+}
+
+/*
+ * Writes the days queued by rollup_close_out() and every live day changed
+ * since the last flush. Copies are taken under station_lock, written outside
+ * it and renamed into place under it, and only while the copy is still the
+ * newest: a live day must still be live, a closed day still queued. A day
+ * that could not be written stays dirty or queued for the next flush.
+ */
+void rollup_flush() {
+    static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+    if (rollups.read_only) return;
+    pthread_mutex_lock(&flush_lock);
+    pthread_mutex_lock(&station_lock);
+    size_t n = 0;
+    ClosedDay *pending = (ClosedDay*) malloc((rollups.closed_count + (size_t)rollups.count) * sizeof(ClosedDay) + 1);
+    if (pending) {
+        for (size_t i = 0; i < rollups.closed_count; ++i) pending[n++] = rollups.closed[i];
+        for (int i = 0; i < rollups.count; ++i) {
+            if (!rollups.dirty[i]) continue;
+            pending[n].seq = 0;
+            pending[n++].day = rollups.live[i];
+            rollups.dirty[i] = 0;
+        }
+    }
+    pthread_mutex_unlock(&station_lock);
+    if (!pending) notice("Out of memory; daily rollups were not written.");
+    if (n > 0 && mkdir(rollups.dir, 0755) != 0 && access(rollups.dir, W_OK) != 0)
+        notice("Cannot use rollup directory %s.", rollups.dir);
+    for (size_t k = 0; k < n; ++k) {
+        char path[300], tmp[310];
+        rollup_path(path, sizeof(path), rollups.dir, pending[k].day.date);
+        snprintf(tmp, sizeof(tmp), "%s.flush", path);
+        int rc = rollup_write_file(tmp, &pending[k].day);
+        pthread_mutex_lock(&station_lock);
+        int live = -1;
+        long queued = -1;
+        if (pending[k].seq == 0) {
+            for (int i = 0; i < rollups.count && live < 0; ++i)
+                if (rollups.live[i].date == pending[k].day.date) live = i;
+        } else {
+            for (size_t i = 0; i < rollups.closed_count && queued < 0; ++i)
+                if (rollups.closed[i].seq == pending[k].seq) queued = (long)i;
+        }
+        if (live < 0 && queued < 0) {
+            /* Superseded: the day was closed out or reopened meanwhile and will be written from there. */
+            if (rc == 0) unlink(tmp);
+            pthread_mutex_unlock(&station_lock);
+            continue;
+        }
+        if (rc == 0) rc = rename(tmp, path);
+        if (rc == 0) {
+            rollups.written++;
+            if (queued >= 0) rollups.closed[queued] = rollups.closed[--rollups.closed_count];
+        } else {
+            rollups.write_failures++;
+            if (live >= 0) rollups.dirty[live] = 1;
+            notice("Cannot write daily rollup %s; will retry.", path);
+        }
+        pthread_mutex_unlock(&station_lock);
+    }
+    free(pending);
+    pthread_mutex_unlock(&flush_lock);
+}
+
+/* Copies the rollup for date from live[], closed[] or, failing that, from its file. */
+static int rollup_lookup(int32_t date, DayRollup *out) {
+    pthread_mutex_lock(&station_lock);
+    for (int i = 0; i < rollups.count; ++i) {
+        if (rollups.live[i].date == date) {
+            *out = rollups.live[i];
+            pthread_mutex_unlock(&station_lock);
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < rollups.closed_count; ++i) {
+        if (rollups.closed[i].day.date == date) {
+            *out = rollups.closed[i].day;
+            pthread_mutex_unlock(&station_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&station_lock);
+    return rollup_read(rollups.dir, date, out);
+}
+
+static int32_t rollup_date_add(int32_t date, int days, int *weekday) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = date / 10000 - 1900;
+    tm.tm_mon = date / 100 % 100 - 1;
+    tm.tm_mday = date % 100 + days;
+    tm.tm_hour = 12;
+    tm.tm_isdst = -1;
+    mktime(&tm);
+    if (weekday) *weekday = tm.tm_wday;
+    return (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+}
+
+/* Parses YYYY-MM-DD, or "0" for today, into YYYYMMDD. */
+static int rollup_parse_date(const char *input, int32_t *out) {
+    int y, m, d;
+    if (strcmp(input, "0") == 0) {
+        time_t now = time(NULL);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        *out = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+        return 0;
+    }
+    if (sscanf(input, "%d-%d-%d", &y, &m, &d) != 3 || y < 1970 || m < 1 || m > 12 || d < 1 || d > 31) return -1;
+    *out = rollup_date_add(y * 10000 + m * 100 + d, 0, NULL);
+    return 0;
+}
+
+static double rollup_pump_amount(const DayRollup *r, int pump_id) {
+    for (int i = 0; i < r->pump_count; ++i)
+        if (r->pump_id[i] == pump_id) return r->pump_amount[i];
+    return 0.0;
+}
+
+static void compare_change(char *buf, size_t cap, int have, double cur, double base) {
+    if (!have) snprintf(buf, cap, "-");
+    else if (base != 0.0) snprintf(buf, cap, "%+.1f%%", (cur - base) / base * 100.0);
+    else snprintf(buf, cap, cur != 0.0 ? "new" : "0");
+}
+
+static void compare_row(const char *label, int decimals, double cur, const int have[3], double prev, double week) {
+    char dp[16], dw[16], vp[24], vw[24];
+    compare_change(dp, sizeof(dp), have[1], cur, prev);
+    compare_change(dw, sizeof(dw), have[2], cur, week);
+    if (have[1]) snprintf(vp, sizeof(vp), "%.*f", decimals, prev); else snprintf(vp, sizeof(vp), "-");
+    if (have[2]) snprintf(vw, sizeof(vw), "%.*f", decimals, week); else snprintf(vw, sizeof(vw), "-");
+    printf("%-16s %14.*f %14s %8s %14s %8s\n", label, decimals, cur, vp, dp, vw, dw);
+}
+
+/*
+ * Day-over-day and week-over-week comparison: a day against the day before
+ * and the same weekday a week earlier, read entirely from rollups.
+ */
+void show_day_comparison() {
+    static const char *weekdays[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    char input[32];
+    int32_t date;
+    printf("\nDay to compare (YYYY-MM-DD, or 0 for today): ");
+    if (scanf("%31s", input) != 1 || rollup_parse_date(input, &date) != 0) {
+        clear_input_buffer();
+        printf("Invalid date.\n");
+        return;
+    }
+    clear_input_buffer();
+
+    TRACE_BEGIN("day_comparison");
+    DayRollup day[3];
+    int32_t dates[3];
+    int wday[3], have[3];
+    static const int offsets[3] = {0, -1, -7};
+    for (int k = 0; k < 3; ++k) {
+        dates[k] = rollup_date_add(date, offsets[k], &wday[k]);
+        have[k] = rollup_lookup(dates[k], &day[k]) == 0;
+        if (!have[k]) memset(&day[k], 0, sizeof(day[k]));
+    }
+    char head[3][24];
+    for (int k = 0; k < 3; ++k)
+        snprintf(head[k], sizeof(head[k]), "%s %04d-%02d-%02d", weekdays[wday[k]],
+                 dates[k] / 10000, dates[k] / 100 % 100, dates[k] % 100);
+    printf("\n=============== DAY COMPARISON ===============\n");
+    printf("%-16s %14s %14s %8s %14s %8s\n", "", head[0] + 4, head[1] + 4, "DoD", head[2] + 4, "WoW");
+    printf("%-16s %14s %14s %8s %14s %8s\n", "", weekdays[wday[0]], weekdays[wday[1]], "", weekdays[wday[2]], "");
+    if (!have[0]) printf("No rollup for %s; showing it as zero.\n", head[0]);
+
+    double qty[3] = {0}, amt[3] = {0};
+    for (int k = 0; k < 3; ++k)
+        for (int f = 0; f < 3; ++f) {
+            qty[k] += day[k].fuel_quantity[f];
+            amt[k] += day[k].fuel_amount[f];
+        }
+    printf("-- Totals\n");
+    compare_row("Sales", 0, (double)day[0].sales, have, (double)day[1].sales, (double)day[2].sales);
+    compare_row("Quantity", 3, qty[0], have, qty[1], qty[2]);
+    compare_row("Revenue (INR)", 2, amt[0], have, amt[1], amt[2]);
+
+    printf("-- Fuel (revenue INR / quantity)\n");
+    for (int f = 0; f < 3; ++f) {
+        char label[24];
+        snprintf(label, sizeof(label), "%s", fuel_name((FuelType)f));
+        compare_row(label, 2, day[0].fuel_amount[f], have, day[1].fuel_amount[f], day[2].fuel_amount[f]);
+        snprintf(label, sizeof(label), "  quantity");
+        compare_row(label, 3, day[0].fuel_quantity[f], have, day[1].fuel_quantity[f], day[2].fuel_quantity[f]);
+    }
+
+    printf("-- Pump (revenue INR)\n");
+    int ids[3 * MAX_PUMPS], nids = 0;
+    for (int k = 0; k < 3; ++k)
+        for (int i = 0; i < day[k].pump_count; ++i) {
+            int seen = 0;
+            for (int j = 0; j < nids && !seen; ++j) seen = ids[j] == day[k].pump_id[i];
+            if (!seen) ids[nids++] = day[k].pump_id[i];
+        }
+    for (int i = 1; i < nids; ++i)
+        for (int j = i; j > 0 && ids[j - 1] > ids[j]; --j) {
+            int t = ids[j];
+            ids[j] = ids[j - 1];
+            ids[j - 1] = t;
+        }
+    for (int i = 0; i < nids; ++i) {
+        char label[24];
+        snprintf(label, sizeof(label), "Pump %d", ids[i]);
+        compare_row(label, 2, rollup_pump_amount(&day[0], ids[i]), have,
+                    rollup_pump_amount(&day[1], ids[i]), rollup_pump_amount(&day[2], ids[i]));
+    }
+
+    printf("-- Hour (revenue INR)\n");
+    for (int h = 0; h < 24; ++h) {
+        if (day[0].hour_amount[h] == 0.0 && day[1].hour_amount[h] == 0.0 && day[2].hour_amount[h] == 0.0) continue;
+        char label[24];
+        snprintf(label, sizeof(label), "%02d:00", h);
+        compare_row(label, 2, day[0].hour_amount[h], have, day[1].hour_amount[h], day[2].hour_amount[h]);
+    }
+
+    printf("-- Payment mode (revenue INR)\n");
+    for (int p = 0; p < 3; ++p)
+        compare_row(payment_name((PaymentMode)p), 2, day[0].payment_amount[p], have,
+                    day[1].payment_amount[p], day[2].payment_amount[p]);
+    printf("==============================================\n");
+    TRACE_END("day_comparison");
+}
+
+/* Natural log for the small-range correction below, without pulling in libm. */
+static double hll_ln(double x) {
+    int e = 0;
+    while (x >= 2.0) { x /= 2.0; e++; }
+    while (x < 1.0) { x *= 2.0; e--; }
+    double z = (x - 1.0) / (x + 1.0), z2 = z * z, term = z, sum = 0.0;
+    for (int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= z2;
+    }
+    return 2.0 * sum + e * 0.69314718055994530942;
+}
+
+static void hll_merge(HyperLogLog *dst, const HyperLogLog *src) {
+    for (int i = 0; i < HLL_REGISTERS; ++i)
+        if (src->reg[i] > dst->reg[i]) dst->reg[i] = src->reg[i];
+}
+
+static double hll_estimate(const HyperLogLog *h) {
+    double sum = 0.0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; ++i) {
+        sum += 1.0 / (double)(1ull << h->reg[i]);
+        if (h->reg[i] == 0) zeros++;
+    }
+    double m = HLL_REGISTERS;
+    double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+    /* Linear counting while many registers are still empty. */
+    if (estimate <= 2.5 * m && zeros > 0) estimate = m * hll_ln(m / zeros);
+    return estimate;
+}
+
+#define UNIQUE_MAX_STATIONS 8
+
+/*
+ * Distinct vehicles and card holders over a range of days, merged from the
+ * daily sketches of this station and, optionally, other stations' rollup
+ * directories. Cost is one sketch merge per station-day, whatever the
+ * number of sales.
+ */
+void show_unique_counts() {
+    char input[32], others[256];
+    int32_t first;
+    int days;
+    printf("\nFirst day (YYYY-MM-DD, or 0 for today): ");
+    if (scanf("%31s", input) != 1 || rollup_parse_date(input, &first) != 0) {
+        clear_input_buffer();
+        printf("Invalid date.\n");
+        return;
+    }
+    printf("Number of days (1-3660): ");
+    if (scanf("%d", &days) != 1 || days < 1 || days > 3660) {
+        clear_input_buffer();
+        printf("Invalid number of days.\n");
+        return;
+    }
+    printf("Other stations' rollup directories (comma-separated, - for none): ");
+    if (scanf("%255s", others) != 1) {
+        clear_input_buffer();
+        printf("Invalid.\n");
+        return;
+    }
+    clear_input_buffer();
+
+    const char *dirs[UNIQUE_MAX_STATIONS];
+    int stations = 0;
+    dirs[stations++] = rollups.dir;
+    if (strcmp(others, "-") != 0) {
+        for (char *save = NULL, *d = strtok_r(others, ",", &save); d; d = strtok_r(NULL, ",", &save)) {
+            if (stations == UNIQUE_MAX_STATIONS) {
+                printf("Only the first %d stations are merged.\n", UNIQUE_MAX_STATIONS);
+                break;
+            }
+            dirs[stations++] = d;
+        }
+    }
+
+    HyperLogLog *range = (HyperLogLog*) calloc(2, sizeof(HyperLogLog));
+    HyperLogLog *today = (HyperLogLog*) calloc(2, sizeof(HyperLogLog));
+    DayRollup *r = (DayRollup*) malloc(sizeof(DayRollup));
+    if (!range || !today || !r) {
+        free(range);
+        free(today);
+        free(r);
+        printf("Out of memory.\n");
+        return;
+    }
+    TRACE_BEGIN("unique_counts");
+    int32_t last = rollup_date_add(first, days - 1, NULL);
+    printf("\n--- Distinct Vehicles & Card Holders, %04d-%02d-%02d to %04d-%02d-%02d, %d station%s ---\n",
+           first / 10000, first / 100 % 100, first % 100, last / 10000, last / 100 % 100, last % 100,
+           stations, stations == 1 ? "" : "s");
+    if (days <= 31) printf("%-12s %10s %12s %14s\n", "Date", "Sales", "Vehicles", "Card holders");
+    unsigned long merged = 0, missing = 0;
+    struct timespec start, end;
+    double merge_secs = 0.0;
+    for (int k = 0; k < days; ++k) {
+        int32_t date = rollup_date_add(first, k, NULL);
+        uint64_t sales = 0;
+        int found = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        memset(today, 0, 2 * sizeof(HyperLogLog));
+        for (int s = 0; s < stations; ++s) {
+            int rc = s == 0 ? rollup_lookup(date, r) : rollup_read(dirs[s], date, r);
+            if (rc != 0) {
+                missing++;
+                continue;
+            }
+            found = 1;
+            merged++;
+            sales += r->sales;
+            hll_merge(&today[0], &r->vehicles);
+            hll_merge(&today[1], &r->customers);
+        }
+        hll_merge(&range[0], &today[0]);
+        hll_merge(&range[1], &today[1]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        merge_secs += elapsed_seconds(&start, &end);
+        if (days <= 31 && found)
+            printf("%04d-%02d-%02d %10llu %12.0f %14.0f\n", date / 10000, date / 100 % 100, date % 100,
+                   (unsigned long long)sales, hll_estimate(&today[0]), hll_estimate(&today[1]));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double vehicles = hll_estimate(&range[0]), customers = hll_estimate(&range[1]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Whole range: %.0f vehicles | %.0f card holders (+/- %.1f%%)\n", vehicles, customers,
+           104.0 / (1 << (HLL_PRECISION / 2)));
+    printf("Merged %lu daily sketches (%lu KB) in %.0f us; %lu station-days without a rollup.\n",
+           merged, merged * 2 * sizeof(HyperLogLog) / 1024,
+           (merge_secs + elapsed_seconds(&start, &end)) * 1e6, missing);
+    TRACE_END("unique_counts");
+    free(range);
+    free(today);
+    free(r);
+}
+
+/*
+ * Standing queries: live metrics such as
+ *     sum(amount) where payment = card and vehicle = commercial and fuel = diesel today
+ * are compiled once into a filter (a bitmask per categorical field, bit sets
+ * of pump ids and hours, open/closed ranges on amount and quantity) and one
+ * specialised update function. record_transaction() feeds every sale to the
+ * registered queries, so a result is always current and reading it costs
+ * nothing. Definitions persist in standing_path (STANDING_QUERY_FILE unless
+ * --standing-queries names another file) and are re-registered at startup
+ * with a one-off backfill over the loaded transactions.
+ */
+#define STANDING_MAX 16
+#define STANDING_TEXT 192
+#define STANDING_PUMP_IDS 1024
+#define STANDING_QUERY_FILE "standing_queries.txt"
+#define STANDING_BACKFILL_CHUNK 65536
+
+static char standing_path[256] = STANDING_QUERY_FILE;
+
+typedef struct {
+    double lo, hi;
+    int lo_open, hi_open;
+} StandingRange;
+
+typedef struct {
+    uint8_t fuel, vehicle, payment;     /* bit per enum value */
+    uint32_t hours;                     /* bit per local hour */
+    int any_pump;
+    uint64_t pumps[STANDING_PUMP_IDS / 64];
+    StandingRange amount, quantity;
+} StandingFilter;
+
+typedef enum { AGG_COUNT, AGG_SUM, AGG_AVG, AGG_MAX, AGG_DISTINCT } StandingAggregate;
+
+struct StandingQuery;
+typedef void (*StandingUpdate)(struct StandingQuery *q, const Transaction *tx);
+
+typedef struct StandingQuery {
+    int active;
+    unsigned id;
+    char text[STANDING_TEXT];
+    StandingAggregate agg;
+    int measure_quantity;
+    int today;                  /* window restarts with each local day */
+    StandingFilter filter;
+    StandingUpdate update;
+    int32_t day;                /* results below; guarded by station_lock */
+    uint64_t matched;
+    double sum;
+    double max;
+    HyperLogLog distinct;
+} StandingQuery;
+
+static struct {
+    StandingQuery q[STANDING_MAX];      /* guarded by station_lock */
+    unsigned next_id;
+} standing;
+
+/* Backfill-only: localtime() once per 15 minutes of timestamps, the finest granularity of any UTC offset. */
+typedef struct {
+    time_t bucket;
+    int hour;
+    int32_t date;
+} StandingClock;
+
+static void standing_clock(StandingClock *c, time_t t, int *hour, int32_t *date) {
+    if (t / 900 != c->bucket) {
+        struct tm tm;
+        localtime_r(&t, &tm);
+        c->bucket = t / 900;
+        c->hour = tm.tm_hour;
+        c->date = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+    }
+    *hour = c->hour;
+    *date = c->date;
+}
+
+static int standing_in_range(const StandingRange *r, double v) {
+    return (v > r->lo || (!r->lo_open && v == r->lo)) && (v < r->hi || (!r->hi_open && v == r->hi));
+}
+
+static int standing_match(const StandingFilter *f, const Transaction *tx, int hour) {
+    if (!(f->fuel >> tx->fuel_type & 1) || !(f->vehicle >> tx->vehicle_type & 1) ||
+        !(f->payment >> tx->payment_mode & 1) || !(f->hours >> hour & 1))
+        return 0;
+    if (!f->any_pump && (tx->pump_id < 0 || tx->pump_id >= STANDING_PUMP_IDS ||
+                         !(f->pumps[tx->pump_id / 64] >> (tx->pump_id % 64) & 1)))
+        return 0;
+    return standing_in_range(&f->amount, tx->amount) && standing_in_range(&f->quantity, tx->quantity);
+}
+
+static void standing_count_only(StandingQuery *q, const Transaction *tx) { (void)q; (void)tx; }
+static void standing_add_amount(StandingQuery *q, const Transaction *tx) { q->sum += tx->amount; }
+static void standing_add_quantity(StandingQuery *q, const Transaction *tx) { q->sum += tx->quantity; }
+static void standing_max_amount(StandingQuery *q, const Transaction *tx) {
+    if (q->matched == 1 || tx->amount > q->max) q->max = tx->amount;
+}
+static void standing_max_quantity(StandingQuery *q, const Transaction *tx) {
+    if (q->matched == 1 || tx->quantity > q->max) q->max = tx->quantity;
+}
+static void standing_distinct_vehicle(StandingQuery *q, const Transaction *tx) {
+    if (tx->vehicle_hash) hll_add(&q->distinct, tx->vehicle_hash);
+}
+static void standing_distinct_customer(StandingQuery *q, const Transaction *tx) {
+    if (tx->customer_hash) hll_add(&q->distinct, tx->customer_hash);
+}
+
+/* Caller holds station_lock. */
+static void standing_feed(StandingQuery *q, const Transaction *tx, int hour, int32_t date) {
+    if (!standing_match(&q->filter, tx, hour)) return;
+    if (q->today) {
+        if (date < q->day) return;
+        if (date > q->day) {
+            q->day = date;
+            q->matched = 0;
+            q->sum = q->max = 0.0;
+            memset(&q->distinct, 0, sizeof(q->distinct));
+        }
+    }
+    q->matched++;
+    q->update(q, tx);
+}
+
+/* Called from record_transaction() with station_lock held. */
+static void standing_apply(const Transaction *tx, int hour, int32_t date) {
+    for (int i = 0; i < STANDING_MAX; ++i)
+        if (standing.q[i].active) standing_feed(&standing.q[i], tx, hour, date);
+}
+
+typedef struct {
+    const char *p;
+    char tok[32];
+    const char *error;
+} StandingParser;
+
+static void standing_advance(StandingParser *ps) {
+    const char *p = ps->p;
+    size_t n = 0;
+    while (*p && isspace((unsigned char)*p)) p++;
+    if (*p && strchr("(),", *p)) {
+        ps->tok[n++] = *p++;
+    } else if (*p && strchr("=!<>", *p)) {
+        ps->tok[n++] = *p++;
+        if (*p == '=') ps->tok[n++] = *p++;
+    } else {
+        while (*p && !isspace((unsigned char)*p) && !strchr("(),=!<>", *p)) {
+            if (n + 1 < sizeof(ps->tok)) ps->tok[n++] = (char)tolower((unsigned char)*p);
+            p++;
+        }
+    }
+    ps->tok[n] = '\0';
+    ps->p = p;
+}
+
+static int standing_accept(StandingParser *ps, const char *word) {
+    if (strcmp(ps->tok, word) != 0) return 0;
+    standing_advance(ps);
+    return 1;
+}
+
+static int standing_expect(StandingParser *ps, const char *word, const char *error) {
+    if (standing_accept(ps, word)) return 1;
+    if (!ps->error) ps->error = error;
+    return 0;
+}
+
+static int standing_number(StandingParser *ps, double *out) {
+    char *end;
+    *out = strtod(ps->tok, &end);
+    if (ps->tok[0] == '\0' || *end != '\0') {
+        if (!ps->error) ps->error = "expected a number";
+        return 0;
+    }
+    standing_advance(ps);
+    return 1;
+}
+
+/* Index of a categorical value (fuel, vehicle, payment), or -1. */
+static int standing_category(const char *field, const char *value) {
+    static const char *vehicles[] = {"2w", "4w", "commercial"};
+    static const char *modes[] = {"cash", "card", "wallet"};
+    if (strcmp(field, "fuel") == 0) return fuel_from_name(value);
+    const char **names = strcmp(field, "vehicle") == 0 ? vehicles : modes;
+    for (int i = 0; i < 3; ++i)
+        if (strcmp(value, names[i]) == 0) return i;
+    return -1;
+}
+
+/* Narrows set (over [0, domain)) to the values that satisfy "op operand(s)" for an integer field. */
+static void standing_int_condition(StandingParser *ps, uint64_t *set, int domain) {
+    uint64_t keep[STANDING_PUMP_IDS / 64];
+    memset(keep, 0, sizeof(keep));
+    char op[sizeof(ps->tok)];
+    snprintf(op, sizeof(op), "%s", ps->tok);
+    standing_advance(ps);
+    double a, b;
+    if (strcmp(op, "in") == 0) {
+        do {
+            if (!standing_number(ps, &a)) return;
+            if (a >= 0 && a < domain && a == (int)a) keep[(int)a / 64] |= 1ull << ((int)a % 64);
+        } while (standing_accept(ps, ","));
+    } else if (strcmp(op, "between") == 0) {
+        if (!standing_number(ps, &a) || !standing_expect(ps, "and", "expected 'and' in between") ||
+            !standing_number(ps, &b))
+            return;
+        for (int v = 0; v < domain; ++v)
+            if (v >= a && v <= b) keep[v / 64] |= 1ull << (v % 64);
+    } else {
+        if (!standing_number(ps, &a)) return;
+        for (int v = 0; v < domain; ++v) {
+            int ok = strcmp(op, "=") == 0 ? v == a : strcmp(op, "!=") == 0 ? v != a :
+                     strcmp(op, "<") == 0 ? v < a : strcmp(op, "<=") == 0 ? v <= a :
+                     strcmp(op, ">") == 0 ? v > a : strcmp(op, ">=") == 0 ? v >= a : -1;
+            if (ok < 0) {
+                ps->error = "expected =, !=, <, <=, >, >=, in or between";
+                return;
+            }
+            if (ok) keep[v / 64] |= 1ull << (v % 64);
+        }
+    }
+    for (int w = 0; w < (domain + 63) / 64; ++w) set[w] &= keep[w];
+}
+
+static void standing_range_condition(StandingParser *ps, StandingRange *r) {
+    char op[sizeof(ps->tok)];
+    snprintf(op, sizeof(op), "%s", ps->tok);
+    standing_advance(ps);
+    double a, b;
+    if (strcmp(op, "between") == 0) {
+        if (!standing_number(ps, &a) || !standing_expect(ps, "and", "expected 'and' in between") ||
+            !standing_number(ps, &b))
+            return;
+    } else if (standing_number(ps, &a)) {
+        b = a;
+    } else {
+        return;
+    }
+    int lo = strcmp(op, "=") == 0 || strcmp(op, "between") == 0 || op[0] == '>';
+    int hi = strcmp(op, "=") == 0 || strcmp(op, "between") == 0 || op[0] == '<';
+    if (!lo && !hi) {
+        ps->error = "expected =, <, <=, >, >= or between";
+        return;
+    }
+    int open = strcmp(op, "<") == 0 || strcmp(op, ">") == 0;
+    if (lo && (a > r->lo || (a == r->lo && open))) {
+        r->lo = a;
+        r->lo_open = open;
+    }
+    if (hi && (b < r->hi || (b == r->hi && open))) {
+        r->hi = b;
+        r->hi_open = open;
+    }
+}
+
+static void standing_condition(StandingParser *ps, StandingFilter *f) {
+    char field[32];
+    snprintf(field, sizeof(field), "%s", ps->tok);
+    standing_advance(ps);
+    if (strcmp(field, "fuel") == 0 || strcmp(field, "vehicle") == 0 || strcmp(field, "payment") == 0) {
+        uint8_t *mask = field[0] == 'f' ? &f->fuel : field[0] == 'v' ? &f->vehicle : &f->payment;
+        int negate = strcmp(ps->tok, "!=") == 0;
+        int list = strcmp(ps->tok, "in") == 0;
+        if (!negate && !list && strcmp(ps->tok, "=") != 0) {
+            ps->error = "expected =, != or in";
+            return;
+        }
+        standing_advance(ps);
+        uint8_t set = 0;
+        do {
+            int v = standing_category(field, ps->tok);
+            if (v < 0) {
+                ps->error = "unknown value (petrol/diesel/cng, 2w/4w/commercial, cash/card/wallet)";
+                return;
+            }
+            set |= (uint8_t)(1u << v);
+            standing_advance(ps);
+        } while (list && standing_accept(ps, ","));
+        *mask &= negate ? (uint8_t)~set : set;
+    } else if (strcmp(field, "pump") == 0) {
+        f->any_pump = 0;
+        standing_int_condition(ps, f->pumps, STANDING_PUMP_IDS);
+    } else if (strcmp(field, "hour") == 0) {
+        uint64_t hours = f->hours;
+        standing_int_condition(ps, &hours, 24);
+        f->hours = (uint32_t)hours;
+    } else if (strcmp(field, "amount") == 0 || strcmp(field, "quantity") == 0) {
+        standing_range_condition(ps, field[0] == 'a' ? &f->amount : &f->quantity);
+    } else {
+        ps->error = "expected fuel, vehicle, payment, pump, hour, amount or quantity";
+    }
+}
+
+/*
+ * query := aggregate [where condition {and condition}] [today]
+ * aggregate := count | sum|avg|max (amount|quantity) | distinct (vehicle|customer)
+ * Returns 0 and fills q, or -1 after printing where the text went wrong.
+ */
+static int standing_compile(const char *text, StandingQuery *q) {
+    StandingParser ps = { text, "", NULL };
+    memset(q, 0, sizeof(*q));
+    snprintf(q->text, sizeof(q->text), "%s", text);
+    q->filter.fuel = q->filter.vehicle = q->filter.payment = 0x7;
+    q->filter.hours = 0xFFFFFF;
+    q->filter.any_pump = 1;
+    memset(q->filter.pumps, 0xFF, sizeof(q->filter.pumps));
+    q->filter.amount.lo = q->filter.quantity.lo = -1e300;
+    q->filter.amount.hi = q->filter.quantity.hi = 1e300;
+    standing_advance(&ps);
+
+    if (standing_accept(&ps, "count")) {
+        q->agg = AGG_COUNT;
+        q->update = standing_count_only;
+    } else if (strcmp(ps.tok, "distinct") == 0) {
+        standing_advance(&ps);
+        q->agg = AGG_DISTINCT;
+        standing_expect(&ps, "(", "expected '('");
+        if (standing_accept(&ps, "vehicle")) q->update = standing_distinct_vehicle;
+        else if (standing_accept(&ps, "customer")) q->update = standing_distinct_customer;
+        else if (!ps.error) ps.error = "expected vehicle or customer";
+        standing_expect(&ps, ")", "expected ')'");
+    } else if (strcmp(ps.tok, "sum") == 0 || strcmp(ps.tok, "avg") == 0 || strcmp(ps.tok, "max") == 0) {
+        q->agg = ps.tok[0] == 's' ? AGG_SUM : ps.tok[0] == 'a' ? AGG_AVG : AGG_MAX;
+        standing_advance(&ps);
+        standing_expect(&ps, "(", "expected '('");
+        if (standing_accept(&ps, "amount")) {
+            q->update = q->agg == AGG_MAX ? standing_max_amount : standing_add_amount;
+        } else if (standing_accept(&ps, "quantity")) {
+            q->measure_quantity = 1;
+            q->update = q->agg == AGG_MAX ? standing_max_quantity : standing_add_quantity;
+        } else if (!ps.error) {
+            ps.error = "expected amount or quantity";
+        }
+        standing_expect(&ps, ")", "expected ')'");
+    } else {
+        ps.error = "expected count, sum, avg, max or distinct";
+    }
+
+    if (!ps.error && standing_accept(&ps, "where")) {
+        do {
+            standing_condition(&ps, &q->filter);
+        } while (!ps.error && standing_accept(&ps, "and"));
+    }
+    if (!ps.error && standing_accept(&ps, "today")) q->today = 1;
+    if (!ps.error && ps.tok[0] != '\0') ps.error = "unexpected text";
+    if (ps.error) {
+        printf("Query error near '%s': %s.\n", ps.tok[0] ? ps.tok : "end of query", ps.error);
+        return -1;
+    }
+    return 0;
+}
+
+static void standing_save(void) {
+    char tmp[270];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", standing_path);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return;
+    pthread_mutex_lock(&station_lock);
+    for (int i = 0; i < STANDING_MAX; ++i)
+        if (standing.q[i].active) fprintf(fp, "%s\n", standing.q[i].text);
+    pthread_mutex_unlock(&station_lock);
+    int ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    fclose(fp);
+    if (!ok || rename(tmp, standing_path) != 0) fprintf(stderr, "Cannot save standing queries to %s.\n", standing_path);
+}
+
+/*
+ * Registers a query and backfills it from the transactions already loaded.
+ * The query goes live first, so sales committed during the backfill are fed
+ * incrementally while the backfill walks the older records in chunks.
+ * *backfilled, if given, receives the number of records walked.
+ */
+int standing_register(const char *text, int persist, size_t *backfilled) {
+    StandingQuery *q = (StandingQuery*) malloc(sizeof(StandingQuery));
+    if (!q) return -1;
+    if (standing_compile(text, q) != 0) {
+        free(q);
+        return -1;
+    }
+    pthread_mutex_lock(&station_lock);
+    int slot = 0;
+    while (slot < STANDING_MAX && standing.q[slot].active) slot++;
+    if (slot == STANDING_MAX) {
+        pthread_mutex_unlock(&station_lock);
+        free(q);
+        printf("All %d standing query slots are in use.\n", STANDING_MAX);
+        return -1;
+    }
+    unsigned id = ++standing.next_id;
+    q->id = id;
+    q->active = 1;
+    standing.q[slot] = *q;
+    size_t end = tx_count;
+    pthread_mutex_unlock(&station_lock);
+    free(q);
+
+    StandingClock clock = { -1, 0, 0 };
+    for (size_t next = 0; next < end;) {
+        pthread_mutex_lock(&station_lock);
+        StandingQuery *live = &standing.q[slot];
+        if (!live->active || live->id != id) {
+            pthread_mutex_unlock(&station_lock);
+            break;
+        }
+        size_t stop = next + STANDING_BACKFILL_CHUNK < end ? next + STANDING_BACKFILL_CHUNK : end;
+        for (; next < stop; ++next) {
+            int hour;
+            int32_t date;
+            standing_clock(&clock, transactions[next].timestamp, &hour, &date);
+            standing_feed(live, &transactions[next], hour, date);
+        }
+        pthread_mutex_unlock(&station_lock);
+    }
+    if (persist) standing_save();
+    if (backfilled) *backfilled = end;
+    return (int)id;
+}
+
+/* Re-registers the saved definitions; called once after recovery. */
+void standing_load() {
+    FILE *fp = fopen(standing_path, "r");
+    if (!fp) return;
+    char line[STANDING_TEXT + 2];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] && standing_register(line, 0, NULL) < 0)
+            fprintf(stderr, "%s: skipped standing query \"%s\".\n", standing_path, line);
+    }
+    fclose(fp);
+}
+
+static void standing_format(const StandingQuery *q, int32_t today, char *out, size_t cap) {
+    int stale = q->today && q->day != today;
+    uint64_t matched = stale ? 0 : q->matched;
+    int decimals = q->measure_quantity ? 3 : 2;
+    switch (q->agg) {
+        case AGG_COUNT:
+            snprintf(out, cap, "%llu", (unsigned long long)matched);
+            break;
+        case AGG_SUM:
+            snprintf(out, cap, "%.*f", decimals, stale ? 0.0 : q->sum);
+            break;
+        case AGG_AVG:
+            snprintf(out, cap, "%.*f", decimals, matched ? q->sum / (double)matched : 0.0);
+            break;
+        case AGG_MAX:
+            snprintf(out, cap, "%.*f", decimals, matched ? q->max : 0.0);
+            break;
+        case AGG_DISTINCT:
+            snprintf(out, cap, "%.0f", stale ? 0.0 : hll_estimate(&q->distinct));
+            break;
+    }
+}
+
+void standing_queries_menu() {
+    for (;;) {
+        time_t now = time(NULL);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        int32_t today = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+        printf("\n----- Standing Queries -----\n");
+        int shown = 0;
+        pthread_mutex_lock(&station_lock);
+        for (int i = 0; i < STANDING_MAX; ++i) {
+            const StandingQuery *q = &standing.q[i];
+            if (!q->active) continue;
+            char value[48];
+            standing_format(q, today, value, sizeof(value));
+            printf("#%-3u %-16s %s\n", q->id, value, q->text);
+            shown++;
+        }
+        pthread_mutex_unlock(&station_lock);
+        if (!shown) printf("None registered.\n");
+        printf("1. Add  2. Remove  0. Back: ");
+        int choice;
+        if (scanf("%d", &choice) != 1) {
+            clear_input_buffer();
+            return;
+        }
+        clear_input_buffer();
+        if (choice == 1) {
+            char text[STANDING_TEXT];
+            printf("Query, e.g. sum(amount) where payment = card and vehicle = commercial and fuel = diesel today\n> ");
+            if (!fgets(text, sizeof(text), stdin)) return;
+            text[strcspn(text, "\r\n")] = '\0';
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            size_t backfilled = 0;
+            int id = standing_register(text, 1, &backfilled);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (id > 0) printf("Registered #%d; backfilled %zu transactions in %.3f ms.\n", id, backfilled,
+                               elapsed_seconds(&start, &end) * 1e3);
+        } else if (choice == 2) {
+            unsigned id;
+            printf("Query number to remove: ");
+            if (scanf("%u", &id) != 1) {
+                clear_input_buffer();
+                continue;
+            }
+            clear_input_buffer();
+            int removed = 0;
+            pthread_mutex_lock(&station_lock);
+            for (int i = 0; i < STANDING_MAX; ++i) {
+                if (standing.q[i].active && standing.q[i].id == id) {
+                    standing.q[i].active = 0;
+                    removed = 1;
+                }
+            }
+            pthread_mutex_unlock(&station_lock);
+            if (removed) standing_save();
+            else printf("No standing query #%u.\n", id);
+        } else {
+            return;
+        }
+    }
+}
+
+/*
+ * Ad-hoc queries (menu 31 and --query): a small SQL dialect over the sales,
+ *     [EXPLAIN] [APPROX] SELECT item, ... FROM sales [WHERE condition AND ...]
+ *         [GROUP BY fuel|vehicle|payment|pump|hour|date|month]
+ *         [ORDER BY column|position [ASC|DESC]] [LIMIT n]
+ * where an item is the GROUP BY key, count(*), sum/avg/min/max(amount or
+ * quantity) or distinct(vehicle|customer), or * to list matching sales.
+ * Conditions are those of standing queries plus date (=, <, <=, >, >=,
+ * between YYYY-MM-DD or today). The planner answers from the cheapest
+ * source that has the data: the running counters, the daily rollups, the
+ * block index (time and amount range per TX_SEGMENT_RECORDS slice) or a
+ * full scan, which filters a block into a selection vector before
+ * aggregating it. APPROX answers count, sum and avg from the per-day samples
+ * instead, each value with a 95% confidence interval.
+ */
+#define SQL_MAX_ITEMS 8
+#define SQL_MAX_GROUPS 4096
+#define SQL_GROUP_SLOTS (2 * SQL_MAX_GROUPS)
+#define SQL_MAX_ROWS 1000
+#define SQL_DEFAULT_ROWS 20
+#define SQL_DATE_MAX 99991231
+
+typedef enum { COL_KEY, COL_COUNT, COL_SUM, COL_AVG, COL_MIN, COL_MAX, COL_DISTINCT } SqlColumnKind;
+typedef enum { KEY_NONE, KEY_FUEL, KEY_VEHICLE, KEY_PAYMENT, KEY_PUMP, KEY_HOUR, KEY_DATE, KEY_MONTH } SqlKey;
+typedef enum { PLAN_COUNTERS, PLAN_ROLLUPS, PLAN_INDEX, PLAN_SCAN, PLAN_SAMPLE } SqlPlan;
+
+static const char *sql_key_names[] = {"", "fuel", "vehicle", "payment", "pump", "hour", "date", "month"};
+static const char *sql_plan_names[] = {"running counters", "daily rollups", "block index", "full scan", "day samples"};
+
+typedef struct {
+    SqlColumnKind kind;
+    int measure;                /* amount/quantity, or vehicle/customer for distinct */
+    char name[48];
+} SqlColumn;
+
+typedef struct {
+    int explain;
+    int approx;
+    int rows;                   /* SELECT *: list matching sales */
+    int ncols;
+    SqlColumn cols[SQL_MAX_ITEMS];
+    StandingFilter filter;
+    int filtered;               /* a condition other than date */
+    int32_t date_lo, date_hi;   /* inclusive */
+    SqlKey group;
+    int order;                  /* output column (or 1 time, 2 amount, 3 quantity for rows); 0 for natural order */
+    int order_desc;
+    long limit;
+} SqlQuery;
+
+typedef struct {
+    int used;
+    int64_t key;
+    uint64_t count;
+    double sum[2];
+    double min[2];
+    double max[2];
+    HyperLogLog *distinct;      /* [2], only when a distinct() column is selected */
+} SqlGroup;
+
+typedef struct {
+    SqlGroup *slots;
+    int groups;
+    int overflow;
+    int want_distinct;
+} SqlGroups;
+
+static int sql_parse_date(StandingParser *ps, int32_t *out) {
+    char text[32];
+    snprintf(text, sizeof(text), "%s", ps->tok);
+    size_t n = strlen(text);
+    if (n >= 2 && text[0] == '\'' && text[n - 1] == '\'') {
+        memmove(text, text + 1, n - 2);
+        text[n - 2] = '\0';
+    }
+    if (strcmp(text, "today") == 0) snprintf(text, sizeof(text), "0");
+    if (rollup_parse_date(text, out) != 0) {
+        if (!ps->error) ps->error = "expected a date YYYY-MM-DD or today";
+        return 0;
+    }
+    standing_advance(ps);
+    return 1;
+}
+
+static void sql_date_condition(StandingParser *ps, SqlQuery *q) {
+    char op[sizeof(ps->tok)];
+    snprintf(op, sizeof(op), "%s", ps->tok);
+    standing_advance(ps);
+    int32_t a, b;
+    if (strcmp(op, "between") == 0) {
+        if (!sql_parse_date(ps, &a) || !standing_expect(ps, "and", "expected 'and' in between") ||
+            !sql_parse_date(ps, &b))
+            return;
+    } else if (sql_parse_date(ps, &a)) {
+        b = a;
+    } else {
+        return;
+    }
+    int32_t lo = 0, hi = SQL_DATE_MAX;
+    if (strcmp(op, "=") == 0 || strcmp(op, "between") == 0) { lo = a; hi = b; }
+    else if (strcmp(op, ">=") == 0) lo = a;
+    else if (strcmp(op, ">") == 0) lo = rollup_date_add(a, 1, NULL);
+    else if (strcmp(op, "<=") == 0) hi = a;
+    else if (strcmp(op, "<") == 0) hi = rollup_date_add(a, -1, NULL);
+    else {
+        ps->error = "expected =, <, <=, >, >= or between";
+        return;
+    }
+    if (lo > q->date_lo) q->date_lo = lo;
+    if (hi < q->date_hi) q->date_hi = hi;
+}
+
+static SqlKey sql_key(const char *word) {
+    for (int k = KEY_FUEL; k <= KEY_MONTH; ++k)
+        if (strcmp(word, sql_key_names[k]) == 0) return (SqlKey)k;
+    return KEY_NONE;
+}
+
+static void sql_item(StandingParser *ps, SqlQuery *q) {
+    if (q->ncols == SQL_MAX_ITEMS) {
+        ps->error = "too many columns";
+        return;
+    }
+    SqlColumn *c = &q->cols[q->ncols++];
+    memset(c, 0, sizeof(*c));
+    char word[sizeof(ps->tok)];
+    snprintf(word, sizeof(word), "%s", ps->tok);
+    standing_advance(ps);
+    SqlKey key = sql_key(word);
+    if (key != KEY_NONE) {
+        c->kind = COL_KEY;
+        c->measure = key;
+        snprintf(c->name, sizeof(c->name), "%s", word);
+        return;
+    }
+    static const char *aggs[] = {"count", "sum", "avg", "min", "max", "distinct"};
+    int agg = -1;
+    for (int i = 0; i < 6; ++i)
+        if (strcmp(word, aggs[i]) == 0) agg = i;
+    if (agg < 0) {
+        ps->error = "expected a group key, count, sum, avg, min, max or distinct";
+        return;
+    }
+    c->kind = (SqlColumnKind)(COL_COUNT + agg);
+    if (c->kind == COL_COUNT) {
+        if (standing_accept(ps, "(")) {
+            standing_accept(ps, "*");
+            standing_expect(ps, ")", "expected ')'");
+        }
+        snprintf(c->name, sizeof(c->name), "count");
+        return;
+    }
+    standing_expect(ps, "(", "expected '('");
+    const char *first = c->kind == COL_DISTINCT ? "vehicle" : "amount";
+    const char *second = c->kind == COL_DISTINCT ? "customer" : "quantity";
+    if (standing_accept(ps, first)) c->measure = 0;
+    else if (standing_accept(ps, second)) c->measure = 1;
+    else if (!ps->error) ps->error = c->kind == COL_DISTINCT ? "expected vehicle or customer" : "expected amount or quantity";
+    standing_expect(ps, ")", "expected ')'");
+    snprintf(c->name, sizeof(c->name), "%s(%s)", word, c->measure ? second : first);
+}
+
+/* Returns 0 and fills q, or -1 after printing where the text went wrong. */
+static int sql_parse(const char *text, SqlQuery *q) {
+    char trimmed[512];
+    snprintf(trimmed, sizeof(trimmed), "%s", text);
+    size_t len = strlen(trimmed);
+    while (len > 0 && (isspace((unsigned char)trimmed[len - 1]) || trimmed[len - 1] == ';')) trimmed[--len] = '\0';
+    StandingParser ps = { trimmed, "", NULL };
+    memset(q, 0, sizeof(*q));
+    q->filter.fuel = q->filter.vehicle = q->filter.payment = 0x7;
+    q->filter.hours = 0xFFFFFF;
+    q->filter.any_pump = 1;
+    memset(q->filter.pumps, 0xFF, sizeof(q->filter.pumps));
+    q->filter.amount.lo = q->filter.quantity.lo = -1e300;
+    q->filter.amount.hi = q->filter.quantity.hi = 1e300;
+    q->date_hi = SQL_DATE_MAX;
+    q->limit = -1;
+    standing_advance(&ps);
+    if (standing_accept(&ps, "explain")) q->explain = 1;
+    if (standing_accept(&ps, "approx")) q->approx = 1;
+    standing_expect(&ps, "select", "expected SELECT");
+    if (!ps.error && standing_accept(&ps, "*")) {
+        q->rows = 1;
+    } else {
+        do {
+            sql_item(&ps, q);
+        } while (!ps.error && standing_accept(&ps, ","));
+    }
+    if (!ps.error && standing_expect(&ps, "from", "expected FROM") &&
+        !standing_accept(&ps, "sales") && !standing_accept(&ps, "transactions"))
+        ps.error = "the only table is sales";
+    if (!ps.error && standing_accept(&ps, "where")) {
+        do {
+            if (standing_accept(&ps, "date")) {
+                sql_date_condition(&ps, q);
+            } else {
+                q->filtered = 1;
+                standing_condition(&ps, &q->filter);
+            }
+        } while (!ps.error && standing_accept(&ps, "and"));
+    }
+    if (!ps.error && standing_accept(&ps, "group")) {
+        standing_expect(&ps, "by", "expected BY");
+        if (!ps.error && (q->group = sql_key(ps.tok)) == KEY_NONE) ps.error = "expected fuel, vehicle, payment, pump, hour, date or month";
+        else if (!ps.error) standing_advance(&ps);
+    }
+    if (!ps.error && standing_accept(&ps, "order")) {
+        standing_expect(&ps, "by", "expected BY");
+        /* Tokens are rejoined so "sum(amount)" and "sum ( amount )" both name the column. */
+        char name[64] = "";
+        while (!ps.error && ps.tok[0] && strcmp(ps.tok, "asc") != 0 && strcmp(ps.tok, "desc") != 0 &&
+               strcmp(ps.tok, "limit") != 0) {
+            if (strlen(name) + strlen(ps.tok) < sizeof(name)) strcat(name, ps.tok);
+            standing_advance(&ps);
+        }
+        if (strcmp(name, "count(*)") == 0 || strcmp(name, "count()") == 0) snprintf(name, sizeof(name), "count");
+        char *end;
+        long pos = strtol(name, &end, 10);
+        if (!ps.error && q->rows) {
+            static const char *fields[] = {"", "time", "amount", "quantity"};
+            for (int i = 1; i <= 3; ++i)
+                if (strcmp(name, fields[i]) == 0) q->order = i;
+            if (!q->order) ps.error = "rows can be ordered by time, amount or quantity";
+        } else if (!ps.error && name[0] && *end == '\0') {
+            if (pos < 1 || pos > q->ncols) ps.error = "ORDER BY position out of range";
+            else q->order = (int)pos;
+        } else if (!ps.error) {
+            for (int i = 0; i < q->ncols; ++i)
+                if (strcmp(name, q->cols[i].name) == 0) q->order = i + 1;
+            if (!q->order) ps.error = "ORDER BY must name a selected column";
+        }
+        if (!ps.error && standing_accept(&ps, "desc")) q->order_desc = 1;
+        else if (!ps.error) standing_accept(&ps, "asc");
+    }
+    if (!ps.error && standing_accept(&ps, "limit")) {
+        double n;
+        if (standing_number(&ps, &n)) {
+            if (n < 0 || n > SQL_MAX_ROWS * 1000.0) ps.error = "LIMIT out of range";
+            else q->limit = (long)n;
+        }
+    }
+    if (!ps.error && ps.tok[0] != '\0') ps.error = "unexpected text";
+    for (int i = 0; !ps.error && i < q->ncols; ++i)
+        if (q->cols[i].kind == COL_KEY && (SqlKey)q->cols[i].measure != q->group)
+            ps.error = "a key column must be the GROUP BY key";
+    if (!ps.error && q->rows && q->group != KEY_NONE) ps.error = "SELECT * cannot be grouped";
+    if (!ps.error && q->approx) {
+        if (q->rows) ps.error = "APPROX needs count, sum or avg";
+        for (int i = 0; !ps.error && i < q->ncols; ++i)
+            if (q->cols[i].kind > COL_AVG) ps.error = "APPROX supports count, sum and avg";
+        if (!ps.error && q->date_lo == 0) ps.error = "APPROX needs a start date";
+    }
+    if (ps.error) {
+        printf("Query error near '%s': %s.\n", ps.tok[0] ? ps.tok : "end of query", ps.error);
+        return -1;
+    }
+    if (q->rows && q->limit < 0) q->limit = SQL_DEFAULT_ROWS;
+    if (q->rows && q->limit > SQL_MAX_ROWS) q->limit = SQL_MAX_ROWS;
+    return 0;
+}
+
+/* Whether the counters or the rollups hold what column c needs under grouping g. */
+static int sql_source_has(SqlPlan src, SqlKey g, const SqlColumn *c) {
+    if (c->kind == COL_KEY) return 1;
+    if (c->kind == COL_MIN || c->kind == COL_MAX) return 0;
+    int needs_count = c->kind == COL_COUNT || c->kind == COL_AVG;
+    if (src == PLAN_COUNTERS) {
+        if (c->kind == COL_DISTINCT) return 0;
+        switch (g) {
+            case KEY_NONE: case KEY_PUMP: return 1;
+            case KEY_FUEL: case KEY_HOUR: return !needs_count;
+            case KEY_PAYMENT: return !needs_count && c->measure == 0;
+            default: return 0;
+        }
+    }
+    if (c->kind == COL_DISTINCT) return g == KEY_NONE || g == KEY_DATE || g == KEY_MONTH;
+    switch (g) {
+        case KEY_NONE: case KEY_DATE: case KEY_MONTH: case KEY_FUEL: case KEY_PUMP: return 1;
+        case KEY_PAYMENT: return c->kind == COL_COUNT || c->measure == 0;
+        case KEY_HOUR: return !needs_count;
+        default: return 0;
+    }
+}
+
+static void sql_time_bounds(const SqlQuery *q, time_t *lo, time_t *hi) {
+    struct tm tm;
+    *lo = 0;
+    *hi = (time_t)1 << 62;
+    if (q->date_lo > 0) {
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = q->date_lo / 10000 - 1900;
+        tm.tm_mon = q->date_lo / 100 % 100 - 1;
+        tm.tm_mday = q->date_lo % 100;
+        tm.tm_isdst = -1;
+        *lo = mktime(&tm);
+    }
+    if (q->date_hi < SQL_DATE_MAX) {
+        int32_t next = rollup_date_add(q->date_hi, 1, NULL);
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = next / 10000 - 1900;
+        tm.tm_mon = next / 100 % 100 - 1;
+        tm.tm_mday = next % 100;
+        tm.tm_isdst = -1;
+        *hi = mktime(&tm) - 1;
+    }
+}
+
+/* Whether block zone can hold a matching sale; caller holds station_lock. */
+static int sql_zone_may_match(const SqlQuery *q, size_t zone, time_t lo, time_t hi) {
+    if (tx_zone_overflow || zone >= tx_zone_cap) return 1;
+    const TxZone *z = &tx_zones[zone];
+    return z->max_time >= lo && z->min_time <= hi &&
+           z->max_amount >= q->filter.amount.lo && z->min_amount <= q->filter.amount.hi;
+}
+
+/*
+ * Whether the daily rollups can stand in for the store over the query's
+ * dates. Days outside the store's first..last sale are history only the
+ * rollups hold; over the days the store does hold, the rollups must count
+ * exactly the store's sales, so a missing day or rollups left by another
+ * dataset send the query to the store. Whole blocks are counted from the
+ * block index; only blocks straddling the range are read.
+ */
+static int sql_rollups_cover(const SqlQuery *q) {
+    time_t lo, hi;
+    sql_time_bounds(q, &lo, &hi);
+    StandingClock clock = { -1, 0, 0 };
+    uint64_t store_sales = 0;
+    time_t first = 0, last = 0;
+    pthread_mutex_lock(&station_lock);
+    size_t end = tx_count;
+    if (end > 0 && tx_zone_overflow) {
+        pthread_mutex_unlock(&station_lock);
+        return 0;
+    }
+    for (size_t b = 0; b * TX_SEGMENT_RECORDS < end; ++b) {
+        const TxZone *z = &tx_zones[b];
+        size_t from = b * TX_SEGMENT_RECORDS;
+        size_t stop = from + TX_SEGMENT_RECORDS < end ? from + TX_SEGMENT_RECORDS : end;
+        if (b == 0 || z->min_time < first) first = z->min_time;
+        if (b == 0 || z->max_time > last) last = z->max_time;
+        if (z->max_time < lo || z->min_time > hi) continue;
+        if (z->min_time >= lo && z->max_time <= hi) {
+            store_sales += stop - from;
+            continue;
+        }
+        for (size_t i = from; i < stop; ++i) {
+            int hour;
+            int32_t date;
+            standing_clock(&clock, transactions[i].timestamp, &hour, &date);
+            if (date >= q->date_lo && date <= q->date_hi) store_sales++;
+        }
+    }
+    pthread_mutex_unlock(&station_lock);
+    if (end == 0) return 1;
+
+    int hour;
+    int32_t from_date, to_date;
+    standing_clock(&clock, first, &hour, &from_date);
+    standing_clock(&clock, last, &hour, &to_date);
+    if (from_date < q->date_lo) from_date = q->date_lo;
+    if (to_date > q->date_hi) to_date = q->date_hi;
+    DayRollup *r = (DayRollup*) malloc(sizeof(DayRollup));
+    if (!r) return 0;
+    uint64_t rollup_sales = 0;
+    for (int32_t date = from_date; date <= to_date; date = rollup_date_add(date, 1, NULL))
+        if (rollup_lookup(date, r) == 0) rollup_sales += r->sales;
+    free(r);
+    return rollup_sales == store_sales;
+}
+
+static SqlPlan sql_plan(const SqlQuery *q) {
+    if (q->approx) return PLAN_SAMPLE;
+    int counters = !q->rows && !q->filtered && q->date_lo == 0 && q->date_hi == SQL_DATE_MAX;
+    int rollups_ok = !q->rows && !q->filtered && q->date_lo > 0 && q->date_hi < SQL_DATE_MAX &&
+                     rollup_date_add(q->date_lo, 3660, NULL) > q->date_hi;
+    for (int i = 0; i < q->ncols; ++i) {
+        counters = counters && sql_source_has(PLAN_COUNTERS, q->group, &q->cols[i]);
+        rollups_ok = rollups_ok && sql_source_has(PLAN_ROLLUPS, q->group, &q->cols[i]);
+    }
+    if (counters) return PLAN_COUNTERS;
+    if (rollups_ok && sql_rollups_cover(q)) return PLAN_ROLLUPS;
+    int bounded = q->date_lo > 0 || q->date_hi < SQL_DATE_MAX ||
+                  q->filter.amount.lo > -1e300 || q->filter.amount.hi < 1e300;
+    return bounded && !tx_zone_overflow ? PLAN_INDEX : PLAN_SCAN;
+}
+
+static SqlGroup *sql_group(SqlGroups *g, int64_t key) {
+    size_t mask = SQL_GROUP_SLOTS - 1;
+    size_t i = (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 40) & mask;
+    while (g->slots[i].used && g->slots[i].key != key) i = (i + 1) & mask;
+    SqlGroup *s = &g->slots[i];
+    if (!s->used) {
+        if (g->groups == SQL_MAX_GROUPS) {
+            g->overflow = 1;
+            return NULL;
+        }
+        if (g->want_distinct && !(s->distinct = (HyperLogLog*) calloc(2, sizeof(HyperLogLog)))) {
+            g->overflow = 1;
+            return NULL;
+        }
+        s->used = 1;
+        s->key = key;
+        s->min[0] = s->min[1] = 1e300;
+        s->max[0] = s->max[1] = -1e300;
+        g->groups++;
+    }
+    return s;
+}
+
+static int64_t sql_tx_key(SqlKey key, const Transaction *t, int hour, int32_t date) {
+    switch (key) {
+        case KEY_FUEL: return t->fuel_type;
+        case KEY_VEHICLE: return t->vehicle_type;
+        case KEY_PAYMENT: return t->payment_mode;
+        case KEY_PUMP: return t->pump_id;
+        case KEY_HOUR: return hour;
+        case KEY_DATE: return date;
+        case KEY_MONTH: return date / 100;
+        default: return 0;
+    }
+}
+
+static void sql_accumulate(SqlGroup *s, const Transaction *t) {
+    double v[2] = { t->amount, t->quantity };
+    s->count++;
+    for (int m = 0; m < 2; ++m) {
+        s->sum[m] += v[m];
+        if (v[m] < s->min[m]) s->min[m] = v[m];
+        if (v[m] > s->max[m]) s->max[m] = v[m];
+    }
+    if (s->distinct) {
+        if (t->vehicle_hash) hll_add(&s->distinct[0], t->vehicle_hash);
+        if (t->customer_hash) hll_add(&s->distinct[1], t->customer_hash);
+    }
+}
+
+static void sql_from_counters(const SqlQuery *q, SqlGroups *g) {
+    SqlGroup *s;
+    pthread_mutex_lock(&station_lock);
+    switch (q->group) {
+        case KEY_NONE:
+            s = sql_group(g, 0);
+            s->count = tx_count;
+            for (int f = 0; f < 3; ++f) {
+                s->sum[0] += fuel_wise_amount[f];
+                s->sum[1] += fuel_wise_quantity[f];
+            }
+            break;
+        case KEY_FUEL:
+            for (int f = 0; f < 3; ++f) {
+                if (fuel_wise_amount[f] == 0.0 && fuel_wise_quantity[f] == 0.0) continue;
+                s = sql_group(g, f);
+                s->sum[0] = fuel_wise_amount[f];
+                s->sum[1] = fuel_wise_quantity[f];
+            }
+            break;
+        case KEY_PAYMENT:
+            for (int p = 0; p < 3; ++p)
+                if (payment_mode_amount[p] != 0.0) sql_group(g, p)->sum[0] = payment_mode_amount[p];
+            break;
+        case KEY_PUMP:
+            for (int i = 0; i < pump_slots; ++i) {
+                if (pumps[i].transactions_count == 0) continue;
+                s = sql_group(g, pumps[i].pump_id);
+                s->count = (uint64_t)pumps[i].transactions_count;
+                s->sum[0] = pumps[i].total_amount;
+                s->sum[1] = pumps[i].total_quantity;
+            }
+            break;
+        case KEY_HOUR:
+            for (int h = 0; h < 24; ++h) {
+                if (hour_amount[h] == 0.0 && hour_quantity[h] == 0.0) continue;
+                s = sql_group(g, h);
+                s->sum[0] = hour_amount[h];
+                s->sum[1] = hour_quantity[h];
+            }
+            break;
+        default:
+            break;
+    }
+    pthread_mutex_unlock(&station_lock);
+}
+
+static void sql_from_rollups(const SqlQuery *q, SqlGroups *g, int *days_read, int *days_missing) {
+    DayRollup *r = (DayRollup*) malloc(sizeof(DayRollup));
+    if (!r) {
+        g->overflow = 1;
+        return;
+    }
+    for (int32_t date = q->date_lo; date <= q->date_hi && !g->overflow; date = rollup_date_add(date, 1, NULL)) {
+        if (rollup_lookup(date, r) != 0) {
+            (*days_missing)++;
+            continue;
+        }
+        (*days_read)++;
+        SqlGroup *s;
+        switch (q->group) {
+            case KEY_NONE: case KEY_DATE: case KEY_MONTH:
+                if (r->sales == 0 || !(s = sql_group(g, q->group == KEY_NONE ? 0 : q->group == KEY_DATE ? date : date / 100)))
+                    break;
+                s->count += r->sales;
+                for (int f = 0; f < 3; ++f) {
+                    s->sum[0] += r->fuel_amount[f];
+                    s->sum[1] += r->fuel_quantity[f];
+                }
+                if (s->distinct) {
+                    hll_merge(&s->distinct[0], &r->vehicles);
+                    hll_merge(&s->distinct[1], &r->customers);
+                }
+                break;
+            case KEY_FUEL:
+                for (int f = 0; f < 3; ++f) {
+                    if (!r->fuel_sales[f] || !(s = sql_group(g, f))) continue;
+                    s->count += r->fuel_sales[f];
+                    s->sum[0] += r->fuel_amount[f];
+                    s->sum[1] += r->fuel_quantity[f];
+                }
+                break;
+            case KEY_PAYMENT:
+                for (int p = 0; p < 3; ++p) {
+                    if (!r->payment_sales[p] || !(s = sql_group(g, p))) continue;
+                    s->count += r->payment_sales[p];
+                    s->sum[0] += r->payment_amount[p];
+                }
+                break;
+            case KEY_PUMP:
+                for (int i = 0; i < r->pump_count; ++i) {
+                    if (!r->pump_sales[i] || !(s = sql_group(g, r->pump_id[i]))) continue;
+                    s->count += r->pump_sales[i];
+                    s->sum[0] += r->pump_amount[i];
+                    s->sum[1] += r->pump_quantity[i];
+                }
+                break;
+            case KEY_HOUR:
+                for (int h = 0; h < 24; ++h) {
+                    if ((r->hour_amount[h] == 0.0 && r->hour_quantity[h] == 0.0) || !(s = sql_group(g, h))) continue;
+                    s->sum[0] += r->hour_amount[h];
+                    s->sum[1] += r->hour_quantity[h];
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    free(r);
+}
+
+/*
+ * Stratified estimate per group: days are the strata, each with N sales of
+ * which n are in its sample. Totals scale the day's sample sums by N/n; the
+ * variance terms are the usual N^2 (1 - n/N) s^2 / n per day, kept as
+ * (co)variances so avg can use the ratio estimator's linearised variance.
+ */
+typedef struct {
+    int32_t date;               /* day the day[] sums belong to */
+    double day[5];              /* matched rows, amount, amount^2, quantity, quantity^2 */
+    double total[3];            /* count, amount, quantity */
+    double var[5];              /* count, amount, quantity, amount x count, quantity x count */
+} SqlEstimate;
+
+static void sql_from_samples(const SqlQuery *q, SqlGroups *g, SqlEstimate *est, int *days_read, int *days_missing,
+                             size_t *sampled) {
+    DayRollup *r = (DayRollup*) malloc(sizeof(DayRollup));
+    if (!r) {
+        g->overflow = 1;
+        return;
+    }
+    int touched[SAMPLE_PER_DAY];
+    Transaction t;
+    memset(&t, 0, sizeof(t));
+    for (int32_t date = q->date_lo; date <= q->date_hi && !g->overflow; date = rollup_date_add(date, 1, NULL)) {
+        if (rollup_lookup(date, r) != 0) {
+            (*days_missing)++;
+            continue;
+        }
+        (*days_read)++;
+        int n = r->sales < SAMPLE_PER_DAY ? (int)r->sales : SAMPLE_PER_DAY, ntouched = 0;
+        *sampled += (size_t)n;
+        for (int i = 0; i < n; ++i) {
+            const SampleRow *row = &r->sample[i];
+            t.amount = row->paise / 100.0;
+            t.quantity = row->milliunits / 1000.0;
+            t.pump_id = row->pump_id;
+            t.fuel_type = (FuelType)row->fuel_type;
+            t.vehicle_type = (VehicleType)row->vehicle_type;
+            t.payment_mode = (PaymentMode)row->payment_mode;
+            int hour = row->minute / 60;
+            if (q->filtered && !standing_match(&q->filter, &t, hour)) continue;
+            SqlGroup *s = sql_group(g, sql_tx_key(q->group, &t, hour, date));
+            if (!s) break;
+            SqlEstimate *e = &est[s - g->slots];
+            if (e->date != date) {
+                memset(e->day, 0, sizeof(e->day));
+                e->date = date;
+                touched[ntouched++] = (int)(s - g->slots);
+            }
+            e->day[0] += 1.0;
+            e->day[1] += t.amount;
+            e->day[2] += t.amount * t.amount;
+            e->day[3] += t.quantity;
+            e->day[4] += t.quantity * t.quantity;
+        }
+        double N = (double)r->sales, m = n;
+        double w = n > 1 && m < N ? N * N * (1.0 - m / N) / m / (m - 1.0) : 0.0;
+        for (int k = 0; k < ntouched; ++k) {
+            SqlEstimate *e = &est[touched[k]];
+            double c = e->day[0], a = e->day[1], qn = e->day[3];
+            e->total[0] += c * N / m;
+            e->total[1] += a * N / m;
+            e->total[2] += qn * N / m;
+            e->var[0] += w * (c - c * c / m);
+            e->var[1] += w * (e->day[2] - a * a / m);
+            e->var[2] += w * (e->day[4] - qn * qn / m);
+            e->var[3] += w * (a - a * c / m);
+            e->var[4] += w * (qn - qn * c / m);
+        }
+    }
+    free(r);
+}
+
+/* Square root for the confidence intervals, again without libm. */
+static double sql_sqrt(double x) {
+    if (x <= 0.0) return 0.0;
+    double r = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 200; ++i) {
+        double next = 0.5 * (r + x / r);
+        if (next >= r) break;
+        r = next;
+    }
+    return r;
+}
+
+/* Estimated value of column c, with its 95% confidence half-width in *half. */
+static double sql_estimate(const SqlColumn *c, const SqlGroup *s, const SqlEstimate *e, double *half) {
+    double v = 0.0, var = 0.0;
+    switch (c->kind) {
+        case COL_COUNT:
+            v = e->total[0];
+            var = e->var[0];
+            break;
+        case COL_SUM:
+            v = e->total[1 + c->measure];
+            var = e->var[1 + c->measure];
+            break;
+        case COL_AVG:
+            if (e->total[0] > 0.0) {
+                v = e->total[1 + c->measure] / e->total[0];
+                var = (e->var[1 + c->measure] - 2.0 * v * e->var[3 + c->measure] + v * v * e->var[0]) /
+                      (e->total[0] * e->total[0]);
+            }
+            break;
+        default:
+            v = (double)s->key;
+            break;
+    }
+    *half = var > 0.0 ? 1.96 * sql_sqrt(var) : 0.0;
+    return v;
+}
+
+typedef struct {
+    Transaction *rows;          /* heap while scanning: the row that ranks last is on top */
+    long count;
+    long limit;
+    int order;
+    int desc;
+} SqlRows;
+
+/* Whether a ranks after b in the requested row order. */
+static int sql_row_after(const SqlRows *r, const Transaction *a, const Transaction *b) {
+    double va = r->order == 2 ? a->amount : r->order == 3 ? a->quantity : (double)a->timestamp;
+    double vb = r->order == 2 ? b->amount : r->order == 3 ? b->quantity : (double)b->timestamp;
+    return r->desc ? va < vb : va > vb;
+}
+
+static void sql_row_sift_down(SqlRows *r, long i) {
+    for (;;) {
+        long worst = i, left = 2 * i + 1, right = left + 1;
+        if (left < r->count && sql_row_after(r, &r->rows[left], &r->rows[worst])) worst = left;
+        if (right < r->count && sql_row_after(r, &r->rows[right], &r->rows[worst])) worst = right;
+        if (worst == i) return;
+        Transaction t = r->rows[i];
+        r->rows[i] = r->rows[worst];
+        r->rows[worst] = t;
+        i = worst;
+    }
+}
+
+static void sql_row_offer(SqlRows *r, const Transaction *t) {
+    if (r->count < r->limit) {
+        long i = r->count++;
+        r->rows[i] = *t;
+        while (i > 0 && sql_row_after(r, &r->rows[i], &r->rows[(i - 1) / 2])) {
+            Transaction tmp = r->rows[i];
+            r->rows[i] = r->rows[(i - 1) / 2];
+            r->rows[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (r->limit > 0 && sql_row_after(r, &r->rows[0], t)) {
+        r->rows[0] = *t;
+        sql_row_sift_down(r, 0);
+    }
+}
+
+/*
+ * Scans transactions[] a block at a time under station_lock: the filter
+ * runs over the whole block into a selection vector, then the selected
+ * rows are aggregated (or offered to the row heap). With use_index, blocks
+ * whose time and amount ranges rule them out are skipped unread.
+ */
+static void sql_scan(const SqlQuery *q, int use_index, SqlGroups *g, SqlRows *rows,
+                     size_t *blocks_read, size_t *blocks_skipped, size_t *matched) {
+    static uint16_t sel[TX_SEGMENT_RECORDS];
+    static uint8_t sel_hour[TX_SEGMENT_RECORDS];
+    static int32_t sel_date[TX_SEGMENT_RECORDS];
+    time_t lo, hi;
+    sql_time_bounds(q, &lo, &hi);
+    StandingClock clock = { -1, 0, 0 };
+    pthread_mutex_lock(&station_lock);
+    size_t end = tx_count;
+    pthread_mutex_unlock(&station_lock);
+    /* Without an ORDER BY, rows come in store order and the scan stops once LIMIT rows are found. */
+    int early_stop = rows && !q->order;
+    for (size_t first = 0; first < end && !g->overflow; first += TX_SEGMENT_RECORDS) {
+        if (early_stop && rows->count >= rows->limit) break;
+        size_t stop = first + TX_SEGMENT_RECORDS < end ? first + TX_SEGMENT_RECORDS : end;
+        pthread_mutex_lock(&station_lock);
+        if (use_index && !sql_zone_may_match(q, first / TX_SEGMENT_RECORDS, lo, hi)) {
+            pthread_mutex_unlock(&station_lock);
+            (*blocks_skipped)++;
+            continue;
+        }
+        (*blocks_read)++;
+        int n = 0;
+        for (size_t i = first; i < stop; ++i) {
+            const Transaction *t = &transactions[i];
+            int hour;
+            int32_t date;
+            standing_clock(&clock, t->timestamp, &hour, &date);
+            if (date < q->date_lo || date > q->date_hi) continue;
+            if (q->filtered && !standing_match(&q->filter, t, hour)) continue;
+            sel[n] = (uint16_t)(i - first);
+            sel_hour[n] = (uint8_t)hour;
+            sel_date[n] = date;
+            n++;
+        }
+        *matched += (size_t)n;
+        const Transaction *block = &transactions[first];
+        if (rows) {
+            for (int k = 0; k < n; ++k) {
+                if (early_stop && rows->count >= rows->limit) break;
+                sql_row_offer(rows, &block[sel[k]]);
+            }
+        } else if (q->group == KEY_NONE) {
+            SqlGroup *s = n > 0 ? sql_group(g, 0) : NULL;
+            for (int k = 0; s && k < n; ++k) sql_accumulate(s, &block[sel[k]]);
+        } else {
+            for (int k = 0; k < n; ++k) {
+                const Transaction *t = &block[sel[k]];
+                SqlGroup *s = sql_group(g, sql_tx_key(q->group, t, sel_hour[k], sel_date[k]));
+                if (!s) break;
+                sql_accumulate(s, t);
+            }
+        }
+        pthread_mutex_unlock(&station_lock);
+    }
+}
+
+static double sql_value(const SqlColumn *c, const SqlGroup *s) {
+    switch (c->kind) {
+        case COL_KEY: return (double)s->key;
+        case COL_COUNT: return (double)s->count;
+        case COL_SUM: return s->sum[c->measure];
+        case COL_AVG: return s->count ? s->sum[c->measure] / (double)s->count : 0.0;
+        case COL_MIN: return s->count ? s->min[c->measure] : 0.0;
+        case COL_MAX: return s->count ? s->max[c->measure] : 0.0;
+        case COL_DISTINCT: return s->distinct ? hll_estimate(&s->distinct[c->measure]) : 0.0;
+    }
+    return 0.0;
+}
+
+static void sql_format(char *out, size_t cap, const SqlColumn *c, double v) {
+    int64_t key = (int64_t)v;
+    if (c->kind == COL_KEY) {
+        switch ((SqlKey)c->measure) {
+            case KEY_FUEL: snprintf(out, cap, "%s", fuel_name((FuelType)key)); break;
+            case KEY_VEHICLE: snprintf(out, cap, "%s", vehicle_name((VehicleType)key)); break;
+            case KEY_PAYMENT: snprintf(out, cap, "%s", payment_name((PaymentMode)key)); break;
+            case KEY_HOUR: snprintf(out, cap, "%02lld:00", (long long)key); break;
+            case KEY_DATE: snprintf(out, cap, "%04lld-%02lld-%02lld", (long long)(key / 10000), (long long)(key / 100 % 100), (long long)(key % 100)); break;
+            case KEY_MONTH: snprintf(out, cap, "%04lld-%02lld", (long long)(key / 100), (long long)(key % 100)); break;
+            default: snprintf(out, cap, "%lld", (long long)key); break;
+        }
+    } else if (c->kind == COL_COUNT || c->kind == COL_DISTINCT) {
+        snprintf(out, cap, "%.0f", v);
+    } else {
+        snprintf(out, cap, "%.*f", c->measure ? 3 : 2, v);
+    }
+}
+
+typedef struct {
+    double v;
+    int64_t key;
+    const SqlGroup *group;
+} SqlSortEntry;
+
+static int sql_sort_cmp(const void *a, const void *b) {
+    const SqlSortEntry *x = (const SqlSortEntry*) a, *y = (const SqlSortEntry*) b;
+    if (x->v != y->v) return x->v < y->v ? -1 : 1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/* With est, every aggregate is followed by its 95% confidence half-width. */
+static void sql_print_groups(const SqlQuery *q, const SqlGroups *g, const SqlEstimate *est) {
+    SqlSortEntry *order = (SqlSortEntry*) malloc((size_t)(g->groups ? g->groups : 1) * sizeof(SqlSortEntry));
+    if (!order) return;
+    int n = 0;
+    for (int i = 0; i < SQL_GROUP_SLOTS; ++i) {
+        if (!g->slots[i].used) continue;
+        order[n].group = &g->slots[i];
+        order[n].key = g->slots[i].key;
+        double half;
+        if (!q->order) order[n].v = (double)g->slots[i].key;
+        else if (est) order[n].v = sql_estimate(&q->cols[q->order - 1], &g->slots[i], &est[i], &half);
+        else order[n].v = sql_value(&q->cols[q->order - 1], &g->slots[i]);
+        if (q->order_desc) order[n].v = -order[n].v;
+        n++;
+    }
+    qsort(order, (size_t)n, sizeof(SqlSortEntry), sql_sort_cmp);
+    long shown = q->limit >= 0 && q->limit < n ? q->limit : n;
+    for (int c = 0; c < q->ncols; ++c) {
+        printf("%*s", c ? 16 : 14, q->cols[c].name);
+        if (est && q->cols[c].kind != COL_KEY) printf("%12s", "+/-");
+    }
+    printf("\n");
+    for (long r = 0; r < shown; ++r) {
+        for (int c = 0; c < q->ncols; ++c) {
+            char cell[40];
+            if (est && q->cols[c].kind != COL_KEY) {
+                double half, v = sql_estimate(&q->cols[c], order[r].group, &est[order[r].group - g->slots], &half);
+                sql_format(cell, sizeof(cell), &q->cols[c], v);
+                printf("%*s", c ? 16 : 14, cell);
+                sql_format(cell, sizeof(cell), &q->cols[c], half);
+                printf("%12s", cell);
+                continue;
+            }
+            sql_format(cell, sizeof(cell), &q->cols[c], sql_value(&q->cols[c], order[r].group));
+            printf("%*s", c ? 16 : 14, cell);
+        }
+        printf("\n");
+    }
+    printf("(%ld row%s)\n", shown, shown == 1 ? "" : "s");
+    free(order);
+}
+
+static int sql_row_cmp_time(const void *a, const void *b) {
+    const Transaction *x = (const Transaction*) a, *y = (const Transaction*) b;
+    return x->timestamp < y->timestamp ? -1 : x->timestamp > y->timestamp;
+}
+
+static void sql_print_rows(SqlRows *r) {
+    /* Drain the heap from the back so the rows come out in rank order. */
+    if (r->order) {
+        long n = r->count;
+        while (r->count > 1) {
+            Transaction worst = r->rows[0];
+            r->rows[0] = r->rows[--r->count];
+            sql_row_sift_down(r, 0);
+            r->rows[r->count] = worst;
+        }
+        r->count = n;
+    } else {
+        qsort(r->rows, (size_t)r->count, sizeof(Transaction), sql_row_cmp_time);
+    }
+    printf("%-20s %-19s %5s %-7s %-11s %12s %12s  %s\n",
+           "txn_id", "time", "pump", "fuel", "vehicle", "quantity", "amount", "payment");
+    for (long i = 0; i < r->count; ++i) {
+        const Transaction *t = &r->rows[i];
+        char timestr[64];
+        format_time_local(t->timestamp, timestr, sizeof(timestr));
+        printf("%-20s %-19s %5d %-7s %-11s %12.3f %12.2f  %s\n", t->txn_id, timestr, t->pump_id,
+               fuel_name(t->fuel_type), vehicle_name(t->vehicle_type), t->quantity, t->amount,
+               payment_name(t->payment_mode));
+    }
+    printf("(%ld row%s)\n", r->count, r->count == 1 ? "" : "s");
+}
+
+/* Parses, plans and runs one query, printing the result. Returns 0 on success. */
+int run_query(const char *text) {
+    SqlQuery q;
+    if (sql_parse(text, &q) != 0) return -1;
+    if (q.approx && q.date_hi == SQL_DATE_MAX) rollup_parse_date("0", &q.date_hi);
+    if (q.approx && rollup_date_add(q.date_lo, 3660, NULL) <= q.date_hi) {
+        printf("APPROX SELECT covers at most 3660 days; narrow the date range.\n");
+        return -1;
+    }
+    SqlPlan plan = sql_plan(&q);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TRACE_BEGIN("query");
+
+    if (q.explain) {
+        printf("Plan: %s", sql_plan_names[plan]);
+        if (plan == PLAN_ROLLUPS || plan == PLAN_SAMPLE) {
+            int days = 0;
+            for (int32_t d = q.date_lo; d <= q.date_hi; d = rollup_date_add(d, 1, NULL)) days++;
+            printf(" over %d day%s", days, days == 1 ? "" : "s");
+            if (plan == PLAN_SAMPLE) printf(", up to %d sampled sales per day", SAMPLE_PER_DAY);
+        } else if (plan == PLAN_INDEX || plan == PLAN_SCAN) {
+            time_t lo, hi;
+            sql_time_bounds(&q, &lo, &hi);
+            pthread_mutex_lock(&station_lock);
+            size_t blocks = (tx_count + TX_SEGMENT_RECORDS - 1) / TX_SEGMENT_RECORDS, candidates = 0;
+            for (size_t b = 0; b < blocks; ++b)
+                if (plan == PLAN_SCAN || sql_zone_may_match(&q, b, lo, hi)) candidates++;
+            size_t count = tx_count;
+            pthread_mutex_unlock(&station_lock);
+            printf(", reading %zu of %zu blocks (%zu sales), filter into a selection vector per block", candidates,
+                   blocks, count);
+        }
+        if (q.rows) printf(", %s%s", q.order ? "top " : "first ", q.order ? "rows by rank" : "rows in store order");
+        else if (q.group != KEY_NONE) printf(", grouped by %s", sql_key_names[q.group]);
+        printf("\n");
+        TRACE_END("query");
+        return 0;
+    }
+
+    SqlGroups groups;
+    memset(&groups, 0, sizeof(groups));
+    SqlRows rows;
+    memset(&rows, 0, sizeof(rows));
+    int rc = 0;
+    size_t blocks_read = 0, blocks_skipped = 0, matched = 0;
+    int days_read = 0, days_missing = 0;
+    size_t sampled = 0;
+    SqlEstimate *estimates = NULL;
+    if (q.rows) {
+        rows.limit = q.limit;
+        rows.order = q.order;
+        rows.desc = q.order_desc;
+        rows.rows = (Transaction*) malloc((size_t)(q.limit ? q.limit : 1) * sizeof(Transaction));
+        if (!rows.rows) rc = -1;
+    } else {
+        groups.slots = (SqlGroup*) calloc(SQL_GROUP_SLOTS, sizeof(SqlGroup));
+        for (int i = 0; i < q.ncols; ++i) groups.want_distinct |= q.cols[i].kind == COL_DISTINCT;
+        if (q.approx && !(estimates = (SqlEstimate*) calloc(SQL_GROUP_SLOTS, sizeof(SqlEstimate)))) rc = -1;
+        if (!groups.slots) rc = -1;
+    }
+    if (rc == 0) {
+        if (plan == PLAN_COUNTERS) sql_from_counters(&q, &groups);
+        else if (plan == PLAN_ROLLUPS) sql_from_rollups(&q, &groups, &days_read, &days_missing);
+        else if (plan == PLAN_SAMPLE) sql_from_samples(&q, &groups, estimates, &days_read, &days_missing, &sampled);
+        else sql_scan(&q, plan == PLAN_INDEX, &groups, q.rows ? &rows : NULL, &blocks_read, &blocks_skipped, &matched);
+        if (groups.overflow) {
+            printf("Query stopped: more than %d groups.\n", SQL_MAX_GROUPS);
+            rc = -1;
+        } else if (q.rows) {
+            sql_print_rows(&rows);
+        } else {
+            if (plan == PLAN_SAMPLE && days_missing > 0)
+                printf("Warning: %d of the %d days have no rollup; the estimate and its interval cover only the other "
+                       "%d.\n", days_missing, days_read + days_missing, days_read);
+            sql_print_groups(&q, &groups, estimates);
+        }
+    } else {
+        printf("Out of memory.\n");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    TRACE_END("query");
+    printf("%.3f ms via %s", elapsed_seconds(&start, &end) * 1e3, sql_plan_names[plan]);
+    if (plan == PLAN_ROLLUPS) printf(" (%d days, %d without a rollup)", days_read, days_missing);
+    else if (plan == PLAN_SAMPLE)
+        printf(" (%d days, %zu sampled sales, %d without a rollup; +/- is the 95%% confidence interval)", days_read,
+               sampled, days_missing);
+    else if (plan != PLAN_COUNTERS) printf(" (%zu blocks read, %zu skipped, %zu sales matched)", blocks_read, blocks_skipped, matched);
+    printf("\n");
+    if (groups.slots) {
+        for (int i = 0; i < SQL_GROUP_SLOTS; ++i) free(groups.slots[i].distinct);
+        free(groups.slots);
+    }
+    free(rows.rows);
+    free(estimates);
+    return rc;
+}
+
+void query_console() {
+    char line[512];
+    printf("\nSELECT ... FROM sales [WHERE ...] [GROUP BY ...] [ORDER BY ...] [LIMIT n]; EXPLAIN shows the plan,\n");
+    printf("APPROX SELECT answers count/sum/avg over long date ranges from daily samples.\n");
+    printf("Empty line returns to the menu.\n");
+    for (;;) {
+        printf("sql> ");
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin)) return;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') return;
+        run_query(line);
+    }
+}
+
+/*
+ * Checkpoints bound recovery time. checkpoint_now() switches appends to a new
+ * journal segment, snapshots the derived state (stock, pump totals,
+ * aggregates, sequence counter) together with the transaction store, and
+ * writes it to <journal>.ckpt through a temporary file and rename. Only then
+ * is the superseded segment deleted, or kept as <journal>.<generation> with
+ * --keep-journal-segments. Recovery restores the newest checkpoint in one
+ * sequential read and replays just the segments written after it. Fuel held
+ * by pending card/wallet authorizations is not journaled, so the snapshot
+ * puts it back into stock.
+ */
+#define CHECKPOINT_MAGIC "PPMSCKP1"
+#define CHECKPOINT_VERSION 7
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t generation;
+    uint64_t tx_count;
+    uint32_t state_crc;
+    uint32_t header_crc;
+} CheckpointHeader;
+
+typedef struct {
+    Fuel fuels[3];
+    Pump pumps[MAX_PUMPS];
+    int32_t pump_slots;
+    double fuel_wise_quantity[3];
+    double fuel_wise_amount[3];
+    double payment_mode_amount[3];
+    double hour_quantity[24];
+    double hour_amount[24];
+    uint64_t txn_sequence;
+    MinuteCell pump_minutes[MAX_PUMPS * MINUTES_PER_DAY];
+    DayRollup rollups[ROLLUP_LIVE_DAYS];
+    int32_t rollup_count;
+    int32_t rollup_closed_through;
+    uint64_t settle_cursor;
+    uint32_t settle_batch_no;
+    int32_t pump_minutes_date;
+} CheckpointState;
+
+static struct {
+    pthread_mutex_t lock;       /* serialises checkpoints */
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int running;
+    int stopping;
+    int requested;
+    unsigned long taken;
+    double last_ms;
+    uint64_t last_records;
+} checkpointer = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake_lock = PTHREAD_MUTEX_INITIALIZER,
+                   .wake = PTHREAD_COND_INITIALIZER };
+
+/* Waits until the journal records appended so far are on disk. */
+static int journal_sync(void) {
+    pthread_mutex_lock(&checkpointer.lock);     /* keeps the segment from being swapped and closed */
+    pthread_mutex_lock(&station_lock);
+    IoFile *f = journal;
+    pthread_mutex_unlock(&station_lock);
+    int rc = f ? io_file_sync(f) : 0;
+    pthread_mutex_unlock(&checkpointer.lock);
+    return rc;
+}
+
+/* Caller holds station_lock. */
+static void checkpoint_snapshot(CheckpointState *st) {
+    memset(st, 0, sizeof(*st));
+    memcpy(st->fuels, fuels, sizeof(fuels));
+    for (int f = 0; f < 3; ++f) st->fuels[f].current_stock += payments.reserved_stock[f];
+    memcpy(st->pumps, pumps, sizeof(pumps));
+    st->pump_slots = pump_slots;
+    memcpy(st->fuel_wise_quantity, fuel_wise_quantity, sizeof(fuel_wise_quantity));
+    memcpy(st->fuel_wise_amount, fuel_wise_amount, sizeof(fuel_wise_amount));
+    memcpy(st->payment_mode_amount, payment_mode_amount, sizeof(payment_mode_amount));
+    memcpy(st->hour_quantity, hour_quantity, sizeof(hour_quantity));
+    memcpy(st->hour_amount, hour_amount, sizeof(hour_amount));
+    st->txn_sequence = txn_sequence;
+    memcpy(st->pump_minutes, pump_minutes, sizeof(pump_minutes));
+    st->pump_minutes_date = pump_minutes_date;
+    memcpy(st->rollups, rollups.live, sizeof(rollups.live));
+    st->rollup_count = rollups.count;
+    st->rollup_closed_through = rollups.closed_through;
+    st->settle_cursor = settlement.cursor;
+    st->settle_batch_no = settlement.batch_no;
+}
+
+static void checkpoint_path(char *out, size_t cap, const char *journal_path, const char *suffix) {
+    snprintf(out, cap, "%s%s", journal_path, suffix);
+}
+
+/* Writes the snapshot and transactions[0, count) to path; transactions are copied out in blocks under station_lock. */
+static void checkpoint_fill_header(CheckpointHeader *hdr, uint64_t generation, const CheckpointState *st,
+                                   uint64_t count) {
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, CHECKPOINT_MAGIC, sizeof(hdr->magic));
+    hdr->version = CHECKPOINT_VERSION;
+    hdr->record_size = (uint32_t)sizeof(Transaction);
+    hdr->generation = generation;
+    hdr->tx_count = count;
+    hdr->state_crc = crc32c(0, st, sizeof(*st));
+    hdr->header_crc = crc32c(0, hdr, offsetof(CheckpointHeader, header_crc));
+}
+
+static int checkpoint_write_file(const char *path, uint64_t generation, const CheckpointState *st, uint64_t count) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    CheckpointHeader hdr;
+    checkpoint_fill_header(&hdr, generation, st, count);
+    uint64_t blocks = archive_block_count(count);
+    uint32_t *crcs = (uint32_t*) malloc((size_t)(blocks ? blocks : 1) * sizeof(uint32_t));
+    Transaction *block = (Transaction*) malloc(ARCHIVE_BLOCK_RECORDS * sizeof(Transaction));
+    int rc = crcs && block ? 0 : -1;
+    if (rc == 0) rc = write_all(fd, &hdr, sizeof(hdr));
+    if (rc == 0) rc = write_all(fd, st, sizeof(*st));
+    for (uint64_t b = 0; rc == 0 && b < blocks; ++b) {
+        uint64_t first = b * ARCHIVE_BLOCK_RECORDS;
+        size_t n = count - first < ARCHIVE_BLOCK_RECORDS ? (size_t)(count - first) : ARCHIVE_BLOCK_RECORDS;
+        pthread_mutex_lock(&station_lock);
+        memcpy(block, transactions + first, n * sizeof(Transaction));
+        pthread_mutex_unlock(&station_lock);
+        crcs[b] = crc32c(0, block, n * sizeof(Transaction));
+        rc = write_all(fd, block, n * sizeof(Transaction));
+    }
+    if (rc == 0) rc = write_all(fd, crcs, (size_t)blocks * sizeof(uint32_t));
+    if (rc == 0) rc = fsync(fd);
+    if (close(fd) != 0) rc = -1;
+    free(crcs);
+    free(block);
+    return rc;
+}
+
+/*
+ * Restores the checkpoint at path. Returns the journal generation it covers,
+ * 0 if there is no checkpoint, or -1 if it exists but cannot be used.
+ */
+static long long checkpoint_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    CheckpointHeader hdr;
+    CheckpointState *st = (CheckpointState*) malloc(sizeof(CheckpointState));
+    long long result = -1;
+    Transaction *store = NULL;
+    uint32_t *crcs = NULL;
+    if (read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != CHECKPOINT_VERSION || hdr.record_size != sizeof(Transaction) ||
+        crc32c(0, &hdr, offsetof(CheckpointHeader, header_crc)) != hdr.header_crc) {
+        fprintf(stderr, "%s is not a checkpoint this build can read.\n", path);
+        goto done;
+    }
+    if (!st) {
+        fprintf(stderr, "%s: out of memory.\n", path);
+        goto done;
+    }
+    if (read(fd, st, sizeof(*st)) != (ssize_t)sizeof(*st) || crc32c(0, st, sizeof(*st)) != hdr.state_crc) {
+        fprintf(stderr, "%s: checkpoint state failed its checksum.\n", path);
+        goto done;
+    }
+    uint64_t blocks = archive_block_count(hdr.tx_count);
+    size_t capacity = hdr.tx_count > INITIAL_TX_CAPACITY ? (size_t)hdr.tx_count : INITIAL_TX_CAPACITY;
+    store = (Transaction*) calloc(capacity, sizeof(Transaction));
+    crcs = (uint32_t*) malloc((size_t)(blocks ? blocks : 1) * sizeof(uint32_t));
+    if (!store || !crcs) goto done;
+    size_t bytes = (size_t)hdr.tx_count * sizeof(Transaction);
+    for (size_t off = 0; off < bytes; ) {
+        ssize_t n = read(fd, (char*)store + off, bytes - off);
+        if (n <= 0) {
+            fprintf(stderr, "%s: checkpoint truncated.\n", path);
+            goto done;
+        }
+        off += (size_t)n;
+    }
+    if (read(fd, crcs, (size_t)blocks * sizeof(uint32_t)) != (ssize_t)(blocks * sizeof(uint32_t))) {
+        fprintf(stderr, "%s: checkpoint truncated.\n", path);
+        goto done;
+    }
+    for (uint64_t b = 0; b < blocks; ++b) {
+        uint64_t first = b * ARCHIVE_BLOCK_RECORDS;
+        size_t n = hdr.tx_count - first < ARCHIVE_BLOCK_RECORDS ? (size_t)(hdr.tx_count - first) : ARCHIVE_BLOCK_RECORDS;
+        if (crc32c(0, store + first, n * sizeof(Transaction)) != crcs[b]) {
+            fprintf(stderr, "%s: checkpoint block %llu failed its checksum.\n", path, (unsigned long long)b);
+            goto done;
+        }
+    }
+    if (st->pump_slots < 0 || st->pump_slots > MAX_PUMPS || st->rollup_count < 0 || st->rollup_count > ROLLUP_LIVE_DAYS) {
+        fprintf(stderr, "%s: checkpoint has an invalid pump or rollup table.\n", path);
+        goto done;
+    }
+    if (tx_count > 0) fprintf(stderr, "Checkpoint %s supersedes the %zu transactions already loaded.\n", path, tx_count);
+    free(transactions);
+    transactions = store;
+    store = NULL;
+    tx_capacity = capacity;
+    tx_count = (size_t)hdr.tx_count;
+    memcpy(fuels, st->fuels, sizeof(fuels));
+    memcpy(pumps, st->pumps, sizeof(pumps));
+    pump_slots = st->pump_slots;
+    if (config_bind_slots(atomic_load(&station_config)) != 0)
+        fprintf(stderr, "Checkpoint %s leaves no pump slots for the configured pumps.\n", path);
+    memcpy(fuel_wise_quantity, st->fuel_wise_quantity, sizeof(fuel_wise_quantity));
+    memcpy(fuel_wise_amount, st->fuel_wise_amount, sizeof(fuel_wise_amount));
+    memcpy(payment_mode_amount, st->payment_mode_amount, sizeof(payment_mode_amount));
+    memcpy(hour_quantity, st->hour_quantity, sizeof(hour_quantity));
+    memcpy(hour_amount, st->hour_amount, sizeof(hour_amount));
+    txn_sequence = (unsigned long)st->txn_sequence;
+    memcpy(pump_minutes, st->pump_minutes, sizeof(pump_minutes));
+    pump_minutes_date = st->pump_minutes_date;
+    memcpy(rollups.live, st->rollups, sizeof(rollups.live));
+    rollups.count = st->rollup_count;
+    rollups.hot = 0;
+    rollups.closed_through = st->rollup_closed_through;
+    memset(rollups.dirty, 1, sizeof(rollups.dirty));
+    if (tx_count > 0) {
+        mark_tx_dirty(tx_count - 1);
+        for (size_t w = 0; w < tx_dirty_words; ++w) tx_dirty[w] = ~0ull;
+    }
+    for (size_t i = 0; i < tx_count; ++i) note_tx_zone(i);
+    settlement.cursor = (size_t)st->settle_cursor;
+    settlement.batch_no = st->settle_batch_no;
+    if (settlement_rebuild() != 0) fprintf(stderr, "%s: no memory for the settlement table.\n", path);
+    result = (long long)hdr.generation;
+done:
+    free(st);
+    free(store);
+    free(crcs);
+    close(fd);
+    return result;
+}
+
+/* path.N: a retired segment kept by --keep-journal-segments, or an older one no checkpoint covers yet. */
+static void journal_segment_name(char *buf, size_t cap, uint64_t generation) {
+    snprintf(buf, cap, "%s.%llu", journal_ctl.path, (unsigned long long)generation);
+}
+
+/* Retires a segment that a checkpoint now covers. */
+static int journal_retire_segment(const char *path, uint64_t generation) {
+    if (!journal_ctl.keep_segments) return unlink(path);
+    char kept[300];
+    journal_segment_name(kept, sizeof(kept), generation);
+    return rename(path, kept);
+}
+
+/*
+ * Moves the live segment from next_path to path once a checkpoint has
+ * switched to it. The segment it replaces is retired if the checkpoint
+ * covers it; otherwise (the checkpoint failed) it is kept as path.N, which
+ * recovery replays before path and the next successful checkpoint retires.
+ */
+static int journal_move_live(void) {
+    if (!journal_ctl.live_next) return 0;
+    uint64_t old = journal_ctl.generation - 1;
+    int rc = 0;
+    if (old > journal_ctl.checkpointed) {
+        char pending[300];
+        journal_segment_name(pending, sizeof(pending), old);
+        rc = rename(journal_ctl.path, pending);
+        if (rc != 0 && errno == ENOENT) rc = 0;
+        if (rc == 0 && journal_ctl.pending_from == 0) journal_ctl.pending_from = old;
+    } else if (journal_retire_segment(journal_ctl.path, old) != 0 && errno != ENOENT) {
+        fprintf(stderr, "Cannot retire journal segment %s; it is replaced instead.\n", journal_ctl.path);
+    }
+    if (rc == 0) rc = rename(journal_ctl.next_path, journal_ctl.path);
+    if (rc == 0) rc = sync_parent_dir(journal_ctl.path);
+    if (rc != 0) return -1;
+    journal_ctl.live_next = 0;
+    pthread_mutex_lock(&io_backend.lock);
+    journal->name = journal_ctl.path;
+    pthread_mutex_unlock(&io_backend.lock);
+    return 0;
+}
+
+int checkpoint_now() {
+    pthread_mutex_lock(&checkpointer.lock);
+    pthread_mutex_lock(&station_lock);
+    int enabled = journal != NULL;
+    uint64_t next_generation = journal_ctl.generation + 1;
+    pthread_mutex_unlock(&station_lock);
+    if (!enabled) {
+        pthread_mutex_unlock(&checkpointer.lock);
+        return -1;
+    }
+    TRACE_BEGIN("checkpoint");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (journal_move_live() != 0) {
+        fprintf(stderr, "Checkpoint skipped: the live journal segment is still %s.\n", journal_ctl.next_path);
+        TRACE_END("checkpoint");
+        pthread_mutex_unlock(&checkpointer.lock);
+        return -1;
+    }
+    char ckpt[300], tmp[300];
+    checkpoint_path(ckpt, sizeof(ckpt), journal_ctl.path, ".ckpt");
+    checkpoint_path(tmp, sizeof(tmp), journal_ctl.path, ".ckpt.tmp");
+    CheckpointState *st = (CheckpointState*) malloc(sizeof(CheckpointState));
+    int fd = st ? journal_create(journal_ctl.next_path, next_generation) : -1;
+    IoFile *next = fd >= 0 ? io_file_open(journal_ctl.next_path, fd, sizeof(JournalHeader), 1) : NULL;
+    if (!next) {
+        if (fd >= 0) close(fd);
+        free(st);
+        fprintf(stderr, "Checkpoint skipped: cannot create journal segment %s.\n", journal_ctl.next_path);
+        TRACE_END("checkpoint");
+        pthread_mutex_unlock(&checkpointer.lock);
+        return -1;
+    }
+
+    pthread_mutex_lock(&station_lock);
+    IoFile *old = journal;
+    uint64_t covered = journal_ctl.generation;
+    journal = next;
+    journal_ctl.generation = next_generation;
+    journal_ctl.since_checkpoint = 0;
+    journal_ctl.live_next = 1;
+    checkpoint_snapshot(st);
+    uint64_t count = tx_count;
+    pthread_mutex_unlock(&station_lock);
+
+    /* From here a crash leaves both segments on disk and recovery replays them in order. */
+    int rc = io_file_close(old);
+    if (rc == 0) rc = checkpoint_write_file(tmp, covered, st, count);
+    free(st);
+    if (rc == 0) rc = rename(tmp, ckpt);
+    if (rc == 0) {
+        journal_ctl.checkpointed = covered;
+        for (uint64_t g = journal_ctl.pending_from; g != 0 && g < covered; ++g) {
+            char pending[300];
+            journal_segment_name(pending, sizeof(pending), g);
+            journal_retire_segment(pending, g);
+        }
+        journal_ctl.pending_from = 0;
+    }
+    /* Even when the checkpoint failed, the live segment must leave next_path before the next one is created. */
+    if (journal_move_live() != 0) rc = -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (rc != 0) {
+        fprintf(stderr, "Checkpoint of generation %llu failed; recovery will replay the journal instead.\n",
+                (unsigned long long)covered);
+    } else {
+        checkpointer.taken++;
+        checkpointer.last_ms = (double)(end.tv_sec - start.tv_sec) * 1e3 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+        checkpointer.last_records = count;
+    }
+    TRACE_END("checkpoint");
+    pthread_mutex_unlock(&checkpointer.lock);
+    if (rc == 0) rollup_flush();
+    return rc == 0 ? 0 : -1;
+}
+
+static void *checkpointer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&checkpointer.wake_lock);
+    for (;;) {
+        while (!checkpointer.requested && !checkpointer.stopping)
+            pthread_cond_wait(&checkpointer.wake, &checkpointer.wake_lock);
+        if (checkpointer.stopping) break;
+        checkpointer.requested = 0;
+        pthread_mutex_unlock(&checkpointer.wake_lock);
+        checkpoint_now();
+        pthread_mutex_lock(&checkpointer.wake_lock);
+    }
+    pthread_mutex_unlock(&checkpointer.wake_lock);
+    return NULL;
+}
+
+/* Called from journal_append under station_lock once a segment reaches JOURNAL_CHECKPOINT_RECORDS. */
+static void checkpoint_request(void) {
+    pthread_mutex_lock(&checkpointer.wake_lock);
+    checkpointer.requested = 1;
+    pthread_cond_signal(&checkpointer.wake);
+    pthread_mutex_unlock(&checkpointer.wake_lock);
+}
+
+/*
+ * Recovers station state from path's checkpoint and journal segments, then
+ * keeps the live segment open for appends. Returns the number of journal
+ * records replayed on top of the checkpoint, or -1 if recovery failed.
+ */
+long journal_open(const char *path, int keep_segments) {
+    if (strlen(path) >= sizeof(journal_ctl.path)) return -1;
+    snprintf(journal_ctl.path, sizeof(journal_ctl.path), "%s", path);
+    snprintf(journal_ctl.next_path, sizeof(journal_ctl.next_path), "%s.next", path);
+    journal_ctl.keep_segments = keep_segments;
+    char ckpt[300];
+    checkpoint_path(ckpt, sizeof(ckpt), path, ".ckpt");
+
+    TRACE_BEGIN("journal_recover");
+    rollups.journaled = 1;
+    long long covered = checkpoint_load(ckpt);
+    if (covered < 0) {
+        TRACE_END("journal_recover");
+        return -1;
+    }
+    if (covered > 0)
+        printf("Restored checkpoint %s (generation %lld, %zu transactions).\n", ckpt, covered, tx_count);
+
+    /* Segments a failed checkpoint kept as path.N come first, then path, then next_path. */
+    uint64_t npending = 0;
+    char name[300];
+    for (;;) {
+        journal_segment_name(name, sizeof(name), (uint64_t)covered + 1 + npending);
+        if (access(name, F_OK) != 0) break;
+        npending++;
+    }
+    uint64_t generation = (uint64_t)covered + 1, end = sizeof(JournalHeader);
+    long recovered = 0;
+    int live = -1, live_at = -1;
+    journal_ctl.checkpointed = (uint64_t)covered;
+    journal_ctl.pending_from = 0;
+    journal_ctl.live_next = 0;
+    for (uint64_t i = 0; i < npending + 2; ++i) {
+        int at = i < npending ? 0 : (int)(i - npending) + 1;  /* 0 path.N, 1 path, 2 next_path */
+        if (at == 0) journal_segment_name(name, sizeof(name), (uint64_t)covered + 1 + i);
+        else snprintf(name, sizeof(name), "%s", at == 1 ? journal_ctl.path : journal_ctl.next_path);
+        int fd = open(name, O_RDWR);
+        if (fd < 0) continue;
+        JournalHeader hdr;
+        struct stat sb;
+        if (fstat(fd, &sb) == 0 && sb.st_size == 0) {
+            close(fd);
+            unlink(name);
+            continue;
+        }
+        if (journal_read_header(fd, name, &hdr) != 0) {
+            close(fd);
+            recovered = -1;
+            break;
+        }
+        if (hdr.generation <= (uint64_t)covered) {
+            close(fd);
+            journal_retire_segment(name, hdr.generation);
+            continue;
+        }
+        long n = journal_replay(fd, name, &end);
+        if (n < 0) {
+            close(fd);
+            recovered = -1;
+            break;
+        }
+        recovered += n;
+        if (live >= 0) {
+            /* No checkpoint covers the older segment yet: keep it as path.N until one does. */
+            close(live);
+            char pending[300];
+            journal_segment_name(pending, sizeof(pending), generation);
+            if (live_at == 1 && rename(journal_ctl.path, pending) != 0) {
+                close(fd);
+                live = -1;
+                recovered = -1;
+                break;
+            }
+            if (journal_ctl.pending_from == 0) journal_ctl.pending_from = generation;
+        }
+        live = fd;
+        live_at = at;
+        generation = hdr.generation;
+    }
+    if (recovered >= 0 && live_at != 1 && live >= 0) {
+        if (live_at == 0) journal_segment_name(name, sizeof(name), generation);
+        if (rename(live_at == 0 ? name : journal_ctl.next_path, journal_ctl.path) != 0) recovered = -1;
+    }
+    if (recovered >= 0 && live < 0) {
+        live = journal_create(journal_ctl.path, generation);
+        end = sizeof(JournalHeader);
+        if (live < 0) {
+            fprintf(stderr, "Cannot create journal %s.\n", path);
+            recovered = -1;
+        }
+    }
+    if (recovered >= 0) sync_parent_dir(journal_ctl.path);
+    TRACE_END("journal_recover");
+    if (recovered < 0) {
+        if (live >= 0) close(live);
+        return -1;
+    }
+    journal_ctl.generation = generation;
+    journal_ctl.since_checkpoint = (unsigned long)recovered;
+    journal_ctl.restored = covered > 0 || recovered > 0;
+    journal = io_file_open(journal_ctl.path, live, end, 1);
+    if (!journal) {
+        close(live);
+        return -1;
+    }
+    if (pthread_create(&checkpointer.thread, NULL, checkpointer_main, NULL) == 0) checkpointer.running = 1;
+    return recovered;
+}
+
+void journal_close() {
+    if (checkpointer.running) {
+        pthread_mutex_lock(&checkpointer.wake_lock);
+        checkpointer.stopping = 1;
+        pthread_cond_signal(&checkpointer.wake);
+        pthread_mutex_unlock(&checkpointer.wake_lock);
+        pthread_join(checkpointer.thread, NULL);
+        checkpointer.running = 0;
+    }
+    if (io_file_close(journal) != 0) fprintf(stderr, "Journal was not fully written.\n");
+    journal = NULL;
+}
+
+void checkpoint_menu() {
+    if (!journal) {
+        printf("No journal is open (start with --journal FILE).\n");
+        return;
+    }
+    if (checkpoint_now() == 0)
+        printf("Checkpoint %lu written: %llu transactions in %.3f ms; journal generation now %llu.\n",
+               checkpointer.taken, (unsigned long long)checkpointer.last_records, checkpointer.last_ms,
+               (unsigned long long)journal_ctl.generation);
+}
+
+/*
+ * Incremental backups. Each backup is one file DIR/backup.NNNNNN holding the
+ * derived state plus only the TX_SEGMENT_RECORDS segments of the transaction
+ * store that were written since the previous backup in DIR (tracked by the
+ * tx_dirty bitmap). The snapshot is taken copy-on-write: the writer runs in a
+ * child forked under station_lock, so sales continue while it works from the
+ * frozen image. The store is append-only, so when this process has not yet
+ * backed up to DIR, every segment from the previous backup's tail onwards is
+ * treated as dirty; anchor_crc (CRC of the last complete segment the previous
+ * backup covered) confirms the store is the same history, else a full backup
+ * is taken. restore_backup() merges the chain newest-first into a checkpoint.
+ */
+#define BACKUP_MAGIC "PPMSBAK1"
+#define BACKUP_VERSION 7
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t backup_no;
+    uint64_t base_no;
+    uint64_t tx_count;
+    uint32_t segment_records;
+    uint32_t segments;
+    uint32_t anchor_crc;
+    uint32_t state_crc;
+    uint32_t header_crc;
+    uint32_t reserved;
+} BackupHeader;
+
+typedef struct {
+    uint64_t index;
+    uint32_t records;
+    uint32_t crc;
+} BackupSegmentHeader;
+
+static struct {
+    char dir[256];      /* directory tx_dirty is relative to, empty if none */
+    uint64_t last_no;
+    uint64_t last_tx_count;
+    unsigned long written_segments;
+    unsigned long skipped_segments;
+} backups;
+
+static void backup_path(char *out, size_t cap, const char *dir, uint64_t no) {
+    snprintf(out, cap, "%s/backup.%06llu", dir, (unsigned long long)no);
+}
+
+static int backup_read_header(const char *path, BackupHeader *hdr) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    int ok = read(fd, hdr, sizeof(*hdr)) == (ssize_t)sizeof(*hdr) &&
+             memcmp(hdr->magic, BACKUP_MAGIC, sizeof(hdr->magic)) == 0 &&
+             hdr->version == BACKUP_VERSION && hdr->record_size == sizeof(Transaction) &&
+             hdr->segment_records == TX_SEGMENT_RECORDS &&
+             crc32c(0, hdr, offsetof(BackupHeader, header_crc)) == hdr->header_crc;
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+/* Highest backup number in dir, 0 if there are none. */
+static uint64_t backup_latest(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    uint64_t latest = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        unsigned long long no;
+        char tail;
+        if (sscanf(e->d_name, "backup.%llu%c", &no, &tail) == 1 && no > latest) latest = no;
+    }
+    closedir(d);
+    return latest;
+}
+
+static uint32_t backup_segment_crc(uint64_t seg, uint64_t count) {
+    uint64_t first = seg * TX_SEGMENT_RECORDS;
+    size_t n = count - first < TX_SEGMENT_RECORDS ? (size_t)(count - first) : TX_SEGMENT_RECORDS;
+    return crc32c(0, transactions + first, n * sizeof(Transaction));
+}
+
+/* Runs in the forked child: writes the frozen image without taking locks. */
+static int backup_write_child(const char *path, const BackupHeader *proto, const CheckpointState *st,
+                              const uint64_t *dirty, uint64_t nsegs) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return -1;
+    BackupHeader hdr = *proto;
+    hdr.segments = 0;
+    for (uint64_t seg = 0; seg < nsegs; ++seg)
+        if (dirty[seg / 64] & (1ull << (seg % 64))) hdr.segments++;
+    hdr.state_crc = crc32c(0, st, sizeof(*st));
+    hdr.header_crc = crc32c(0, &hdr, offsetof(BackupHeader, header_crc));
+    int rc = write_all(fd, &hdr, sizeof(hdr));
+    if (rc == 0) rc = write_all(fd, st, sizeof(*st));
+    for (uint64_t seg = 0; rc == 0 && seg < nsegs; ++seg) {
+        if (!(dirty[seg / 64] & (1ull << (seg % 64)))) continue;
+        uint64_t first = seg * TX_SEGMENT_RECORDS;
+        BackupSegmentHeader sh;
+        sh.index = seg;
+        sh.records = (uint32_t)(hdr.tx_count - first < TX_SEGMENT_RECORDS ? hdr.tx_count - first : TX_SEGMENT_RECORDS);
+        sh.crc = backup_segment_crc(seg, hdr.tx_count);
+        rc = write_all(fd, &sh, sizeof(sh));
+        if (rc == 0) rc = write_all(fd, transactions + first, sh.records * sizeof(Transaction));
+    }
+    if (rc == 0) rc = fsync(fd);
+    if (close(fd) != 0) rc = -1;
+    if (rc != 0) unlink(path);
+    return rc;
+}
+
+/* Writes the next backup into dir; returns its number, or -1. */
+long long run_backup(const char *dir) {
+    if (mkdir(dir, 0755) != 0 && access(dir, W_OK) != 0) {
+        fprintf(stderr, "Cannot use backup directory %s.\n", dir);
+        return -1;
+    }
+    int same_dir = strcmp(backups.dir, dir) == 0;
+    uint64_t prev_no = backup_latest(dir);
+    BackupHeader prev;
+    char path[300];
+    memset(&prev, 0, sizeof(prev));
+    if (prev_no > 0) {
+        backup_path(path, sizeof(path), dir, prev_no);
+        if (backup_read_header(path, &prev) != 0) {
+            fprintf(stderr, "%s is unreadable; taking a full backup.\n", path);
+            prev_no = 0;
+        }
+    }
+    if (same_dir && prev_no != backups.last_no) same_dir = 0;
+
+    CheckpointState *st = (CheckpointState*) malloc(sizeof(CheckpointState));
+    if (!st) return -1;
+    pthread_mutex_lock(&station_lock);
+    uint64_t count = tx_count;
+    uint64_t nsegs = (count + TX_SEGMENT_RECORDS - 1) / TX_SEGMENT_RECORDS;
+    size_t words = (size_t)((nsegs + 63) / 64);
+    uint64_t *dirty = (uint64_t*) calloc(words ? words : 1, sizeof(uint64_t));
+    if (!dirty) {
+        pthread_mutex_unlock(&station_lock);
+        free(st);
+        return -1;
+    }
+    int full = prev_no == 0 || tx_dirty_overflow || (!same_dir && prev.tx_count > count);
+    if (!full && !same_dir) {
+        uint64_t anchor = prev.tx_count / TX_SEGMENT_RECORDS;
+        if (anchor > 0 && backup_segment_crc(anchor - 1, count) != prev.anchor_crc) full = 1;
+        for (uint64_t seg = anchor; seg < nsegs; ++seg) dirty[seg / 64] |= 1ull << (seg % 64);
+    } else if (!full) {
+        for (size_t w = 0; w < words && w < tx_dirty_words; ++w) dirty[w] = tx_dirty[w];
+    }
+    if (full)
+        for (uint64_t seg = 0; seg < nsegs; ++seg) dirty[seg / 64] |= 1ull << (seg % 64);
+
+    BackupHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BACKUP_MAGIC, sizeof(hdr.magic));
+    hdr.version = BACKUP_VERSION;
+    hdr.record_size = (uint32_t)sizeof(Transaction);
+    hdr.backup_no = prev_no + 1;
+    hdr.base_no = full ? 0 : prev_no;
+    hdr.tx_count = count;
+    hdr.segment_records = TX_SEGMENT_RECORDS;
+    hdr.anchor_crc = count / TX_SEGMENT_RECORDS > 0 ? backup_segment_crc(count / TX_SEGMENT_RECORDS - 1, count) : 0;
+    checkpoint_snapshot(st);
+    backup_path(path, sizeof(path), dir, hdr.backup_no);
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) _exit(backup_write_child(path, &hdr, st, dirty, nsegs) == 0 ? 0 : 1);
+    if (pid > 0) memset(tx_dirty, 0, tx_dirty_words * sizeof(uint64_t));
+    pthread_mutex_unlock(&station_lock);
+    free(st);
+
+    int status = 0;
+    int ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (ok) ok = sync_parent_dir(path) == 0;
+    unsigned long written = 0;
+    for (uint64_t seg = 0; seg < nsegs; ++seg)
+        if (dirty[seg / 64] & (1ull << (seg % 64))) written++;
+    if (!ok) {
+        /* Put the segments back so the next attempt still includes them. */
+        pthread_mutex_lock(&station_lock);
+        if (nsegs > 0) mark_tx_dirty((size_t)(nsegs - 1) * TX_SEGMENT_RECORDS);
+        for (size_t w = 0; w < words && w < tx_dirty_words; ++w) tx_dirty[w] |= dirty[w];
+        pthread_mutex_unlock(&station_lock);
+        free(dirty);
+        fprintf(stderr, "Backup to %s failed.\n", path);
+        return -1;
+    }
+    free(dirty);
+    snprintf(backups.dir, sizeof(backups.dir), "%s", dir);
+    backups.last_no = hdr.backup_no;
+    backups.last_tx_count = count;
+    backups.written_segments = written;
+    backups.skipped_segments = (unsigned long)(nsegs - written);
+    tx_dirty_overflow = 0;
+    return (long long)hdr.backup_no;
+}
+
+/*
+ * Reassembles the newest backup in dir into a checkpoint at ckpt_path. Each
+ * segment is taken from the newest backup that holds it, walking back until
+ * a full backup; segments are then streamed in order with their CRCs checked.
+ */
+int restore_backup(const char *dir, const char *ckpt_path) {
+    uint64_t latest = backup_latest(dir);
+    if (latest == 0) {
+        fprintf(stderr, "No backups found in %s.\n", dir);
+        return -1;
+    }
+    char path[300];
+    BackupHeader top;
+    backup_path(path, sizeof(path), dir, latest);
+    if (backup_read_header(path, &top) != 0) {
+        fprintf(stderr, "%s is not a readable backup.\n", path);
+        return -1;
+    }
+    uint64_t nsegs = (top.tx_count + TX_SEGMENT_RECORDS - 1) / TX_SEGMENT_RECORDS;
+    uint64_t *src_no = (uint64_t*) calloc(nsegs ? nsegs : 1, sizeof(uint64_t));
+    off_t *src_off = (off_t*) calloc(nsegs ? nsegs : 1, sizeof(off_t));
+    Transaction *block = (Transaction*) malloc(TX_SEGMENT_RECORDS * sizeof(Transaction));
+    uint32_t *crcs = (uint32_t*) malloc((size_t)(nsegs ? nsegs : 1) * sizeof(uint32_t));
+    CheckpointState *st = (CheckpointState*) malloc(sizeof(CheckpointState));
+    int rc = src_no && src_off && block && crcs && st ? 0 : -1;
+    /* The state always comes from the newest backup, even one with no segments. */
+    int sfd = rc == 0 ? open(path, O_RDONLY) : -1;
+    if (rc == 0 && (sfd < 0 || pread(sfd, st, sizeof(*st), sizeof(top)) != (ssize_t)sizeof(*st) ||
+                    crc32c(0, st, sizeof(*st)) != top.state_crc)) {
+        fprintf(stderr, "%s: state failed its checksum.\n", path);
+        rc = -1;
+    }
+    if (sfd >= 0) close(sfd);
+    uint64_t missing = nsegs, no = latest;
+    while (rc == 0 && missing > 0 && no > 0) {
+        BackupHeader hdr;
+        backup_path(path, sizeof(path), dir, no);
+        int fd = backup_read_header(path, &hdr) == 0 ? open(path, O_RDONLY) : -1;
+        if (fd < 0) {
+            fprintf(stderr, "Backup chain broken at %s.\n", path);
+            rc = -1;
+            break;
+        }
+        off_t off = (off_t)sizeof(hdr) + (off_t)sizeof(CheckpointState);
+        for (uint32_t i = 0; i < hdr.segments; ++i) {
+            BackupSegmentHeader sh;
+            if (pread(fd, &sh, sizeof(sh), off) != (ssize_t)sizeof(sh)) {
+                fprintf(stderr, "%s: truncated.\n", path);
+                rc = -1;
+                break;
+            }
+            if (sh.index < nsegs && src_no[sh.index] == 0) {
+                src_no[sh.index] = no;
+                src_off[sh.index] = off;
+                missing--;
+            }
+            off += (off_t)sizeof(sh) + (off_t)sh.records * (off_t)sizeof(Transaction);
+        }
+        close(fd);
+        if (hdr.base_no == 0) break;
+        no = hdr.base_no;
+    }
+    if (rc == 0 && missing > 0) {
+        fprintf(stderr, "Backup chain in %s is missing %llu segments.\n", dir, (unsigned long long)missing);
+        rc = -1;
+    }
+
+    int out = -1;
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ckpt_path);
+    if (rc == 0) {
+        out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        CheckpointHeader ch;
+        checkpoint_fill_header(&ch, 1, st, top.tx_count);
+        if (out < 0) {
+            fprintf(stderr, "Cannot create %s.\n", tmp);
+            rc = -1;
+        }
+        if (rc == 0) rc = write_all(out, &ch, sizeof(ch));
+        if (rc == 0) rc = write_all(out, st, sizeof(*st));
+    }
+    int in = -1;
+    uint64_t in_no = 0;
+    for (uint64_t seg = 0; rc == 0 && seg < nsegs; ++seg) {
+        if (src_no[seg] != in_no) {
+            if (in >= 0) close(in);
+            backup_path(path, sizeof(path), dir, src_no[seg]);
+            in = open(path, O_RDONLY);
+            in_no = src_no[seg];
+        }
+        BackupSegmentHeader sh;
+        uint64_t expect = top.tx_count - seg * TX_SEGMENT_RECORDS;
+        if (expect > TX_SEGMENT_RECORDS) expect = TX_SEGMENT_RECORDS;
+        if (in < 0 || pread(in, &sh, sizeof(sh), src_off[seg]) != (ssize_t)sizeof(sh) || sh.records < expect) {
+            fprintf(stderr, "Segment %llu unreadable in %s.\n", (unsigned long long)seg, path);
+            rc = -1;
+            break;
+        }
+        /* A tail segment may have grown in a later backup; an older copy only serves if it is complete. */
+        size_t bytes = (size_t)expect * sizeof(Transaction);
+        if (pread(in, block, (size_t)sh.records * sizeof(Transaction), src_off[seg] + (off_t)sizeof(sh)) !=
+                (ssize_t)(sh.records * sizeof(Transaction)) ||
+            crc32c(0, block, (size_t)sh.records * sizeof(Transaction)) != sh.crc) {
+            fprintf(stderr, "Segment %llu in %s failed its checksum.\n", (unsigned long long)seg, path);
+            rc = -1;
+            break;
+        }
+        crcs[seg] = crc32c(0, block, bytes);
+        rc = write_all(out, block, bytes);
+    }
+    if (in >= 0) close(in);
+    if (rc == 0) rc = write_all(out, crcs, (size_t)nsegs * sizeof(uint32_t));
+    if (rc == 0) rc = fsync(out);
+    if (out >= 0 && close(out) != 0) rc = -1;
+    if (rc == 0) rc = rename(tmp, ckpt_path);
+    else if (out >= 0) unlink(tmp);
+    if (rc == 0) {
+        printf("Restored backup %llu (%llu transactions) from %s into %s.\n",
+               (unsigned long long)latest, (unsigned long long)top.tx_count, dir, ckpt_path);
+    }
+    free(src_no);
+    free(src_off);
+    free(block);
+    free(crcs);
+    free(st);
+    return rc;
+}
+
+void backup_menu() {
+    char dir[256];
+    printf("Backup directory: ");
+    if (scanf("%255s", dir) != 1) {
         clear_input_buffer();
         printf("Invalid.\n");
         return;
     }
+    clear_input_buffer();
+    long long no = run_backup(dir);
+    if (no > 0)
+        printf("Backup %lld written to %s: %lu segments copied, %lu unchanged.\n",
+               no, dir, backups.written_segments, backups.skipped_segments);
+}
 
-    Transaction tx;
-    memset(&tx, 0, sizeof(tx));
-    generate_txn_id(tx.txn_id, sizeof(tx.txn_id));
-    tx.timestamp = time(NULL);
-    tx.pump_id = pump_id;
-    tx.fuel_type = ftype;
-    tx.vehicle_type = (VehicleType)vchoice;
-    tx.quantity = qty;
-    tx.amount = amt;
-    tx.payment_mode = (PaymentMode)paychoice;
+/*
+ * Synthetic dataset generator. Each simulated day gets an equal share of the
+ * requested records; within a day, timestamps follow gen_hour_profile through
+ * an inverse CDF so records stay in time order. Days are split across worker
+ * threads and every day seeds its own RNG, so output is identical for any
+ * thread count.
+ */
+static const double gen_hour_profile[24] = {
+    0.6, 0.4, 0.3, 0.3, 0.5, 1.2, 3.0, 5.5, 7.5, 6.8, 5.2, 4.8,
+    5.0, 4.9, 4.6, 4.8, 5.6, 7.2, 8.0, 6.9, 4.9, 3.1, 1.8, 1.0
+};
+static const double gen_pump_weight[PUMP_COUNT] = { 0.24, 0.20, 0.18, 0.14, 0.13, 0.11 };
+static const double gen_vehicle_mix[3][3] = {
+    { 0.55, 0.40, 0.05 },
+    { 0.00, 0.45, 0.55 },
+    { 0.05, 0.70, 0.25 }
+};
+static const double gen_vehicle_litres[3] = { 3.0, 28.0, 85.0 };
+static const double gen_payment_mix[3] = { 0.42, 0.26, 0.32 };
+/* Most sales come from a pool of regular vehicles; the rest are one-off visitors. */
+#define GEN_REGULAR_VEHICLES 20000
+#define GEN_REGULAR_SHARE 0.65
 
-    fuels[ftype].current_stock -= qty;
+typedef struct {
+    int fd;
+    uint64_t seed;
+    int first_day;
+    int last_day;
+    const time_t *day_start;
+    uint64_t per_day;
+    uint64_t extra_days;
+    uint64_t count;
+    uint32_t *crcs;             /* shared archive CRC table; each worker fills the blocks it writes whole */
+    int failed;
+} GenWorker;
 
-    record_transaction(&tx);
+static uint64_t gen_next(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ull;
+}
 
-    print_receipt(&tx);
+static double gen_uniform(uint64_t *state) {
+    return (double)(gen_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
 
-    check_low_stock_alerts();
+static int gen_pick(uint64_t *state, const double *weights, int n) {
+    double total = 0.0;
+    for (int i = 0; i < n; ++i) total += weights[i];
+    double r = gen_uniform(state) * total;
+    for (int i = 0; i < n - 1; ++i) {
+        if (r < weights[i]) return i;
+        r -= weights[i];
+    }
+    return n - 1;
+}
 
-    clear_input_buffer();
+/* Stand-in for identity_hash() of a synthetic registration number or card token. */
+static uint64_t gen_identity(uint64_t seed, uint64_t id) {
+    uint64_t h = seed ^ (id * 0x9E3779B97F4A7C15ull);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h ? h : 1;
 }
 
-void add_supply() {
-    printf("\nAdd supply to which fuel? 0=Petrol,1=Diesel,2=CNG: ");
-    int f;
-    if (scanf("%d", &f) != 1 || f < 0 || f > 2) {
+static uint64_t gen_day_first_index(const GenWorker *w, int day) {
+    uint64_t d = (uint64_t)day;
+    return d * w->per_day + (d < w->extra_days ? d : w->extra_days);
+}
+
+static void *gen_worker_main(void *arg) {
+    GenWorker *w = (GenWorker*) arg;
+    double cum[25];
+    cum[0] = 0.0;
+    for (int h = 0; h < 24; ++h) cum[h + 1] = cum[h] + gen_hour_profile[h];
+
+    Transaction *block = (Transaction*) malloc(ARCHIVE_BLOCK_RECORDS * sizeof(Transaction));
+    if (!block) { w->failed = 1; return NULL; }
+    /* Flushes stop at archive block boundaries; a block begun by the previous worker is summed by the caller. */
+    uint32_t block_crc = 0;
+    int block_whole = gen_day_first_index(w, w->first_day) % ARCHIVE_BLOCK_RECORDS == 0;
+
+    for (int day = w->first_day; day < w->last_day; ++day) {
+        uint64_t rng = w->seed ^ ((uint64_t)(day + 1) * 0x9E3779B97F4A7C15ull);
+        if (rng == 0) rng = 1;
+        uint64_t first = gen_day_first_index(w, day);
+        uint64_t n = w->per_day + ((uint64_t)day < w->extra_days ? 1 : 0);
+        struct tm day_tm;
+        localtime_r(&w->day_start[day], &day_tm);
+        size_t fill = 0;
+        uint64_t flushed = first;
+        for (uint64_t j = 0; j < n; ++j) {
+            double target = ((double)j + gen_uniform(&rng)) / (double)n * cum[24];
+            int h = 0;
+            while (h < 23 && cum[h + 1] <= target) h++;
+            double frac = (target - cum[h]) / gen_hour_profile[h];
+            int secs = h * 3600 + (int)(frac * 3600.0);
+            if (secs > 86399) secs = 86399;
+
+            Transaction *t = &block[fill++];
+            memset(t, 0, sizeof(*t));
+            t->timestamp = w->day_start[day] + secs;
+            int p = gen_pick(&rng, gen_pump_weight, PUMP_COUNT);
+            t->pump_id = p + 1;
+            t->fuel_type = p < 2 ? FUEL_PETROL : (p < 4 ? FUEL_DIESEL : FUEL_CNG);
+            t->vehicle_type = (VehicleType) gen_pick(&rng, gen_vehicle_mix[t->fuel_type], 3);
+            double litres = gen_vehicle_litres[t->vehicle_type] * (0.35 + 1.3 * gen_uniform(&rng));
+            double price = t->fuel_type == FUEL_PETROL ? PRICE_PETROL
+                         : (t->fuel_type == FUEL_DIESEL ? PRICE_DIESEL : PRICE_CNG);
+            if (gen_uniform(&rng) < 0.6) {
+                t->amount = (double)(50 * (1 + (int)(litres * price / 50.0)));
+                t->quantity = t->amount / price;
+            } else {
+                t->quantity = (double)(int)(litres * 1000.0 + 0.5) / 1000.0;
+                t->amount = t->quantity * price;
+            }
+            t->payment_mode = (PaymentMode) gen_pick(&rng, gen_payment_mix, 3);
+            t->processor_id = payment_processor_for(t->payment_mode);
+            if (t->processor_id != PROCESSOR_NONE) t->auth_code = (unsigned)(gen_next(&rng) % 1000000);
+            uint64_t vehicle = gen_uniform(&rng) < GEN_REGULAR_SHARE
+                             ? gen_next(&rng) % GEN_REGULAR_VEHICLES
+                             : GEN_REGULAR_VEHICLES + (gen_next(&rng) >> 8);
+            t->vehicle_hash = gen_identity(w->seed, vehicle);
+            if (t->payment_mode != PAY_CASH) t->customer_hash = gen_identity(~w->seed, vehicle);
+            snprintf(t->txn_id, sizeof(t->txn_id), "TXN%04u%02u%02u%02u%05u",
+                     (unsigned)(day_tm.tm_year + 1900) % 10000, (unsigned)(day_tm.tm_mon + 1) % 100,
+                     (unsigned)day_tm.tm_mday % 100, (unsigned)h, (unsigned)((j + 1) % 100000000));
+
+            uint64_t next = flushed + fill;
+            if (next % ARCHIVE_BLOCK_RECORDS == 0 || j + 1 == n) {
+                size_t bytes = fill * sizeof(Transaction);
+                off_t off = (off_t)sizeof(ArchiveHeader) + (off_t)flushed * (off_t)sizeof(Transaction);
+                if (pwrite(w->fd, block, bytes, off) != (ssize_t)bytes) {
+                    w->failed = 1;
+                    free(block);
+                    return NULL;
+                }
+                block_crc = crc32c(block_crc, block, bytes);
+                if (next % ARCHIVE_BLOCK_RECORDS == 0 || next == w->count) {
+                    if (block_whole) w->crcs[(next - 1) / ARCHIVE_BLOCK_RECORDS] = block_crc;
+                    block_crc = 0;
+                    block_whole = 1;
+                }
+                flushed += fill;
+                fill = 0;
+            }
+        }
+    }
+    free(block);
+    return NULL;
+}
+
+int generate_dataset(const char *path, uint64_t count, int days, int threads, uint64_t seed) {
+    if (count == 0 || days <= 0 || threads <= 0) {
+        fprintf(stderr, "Dataset generation needs a positive record count, day count and thread count.\n");
+        return -1;
+    }
+    if (threads > days) threads = days;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create archive %s.\n", path);
+        return -1;
+    }
+    if (archive_write_header(fd, count) != 0) {
+        fprintf(stderr, "Failed to write archive header to %s.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    time_t *day_start = (time_t*) malloc((size_t)days * sizeof(time_t));
+    GenWorker *workers = (GenWorker*) calloc((size_t)threads, sizeof(GenWorker));
+    pthread_t *tids = (pthread_t*) calloc((size_t)threads, sizeof(pthread_t));
+    uint32_t *crcs = (uint32_t*) calloc((size_t)archive_block_count(count), sizeof(uint32_t));
+    if (!day_start || !workers || !tids || !crcs) {
+        free(day_start); free(workers); free(tids); free(crcs);
+        close(fd);
+        return -1;
+    }
+    time_t now = time(NULL);
+    struct tm base;
+    localtime_r(&now, &base);
+    for (int d = 0; d < days; ++d) {
+        struct tm dt = base;
+        dt.tm_mday -= days - d;
+        dt.tm_hour = 0; dt.tm_min = 0; dt.tm_sec = 0;
+        dt.tm_isdst = -1;
+        day_start[d] = mktime(&dt);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int t = 0; t < threads; ++t) {
+        workers[t].fd = fd;
+        workers[t].seed = seed;
+        workers[t].first_day = (int)((long long)days * t / threads);
+        workers[t].last_day = (int)((long long)days * (t + 1) / threads);
+        workers[t].day_start = day_start;
+        workers[t].per_day = count / (uint64_t)days;
+        workers[t].extra_days = count % (uint64_t)days;
+        workers[t].count = count;
+        workers[t].crcs = crcs;
+        if (pthread_create(&tids[t], NULL, gen_worker_main, &workers[t]) != 0) {
+            workers[t].failed = 1;
+            tids[t] = 0;
+        }
+    }
+    int failed = 0;
+    for (int t = 0; t < threads; ++t) {
+        if (tids[t]) pthread_join(tids[t], NULL);
+        failed |= workers[t].failed;
+    }
+    for (int t = 1; t < threads && !failed; ++t) {
+        uint64_t first = gen_day_first_index(&workers[t], workers[t].first_day);
+        if (first % ARCHIVE_BLOCK_RECORDS != 0 && first < count &&
+            archive_block_crc(fd, count, first / ARCHIVE_BLOCK_RECORDS, &crcs[first / ARCHIVE_BLOCK_RECORDS]) != 0)
+            failed = 1;
+    }
+    if (!failed && archive_write_checksums(fd, count, crcs) != 0) failed = 1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (close(fd) != 0) failed = 1;
+    free(day_start); free(workers); free(tids); free(crcs);
+    if (failed) {
+        fprintf(stderr, "Dataset generation failed while writing %s.\n", path);
+        return -1;
+    }
+    double secs = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    double mb = (double)count * sizeof(Transaction) / (1024.0 * 1024.0);
+    printf("Generated %llu transactions over %d days into %s (%.1f MB) in %.3f s",
+           (unsigned long long)count, days, path, mb, secs);
+    if (secs > 0) printf(" - %.0f records/s, %.1f MB/s", (double)count / secs, mb / secs);
+    printf("\n");
+    return 0;
+}
+
+/*
+ * Replays a capture file at full speed against this build and checks that the
+ * resulting state digest matches the one recorded by the capturing build.
+ * Returns the process exit status: 0 on match, 1 on mismatch or error.
+ */
+int replay_capture(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open capture file %s.\n", path);
+        return 1;
+    }
+    char line[512];
+    if (!fgets(line, sizeof(line), fp) || strncmp(line, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) != 0) {
+        fprintf(stderr, "%s is not a capture file.\n", path);
+        fclose(fp);
+        return 1;
+    }
+
+    size_t sales = 0, rejected = 0, supplies = 0, status_changes = 0, reconfigs = 0, lineno = 1;
+    int have_digest = 0;
+    unsigned long long expected = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        long long ts;
+        int a, b, c, d;
+        double v0, v1, v2;
+        switch (line[0]) {
+            case 'I':
+                if (sscanf(line + 1, "%la %la %la", &v0, &v1, &v2) != 3) goto bad_line;
+                fuels[FUEL_PETROL].opening_stock = fuels[FUEL_PETROL].current_stock = v0;
+                fuels[FUEL_DIESEL].opening_stock = fuels[FUEL_DIESEL].current_stock = v1;
+                fuels[FUEL_CNG].opening_stock = fuels[FUEL_CNG].current_stock = v2;
+                break;
+            case 'S': {
+                unsigned long long vh = 0, ch = 0;
+                int fields = sscanf(line + 1, "%lld %d %d %d %la %d %llx %llx", &ts, &a, &b, &c, &v0, &d, &vh, &ch);
+                if (fields != 6 && fields != 8) goto bad_line;
+                SaleRequest req;
+                req.vehicle_hash = vh;
+                req.customer_hash = ch;
+                req.timestamp = (time_t)ts;
+                req.pump_id = a;
+                req.vehicle_type = (VehicleType)b;
+                req.by_amount = c;
+                req.value = v0;
+                req.payment_mode = (PaymentMode)d;
+                if (execute_sale(&req, NULL) != SALE_OK) rejected++;
+                sales++;
+                break;
+            }
+            case 'A': {
+                unsigned long long vh, ch;
+                int fuel;
+                SaleRequest req;
+                if (sscanf(line + 1, "%lld %d %d %d %la %d %llx %llx %d %la %la", &ts, &a, &b, &c, &v0, &d, &vh, &ch,
+                           &fuel, &v1, &v2) != 11 || fuel < FUEL_PETROL || fuel > FUEL_CNG)
+                    goto bad_line;
+                req.vehicle_hash = vh;
+                req.customer_hash = ch;
+                req.timestamp = (time_t)ts;
+                req.pump_id = a;
+                req.vehicle_type = (VehicleType)b;
+                req.by_amount = c;
+                req.value = v0;
+                req.payment_mode = (PaymentMode)d;
+                pthread_mutex_lock(&station_lock);
+                fuels[fuel].current_stock -= v1;
+                commit_sale(&req, (FuelType)fuel, v1, v2, 0, NULL);
+                pthread_mutex_unlock(&station_lock);
+                sales++;
+                break;
+            }
+            case 'U':
+                if (sscanf(line + 1, "%lld %d %la", &ts, &a, &v0) != 3) goto bad_line;
+                apply_supply(a, v0);
+                supplies++;
+                break;
+            case 'P':
+                if (sscanf(line + 1, "%lld %d %d", &ts, &a, &b) != 3) goto bad_line;
+                apply_pump_status(a, (PumpStatus)b);
+                status_changes++;
+                break;
+            case 'C': {
+                StationConfig *cfg = (StationConfig*) calloc(1, sizeof(StationConfig));
+                const char *p = line + 1;
+                int used = 0;
+                if (!cfg || sscanf(p, "%la %la %la %la %d%n", &cfg->low_stock_threshold, &cfg->price[FUEL_PETROL],
+                                   &cfg->price[FUEL_DIESEL], &cfg->price[FUEL_CNG], &cfg->pump_count, &used) != 5 ||
+                    cfg->pump_count < 1 || cfg->pump_count > MAX_PUMPS) {
+                    free(cfg);
+                    goto bad_line;
+                }
+                for (int i = 0; i < cfg->pump_count; ++i) {
+                    p += used;
+                    if (sscanf(p, " %d:%d%n", &a, &b, &used) != 2 || b < FUEL_PETROL || b > FUEL_CNG) {
+                        free(cfg);
+                        goto bad_line;
+                    }
+                    cfg->pumps[i].pump_id = a;
+                    cfg->pumps[i].fuel = (FuelType)b;
+                }
+                if (config_install(cfg) != 0) goto bad_line;
+                reconfigs++;
+                break;
+            }
+            case 'Z':
+                line[strcspn(line, "\r\n")] = '\0';
+                if (line[1] != ' ' || line[2] == '\0') goto bad_line;
+                setenv("TZ", line + 2, 1);
+                tzset();
+                break;
+            case 'D':
+                if (sscanf(line + 1, "%llx", &expected) != 1) goto bad_line;
+                have_digest = 1;
+                break;
+            default:
+                goto bad_line;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fclose(fp);
+
+    double secs = elapsed_seconds(&start, &end);
+    size_t ops = sales + supplies + status_changes + reconfigs;
+    printf("Replayed %zu commands (%zu sales, %zu rejected, %zu supplies, %zu status changes, %zu reconfigurations) in %.3f ms",
+           ops, sales, rejected, supplies, status_changes, reconfigs, secs * 1e3);
+    if (secs > 0) printf(" - %.0f ops/s", (double)ops / secs);
+    printf("\n");
+
+    FILE *sink = fopen("/dev/null", "w");
+    if (sink) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        generate_daily_report(sink);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fclose(sink);
+        printf("Daily report generation: %.3f ms\n", elapsed_seconds(&start, &end) * 1e3);
+    }
+
+    unsigned long long actual = (unsigned long long)state_digest();
+    if (!have_digest) {
+        printf("State digest: %016llx (capture has no recorded digest to compare)\n", actual);
+        return 0;
+    }
+    if (actual != expected) {
+        printf("State digest MISMATCH: expected %016llx, got %016llx\n", expected, actual);
+        return 1;
+    }
+    printf("State digest match: %016llx\n", actual);
+    return 0;
+
+bad_line:
+    fprintf(stderr, "%s:%zu: malformed capture record.\n", path, lineno);
+    fclose(fp);
+    return 1;
+}
+
+void show_latency_histograms() {
+#ifdef PPMS_PROFILE
+    fflush(stdout);
+    prof_dump_fd(STDOUT_FILENO);
+#else
+    printf("\nLatency instrumentation is not compiled in (rebuild with -DPPMS_PROFILE).\n");
+#endif
+}
+
+void dump_event_trace() {
+#ifdef PPMS_TRACE
+    if (trace_dump(TRACE_OUTPUT_FILE) != 0) {
+        printf("Failed to write %s.\n", TRACE_OUTPUT_FILE);
+        return;
+    }
+    printf("Event trace written to %s (open in chrome://tracing or Perfetto).\n", TRACE_OUTPUT_FILE);
+#else
+    printf("\nEvent tracing is not compiled in (rebuild with -DPPMS_TRACE).\n");
+#endif
+}
+
+/*
+ * Station events driven by the timer wheel: day rollover at local midnight
+ * (closing stock becomes the next day's opening stock), shift ends every
+ * SHIFT_HOURS from SHIFT_FIRST_HOUR with a per-shift summary, operator
+ * scheduled price revisions (menu 25) and a journal checkpoint every
+ * CHECKPOINT_INTERVAL_MS when records are waiting.
+ */
+#define SHIFT_FIRST_HOUR 6
+#define SHIFT_HOURS 8
+#define CHECKPOINT_INTERVAL_MS (5 * 60 * 1000)
+#define PRICE_REVISION_SLOTS 16
+
+typedef struct {
+    Timer timer;
+    int pending;
+    unsigned long seq;
+    FuelType fuel;
+    double price;
+    time_t at;
+} PriceRevision;
+
+static struct {
+    pthread_mutex_t lock;       /* guards revisions[] and the next_* times */
+    Timer day_timer;
+    Timer shift_timer;
+    Timer checkpoint_timer;
+    time_t next_day;
+    time_t next_shift;
+    size_t shift_first_tx;      /* guarded by station_lock */
+    time_t shift_started;
+    unsigned long periodic_checkpoints;
+    unsigned long revision_seq;
+    PriceRevision revisions[PRICE_REVISION_SLOTS];
+} schedule = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Next local wall-clock time hour:minute strictly after now. */
+static time_t next_local_time(time_t now, int hour, int minute) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    time_t at = mktime(&tm);
+    if (at <= now) {
+        tm.tm_mday++;
+        tm.tm_hour = hour;
+        tm.tm_min = minute;
+        tm.tm_isdst = -1;
+        at = mktime(&tm);
+    }
+    return at;
+}
+
+static time_t next_shift_end(time_t now) {
+    time_t best = 0;
+    for (int h = SHIFT_FIRST_HOUR; h < SHIFT_FIRST_HOUR + 24; h += SHIFT_HOURS) {
+        time_t at = next_local_time(now, h % 24, 0);
+        if (!best || at < best) best = at;
+    }
+    return best;
+}
+
+static uint64_t ms_until(time_t at) {
+    time_t now = time(NULL);
+    return at > now ? (uint64_t)(at - now) * 1000 : 0;
+}
+
+static void day_rollover_fire(void *arg, unsigned long data) {
+    (void)arg; (void)data;
+    time_t now = time(NULL);
+    char day[16];
+    time_t closed = now - 60;
+    struct tm tm;
+    strftime(day, sizeof(day), "%Y-%m-%d", localtime_r(&closed, &tm));
+    pthread_mutex_lock(&station_lock);
+    for (int i = 0; i < 3; ++i) {
+        fuels[i].closing_stock = fuels[i].current_stock;
+        fuels[i].opening_stock = fuels[i].current_stock;
+    }
+    notice("[Day rollover] %s closed with stock Petrol %.2f | Diesel %.2f | CNG %.2f", day,
+           fuels[FUEL_PETROL].closing_stock, fuels[FUEL_DIESEL].closing_stock, fuels[FUEL_CNG].closing_stock);
+    pthread_mutex_unlock(&station_lock);
+    rollup_flush();
+    time_t next = next_local_time(now, 0, 0);
+    pthread_mutex_lock(&schedule.lock);
+    schedule.next_day = next;
+    pthread_mutex_unlock(&schedule.lock);
+    timer_arm(&schedule.day_timer, ms_until(next), day_rollover_fire, NULL, 0);
+}
+
+static void shift_end_fire(void *arg, unsigned long data) {
+    (void)arg; (void)data;
+    time_t now = time(NULL);
+    char from[8], to[8];
+    struct tm tm;
+    pthread_mutex_lock(&station_lock);
+    size_t sales = 0;
+    double amount = 0.0;
+    for (size_t i = schedule.shift_first_tx; i < tx_count; ++i) {
+        sales++;
+        amount += transactions[i].amount;
+    }
+    strftime(from, sizeof(from), "%H:%M", localtime_r(&schedule.shift_started, &tm));
+    strftime(to, sizeof(to), "%H:%M", localtime_r(&now, &tm));
+    notice("[Shift end] %s-%s: %zu sales, INR %.2f", from, to, sales, amount);
+    schedule.shift_first_tx = tx_count;
+    schedule.shift_started = now;
+    pthread_mutex_unlock(&station_lock);
+    time_t next = next_shift_end(now);
+    pthread_mutex_lock(&schedule.lock);
+    schedule.next_shift = next;
+    pthread_mutex_unlock(&schedule.lock);
+    timer_arm(&schedule.shift_timer, ms_until(next), shift_end_fire, NULL, 0);
+}
+
+static void periodic_checkpoint_fire(void *arg, unsigned long data) {
+    (void)arg; (void)data;
+    pthread_mutex_lock(&station_lock);
+    int due = journal && journal_ctl.since_checkpoint > 0;
+    pthread_mutex_unlock(&station_lock);
+    if (due) {
+        checkpoint_request();
+        pthread_mutex_lock(&schedule.lock);
+        schedule.periodic_checkpoints++;
+        pthread_mutex_unlock(&schedule.lock);
+    }
+    timer_arm(&schedule.checkpoint_timer, CHECKPOINT_INTERVAL_MS, periodic_checkpoint_fire, NULL, 0);
+}
+
+static void price_revision_fire(void *arg, unsigned long seq) {
+    PriceRevision *r = (PriceRevision*) arg;
+    pthread_mutex_lock(&schedule.lock);
+    int pending = r->pending && r->seq == seq;
+    FuelType fuel = r->fuel;
+    double price = r->price;
+    if (pending) r->pending = 0;
+    pthread_mutex_unlock(&schedule.lock);
+    if (!pending) return;
+    config_set_price(fuel, price);
+}
+
+void schedule_start() {
+    time_t now = time(NULL);
+    pthread_mutex_lock(&station_lock);
+    schedule.shift_first_tx = tx_count;
+    pthread_mutex_unlock(&station_lock);
+    schedule.shift_started = now;
+    schedule.next_day = next_local_time(now, 0, 0);
+    schedule.next_shift = next_shift_end(now);
+    timer_arm(&schedule.day_timer, ms_until(schedule.next_day), day_rollover_fire, NULL, 0);
+    timer_arm(&schedule.shift_timer, ms_until(schedule.next_shift), shift_end_fire, NULL, 0);
+    timer_arm(&schedule.checkpoint_timer, CHECKPOINT_INTERVAL_MS, periodic_checkpoint_fire, NULL, 0);
+}
+
+void schedule_menu() {
+    char at[32];
+    struct tm tm;
+    pthread_mutex_lock(&timer_wheel.lock);
+    int running = timer_wheel.running;
+    printf("\n----- Scheduled Events -----\n");
+    printf("Timer wheel: %zu pending | %lu armed | %lu fired | %lu cancelled | %lu cascaded\n",
+           timer_wheel.pending, timer_wheel.armed, timer_wheel.fired, timer_wheel.cancelled, timer_wheel.cascaded);
+    pthread_mutex_unlock(&timer_wheel.lock);
+    if (!running) {
+        printf("Timer thread is not running.\n");
+        return;
+    }
+    pthread_mutex_lock(&schedule.lock);
+    strftime(at, sizeof(at), "%Y-%m-%d %H:%M", localtime_r(&schedule.next_day, &tm));
+    printf("Next day rollover: %s\n", at);
+    strftime(at, sizeof(at), "%Y-%m-%d %H:%M", localtime_r(&schedule.next_shift, &tm));
+    printf("Next shift end:    %s\n", at);
+    printf("Periodic checkpoints requested: %lu\n", schedule.periodic_checkpoints);
+    for (int i = 0; i < PRICE_REVISION_SLOTS; ++i) {
+        const PriceRevision *r = &schedule.revisions[i];
+        if (!r->pending) continue;
+        strftime(at, sizeof(at), "%Y-%m-%d %H:%M", localtime_r(&r->at, &tm));
+        printf("Price revision: %s -> %.2f at %s\n", fuel_name(r->fuel), r->price, at);
+    }
+    pthread_mutex_unlock(&schedule.lock);
+
+    int fuel, hour, minute;
+    double price;
+    printf("Schedule a price revision - fuel (0=Petrol, 1=Diesel, 2=CNG, -1=none): ");
+    if (scanf("%d", &fuel) != 1 || fuel < 0 || fuel > 2) {
         clear_input_buffer();
-        printf("Invalid.\n");
         return;
     }
-    double amt;
-    printf("Enter quantity to add (%s): ", (f==FUEL_CNG?"kg":"liters"));
-    if (scanf("%lf", &amt) != 1 || amt <= 0) {
+    printf("New price per unit (0 cancels pending revisions for this fuel): ");
+    if (scanf("%lf", &price) != 1 || price < 0 || price > 100000) {
         clear_input_buffer();
-        printf("Invalid quantity.\n");
+        printf("Invalid price.\n");
         return;
     }
-    fuels[f].current_stock += amt;
-    printf("Supply added. New stock for %s: %.2f\n", fuel_name(fuels[f].type), fuels[f].current_stock);
-    clear_input_buffer();
-}
-
-void change_pump_status() {
-    int pid;
-    printf("Enter Pump ID to change status: ");
-    if (scanf("%d", &pid) != 1) {
+    if (price == 0) {
+        int cancelled = 0;
+        pthread_mutex_lock(&schedule.lock);
+        for (int i = 0; i < PRICE_REVISION_SLOTS; ++i) {
+            PriceRevision *r = &schedule.revisions[i];
+            if (!r->pending || r->fuel != (FuelType)fuel) continue;
+            timer_cancel(&r->timer);
+            r->pending = 0;
+            cancelled++;
+        }
+        pthread_mutex_unlock(&schedule.lock);
+        printf("Cancelled %d pending %s price revisions.\n", cancelled, fuel_name((FuelType)fuel));
         clear_input_buffer();
-        printf("Invalid.\n");
         return;
     }
-    int idx = pump_index_by_id(pid);
-    if (idx < 0) { printf("Invalid pump id.\n"); clear_input_buffer(); return; }
-    int s;
-    printf("Select status: 0=Active,1=Inactive,2=Maintenance: ");
-    if (scanf("%d", &s) != 1 || s < 0 || s > 2) {
+    printf("Effective at (HH:MM, local time): ");
+    if (scanf("%d:%d", &hour, &minute) != 2 || hour < 0 || hour > 23 || minute < 0 || minute > 59) {
         clear_input_buffer();
-        printf("Invalid.\n");
+        printf("Invalid time.\n");
         return;
     }
-    pumps[idx].status = (PumpStatus)s;
-    printf("Pump %d status set to %s\n", pid, pump_status_name(pumps[idx].status));
     clear_input_buffer();
+    pthread_mutex_lock(&schedule.lock);
+    PriceRevision *r = NULL;
+    for (int i = 0; i < PRICE_REVISION_SLOTS && !r; ++i)
+        if (!schedule.revisions[i].pending) r = &schedule.revisions[i];
+    if (!r) {
+        pthread_mutex_unlock(&schedule.lock);
+        printf("All %d price revision slots are in use.\n", PRICE_REVISION_SLOTS);
+        return;
+    }
+    r->pending = 1;
+    r->seq = ++schedule.revision_seq;
+    r->fuel = (FuelType)fuel;
+    r->price = price;
+    r->at = next_local_time(time(NULL), hour, minute);
+    timer_arm(&r->timer, ms_until(r->at), price_revision_fire, r, r->seq);
+    strftime(at, sizeof(at), "%Y-%m-%d %H:%M", localtime_r(&r->at, &tm));
+    pthread_mutex_unlock(&schedule.lock);
+    printf("%s price revision to %.2f scheduled for %s.\n", fuel_name((FuelType)fuel), price, at);
 }
 
-void show_pump_performance() {
-    printf("\n----- Pump-wise Performance -----\n");
-    for (int i = 0; i < PUMP_COUNT; ++i) {
-        printf("Pump %d | Fuel: %s | Status: %s | Txns: %.0f | Qty: %.3f | Revenue: ₹%.2f\n",
-               pumps[i].pump_id,
-               fuel_name(pumps[i].fuel_type),
-               pump_status_name(pumps[i].status),
-               pumps[i].transactions_count,
-               pumps[i].total_quantity,
-               pumps[i].total_amount);
-    }
+/*
+ * Live dashboard (menu 26). Each frame is drawn into an off-screen cell grid
+ * and compared with the previous one; only runs of changed cells are sent,
+ * each preceded by a cursor move, and the whole frame goes out in a single
+ * write(). An idle station therefore costs a clock update per refresh, which
+ * keeps the dashboard usable over slow serial consoles. The terminal runs in
+ * non-canonical mode on the alternate screen; 'q' or Esc returns to the menu.
+ */
+#define DASH_REFRESH_MS 250
+#define DASH_MAX_ROWS 64
+#define DASH_MAX_COLS 160
+#define DASH_GAUGE_WIDTH 36
+#define DASH_MERGE_GAP 6
+
+typedef struct {
+    int rows;
+    int cols;
+    char cells[DASH_MAX_ROWS][DASH_MAX_COLS];
+} DashScreen;
+
+static void dash_line(DashScreen *scr, int row, const char *fmt, ...) {
+    if (row >= scr->rows) return;
+    char line[DASH_MAX_COLS + 1];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0) n = 0;
+    if (n > scr->cols) n = scr->cols;
+    memcpy(scr->cells[row], line, (size_t)n);
+    memset(scr->cells[row] + n, ' ', (size_t)(scr->cols - n));
 }
 
-void show_fuel_summary() {
-    printf("\n----- Fuel-wise Summary -----\n");
-    for (int i = 0; i < 3; ++i) {
-        printf("%s | Opening Stock: %.2f | Current Stock: %.2f | Sold Qty: %.3f | Revenue: ₹%.2f\n",
-               fuel_name(fuels[i].type),
-               fuels[i].opening_stock,
-               fuels[i].current_stock,
-               fuel_wise_quantity[i],
-               fuel_wise_amount[i]);
+static void dash_gauge(char *out, double value, double capacity, double threshold) {
+    int fill = capacity > 0 ? (int)(value / capacity * DASH_GAUGE_WIDTH + 0.5) : 0;
+    int mark = capacity > 0 ? (int)(threshold / capacity * DASH_GAUGE_WIDTH) : -1;
+    if (fill < 0) fill = 0;
+    if (fill > DASH_GAUGE_WIDTH) fill = DASH_GAUGE_WIDTH;
+    for (int i = 0; i < DASH_GAUGE_WIDTH; ++i) out[i] = i < fill ? '#' : '-';
+    if (mark >= 0 && mark < DASH_GAUGE_WIDTH) out[mark] = '|';
+    out[DASH_GAUGE_WIDTH] = '\0';
+}
+
+static void dash_render(DashScreen *scr, unsigned long frame, size_t last_bytes, double avg_bytes_per_s) {
+    unsigned ticket;
+    const StationConfig *cfg = config_acquire(&ticket);
+    int row = 0;
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime_r(&now, &tm));
+    dash_line(scr, row++, "%s - live dashboard   %s   config v%lu   q = back to menu",
+              STATION_NAME, stamp, cfg->version);
+    dash_line(scr, row++, "%.*s", scr->cols, "------------------------------------------------------------------------------------------------");
+
+    int authorizing[MAX_PUMPS] = {0};
+    pthread_mutex_lock(&payments.lock);
+    size_t in_flight = payments.in_flight;
+    for (int i = 0; i < PAYMENT_MAX_PENDING; ++i) {
+        const PaymentAuth *a = &payments.slots[i];
+        if (a->state == AUTH_FREE) continue;
+        int idx = pump_index_by_id(a->req.pump_id);
+        if (idx >= 0) authorizing[idx]++;
+    }
+    pthread_mutex_unlock(&payments.lock);
+    int queued[MAX_PUMPS] = {0};
+    pthread_mutex_lock(&admission.lock);
+    size_t admission_queued = admission.queued;
+    for (int p = 0; p < pump_slots; ++p)
+        queued[p] = (int)(admission.queues[p][ADMIT_DISPENSE].count + admission.queues[p][ADMIT_NEW_AUTH].count);
+    pthread_mutex_unlock(&admission.lock);
+
+    pthread_mutex_lock(&station_lock);
+    dash_line(scr, row++, "Pump  Fuel    Status         Txns    Quantity     Revenue INR  Queued  Authorizing");
+    for (int i = 0; i < cfg->pump_count; ++i) {
+        const Pump *p = &pumps[cfg->pumps[i].slot];
+        dash_line(scr, row++, "%4d  %-6s  %-11s %7.0f %11.3f %15.2f  %6d  %11d", p->pump_id,
+                  fuel_name(cfg->pumps[i].fuel), pump_status_name(p->status), p->transactions_count,
+                  p->total_quantity, p->total_amount, queued[cfg->pumps[i].slot], authorizing[cfg->pumps[i].slot]);
     }
+    dash_line(scr, row++, "");
+    dash_line(scr, row++, "Stock (| marks the low-stock threshold %.0f)", cfg->low_stock_threshold);
+    for (int f = 0; f < 3; ++f) {
+        char gauge[DASH_GAUGE_WIDTH + 1];
+        double cap = fuels[f].opening_stock > fuels[f].current_stock ? fuels[f].opening_stock : fuels[f].current_stock;
+        dash_gauge(gauge, fuels[f].current_stock, cap, cfg->low_stock_threshold);
+        dash_line(scr, row++, "%-6s [%s] %10.2f / %10.2f %4.0f%%%s", fuel_name((FuelType)f), gauge,
+                  fuels[f].current_stock, cap, cap > 0 ? 100.0 * fuels[f].current_stock / cap : 0.0,
+                  fuels[f].current_stock < cfg->low_stock_threshold ? "  LOW" : "");
+    }
+    unsigned long c60, c300;
+    double a60, a300;
+    sale_rate_window(60, &c60, &a60);
+    sale_rate_window(RATE_WINDOW_SECS, &c300, &a300);
+    size_t total_tx = tx_count;
+    pthread_mutex_unlock(&station_lock);
+    config_release(ticket);
+
+    dash_line(scr, row++, "");
+    dash_line(scr, row++, "Rates           last 60 s     last 5 min");
+    dash_line(scr, row++, "Sales / min  %12.1f   %12.1f", (double)c60, (double)c300 / 5.0);
+    dash_line(scr, row++, "INR / min    %12.2f   %12.2f", a60, a300 / 5.0);
+    dash_line(scr, row++, "");
+    dash_line(scr, row++, "Transactions %zu | payments authorizing %zu | admission queued %zu", total_tx, in_flight,
+              admission_queued);
+    char event[NOTICE_BYTES];
+    if (notice_latest(event, sizeof(event))) dash_line(scr, row++, "Last event: %s", event);
+    while (row < scr->rows - 1) dash_line(scr, row++, "");
+    dash_line(scr, scr->rows - 1, "frame %lu | %zu bytes last frame | %.0f bytes/s", frame, last_bytes, avg_bytes_per_s);
 }
 
-void show_hour_wise_analysis() {
-    printf("\n----- Hour-wise Sales Analysis -----\n");
-    for (int h = 0; h < 24; ++h) {
-        if (hour_quantity[h] > 0.0 || hour_amount[h] > 0.0)
-            printf("Hour %02d:00 - Qty: %.3f | Revenue: ₹%.2f\n", h, hour_quantity[h], hour_amount[h]);
+/* Writes the escape sequences that turn prev into cur; returns their length. */
+static size_t dash_diff(const DashScreen *cur, const DashScreen *prev, char *out, size_t cap) {
+    size_t len = 0;
+    for (int r = 0; r < cur->rows; ++r) {
+        int c = 0;
+        while (c < cur->cols) {
+            if (cur->cells[r][c] == prev->cells[r][c]) {
+                c++;
+                continue;
+            }
+            int start = c, end = c + 1, same = 0;
+            for (c = end; c < cur->cols && same < DASH_MERGE_GAP; ++c) {
+                if (cur->cells[r][c] == prev->cells[r][c]) {
+                    same++;
+                } else {
+                    same = 0;
+                    end = c + 1;
+                }
+            }
+            if (len + 16 + (size_t)(end - start) >= cap) return len;
+            len += (size_t)snprintf(out + len, cap - len, "\x1b[%d;%dH", r + 1, start + 1);
+            memcpy(out + len, &cur->cells[r][start], (size_t)(end - start));
+            len += (size_t)(end - start);
+            c = end;
+        }
     }
+    return len;
 }
 
-void show_payment_breakdown() {
-    printf("\n----- Payment Mode Breakdown -----\n");
-    printf("Cash: ₹%.2f\n", payment_mode_amount[PAY_CASH]);
-    printf("Credit Card: ₹%.2f\n", payment_mode_amount[PAY_CARD]);
-    printf("Digital Wallet: ₹%.2f\n", payment_mode_amount[PAY_WALLET]);
+static void dash_write(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n <= 0) return;
+        buf += n;
+        len -= (size_t)n;
+    }
 }
 
-void generate_daily_report() {
-    printf("\n================= DAILY REPORT =================\n");
-    printf("Fuel Opening & Closing Stocks:\n");
-    for (int i = 0; i < 3; ++i) {
-        fuels[i].closing_stock = fuels[i].current_stock;
-        printf("%s: Opening: %.2f | Closing: %.2f\n",
-               fuel_name(fuels[i].type),
-               fuels[i].opening_stock,
-               fuels[i].closing_stock);
+void run_dashboard() {
+    static DashScreen cur, prev;
+    static char out[DASH_MAX_ROWS * (DASH_MAX_COLS + 16) + 64];
+    struct termios saved, raw;
+    int tty = tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (tty) {
+        raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
     }
-    double total_qty = 0.0, total_amt = 0.0;
-    for (int i = 0; i < 3; ++i) {
-        total_qty += fuel_wise_quantity[i];
-        total_amt += fuel_wise_amount[i];
+    fflush(stdout);
+    dash_write("\x1b[?1049h\x1b[?25l", 14);
+
+    unsigned long frame = 0;
+    size_t last_bytes = 0;
+    unsigned long long total_bytes = 0;
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int full = 1;
+    for (;;) {
+        struct winsize ws;
+        int rows = 24, cols = 80;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+            rows = ws.ws_row;
+            cols = ws.ws_col;
+        }
+        if (rows > DASH_MAX_ROWS) rows = DASH_MAX_ROWS;
+        if (cols > DASH_MAX_COLS) cols = DASH_MAX_COLS;
+        if (rows != cur.rows || cols != cur.cols) full = 1;
+        cur.rows = rows;
+        cur.cols = cols;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double secs = elapsed_seconds(&start, &now);
+        dash_render(&cur, ++frame, last_bytes, secs > 0 ? (double)total_bytes / secs : 0.0);
+        size_t len = 0;
+        if (full) {
+            /* After a clear the terminal holds blanks, so diff against a blank screen. */
+            len = (size_t)snprintf(out, sizeof(out), "\x1b[2J");
+            memset(prev.cells, ' ', sizeof(prev.cells));
+        }
+        len += dash_diff(&cur, &prev, out + len, sizeof(out) - len);
+        dash_write(out, len);
+        last_bytes = len;
+        total_bytes += len;
+        prev = cur;
+        full = 0;
+
+        fd_set in;
+        FD_ZERO(&in);
+        FD_SET(STDIN_FILENO, &in);
+        struct timeval tv = { 0, DASH_REFRESH_MS * 1000 };
+        if (select(STDIN_FILENO + 1, &in, NULL, NULL, &tv) > 0) {
+            char key;
+            ssize_t n = read(STDIN_FILENO, &key, 1);
+            if (n <= 0 || key == 'q' || key == 'Q' || key == 27) break;
+        }
     }
-    printf("Total Sales Quantity (all fuels): %.3f\n", total_qty);
-    printf("Total Revenue (all fuels): ₹%.2f\n", total_amt);
-    show_fuel_summary();
-    printf("Number of transactions: %zu\n", tx_count);
-    show_payment_breakdown();
-    show_pump_performance();
-    show_hour_wise_analysis();
-    printf("================================================\n");
+
+    dash_write("\x1b[?25h\x1b[?1049l", 14);
+    if (tty) tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    memset(&prev, 0, sizeof(prev));
+    memset(&cur, 0, sizeof(cur));
+    printf("Dashboard closed after %lu frames, %.1f KB sent.\n", frame, (double)total_bytes / 1024);
 }
 
-void list_transactions() {
-    if (tx_count == 0) { printf("No transactions yet.\n"); return; }
-    printf("\n---- Transactions (most recent first) ----\n");
-    for (long i = (long)tx_count - 1; i >= 0; --i) {
-        char timestr[64];
-        format_time_local(transactions[i].timestamp, timestr, sizeof(timestr));
-        printf("%s | %s | Pump %d | Qty: %.3f | ₹%.2f | %s\n",
-               transactions[i].txn_id,
-               timestr,
-               transactions[i].pump_id,
-               transactions[i].quantity,
-               transactions[i].amount,
-               payment_name(transactions[i].payment_mode));
+/*
+ * Live memory statistics (menus 11 and 12). Subsystem footprints are computed
+ * from the structures themselves, each under its own lock; heap totals come
+ * from glibc's mallinfo2() where available and peak RSS from getrusage().
+ */
+static void print_memory_row(const char *name, unsigned long long bytes, const char *note) {
+    if (bytes >= 10ull << 20) printf("%-28s %10.1f MB", name, (double)bytes / (1 << 20));
+    else printf("%-28s %10.1f KB", name, (double)bytes / 1024);
+    printf("%s%s\n", note[0] ? "  " : "", note);
+}
+
+void show_memory_statistics() {
+    char note[96];
+    unsigned long long total = 0;
+    printf("\n----- Memory & Growth Statistics -----\n");
+
+    pthread_mutex_lock(&station_lock);
+    size_t used = tx_count, capacity = tx_capacity;
+    unsigned long growths = tx_growth.growths, moves = tx_growth.moves;
+    unsigned long long moved = tx_growth.bytes_moved;
+    double growth_ms = tx_growth.total_ms;
+    unsigned long long dirty_bytes = (unsigned long long)tx_dirty_words * sizeof(uint64_t);
+    unsigned long long zone_bytes = (unsigned long long)tx_zone_cap * sizeof(TxZone);
+    size_t settle_cap = settlement.table_cap, settle_used = settlement.table_used;
+    pthread_mutex_unlock(&station_lock);
+    printf("Transaction store: %zu of %zu records used (%.1f%%), %zu bytes per record\n", used, capacity,
+           capacity ? 100.0 * (double)used / (double)capacity : 0.0, sizeof(Transaction));
+    printf("Store growth: %lu expansions, %lu moved the block (%.1f MB moved), %.3f ms spent growing\n",
+           growths, moves, (double)moved / (1 << 20), growth_ms);
+
+    printf("\n%-28s %13s\n", "Subsystem", "Footprint");
+    snprintf(note, sizeof(note), "(%.1f MB in use)", (double)(used * sizeof(Transaction)) / (1 << 20));
+    print_memory_row("Transaction store", (unsigned long long)capacity * sizeof(Transaction), note);
+    total += (unsigned long long)capacity * sizeof(Transaction);
+    print_memory_row("Backup dirty-segment bitmap", dirty_bytes, "");
+    total += dirty_bytes;
+    print_memory_row("Query block index", zone_bytes, "");
+    total += zone_bytes;
+
+    unsigned long long settle_bytes = (unsigned long long)settle_cap * sizeof(SettlementEntry);
+    snprintf(note, sizeof(note), "(%zu of %zu slots)", settle_used, settle_cap);
+    print_memory_row("Settlement txn index", settle_bytes, note);
+    total += settle_bytes;
+
+    print_memory_row("Receipt spooler queue", sizeof(spooler.slots), "");
+    total += sizeof(spooler.slots);
+    pthread_mutex_lock(&ereceipts.lock);
+    unsigned long long ereceipt_bytes = sizeof(ereceipts.slots) + ereceipts.retry_cap * sizeof(EReceipt);
+    snprintf(note, sizeof(note), "(%zu queued, %zu awaiting retry)", ereceipts.count, ereceipts.retry_count);
+    pthread_mutex_unlock(&ereceipts.lock);
+    print_memory_row("E-receipt queue", ereceipt_bytes, note);
+    total += ereceipt_bytes;
+    print_memory_row("Payment authorizations", sizeof(payments.slots), "");
+    total += sizeof(payments.slots);
+    print_memory_row("Admission queues", sizeof(admission.queues), "");
+    total += sizeof(admission.queues);
+
+    pthread_mutex_lock(&io_backend.lock);
+    int io_files = io_backend.nfiles;
+    pthread_mutex_unlock(&io_backend.lock);
+    snprintf(note, sizeof(note), "(%d open files)", io_files);
+    print_memory_row("Write-behind staging", (unsigned long long)io_files * 2 * IO_STAGING_BYTES, note);
+    total += (unsigned long long)io_files * 2 * IO_STAGING_BYTES;
+    print_memory_row("Station configuration", sizeof(StationConfig), "");
+    total += sizeof(StationConfig);
+    pthread_mutex_lock(&station_lock);
+    size_t closed_days = rollups.closed_count, closed_cap = rollups.closed_cap;
+    snprintf(note, sizeof(note), "(%d of %d days live, %zu awaiting write)", rollups.count, ROLLUP_LIVE_DAYS,
+             closed_days);
+    pthread_mutex_unlock(&station_lock);
+    print_memory_row("Daily rollups", sizeof(rollups.live) + closed_cap * sizeof(ClosedDay), note);
+    total += sizeof(rollups.live) + closed_cap * sizeof(ClosedDay);
+    snprintf(note, sizeof(note), "(%d pumps x %d minutes)", (int)pump_slots, MINUTES_PER_DAY);
+    print_memory_row("Pump x minute matrix", sizeof(pump_minutes), note);
+    total += sizeof(pump_minutes);
+    pthread_mutex_lock(&timer_wheel.lock);
+    snprintf(note, sizeof(note), "(%zu timers pending)", timer_wheel.pending);
+    pthread_mutex_unlock(&timer_wheel.lock);
+    print_memory_row("Timer wheel", sizeof(timer_wheel.slots), note);
+    total += sizeof(timer_wheel.slots);
+#ifdef PPMS_PROFILE
+    print_memory_row("Latency histograms", sizeof(prof_hist), "");
+    total += sizeof(prof_hist);
+#endif
+#ifdef PPMS_TRACE
+    pthread_mutex_lock(&trace_registry_lock);
+    int trace_threads = trace_thread_count;
+    pthread_mutex_unlock(&trace_registry_lock);
+    snprintf(note, sizeof(note), "(%d threads)", trace_threads);
+    print_memory_row("Trace buffers", (unsigned long long)trace_threads * sizeof(TraceBuffer), note);
+    total += (unsigned long long)trace_threads * sizeof(TraceBuffer);
+#endif
+    print_memory_row("Total accounted", total, "");
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    printf("\nHeap arenas: %.1f MB in use, %.1f MB free (%zu free chunks) | %zu mmap'd blocks: %.1f MB\n",
+           (double)mi.uordblks / (1 << 20), (double)mi.fordblks / (1 << 20), mi.ordblks,
+           mi.hblks, (double)mi.hblkhd / (1 << 20));
+#endif
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        printf("Peak RSS: %.1f MB | minor faults %ld | major faults %ld\n",
+               (double)ru.ru_maxrss / 1024, ru.ru_minflt, ru.ru_majflt);
+    FILE *statm = fopen("/proc/self/statm", "r");
+    unsigned long pages_total, pages_resident;
+    if (statm) {
+        if (fscanf(statm, "%lu %lu", &pages_total, &pages_resident) == 2)
+            printf("Current RSS: %.1f MB of %.1f MB virtual\n",
+                   (double)pages_resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20),
+                   (double)pages_total * (double)sysconf(_SC_PAGESIZE) / (1 << 20));
+        fclose(statm);
     }
 }
 
-void print_sample_receipt_format() {
-    printf("\n--- Sample Receipt Format ---\n");
-    printf("Station: ABC Fuel Station\n");
-    printf("Address: 123 Main Road\n");
-    printf("Receipt No: <TXN ID>\n");
-    printf("Date/Time: <YYYY-MM-DD HH:MM:SS>\n");
-    printf("Pump: <ID>\n");
-    printf("Fuel: <Petrol/Diesel/CNG>\n");
-    printf("Vehicle: <2W/4W/Commercial>\n");
-    printf("Quantity: <x.xxx liters/kg>\n");
-    printf("Rate: ₹<price> per unit\n");
-    printf("Amount: ₹<xx.xx>\n");
-    printf("Payment: <Cash/Card/Wallet>\n");
-    printf("Thank you!\n");
-    printf("-----------------------------\n");
-}
-
-void print_system_architecture() {
-    printf("\n--- System Architecture & Memory Strategy ---\n");
-    printf("1. Data structures:\n");
-    printf("   - Fuel, Pump, Transaction (C structs)\n");
-    printf("2. Transactions stored in a dynamic array (Transaction*)\n");
-    printf("   - initially allocated with calloc(%d)\n", INITIAL_TX_CAPACITY);
-    printf("   - expanded using realloc (doubling capacity) when full\n");
-    printf("3. Pointer usage: transactions pointer manipulated by ensure_tx_capacity() and record_transaction()\n");
-    printf("4. Static variables: txn_sequence (for unique ids) and other persistent counters inside functions\n");
-    printf("5. Memory deallocation: transactions freed at shutdown\n");
-    printf("-----------------------------------------------\n");
-}
-
-void print_dynamic_allocation_advantages() {
-    printf("\n--- Advantages of Dynamic Allocation for Transactions ---\n");
-    printf("- Efficient initial memory usage (start small with calloc)\n");
-    printf("- Can grow as needed with realloc, avoiding fixed limits\n");
-    printf("- Keeps memory contiguous (when realloc succeeds), improving cache locality\n");
-    printf("- Easier to manage life-cycle of daily transaction logs and free at end\n");
-    printf("-----------------------------------------------\n");
+void show_store_growth() {
+    pthread_mutex_lock(&station_lock);
+    printf("\n----- Transaction Store Growth -----\n");
+    printf("Initial capacity %d records, doubling when full; now %zu records (%.1f MB)\n",
+           INITIAL_TX_CAPACITY, tx_capacity, (double)(tx_capacity * sizeof(Transaction)) / (1 << 20));
+    if (tx_growth.growths == 0) {
+        printf("No expansions yet.\n");
+        pthread_mutex_unlock(&station_lock);
+        return;
+    }
+    unsigned long first = tx_growth.growths > TX_GROWTH_HISTORY ? tx_growth.growths - TX_GROWTH_HISTORY : 0;
+    printf("Last %lu of %lu expansions:\n", tx_growth.growths - first, tx_growth.growths);
+    for (unsigned long i = first; i < tx_growth.growths; ++i) {
+        const TxGrowthEvent *ev = &tx_growth.recent[i % TX_GROWTH_HISTORY];
+        char when[16];
+        struct tm tm;
+        strftime(when, sizeof(when), "%H:%M:%S", localtime_r(&ev->when, &tm));
+        printf("#%-4lu %s  %10zu -> %10zu records  %-14s %8.1f KB  %8.3f ms\n", i + 1, when,
+               ev->from_capacity, ev->to_capacity, ev->bytes_moved ? "moved" : "grown in place",
+               (double)ev->bytes_moved / 1024, ev->ms);
+    }
+    printf("Average %.3f ms per expansion; %.1f MB moved in total\n",
+           tx_growth.total_ms / (double)tx_growth.growths, (double)tx_growth.bytes_moved / (1 << 20));
+    pthread_mutex_unlock(&station_lock);
 }
 
 void show_main_menu() {
@@ -516,17 +9461,333 @@ void show_main_menu() {
     printf("8. Show Hour-wise Sales\n");
     printf("9. Show Payment Breakdown\n");
     printf("10. Print Sample Receipt Format\n");
-    printf("11. Print System Architecture & Memory Strategy\n");
-    printf("12. Show Advantages of Dynamic Allocation\n");
+    printf("11. Show Memory & Growth Statistics\n");
+    printf("12. Show Transaction Store Growth History\n");
+    printf("13. Show Sale Latency Histograms\n");
+    printf("14. Dump Event Trace (Chrome JSON)\n");
+    printf("15. Show E-Receipt Delivery Status\n");
+    printf("16. Show Pending Payment Authorizations\n");
+    printf("17. Run Card/Wallet Settlement\n");
+    printf("18. Reconcile Settlement Response\n");
+    printf("19. Toggle Payment Link (simulate outage)\n");
+    printf("20. Show Sale Admission Metrics\n");
+    printf("21. Export Transactions to CSV\n");
+    printf("22. Checkpoint Journal Now\n");
+    printf("23. Run Incremental Backup\n");
+    printf("24. Reload Configuration\n");
+    printf("25. Scheduled Events & Price Revisions\n");
+    printf("26. Live Dashboard\n");
+    printf("27. Pump x Minute Heatmap\n");
+    printf("28. Day-over-Day / Week-over-Week Comparison\n");
+    printf("29. Distinct Vehicles & Card Holders\n");
+    printf("30. Standing Queries\n");
+    printf("31. Ad-hoc Query (SQL)\n");
     printf("0. Exit\n");
     printf("Enter choice: ");
 }
 
-int main(void) {
+void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--record FILE] [--replay FILE] [--load-archive FILE] [--settle DIR]\n", prog);
+    fprintf(stderr, "       [--receipt-device PATH | --receipt-file PATH] [--receipt-template FILE]\n");
+    fprintf(stderr, "       [--ereceipt-gateway CMD] [--payment-sim MS[,DECLINE%%[,TIMEOUT%%]]]\n");
+    fprintf(stderr, "       [--journal FILE [--keep-journal-segments]] [--backup DIR] [--restore-backup DIR]\n");
+    fprintf(stderr, "       [--export-csv FILE] [--export-heatmap FILE] [--overload-test N SECS] [--config FILE]\n");
+    fprintf(stderr, "       [--rollup-dir DIR] [--identity-key FILE] [--standing-queries FILE] [--query SQL|-]\n");
+    fprintf(stderr, "       %s --generate COUNT FILE [--days N] [--threads N] [--seed N]\n", prog);
+    fprintf(stderr, "  --record FILE        capture sale/supply/status commands for later replay\n");
+    fprintf(stderr, "  --replay FILE        replay a capture at full speed and verify the final state\n");
+    fprintf(stderr, "  --load-archive FILE  load a transaction archive before starting\n");
+    fprintf(stderr, "  --receipt-device PATH  spool receipts to a printer device instead of stdout\n");
+    fprintf(stderr, "  --receipt-file PATH    spool receipts to a text file, one page per receipt\n");
+    fprintf(stderr, "  --receipt-template FILE  render receipts from a template with {field} placeholders\n");
+    fprintf(stderr, "  --ereceipt-gateway CMD   deliver e-receipts through a local gateway command\n");
+    fprintf(stderr, "  --payment-sim SPEC       authorize card/wallet sales asynchronously via a simulated processor\n");
+    fprintf(stderr, "  --journal FILE           recover from and append to a durable sale journal\n");
+    fprintf(stderr, "  --keep-journal-segments  keep checkpointed journal segments as FILE.N instead of deleting them\n");
+    fprintf(stderr, "  --backup DIR             write an incremental backup of the loaded state into DIR and exit\n");
+    fprintf(stderr, "  --restore-backup DIR     rebuild the latest backup in DIR as the checkpoint of a new --journal\n");
+    fprintf(stderr, "  --export-csv FILE        export all loaded transactions as CSV and exit\n");
+    fprintf(stderr, "  --export-heatmap FILE    export per-pump, per-minute volume and revenue as CSV and exit\n");
+    fprintf(stderr, "  --settle DIR             write card/wallet settlement files for loaded sales and exit\n");
+    fprintf(stderr, "  --overload-test N SECS   hammer the sale engine from N concurrent controllers\n");
+    fprintf(stderr, "  --config FILE            prices, low-stock threshold and pump list; re-read on SIGHUP or menu 24\n");
+    fprintf(stderr, "  --rollup-dir DIR         directory of per-day rollups for comparison reports (default rollups)\n");
+    fprintf(stderr, "  --identity-key FILE      secret key for vehicle/card identity hashes (default identity.key)\n");
+    fprintf(stderr, "  --standing-queries FILE  where standing query definitions are kept (default standing_queries.txt)\n");
+    fprintf(stderr, "  --query SQL|-            run one query (or one per line from stdin with -) over the loaded sales and exit\n");
+    fprintf(stderr, "  --generate COUNT FILE  write a synthetic archive of COUNT transactions\n");
+}
+
+int main(int argc, char **argv) {
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    const char *archive_path = NULL;
+    const char *generate_path = NULL;
+    unsigned long long generate_count = 0, generate_seed = 2025;
+    int generate_days = 30;
+    int generate_threads = 4;
+    ReceiptSinkType receipt_sink = RECEIPT_SINK_STDOUT;
+    const char *receipt_path = NULL;
+    const char *template_path = NULL;
+    const char *ereceipt_command = NULL;
+    const char *payment_sim_spec = NULL;
+    const char *settle_dir = NULL;
+    const char *journal_path = NULL;
+    int keep_segments = 0;
+    const char *backup_dir = NULL;
+    const char *restore_dir = NULL;
+    const char *export_path = NULL;
+    const char *heatmap_path = NULL;
+    const char *query_text = NULL;
+    int overload_controllers = 0;
+    double overload_seconds = 5.0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--load-archive") == 0 && i + 1 < argc) {
+            archive_path = argv[++i];
+        } else if (strcmp(argv[i], "--generate") == 0 && i + 2 < argc) {
+            generate_count = strtoull(argv[++i], NULL, 10);
+            generate_path = argv[++i];
+        } else if (strcmp(argv[i], "--receipt-device") == 0 && i + 1 < argc) {
+            receipt_sink = RECEIPT_SINK_DEVICE;
+            receipt_path = argv[++i];
+        } else if (strcmp(argv[i], "--receipt-file") == 0 && i + 1 < argc) {
+            receipt_sink = RECEIPT_SINK_FILE;
+            receipt_path = argv[++i];
+        } else if (strcmp(argv[i], "--receipt-template") == 0 && i + 1 < argc) {
+            template_path = argv[++i];
+        } else if (strcmp(argv[i], "--ereceipt-gateway") == 0 && i + 1 < argc) {
+            ereceipt_command = argv[++i];
+        } else if (strcmp(argv[i], "--payment-sim") == 0 && i + 1 < argc) {
+            payment_sim_spec = argv[++i];
+        } else if (strcmp(argv[i], "--settle") == 0 && i + 1 < argc) {
+            settle_dir = argv[++i];
+        } else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            journal_path = argv[++i];
+        } else if (strcmp(argv[i], "--keep-journal-segments") == 0) {
+            keep_segments = 1;
+        } else if (strcmp(argv[i], "--backup") == 0 && i + 1 < argc) {
+            backup_dir = argv[++i];
+        } else if (strcmp(argv[i], "--restore-backup") == 0 && i + 1 < argc) {
+            restore_dir = argv[++i];
+        } else if (strcmp(argv[i], "--export-csv") == 0 && i + 1 < argc) {
+            export_path = argv[++i];
+        } else if (strcmp(argv[i], "--export-heatmap") == 0 && i + 1 < argc) {
+            heatmap_path = argv[++i];
+        } else if (strcmp(argv[i], "--query") == 0 && i + 1 < argc) {
+            query_text = argv[++i];
+        } else if (strcmp(argv[i], "--standing-queries") == 0 && i + 1 < argc) {
+            snprintf(standing_path, sizeof(standing_path), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--identity-key") == 0 && i + 1 < argc) {
+            snprintf(identity_key_path, sizeof(identity_key_path), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--rollup-dir") == 0 && i + 1 < argc) {
+            snprintf(rollups.dir, sizeof(rollups.dir), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            config_file = argv[++i];
+        } else if (strcmp(argv[i], "--overload-test") == 0 && i + 2 < argc) {
+            overload_controllers = atoi(argv[++i]);
+            overload_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+            generate_days = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            generate_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            generate_seed = strtoull(argv[++i], NULL, 10);
+        } else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Replays and batch runs may load another dataset; they must not rewrite the station's day files. */
+    rollups.read_only = replay_path || generate_path || overload_controllers || backup_dir || export_path ||
+                        heatmap_path || query_text || settle_dir;
+    config_block_signals();
     initialize_system();
+    crc32c_init();
+    if (config_file && config_reload(config_file, 0) != 0) {
+        shutdown_system();
+        return EXIT_FAILURE;
+    }
+    if (compile_receipt_template(default_receipt_template, &receipt_template) != 0 ||
+        (template_path && load_receipt_template(template_path) != 0)) {
+        shutdown_system();
+        return EXIT_FAILURE;
+    }
+#ifdef PPMS_PROFILE
+    signal(SIGUSR1, prof_signal_handler);
+#endif
+#ifdef PPMS_TRACE
+    trace_init();
+#endif
+
+    if (generate_path) {
+        int rc = generate_dataset(generate_path, generate_count, generate_days,
+                                  generate_threads, generate_seed);
+        shutdown_system();
+        return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (overload_controllers) {
+        int rc = run_overload_test(overload_controllers, overload_seconds);
+        shutdown_system();
+        return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (replay_path && !journal_path) {
+        int rc = replay_capture(replay_path);
+        shutdown_system();
+        return rc;
+    }
+    if (archive_path) {
+        rollups.archive_load = 1;
+        long loaded = load_archive(archive_path);
+        rollups.archive_load = 0;
+        if (loaded < 0) {
+            shutdown_system();
+            return EXIT_FAILURE;
+        }
+        printf("Loaded %ld archived transactions from %s.\n", loaded, archive_path);
+    }
+    if (restore_dir) {
+        char ckpt[300];
+        struct stat sb;
+        if (!journal_path) {
+            fprintf(stderr, "--restore-backup needs --journal FILE naming a new journal to restore into.\n");
+            shutdown_system();
+            return EXIT_FAILURE;
+        }
+        checkpoint_path(ckpt, sizeof(ckpt), journal_path, ".ckpt");
+        if (stat(journal_path, &sb) == 0 || stat(ckpt, &sb) == 0) {
+            fprintf(stderr, "Journal %s already exists; restore into a new journal path.\n", journal_path);
+            shutdown_system();
+            return EXIT_FAILURE;
+        }
+        if (restore_backup(restore_dir, ckpt) != 0) {
+            shutdown_system();
+            return EXIT_FAILURE;
+        }
+    }
+    io_backend_start();
+    if (journal_path) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long recovered = journal_open(journal_path, keep_segments);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (recovered < 0) {
+            io_backend_stop();
+            shutdown_system();
+            return EXIT_FAILURE;
+        }
+        printf("Recovered %ld journal records from %s in %.3f ms (%s).\n",
+               recovered, journal_path, elapsed_seconds(&start, &end) * 1e3, io_backend_name());
+    }
+    /* With --journal the capture is applied on top of the recovered state and journaled as it goes. */
+    if (replay_path) {
+        int rc = replay_capture(replay_path);
+        journal_close();
+        io_backend_stop();
+        shutdown_system();
+        return rc;
+    }
+    if (backup_dir) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long long no = run_backup(backup_dir);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (no > 0)
+            printf("Backup %lld written to %s in %.3f ms: %lu segments copied, %lu unchanged.\n", no, backup_dir,
+                   elapsed_seconds(&start, &end) * 1e3, backups.written_segments, backups.skipped_segments);
+        journal_close();
+        io_backend_stop();
+        shutdown_system();
+        return no > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (export_path) {
+        long exported = export_transactions_csv(export_path);
+        if (exported >= 0) printf("Exported %ld transactions to %s.\n", exported, export_path);
+        journal_close();
+        io_backend_stop();
+        shutdown_system();
+        return exported >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (heatmap_path) {
+        long exported = export_heatmap_csv(heatmap_path);
+        if (exported >= 0) printf("Exported %ld pump-minutes to %s.\n", exported, heatmap_path);
+        journal_close();
+        io_backend_stop();
+        shutdown_system();
+        return exported >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (query_text) {
+        int rc = 0;
+        if (strcmp(query_text, "-") == 0) {
+            char line[512];
+            while (fgets(line, sizeof(line), stdin)) {
+                line[strcspn(line, "\r\n")] = '\0';
+                if (line[0] == '\0') continue;
+                if (run_query(line) != 0) rc = -1;
+                fflush(stdout);
+            }
+        } else {
+            rc = run_query(query_text);
+        }
+        journal_close();
+        io_backend_stop();
+        shutdown_system();
+        return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (settle_dir) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int rc = run_settlement(settle_dir);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        print_settlement_position();
+        printf("Settlement pass over %zu transactions took %.3f ms.\n", tx_count, elapsed_seconds(&start, &end) * 1e3);
+        settlement_release();
+        journal_close();
+        io_backend_stop();
+        shutdown_system();
+        return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    /* A capture holds only initial stocks and config, so replay could not rebuild a restored store. */
+    if (record_path && (archive_path || restore_dir || journal_ctl.restored)) {
+        fprintf(stderr, "--record needs an empty station; state loaded from an archive, backup or journal cannot be replayed.\n");
+        journal_close();
+        io_backend_stop();
+        shutdown_system();
+        return EXIT_FAILURE;
+    }
+    if (identity_key_load() != 0) {
+        journal_close();
+        io_backend_stop();
+        shutdown_system();
+        return EXIT_FAILURE;
+    }
+    if (record_path && capture_open(record_path) != 0) {
+        fprintf(stderr, "Cannot open capture file %s.\n", record_path);
+        journal_close();
+        io_backend_stop();
+        shutdown_system();
+        return EXIT_FAILURE;
+    }
+    rollup_flush();             /* days the archive load or recovery pushed out of live[] */
+    standing_load();
+    config_watch_signals();
+    if (timers_start() == 0) schedule_start();
+    receipt_spooler_start(receipt_sink, receipt_path);
+    admission_start();
+    if (ereceipt_command) ereceipt_start(ereceipt_command);
+    if (payment_sim_spec) {
+        PaymentProcessor processor;
+        if (sim_processor_start(payment_sim_spec, &processor) == 0) payment_pipeline_start(processor);
+        else fprintf(stderr, "Failed to start simulated payment processor.\n");
+    }
 
     int choice;
     while (1) {
+        notices_flush(stdout);
         show_main_menu();
         if (scanf("%d", &choice) != 1) {
             clear_input_buffer();
@@ -545,34 +9806,113 @@ int main(void) {
                 change_pump_status();
                 break;
             case 4:
+                pthread_mutex_lock(&station_lock);
                 list_transactions();
+                pthread_mutex_unlock(&station_lock);
                 break;
             case 5:
-                generate_daily_report();
+                pthread_mutex_lock(&station_lock);
+                generate_daily_report(stdout);
+                pthread_mutex_unlock(&station_lock);
                 break;
             case 6:
-                show_pump_performance();
+                pthread_mutex_lock(&station_lock);
+                show_pump_performance(stdout);
+                pthread_mutex_unlock(&station_lock);
                 break;
             case 7:
-                show_fuel_summary();
+                pthread_mutex_lock(&station_lock);
+                show_fuel_summary(stdout);
+                pthread_mutex_unlock(&station_lock);
                 break;
             case 8:
-                show_hour_wise_analysis();
+                pthread_mutex_lock(&station_lock);
+                show_hour_wise_analysis(stdout);
+                pthread_mutex_unlock(&station_lock);
                 break;
             case 9:
-                show_payment_breakdown();
+                pthread_mutex_lock(&station_lock);
+                show_payment_breakdown(stdout);
+                pthread_mutex_unlock(&station_lock);
                 break;
             case 10:
                 print_sample_receipt_format();
                 break;
             case 11:
-                print_system_architecture();
+                show_memory_statistics();
                 break;
             case 12:
-                print_dynamic_allocation_advantages();
+                show_store_growth();
+                break;
+            case 13:
+                show_latency_histograms();
+                break;
+            case 14:
+                dump_event_trace();
+                break;
+            case 15:
+                show_ereceipt_status();
+                break;
+            case 16:
+                show_pending_authorizations();
+                break;
+            case 17:
+                settle_payments_menu();
+                break;
+            case 18:
+                reconcile_settlement_menu();
+                break;
+            case 19:
+                toggle_payment_link();
+                break;
+            case 20:
+                show_admission_metrics();
+                break;
+            case 21:
+                export_transactions_menu();
+                break;
+            case 22:
+                checkpoint_menu();
+                break;
+            case 23:
+                backup_menu();
+                break;
+            case 24:
+                config_reload(config_file, 0);
+                break;
+            case 25:
+                schedule_menu();
+                break;
+            case 26:
+                run_dashboard();
+                break;
+            case 27:
+                show_minute_heatmap();
+                break;
+            case 28:
+                show_day_comparison();
+                break;
+            case 29:
+                show_unique_counts();
+                break;
+            case 30:
+                standing_queries_menu();
+                break;
+            case 31:
+                query_console();
                 break;
             case 0:
                 printf("Exiting... freeing memory and shutting down.\n");
+                payment_pipeline_stop();
+                admission_stop();
+                receipt_spooler_stop();
+                ereceipt_stop();
+                timers_stop();
+                if (!journal || checkpoint_now() != 0) rollup_flush();
+                journal_close();
+                io_backend_stop();
+                capture_close();
+                settlement_release();
                 shutdown_system();
                 return 0;
             default:
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Builds ppms from this tree and replays every capture in tests/ against it,
+# then checks that state rebuilt from a journal, a checkpoint or a backup
+# reproduces the capture's digest. Exits non-zero if the build or any check fails.
+here=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+${CC:-cc} -std=gnu11 -O2 -pthread -o "$work/ppms" "$here/../ppms.c" || exit 1
+cd "$work" || exit 1
+
+failed=0
+# check LABEL COMMAND...: runs COMMAND and reports it, showing its output if it fails.
+check() {
+    label=$1
+    shift
+    if "$@" > out.txt 2>&1; then
+        echo "PASS $label"
+    else
+        echo "FAIL $label"
+        cat out.txt
+        failed=1
+    fi
+}
+
+for cap in "$here"/*.cap; do
+    name=$(basename "$cap" .cap)
+    check "$name: replay" ./ppms --replay "$cap"
+
+    # A capture holding only the digest checks whatever state startup recovered.
+    printf 'PPMSREC 1\nD %s\n' "$(sed -n 's/^D //p' "$cap")" > expect.cap
+    TZ=$(sed -n 's/^Z //p' "$cap")
+    export TZ
+    printf '22\n0\n0\n0\n' > checkpoint.menu
+
+    rm -rf j && mkdir j
+    check "$name: replay into a journal" ./ppms --journal j/s.jnl --replay "$cap"
+    check "$name: recover from the journal" ./ppms --journal j/s.jnl --replay expect.cap
+    check "$name: checkpoint" ./ppms --journal j/s.jnl < checkpoint.menu
+    check "$name: recover from the checkpoint" ./ppms --journal j/s.jnl --replay expect.cap
+
+    # Failed checkpoints must leave every segment they could not cover where recovery finds it.
+    rm -rf j && mkdir j j/s.jnl.ckpt.tmp
+    check "$name: replay into a journal" ./ppms --journal j/s.jnl --replay "$cap"
+    ./ppms --journal j/s.jnl < checkpoint.menu > out.txt 2>&1
+    check "$name: recover after failed checkpoints" ./ppms --journal j/s.jnl --replay expect.cap
+    rmdir j/s.jnl.ckpt.tmp
+    check "$name: checkpoint after failures" ./ppms --journal j/s.jnl < checkpoint.menu
+    check "$name: recover from that checkpoint" ./ppms --journal j/s.jnl --replay expect.cap
+
+    # The second backup in one session copies no segments, so restore has to walk back to the first.
+    rm -rf bk r && mkdir r
+    printf '23\nbk\n23\nbk\n0\n0\n0\n' > backup.menu
+    check "$name: full and incremental backup" ./ppms --journal j/s.jnl < backup.menu
+    check "$name: restore the backup chain" ./ppms --restore-backup bk --journal r/s.jnl --replay expect.cap
+    unset TZ
+done
+exit $failed